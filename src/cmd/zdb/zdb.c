@@ -1597,6 +1597,17 @@ zdb_blkptr_cb(traverse_blk_cache_t *bc, spa_t *spa, void *arg)
 	return (0);
 }
 
+static void
+zdb_destroyed_cb(spa_t *spa, blkptr_t *bp, void *arg)
+{
+	if (dump_opt['b'] >= 4) {
+		char blkbuf[BP_SPRINTF_LEN];
+		sprintf_blkptr(blkbuf, BP_SPRINTF_LEN, bp);
+		(void) printf("[%s] %s\n", "destroyed", blkbuf);
+	}
+	zdb_count_block(spa, arg, bp, DMU_OT_DEFERRED);
+}
+
 static int
 dump_block_stats(spa_t *spa)
 {
@@ -1657,6 +1668,11 @@ dump_block_stats(spa_t *spa)
 		bplist_close(bpl);
 	}
 
+	/*
+	 * Likewise for what destroyed datasets have left to be freed.
+	 */
+	spa_destroy_walk(spa, zdb_destroyed_cb, &zcb);
+
 	/*
 	 * Now traverse the pool.  If we're reading all data to verify
 	 * checksums, do a scrubbing read so that we validate all copies.
@@ -311,6 +311,32 @@ zfs_sort(const void *larg, const void *rarg, void *data)
 	return (zfs_compare(larg, rarg, NULL));
 }
 
+/*
+ * Ask the iterators to fetch only the properties that are displayed or sorted
+ * on, instead of all of them, along with each dataset.
+ */
+static void
+set_iter_proplist(zprop_list_t *proplist, zfs_sort_column_t *sortcol)
+{
+	zprop_list_t *pl = proplist;
+	zprop_list_t *next;
+
+	for (; sortcol != NULL; sortcol = sortcol->sc_next) {
+		next = safe_malloc(sizeof (zprop_list_t));
+		next->pl_prop = sortcol->sc_prop;
+		next->pl_user_prop = sortcol->sc_user_prop;
+		next->pl_next = pl;
+		pl = next;
+	}
+
+	(void) zfs_set_iter_proplist(g_zfs, pl);
+
+	for (; pl != proplist; pl = next) {
+		next = pl->pl_next;
+		free(pl);
+	}
+}
+
 int
 zfs_for_each(int argc, char **argv, boolean_t recurse, zfs_type_t types,
     zfs_sort_column_t *sortcol, zprop_list_t **proplist, zfs_iter_f callback,
@@ -340,6 +366,9 @@ zfs_for_each(int argc, char **argv, boolean_t recurse, zfs_type_t types,
 		exit(1);
 	}
 
+	if (proplist != NULL)
+		set_iter_proplist(*proplist, sortcol);
+
 	if (argc == 0) {
 		/*
 		 * If given no arguments, iterate over all datasets.
@@ -404,5 +433,8 @@ zfs_for_each(int argc, char **argv, boolean_t recurse, zfs_type_t types,
 	uu_avl_destroy(cb.cb_avl);
 	uu_avl_pool_destroy(avl_pool);
 
+	if (proplist != NULL)
+		(void) zfs_set_iter_proplist(g_zfs, NULL);
+
 	return (ret);
 }
@@ -3305,6 +3305,13 @@ share_mount(int op, int argc, char **argv)
 
 		qsort(dslist, count, sizeof (void *), dataset_cmp);
 
+		/*
+		 * Filesystems whose mountpoints don't overlap are mounted in
+		 * parallel; zfs_mount() only queues the mount until then.
+		 */
+		if (op == OP_MOUNT)
+			zfs_mount_batch_start(g_zfs);
+
 		for (i = 0; i < count; i++) {
 			if (verbose)
 				report_mount_progress(i, count);
@@ -3315,6 +3322,9 @@ share_mount(int op, int argc, char **argv)
 			zfs_close(dslist[i]);
 		}
 
+		if (op == OP_MOUNT && zfs_mount_batch_end(g_zfs) != 0)
+			ret = 1;
+
 		free(dslist);
 	} else if (argc == 0) {
 		struct mnttab entry;
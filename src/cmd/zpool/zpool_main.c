@@ -79,6 +79,7 @@ static int zpool_do_export(int, char **);
 static int zpool_do_upgrade(int, char **);
 
 static int zpool_do_history(int, char **);
+static int zpool_do_latency(int, char **);
 
 static int zpool_do_get(int, char **);
 static int zpool_do_set(int, char **);
@@ -110,6 +111,7 @@ typedef enum {
 	HELP_HISTORY,
 	HELP_IMPORT,
 	HELP_IOSTAT,
+	HELP_LATENCY,
 	HELP_LIST,
 	HELP_OFFLINE,
 	HELP_ONLINE,
@@ -164,6 +166,7 @@ static zpool_command_t command_table[] = {
 	{ "upgrade",	zpool_do_upgrade,	HELP_UPGRADE		},
 	{ NULL },
 	{ "history",	zpool_do_history,	HELP_HISTORY		},
+	{ "latency",	zpool_do_latency,	HELP_LATENCY		},
 	{ "get",	zpool_do_get,		HELP_GET		},
 	{ "set",	zpool_do_set,		HELP_SET		},
 };
@@ -204,6 +207,8 @@ get_usage(zpool_help_t idx) {
 	case HELP_IOSTAT:
 		return (gettext("\tiostat [-v] [pool] ... [interval "
 		    "[count]]\n"));
+	case HELP_LATENCY:
+		return (gettext("\tlatency [-r]\n"));
 	case HELP_LIST:
 		return (gettext("\tlist [-H] [-o property[,...]] "
 		    "[pool] ...\n"));
@@ -2582,14 +2587,16 @@ typedef struct status_cbdata {
  * Print out detailed scrub status.
  */
 void
-print_scrub_status(nvlist_t *nvroot)
+print_scrub_status(zpool_handle_t *zhp, nvlist_t *nvroot)
 {
 	vdev_stat_t *vs;
 	uint_t vsc;
 	time_t start, end, now;
 	double fraction_done;
 	uint64_t examined, total, minutes_left, minutes_taken;
+	uint64_t rate, latency;
 	char *scrub_type;
+	char buf[32];
 
 	verify(nvlist_lookup_uint64_array(nvroot, ZPOOL_CONFIG_STATS,
 	    (uint64_t **)&vs, &vsc) == 0);
@@ -2638,6 +2645,19 @@ print_scrub_status(nvlist_t *nvroot)
 	    scrub_type, (u_longlong_t)(minutes_taken / 60),
 	    (uint_t)(minutes_taken % 60), 100 * fraction_done,
 	    (u_longlong_t)(minutes_left / 60), (uint_t)(minutes_left % 60));
+
+	rate = zpool_get_prop_int(zhp, vs->vs_scrub_type ==
+	    POOL_SCRUB_RESILVER ? ZPOOL_PROP_RESILVERRATE :
+	    ZPOOL_PROP_SCRUBRATE, NULL);
+	latency = zpool_get_prop_int(zhp, ZPOOL_PROP_SCRUBLATENCY, NULL);
+
+	if (rate != 0) {
+		zfs_nicenum(rate, buf, sizeof (buf));
+		(void) printf(gettext("        limited to %s/s\n"), buf);
+	}
+	if (latency != 0)
+		(void) printf(gettext("        backing off while I/O latency "
+		    "exceeds %llums\n"), (u_longlong_t)latency);
 }
 
 typedef struct spare_cbdata {
@@ -3083,7 +3103,7 @@ status_callback(zpool_handle_t *zhp, void *data)
 
 
 		(void) printf(gettext(" scrub: "));
-		print_scrub_status(nvroot);
+		print_scrub_status(zhp, nvroot);
 
 		namewidth = max_width(zhp, nvroot, 0, 0);
 		if (namewidth < 10)
@@ -3627,6 +3647,126 @@ zpool_do_history(int argc, char **argv)
 	return (ret);
 }
 
+/*
+ * Format a latency in nanoseconds with the largest unit it has at least
+ * one of.
+ */
+static void
+latency_nicenum(uint64_t ns, char *buf, size_t buflen)
+{
+	if (ns < 1000)
+		(void) snprintf(buf, buflen, "%lluns", (u_longlong_t)ns);
+	else if (ns < 1000000)
+		(void) snprintf(buf, buflen, "%lluus", (u_longlong_t)ns / 1000);
+	else if (ns < 1000000000)
+		(void) snprintf(buf, buflen, "%llums",
+		    (u_longlong_t)ns / 1000000);
+	else
+		(void) snprintf(buf, buflen, "%llus",
+		    (u_longlong_t)ns / 1000000000);
+}
+
+/*
+ * Print the latency histogram of each operation of a class, from its
+ * fastest to its slowest bucket, the way DTrace prints quantize().
+ */
+static void
+print_latency_class(nvlist_t *nvl, const char *class)
+{
+	nvlist_t *ops;
+	nvpair_t *elem = NULL;
+
+	if (nvlist_lookup_nvlist(nvl, class, &ops) != 0)
+		return;
+
+	while ((elem = nvlist_next_nvpair(ops, elem)) != NULL) {
+		uint64_t *val;
+		uint_t nval;
+		uint64_t count, max = 0;
+		int b, first = -1, last = -1;
+		char buf[16];
+
+		verify(nvpair_value_uint64_array(elem, &val, &nval) == 0);
+		if (nval != ZFS_LATENCY_HIST + ZFS_LATENCY_BUCKETS)
+			continue;
+
+		count = val[ZFS_LATENCY_COUNT];
+		latency_nicenum(val[ZFS_LATENCY_TOTAL] / count, buf,
+		    sizeof (buf));
+		(void) printf(gettext("%s %s: %llu operations, average %s\n"),
+		    class, nvpair_name(elem), (u_longlong_t)count, buf);
+
+		for (b = 0; b < ZFS_LATENCY_BUCKETS; b++) {
+			if (val[ZFS_LATENCY_HIST + b] == 0)
+				continue;
+			if (first == -1)
+				first = b;
+			last = b;
+			max = MAX(max, val[ZFS_LATENCY_HIST + b]);
+		}
+
+		(void) printf("%16s  %s %s\n", gettext("value"),
+		    "------------- Distribution -------------",
+		    gettext("count"));
+		for (b = first; b <= last; b++) {
+			uint64_t n = val[ZFS_LATENCY_HIST + b];
+			int width = (n * 40 + max - 1) / max;
+
+			latency_nicenum(1ULL << b, buf, sizeof (buf));
+			(void) printf("%16s |%-40.*s %llu\n", buf, width,
+			    "@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@",
+			    (u_longlong_t)n);
+		}
+		(void) printf("\n");
+	}
+}
+
+/*
+ * zpool latency [-r]
+ *
+ *	-r	Reset the statistics after printing them.
+ *
+ * Displays histograms of the time the zfs-fuse daemon took to serve each
+ * kind of FUSE operation and ioctl, since it started or since the last
+ * reset.
+ */
+int
+zpool_do_latency(int argc, char **argv)
+{
+	boolean_t reset = B_FALSE;
+	nvlist_t *nvl;
+	int c;
+
+	/* check options */
+	while ((c = getopt(argc, argv, "r")) != -1) {
+		switch (c) {
+		case 'r':
+			reset = B_TRUE;
+			break;
+		case '?':
+			(void) fprintf(stderr, gettext("invalid option '%c'\n"),
+			    optopt);
+			usage(B_FALSE);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 0) {
+		(void) fprintf(stderr, gettext("too many arguments\n"));
+		usage(B_FALSE);
+	}
+
+	if (libzfs_latency_stats(g_zfs, reset, &nvl) != 0)
+		return (1);
+
+	print_latency_class(nvl, ZFS_LATENCY_FUSE);
+	print_latency_class(nvl, ZFS_LATENCY_IOCTL);
+
+	nvlist_free(nvl);
+	return (0);
+}
+
 static int
 get_callback(zpool_handle_t *zhp, void *data)
 {
@@ -246,6 +246,8 @@ static int ztest_dump_core = 1;
 static boolean_t ztest_exiting = B_FALSE;
 
 extern uint64_t metaslab_gang_bang;
+extern uint64_t zfs_free_max_blocks;
+extern uint64_t zfs_scrub_queue_max;
 extern uint16_t zio_zil_fail_shift;
 extern uint16_t zio_io_fail_shift;
 
@@ -445,6 +447,12 @@ process_options(int argc, char **argv)
 	/* Default value, fail every 32nd allocation */
 	zio_zil_fail_shift = 5;
 
+	/* Free destroyed datasets in small slices, so that they span txgs */
+	zfs_free_max_blocks = 1000;
+
+	/* Keep the scrub queue small, so that it fills up mid-traverse */
+	zfs_scrub_queue_max = 64 << 10;
+
 	while ((opt = getopt(argc, argv,
 	    "v:s:a:m:r:R:d:t:g:i:k:p:f:VET:P:z:w:h")) != EOF) {
 		value = 0;
@@ -2506,15 +2514,27 @@ ztest_dsl_prop_get_set(ztest_args_t *za)
 
 	dmu_objset_name(os, osname);
 
-	for (i = 0; i < 2; i++) {
+	for (i = 0; i < 6; i++) {
 		if (i == 0) {
 			prop = "checksum";
 			value = ztest_random_checksum();
 			inherit = (value == ZIO_CHECKSUM_INHERIT);
-		} else {
+		} else if (i == 1) {
 			prop = "compression";
 			value = ztest_random_compress();
 			inherit = (value == ZIO_COMPRESS_INHERIT);
+		} else if (i < 4) {
+			prop = (i == 2) ? "primarycache" : "secondarycache";
+			value = ztest_random(ZFS_CACHE_ALL + 2);
+			inherit = (value > ZFS_CACHE_ALL);
+		} else if (i == 4) {
+			prop = "sync";
+			value = ztest_random(ZFS_SYNC_DISABLED + 2);
+			inherit = (value > ZFS_SYNC_DISABLED);
+		} else {
+			prop = "logbias";
+			value = ztest_random(ZFS_LOGBIAS_THROUGHPUT + 2);
+			inherit = (value > ZFS_LOGBIAS_THROUGHPUT);
 		}
 
 		error = dsl_prop_set(osname, prop, sizeof (value),
@@ -2532,8 +2552,11 @@ ztest_dsl_prop_get_set(ztest_args_t *za)
 
 		if (i == 0)
 			valname = zio_checksum_table[value].ci_name;
-		else
+		else if (i == 1)
 			valname = zio_compress_table[value].ci_name;
+		else
+			VERIFY(zfs_prop_index_to_string(zfs_name_to_prop(prop),
+			    value, &valname) == 0);
 
 		if (zopt_verbose >= 6) {
 			(void) printf("%s %s = %s for '%s'\n",
@@ -2673,6 +2696,20 @@ void
 ztest_scrub(ztest_args_t *za)
 {
 	spa_t *spa = za->za_spa;
+	nvlist_t *props;
+
+	/*
+	 * Scrub either flat out or throttled, by rate and by latency.
+	 */
+	VERIFY(nvlist_alloc(&props, NV_UNIQUE_NAME, 0) == 0);
+	VERIFY(nvlist_add_uint64(props,
+	    zpool_prop_to_name(ZPOOL_PROP_SCRUBRATE),
+	    ztest_random(2) ? 0 : 1ULL << (20 + ztest_random(4))) == 0);
+	VERIFY(nvlist_add_uint64(props,
+	    zpool_prop_to_name(ZPOOL_PROP_SCRUBLATENCY),
+	    ztest_random(2) ? 0 : 1 + ztest_random(50)) == 0);
+	(void) spa_prop_set(spa, props);
+	nvlist_free(props);
 
 	mutex_enter(&spa_namespace_lock);
 	(void) spa_scrub(spa, POOL_SCRUB_EVERYTHING, B_FALSE);
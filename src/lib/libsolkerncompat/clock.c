@@ -27,8 +27,24 @@
 
 #include <sys/systm.h>
 #include <sys/poll.h>
+#include <time.h>
 
 void delay(clock_t ticks)
 {
 	poll(0, 0, ticks * (1000 / hz));
 }
+
+/*
+ * Sleep until the given gethrtime(), for delays finer than a clock tick.
+ */
+void zfs_sleep_until(hrtime_t wakeup)
+{
+	hrtime_t now;
+	struct timespec ts;
+
+	while ((now = gethrtime()) < wakeup) {
+		ts.tv_sec = (wakeup - now) / NANOSEC;
+		ts.tv_nsec = (wakeup - now) % NANOSEC;
+		(void) nanosleep(&ts, NULL);
+	}
+}
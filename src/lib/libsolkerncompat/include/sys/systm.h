@@ -45,6 +45,7 @@ extern uint64_t physmem;
 extern struct vnode *rootdir;	/* pointer to vnode of root directory */
 
 extern void delay(clock_t ticks);
+extern void zfs_sleep_until(hrtime_t wakeup);
 
 static inline int fuword8(const void *from, uint8_t *to)
 {
@@ -172,6 +172,11 @@ extern libzfs_handle_t *zfs_get_handle(zfs_handle_t *);
 
 extern void libzfs_print_on_error(libzfs_handle_t *, boolean_t);
 
+/*
+ * zfs-fuse: latency histograms of the operations served by the daemon
+ */
+extern int libzfs_latency_stats(libzfs_handle_t *, boolean_t, nvlist_t **);
+
 extern int libzfs_errno(libzfs_handle_t *);
 extern const char *libzfs_error_action(libzfs_handle_t *);
 extern const char *libzfs_error_description(libzfs_handle_t *);
@@ -408,6 +413,7 @@ extern int zfs_iter_children(zfs_handle_t *, zfs_iter_f, void *);
 extern int zfs_iter_dependents(zfs_handle_t *, boolean_t, zfs_iter_f, void *);
 extern int zfs_iter_filesystems(zfs_handle_t *, zfs_iter_f, void *);
 extern int zfs_iter_snapshots(zfs_handle_t *, zfs_iter_f, void *);
+extern int zfs_set_iter_proplist(libzfs_handle_t *, zprop_list_t *);
 
 /*
  * Functions to create and destroy datasets.
@@ -476,6 +482,8 @@ extern void zfs_deleg_permissions(void);
 extern boolean_t is_mounted(libzfs_handle_t *, const char *special, char **);
 extern boolean_t zfs_is_mounted(zfs_handle_t *, char **);
 extern int zfs_mount(zfs_handle_t *, const char *, int);
+extern void zfs_mount_batch_start(libzfs_handle_t *);
+extern int zfs_mount_batch_end(libzfs_handle_t *);
 extern int zfs_unmount(zfs_handle_t *, const char *, int);
 extern int zfs_unmountall(zfs_handle_t *, int);
 
@@ -64,6 +64,9 @@ struct libzfs_handle {
 	int libzfs_printerr;
 	void *libzfs_sharehdl; /* libshare handle */
 	uint_t libzfs_shareflags;
+	nvlist_t *libzfs_iter_props; /* properties fetched by the iterators */
+	uint64_t libzfs_iter_native; /* ... as a mask of native properties */
+	struct mount_batch *libzfs_mount_batch; /* see zfs_mount_batch_start() */
 };
 #define	ZFSSHARE_MISS	0x01	/* Didn't find entry in cache */
 
@@ -75,6 +78,8 @@ struct zfs_handle {
 	dmu_objset_stats_t zfs_dmustats;
 	nvlist_t *zfs_props;
 	nvlist_t *zfs_user_props;
+	boolean_t zfs_props_partial; /* only libzfs_iter_props were fetched */
+	uint64_t zfs_props_native; /* ... their native properties */
 	boolean_t zfs_mntcheck;
 	char *zfs_mntopts;
 	char zfs_root[MAXPATHLEN];
@@ -182,6 +187,7 @@ extern int zfs_unshare_proto(zfs_handle_t *zhp,
 
 /* ZFSFUSE */
 int zfsfuse_mount(libzfs_handle_t *hdl, const char *spec, const char *dir, int mflag, char *fstype, char *dataptr, int datalen, char *optptr, int optlen);
+int zfsfuse_mount_req(int fd, const char *spec, const char *dir, int mflag, char *optptr, int optlen);
 
 #ifdef	__cplusplus
 }
@@ -304,6 +304,7 @@ get_stats(zfs_handle_t *zhp)
 
 	zhp->zfs_props = allprops;
 	zhp->zfs_user_props = userprops;
+	zhp->zfs_props_partial = B_FALSE;
 
 	return (0);
 }
@@ -317,6 +318,29 @@ zfs_refresh_properties(zfs_handle_t *zhp)
 	(void) get_stats(zhp);
 }
 
+/*
+ * Determine the high-level type of a dataset from its statistics.
+ */
+static void
+set_dataset_type(zfs_handle_t *zhp)
+{
+	if (zhp->zfs_dmustats.dds_type == DMU_OST_ZVOL)
+		zhp->zfs_head_type = ZFS_TYPE_VOLUME;
+	else if (zhp->zfs_dmustats.dds_type == DMU_OST_ZFS)
+		zhp->zfs_head_type = ZFS_TYPE_FILESYSTEM;
+	else
+		abort();
+
+	if (zhp->zfs_dmustats.dds_is_snapshot)
+		zhp->zfs_type = ZFS_TYPE_SNAPSHOT;
+	else if (zhp->zfs_dmustats.dds_type == DMU_OST_ZVOL)
+		zhp->zfs_type = ZFS_TYPE_VOLUME;
+	else if (zhp->zfs_dmustats.dds_type == DMU_OST_ZFS)
+		zhp->zfs_type = ZFS_TYPE_FILESYSTEM;
+	else
+		abort();	/* we should never see any other types */
+}
+
 /*
  * Makes a handle from the given dataset name.  Used by zfs_open() and
  * zfs_iter_* to create child handles on the fly.
@@ -394,26 +418,63 @@ top:
 	 * We've managed to open the dataset and gather statistics.  Determine
 	 * the high-level type.
 	 */
-	if (zhp->zfs_dmustats.dds_type == DMU_OST_ZVOL)
-		zhp->zfs_head_type = ZFS_TYPE_VOLUME;
-	else if (zhp->zfs_dmustats.dds_type == DMU_OST_ZFS)
-		zhp->zfs_head_type = ZFS_TYPE_FILESYSTEM;
-	else
-		abort();
-
-	if (zhp->zfs_dmustats.dds_is_snapshot)
-		zhp->zfs_type = ZFS_TYPE_SNAPSHOT;
-	else if (zhp->zfs_dmustats.dds_type == DMU_OST_ZVOL)
-		zhp->zfs_type = ZFS_TYPE_VOLUME;
-	else if (zhp->zfs_dmustats.dds_type == DMU_OST_ZFS)
-		zhp->zfs_type = ZFS_TYPE_FILESYSTEM;
-	else
-		abort();	/* we should never see any other types */
+	set_dataset_type(zhp);
 
 	zhp->zfs_hdl->libzfs_log_str = logstr;
 	return (zhp);
 }
 
+/*
+ * Makes a handle from one entry of a ZFS_IOC_DATASET_LIST_BULK reply.  If only
+ * some of the properties were asked for, the handle is marked partial and
+ * fetches the rest the first time one of them is needed.  Inconsistent
+ * datasets are handed to make_dataset_handle() to be cleaned up.
+ */
+static zfs_handle_t *
+make_dataset_handle_bulk(libzfs_handle_t *hdl, const char *path,
+    nvlist_t *entry, const char *altroot)
+{
+	zfs_handle_t *zhp;
+	nvlist_t *props;
+	uchar_t *stats;
+	uint_t len;
+
+	if (nvlist_lookup_byte_array(entry, ZFS_LIST_BULK_STATS, &stats,
+	    &len) != 0 || len != sizeof (dmu_objset_stats_t) ||
+	    nvlist_lookup_nvlist(entry, ZFS_LIST_BULK_PROPS, &props) != 0)
+		return (make_dataset_handle(hdl, path));
+
+	if (((dmu_objset_stats_t *)stats)->dds_inconsistent)
+		return (make_dataset_handle(hdl, path));
+
+	if ((zhp = calloc(sizeof (zfs_handle_t), 1)) == NULL)
+		return (NULL);
+
+	zhp->zfs_hdl = hdl;
+	(void) strlcpy(zhp->zfs_name, path, sizeof (zhp->zfs_name));
+	(void) strlcpy(zhp->zfs_root, altroot, sizeof (zhp->zfs_root));
+	bcopy(stats, &zhp->zfs_dmustats, sizeof (zhp->zfs_dmustats));
+
+	if (nvlist_dup(props, &zhp->zfs_props, 0) != 0) {
+		free(zhp);
+		(void) no_memory(hdl);
+		return (NULL);
+	}
+	if ((zhp->zfs_user_props = process_user_props(zhp,
+	    zhp->zfs_props)) == NULL) {
+		nvlist_free(zhp->zfs_props);
+		free(zhp);
+		return (NULL);
+	}
+	if (hdl->libzfs_iter_props != NULL) {
+		zhp->zfs_props_partial = B_TRUE;
+		zhp->zfs_props_native = hdl->libzfs_iter_native;
+	}
+
+	set_dataset_type(zhp);
+	return (zhp);
+}
+
 /*
  * Opens the given snapshot, filesystem, or volume.   The 'types'
  * argument is a mask of acceptable types.  The function will print an
@@ -1958,6 +2019,19 @@ error:
 	return (ret);
 }
 
+/*
+ * Handles made by the iterators may hold only the properties that were asked
+ * for with zfs_set_iter_proplist().  Fetch all of them before looking up any
+ * other property.
+ */
+static void
+getprop_complete(zfs_handle_t *zhp, zfs_prop_t prop)
+{
+	if (zhp->zfs_props_partial &&
+	    !(zhp->zfs_props_native & (1ULL << prop)))
+		(void) get_stats(zhp);
+}
+
 /*
  * True DSL properties are stored in an nvlist.  The following two functions
  * extract them appropriately.
@@ -1968,6 +2042,7 @@ getprop_uint64(zfs_handle_t *zhp, zfs_prop_t prop, char **source)
 	nvlist_t *nv;
 	uint64_t value;
 
+	getprop_complete(zhp, prop);
 	*source = NULL;
 	if (nvlist_lookup_nvlist(zhp->zfs_props,
 	    zfs_prop_to_name(prop), &nv) == 0) {
@@ -1987,6 +2062,7 @@ getprop_string(zfs_handle_t *zhp, zfs_prop_t prop, char **source)
 	nvlist_t *nv;
 	char *value;
 
+	getprop_complete(zhp, prop);
 	*source = NULL;
 	if (nvlist_lookup_nvlist(zhp->zfs_props,
 	    zfs_prop_to_name(prop), &nv) == 0) {
@@ -2494,20 +2570,26 @@ zfs_get_type(const zfs_handle_t *zhp)
 }
 
 /*
- * Iterate over all child filesystems
+ * Initial size of the buffer for ZFS_IOC_DATASET_LIST_BULK replies.  It is
+ * expanded whenever a single dataset does not fit.
  */
-int
-zfs_iter_filesystems(zfs_handle_t *zhp, zfs_iter_f func, void *data)
+#define	ZFS_LIST_BULK_BUFSIZE	(256 * 1024)
+
+/*
+ * Iterate over the child filesystems or the snapshots of a dataset one at a
+ * time, for daemons that don't have ZFS_IOC_DATASET_LIST_BULK.
+ */
+static int
+iter_dataset_next(zfs_handle_t *zhp, int kind, zfs_iter_f func, void *data)
 {
 	zfs_cmd_t zc = { 0 };
 	zfs_handle_t *nzhp;
+	int ioc = (kind == ZFS_LIST_BULK_SNAPSHOTS ?
+	    ZFS_IOC_SNAPSHOT_LIST_NEXT : ZFS_IOC_DATASET_LIST_NEXT);
 	int ret;
 
-	if (zhp->zfs_type != ZFS_TYPE_FILESYSTEM)
-		return (0);
-
 	for ((void) strlcpy(zc.zc_name, zhp->zfs_name, sizeof (zc.zc_name));
-	    ioctl(zhp->zfs_hdl->libzfs_fd, ZFS_IOC_DATASET_LIST_NEXT, &zc) == 0;
+	    ioctl(zhp->zfs_hdl->libzfs_fd, ioc, &zc) == 0;
 	    (void) strlcpy(zc.zc_name, zhp->zfs_name, sizeof (zc.zc_name))) {
 		/*
 		 * Ignore private dataset names.
@@ -2540,40 +2622,170 @@ zfs_iter_filesystems(zfs_handle_t *zhp, zfs_iter_f func, void *data)
 }
 
 /*
- * Iterate over all snapshots
+ * Iterate over the child filesystems or the snapshots of a dataset, fetching
+ * the statistics and properties of many of them with each ioctl.
  */
-int
-zfs_iter_snapshots(zfs_handle_t *zhp, zfs_iter_f func, void *data)
+static int
+iter_dataset_bulk(zfs_handle_t *zhp, int kind, zfs_iter_f func, void *data)
 {
+	libzfs_handle_t *hdl = zhp->zfs_hdl;
 	zfs_cmd_t zc = { 0 };
 	zfs_handle_t *nzhp;
-	int ret;
+	nvlist_t *list, *entry;
+	nvpair_t *elem;
+	size_t bufsize = ZFS_LIST_BULK_BUFSIZE;
+	boolean_t first = B_TRUE;
+	int ret = 0;
+
+	if (zcmd_alloc_dst_nvlist(hdl, &zc, bufsize) != 0)
+		return (-1);
+	if (hdl->libzfs_iter_props != NULL &&
+	    zcmd_write_src_nvlist(hdl, &zc, hdl->libzfs_iter_props) != 0) {
+		zcmd_free_nvlists(&zc);
+		return (-1);
+	}
+	zc.zc_objset_type = kind;
+
+	for (;;) {
+		(void) strlcpy(zc.zc_name, zhp->zfs_name, sizeof (zc.zc_name));
+		zc.zc_nvlist_dst_size = bufsize;
+		if (ioctl(hdl->libzfs_fd, ZFS_IOC_DATASET_LIST_BULK,
+		    &zc) != 0) {
+			if (errno == ENOMEM) {
+				bufsize = zc.zc_nvlist_dst_size;
+				if (zcmd_expand_dst_nvlist(hdl, &zc) != 0) {
+					ret = -1;
+					break;
+				}
+				continue;
+			}
+
+			/*
+			 * A daemon that doesn't know the ioctl rejects it
+			 * with EINVAL.
+			 */
+			if (errno == EINVAL && first) {
+				zcmd_free_nvlists(&zc);
+				return (iter_dataset_next(zhp, kind, func,
+				    data));
+			}
 
+			/*
+			 * An errno value of ESRCH indicates normal
+			 * completion.  If ENOENT is returned, then the
+			 * underlying dataset has been removed since we
+			 * obtained the handle.
+			 */
+			if (errno != ESRCH && errno != ENOENT)
+				ret = zfs_standard_error(hdl, errno,
+				    dgettext(TEXT_DOMAIN,
+				    "cannot iterate filesystems"));
+			break;
+		}
+		first = B_FALSE;
+
+		if (zcmd_read_dst_nvlist(hdl, &zc, &list) != 0) {
+			ret = -1;
+			break;
+		}
+
+		for (elem = nvlist_next_nvpair(list, NULL); elem != NULL;
+		    elem = nvlist_next_nvpair(list, elem)) {
+			/*
+			 * Ignore private dataset names.
+			 */
+			if (dataset_name_hidden(nvpair_name(elem)))
+				continue;
+
+			/*
+			 * Silently ignore errors, as the only plausible
+			 * explanation is that the pool has since been removed.
+			 */
+			verify(nvpair_value_nvlist(elem, &entry) == 0);
+			if ((nzhp = make_dataset_handle_bulk(hdl,
+			    nvpair_name(elem), entry, zc.zc_value)) == NULL)
+				continue;
+
+			if ((ret = func(nzhp, data)) != 0)
+				break;
+		}
+		nvlist_free(list);
+		if (ret != 0)
+			break;
+	}
+
+	zcmd_free_nvlists(&zc);
+	return (ret);
+}
+
+/*
+ * Iterate over all child filesystems
+ */
+int
+zfs_iter_filesystems(zfs_handle_t *zhp, zfs_iter_f func, void *data)
+{
+	if (zhp->zfs_type != ZFS_TYPE_FILESYSTEM)
+		return (0);
+
+	return (iter_dataset_bulk(zhp, ZFS_LIST_BULK_FILESYSTEMS, func, data));
+}
+
+/*
+ * Iterate over all snapshots
+ */
+int
+zfs_iter_snapshots(zfs_handle_t *zhp, zfs_iter_f func, void *data)
+{
 	if (zhp->zfs_type == ZFS_TYPE_SNAPSHOT)
 		return (0);
 
-	for ((void) strlcpy(zc.zc_name, zhp->zfs_name, sizeof (zc.zc_name));
-	    ioctl(zhp->zfs_hdl->libzfs_fd, ZFS_IOC_SNAPSHOT_LIST_NEXT,
-	    &zc) == 0;
-	    (void) strlcpy(zc.zc_name, zhp->zfs_name, sizeof (zc.zc_name))) {
+	return (iter_dataset_bulk(zhp, ZFS_LIST_BULK_SNAPSHOTS, func, data));
+}
 
-		if ((nzhp = make_dataset_handle(zhp->zfs_hdl,
-		    zc.zc_name)) == NULL)
-			continue;
+/*
+ * Restrict the properties that zfs_iter_filesystems() and zfs_iter_snapshots()
+ * fetch along with each dataset to those in 'pl'.  Other native properties
+ * are fetched when first asked for, but zfs_get_user_props() only returns the
+ * user properties in 'pl'.  A NULL list, or one covering all properties,
+ * fetches everything again.
+ */
+int
+zfs_set_iter_proplist(libzfs_handle_t *hdl, zprop_list_t *pl)
+{
+	zprop_list_t *entry;
+	nvlist_t *nvl;
+	uint64_t native = 0;
+	const char *name;
 
-		if ((ret = func(nzhp, data)) != 0)
-			return (ret);
+	nvlist_free(hdl->libzfs_iter_props);
+	hdl->libzfs_iter_props = NULL;
+	hdl->libzfs_iter_native = 0;
+
+	if (pl == NULL)
+		return (0);
+	for (entry = pl; entry != NULL; entry = entry->pl_next) {
+		if (entry->pl_all)
+			return (0);
 	}
 
-	/*
-	 * An errno value of ESRCH indicates normal completion.  If ENOENT is
-	 * returned, then the underlying dataset has been removed since we
-	 * obtained the handle.  Silently ignore this case, and return success.
-	 */
-	if (errno != ESRCH && errno != ENOENT)
-		return (zfs_standard_error(zhp->zfs_hdl, errno,
-		    dgettext(TEXT_DOMAIN, "cannot iterate filesystems")));
+	if (nvlist_alloc(&nvl, NV_UNIQUE_NAME, 0) != 0)
+		return (no_memory(hdl));
 
+	for (entry = pl; entry != NULL; entry = entry->pl_next) {
+		if (entry->pl_prop != ZPROP_INVAL) {
+			name = zfs_prop_to_name(entry->pl_prop);
+			native |= 1ULL << entry->pl_prop;
+		} else {
+			name = entry->pl_user_prop;
+		}
+		if (nvlist_add_boolean(nvl, name) != 0) {
+			nvlist_free(nvl);
+			return (no_memory(hdl));
+		}
+	}
+
+	hdl->libzfs_iter_props = nvl;
+	hdl->libzfs_iter_native = native;
 	return (0);
 }
 
@@ -3959,8 +4171,11 @@ zvol_create_link_common(libzfs_handle_t *hdl, const char *dataset, int ifexists)
 	return (0);
 #endif
 
-	/* zfs-fuse TODO: implement ZVOLs */
-	abort();
+	/*
+	 * zfs-fuse: volumes have no device links, the daemon exports them
+	 * through its NBD server under their dataset names.
+	 */
+	return (0);
 }
 
 /*
@@ -45,6 +45,8 @@
 #include <dirent.h>
 #include <errno.h>
 #include <libintl.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -720,14 +722,15 @@ label_offset(uint64_t size, int l)
 
 /*
  * Given a file descriptor, read the label information and return an nvlist
- * describing the configuration, if there is one.
+ * describing the configuration, if there is one.  Only the part of each label
+ * holding the configuration is read.
  */
 int
 zpool_read_label(int fd, nvlist_t **config)
 {
 	struct stat64 statbuf;
 	int l;
-	vdev_label_t *label;
+	vdev_phys_t *phys;
 	uint64_t state, txg, size;
 
 	*config = NULL;
@@ -736,16 +739,17 @@ zpool_read_label(int fd, nvlist_t **config)
 		return (0);
 	size = P2ALIGN_TYPED(statbuf.st_size, sizeof (vdev_label_t), uint64_t);
 
-	if ((label = malloc(sizeof (vdev_label_t))) == NULL)
+	if ((phys = malloc(sizeof (vdev_phys_t))) == NULL)
 		return (-1);
 
 	for (l = 0; l < VDEV_LABELS; l++) {
-		if (pread(fd, label, sizeof (vdev_label_t),
-		    label_offset(size, l)) != sizeof (vdev_label_t))
+		if (pread(fd, phys, sizeof (vdev_phys_t),
+		    label_offset(size, l) + offsetof(vdev_label_t,
+		    vl_vdev_phys)) != sizeof (vdev_phys_t))
 			continue;
 
-		if (nvlist_unpack(label->vl_vdev_phys.vp_nvlist,
-		    sizeof (label->vl_vdev_phys.vp_nvlist), config, 0) != 0)
+		if (nvlist_unpack(phys->vp_nvlist,
+		    sizeof (phys->vp_nvlist), config, 0) != 0)
 			continue;
 
 		if (nvlist_lookup_uint64(*config, ZPOOL_CONFIG_POOL_STATE,
@@ -761,15 +765,76 @@ zpool_read_label(int fd, nvlist_t **config)
 			continue;
 		}
 
-		free(label);
+		free(phys);
 		return (0);
 	}
 
-	free(label);
+	free(phys);
 	*config = NULL;
 	return (0);
 }
 
+/*
+ * Number of threads reading labels in zpool_find_import().  Reading the labels
+ * is mostly waiting for the disks, so this is not tied to the number of CPUs.
+ */
+#define	IMPORT_THREADS	16
+
+/*
+ * A device found while searching for pools.  A device reached through more
+ * than one name only has its label read once.
+ */
+typedef struct import_dev {
+	char		*id_path;
+	dev_t		id_dev;		/* st_rdev for block devices */
+	ino64_t		id_ino;		/* 0 for block devices */
+	int		id_alias;	/* earlier entry for the same device */
+	int		id_error;
+	nvlist_t	*id_config;
+} import_dev_t;
+
+typedef struct import_scan {
+	pthread_mutex_t	is_lock;
+	import_dev_t	*is_devs;
+	int		is_count;
+	int		is_next;
+} import_scan_t;
+
+/*
+ * Read the labels of the devices in an import_scan_t until there are none
+ * left.  Run by several threads at once.
+ */
+static void *
+import_read_labels(void *arg)
+{
+	import_scan_t *is = arg;
+	import_dev_t *id;
+	int i, fd;
+
+	for (;;) {
+		(void) pthread_mutex_lock(&is->is_lock);
+		i = is->is_next++;
+		(void) pthread_mutex_unlock(&is->is_lock);
+
+		if (i >= is->is_count)
+			break;
+
+		id = &is->is_devs[i];
+		if (id->id_alias != -1)
+			continue;
+
+		if ((fd = open64(id->id_path, O_RDONLY)) < 0)
+			continue;
+
+		if (zpool_read_label(fd, &id->id_config) != 0)
+			id->id_error = ENOMEM;
+
+		(void) close(fd);
+	}
+
+	return (NULL);
+}
+
 /*
  * Given a list of directories to search, find all pools stored on disk.  This
  * includes partial pools which are not available to import.  If no args are
@@ -779,7 +844,7 @@ nvlist_t *
 zpool_find_import(libzfs_handle_t *hdl, int argc, char **argv,
     boolean_t active_ok)
 {
-	int i;
+	int i, j, nthreads;
 	DIR *dirp = NULL;
 	struct dirent64 *dp;
 	char path[MAXPATHLEN], path2[MAXPATHLEN];
@@ -788,22 +853,25 @@ zpool_find_import(libzfs_handle_t *hdl, int argc, char **argv,
 	struct stat64 statbuf;
 	nvlist_t *ret = NULL, *config;
 	static char *default_dir = "/dev";
-	int fd;
 	pool_list_t pools = { 0 };
 	pool_entry_t *pe, *penext;
 	vdev_entry_t *ve, *venext;
 	config_entry_t *ce, *cenext;
 	name_entry_t *ne, *nenext;
+	import_scan_t is = { 0 };
+	import_dev_t *id;
+	int alloc = 0;
+	pthread_t threads[IMPORT_THREADS];
 
 	if (argc == 0) {
 		argc = 1;
 		argv = &default_dir;
 	}
 
+	(void) pthread_mutex_init(&is.is_lock, NULL);
+
 	/*
-	 * Go through and read the label configuration information from every
-	 * possible device, organizing the information according to pool GUID
-	 * and toplevel GUID.
+	 * Go through and find every possible device.
 	 */
 	for (i = 0; i < argc; i++) {
 		char *rdsk;
@@ -849,27 +917,92 @@ zpool_find_import(libzfs_handle_t *hdl, int argc, char **argv,
 			    !S_ISBLK(statbuf.st_mode)))
 				continue;
 
-			if ((fd = open64(path2, O_RDONLY)) < 0)
-				continue;
+			if (is.is_count == alloc) {
+				void *ptr;
 
-			if ((zpool_read_label(fd, &config)) != 0) {
-				(void) close(fd);
-				(void) no_memory(hdl);
-				goto error;
+				alloc = alloc == 0 ? 64 : alloc * 2;
+				if ((ptr = realloc(is.is_devs,
+				    alloc * sizeof (import_dev_t))) == NULL) {
+					(void) no_memory(hdl);
+					goto error;
+				}
+				is.is_devs = ptr;
 			}
 
-			(void) close(fd);
-
-			if (config != NULL) {
-				if (add_config(hdl, &pools, path2, config) != 0)
-					goto error;
+			id = &is.is_devs[is.is_count];
+			if ((id->id_path = zfs_strdup(hdl, path2)) == NULL)
+				goto error;
+			id->id_config = NULL;
+			id->id_error = 0;
+			if (S_ISBLK(statbuf.st_mode)) {
+				id->id_dev = statbuf.st_rdev;
+				id->id_ino = 0;
+			} else {
+				id->id_dev = statbuf.st_dev;
+				id->id_ino = statbuf.st_ino;
 			}
+			id->id_alias = -1;
+			for (j = 0; j < is.is_count; j++) {
+				if (is.is_devs[j].id_alias == -1 &&
+				    is.is_devs[j].id_dev == id->id_dev &&
+				    is.is_devs[j].id_ino == id->id_ino) {
+					id->id_alias = j;
+					break;
+				}
+			}
+			is.is_count++;
 		}
 
 		(void) closedir(dirp);
 		dirp = NULL;
 	}
 
+	/*
+	 * Read the label configuration information from every device, a few
+	 * devices at a time.  If no thread can be started, do it ourselves.
+	 */
+	for (nthreads = 0; nthreads < IMPORT_THREADS &&
+	    nthreads < is.is_count; nthreads++) {
+		if (pthread_create(&threads[nthreads], NULL,
+		    import_read_labels, &is) != 0)
+			break;
+	}
+	(void) import_read_labels(&is);
+	for (i = 0; i < nthreads; i++)
+		(void) pthread_join(threads[i], NULL);
+
+	/*
+	 * Organize the information according to pool GUID and toplevel GUID,
+	 * in the order the devices were found.
+	 */
+	for (i = 0; i < is.is_count; i++) {
+		id = &is.is_devs[i];
+
+		if (id->id_alias != -1) {
+			config = is.is_devs[id->id_alias].id_config;
+			if (config != NULL &&
+			    nvlist_dup(config, &id->id_config, 0) != 0) {
+				(void) no_memory(hdl);
+				goto error;
+			}
+		}
+
+		if (id->id_error != 0) {
+			(void) no_memory(hdl);
+			goto error;
+		}
+	}
+
+	for (i = 0; i < is.is_count; i++) {
+		id = &is.is_devs[i];
+
+		if ((config = id->id_config) != NULL) {
+			id->id_config = NULL;
+			if (add_config(hdl, &pools, id->id_path, config) != 0)
+				goto error;
+		}
+	}
+
 	ret = get_configs(hdl, &pools, active_ok);
 
 error:
@@ -895,6 +1028,14 @@ error:
 		free(ne);
 	}
 
+	for (i = 0; i < is.is_count; i++) {
+		free(is.is_devs[i].id_path);
+		if (is.is_devs[i].id_config)
+			nvlist_free(is.is_devs[i].id_config);
+	}
+	free(is.is_devs);
+	(void) pthread_mutex_destroy(&is.is_lock);
+
 	if (dirp)
 		(void) closedir(dirp);
 
@@ -34,6 +34,8 @@
  *
  * 	zfs_is_mounted()
  * 	zfs_mount()
+ * 	zfs_mount_batch_start()
+ * 	zfs_mount_batch_end()
  * 	zfs_unmount()
  * 	zfs_unmountall()
  *
@@ -68,8 +70,10 @@
 #include <dirent.h>
 #include <dlfcn.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <libgen.h>
 #include <libintl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <strings.h>
@@ -83,6 +87,7 @@
 #include <libzfs.h>
 
 #include "libzfs_impl.h"
+#include "zfsfuse.h"
 
 #include <libshare.h>
 #include <sys/systeminfo.h>
@@ -302,23 +307,293 @@ zfs_is_mountable(zfs_handle_t *zhp, char *buf, size_t buflen,
 }
 
 /*
- * Mount the given filesystem.
+ * Mount batches.  Between zfs_mount_batch_start() and zfs_mount_batch_end(),
+ * zfs_mount() only prepares the mountpoint and queues the request for the
+ * daemon; a few threads, each with its own connection to the daemon, send
+ * the queued requests in parallel.  The daemon serves every connection from
+ * a different thread, so independent filesystems are mounted concurrently.
+ *
+ * A filesystem is only prepared once no queued or running mount overlaps
+ * its mountpoint, so parents are still mounted before their children as long
+ * as the datasets are mounted in mountpoint order.  Failures are reported
+ * from the calling thread, which is the only one that touches the libzfs
+ * handle.
+ */
+#define	MOUNT_THREADS	8
+
+typedef struct mount_request {
+	struct mount_request *mr_next;
+	char		mr_name[ZFS_MAXNAMELEN];
+	char		mr_mountpoint[ZFS_MAXPROPLEN];
+	char		mr_mntopts[MNT_LINE_MAX];
+	int		mr_flags;
+	int		*mr_donep;	/* set to 1 once mounted */
+	boolean_t	mr_started;
+	boolean_t	mr_done;
+	int		mr_error;
+} mount_req_t;
+
+typedef struct mount_batch {
+	pthread_mutex_t	mb_lock;
+	pthread_cond_t	mb_cv;		/* signalled on new and done requests */
+	mount_req_t	*mb_head;	/* requests not reported yet, in order */
+	mount_req_t	*mb_tail;
+	boolean_t	mb_exit;
+	int		mb_error;	/* some mount failed */
+	int		mb_nthreads;
+	pthread_t	mb_threads[MOUNT_THREADS];
+	int		mb_fds[MOUNT_THREADS];
+} mount_batch_t;
+
+typedef struct mount_thread_arg {
+	mount_batch_t	*mta_batch;
+	int		mta_fd;
+} mount_thread_arg_t;
+
+static void *
+mount_thread(void *arg)
+{
+	mount_batch_t *mb = ((mount_thread_arg_t *)arg)->mta_batch;
+	int fd = ((mount_thread_arg_t *)arg)->mta_fd;
+	mount_req_t *mr;
+	int error;
+
+	free(arg);
+
+	(void) pthread_mutex_lock(&mb->mb_lock);
+	for (;;) {
+		for (mr = mb->mb_head; mr != NULL; mr = mr->mr_next) {
+			if (!mr->mr_started)
+				break;
+		}
+		if (mr == NULL) {
+			if (mb->mb_exit)
+				break;
+			(void) pthread_cond_wait(&mb->mb_cv, &mb->mb_lock);
+			continue;
+		}
+		mr->mr_started = B_TRUE;
+		(void) pthread_mutex_unlock(&mb->mb_lock);
+
+		error = 0;
+		if (zfsfuse_mount_req(fd, mr->mr_name, mr->mr_mountpoint,
+		    MS_OPTIONSTR | mr->mr_flags, mr->mr_mntopts,
+		    strlen(mr->mr_mntopts)) != 0)
+			error = errno;
+
+		(void) pthread_mutex_lock(&mb->mb_lock);
+		mr->mr_error = error;
+		mr->mr_done = B_TRUE;
+		(void) pthread_cond_broadcast(&mb->mb_cv);
+	}
+	(void) pthread_mutex_unlock(&mb->mb_lock);
+
+	return (NULL);
+}
+
+/*
+ * Returns true if one mountpoint is the same as, or a directory below, the
+ * other one.
+ */
+static boolean_t
+mountpoint_overlaps(const char *a, const char *b)
+{
+	size_t alen = strlen(a);
+	size_t blen = strlen(b);
+
+	if (alen > blen)
+		return (mountpoint_overlaps(b, a));
+
+	if (strncmp(a, b, alen) != 0)
+		return (B_FALSE);
+
+	return (alen == blen || b[alen] == '/' ||
+	    (alen > 0 && a[alen - 1] == '/'));
+}
+
+static int
+mount_error(libzfs_handle_t *hdl, const char *name, int error)
+{
+	/*
+	 * Generic errors are nasty, but there are just way too many
+	 * from mount(), and they're well-understood.  We pick a few
+	 * common ones to improve upon.
+	 */
+	if (error == EBUSY) {
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "mountpoint or dataset is busy"));
+	} else if (error == EPERM) {
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "Insufficient privileges"));
+	} else {
+		zfs_error_aux(hdl, strerror(error));
+	}
+
+	return (zfs_error_fmt(hdl, EZFS_MOUNTFAILED,
+	    dgettext(TEXT_DOMAIN, "cannot mount '%s'"), name));
+}
+
+/*
+ * Wait until no request overlapping the given mountpoint (or, if it is NULL,
+ * no request at all) is pending, and report the requests that are done.
+ */
+static void
+mount_batch_wait(libzfs_handle_t *hdl, const char *mountpoint)
+{
+	mount_batch_t *mb = hdl->libzfs_mount_batch;
+	mount_req_t *mr, **mrp, *done = NULL, **donep = &done;
+
+	(void) pthread_mutex_lock(&mb->mb_lock);
+	for (;;) {
+		for (mr = mb->mb_head; mr != NULL; mr = mr->mr_next) {
+			if (!mr->mr_done && (mountpoint == NULL ||
+			    mountpoint_overlaps(mountpoint, mr->mr_mountpoint)))
+				break;
+		}
+		if (mr == NULL)
+			break;
+		(void) pthread_cond_wait(&mb->mb_cv, &mb->mb_lock);
+	}
+
+	mb->mb_tail = NULL;
+	for (mrp = &mb->mb_head; (mr = *mrp) != NULL; ) {
+		if (mr->mr_done) {
+			*mrp = mr->mr_next;
+			*donep = mr;
+			donep = &mr->mr_next;
+		} else {
+			mb->mb_tail = mr;
+			mrp = &mr->mr_next;
+		}
+	}
+	*donep = NULL;
+	(void) pthread_mutex_unlock(&mb->mb_lock);
+
+	while ((mr = done) != NULL) {
+		done = mr->mr_next;
+		if (mr->mr_error != 0) {
+			(void) mount_error(hdl, mr->mr_name, mr->mr_error);
+			mb->mb_error = B_TRUE;
+		} else if (mr->mr_donep != NULL) {
+			*mr->mr_donep = 1;
+		}
+		free(mr);
+	}
+}
+
+/*
+ * Start mounting filesystems in parallel, see above.  If the extra
+ * connections to the daemon cannot be opened, zfs_mount() keeps mounting
+ * one filesystem at a time.
+ */
+void
+zfs_mount_batch_start(libzfs_handle_t *hdl)
+{
+	mount_batch_t *mb;
+	mount_thread_arg_t *mta;
+	int fd;
+
+	if (hdl->libzfs_mount_batch != NULL ||
+	    (mb = calloc(1, sizeof (mount_batch_t))) == NULL)
+		return;
+
+	(void) pthread_mutex_init(&mb->mb_lock, NULL);
+	(void) pthread_cond_init(&mb->mb_cv, NULL);
+
+	while (mb->mb_nthreads < MOUNT_THREADS) {
+		if ((mta = malloc(sizeof (mount_thread_arg_t))) == NULL)
+			break;
+		if ((fd = zfsfuse_open(ZFS_DEV_NAME, O_RDWR)) == -1) {
+			free(mta);
+			break;
+		}
+		mta->mta_batch = mb;
+		mta->mta_fd = fd;
+		if (pthread_create(&mb->mb_threads[mb->mb_nthreads], NULL,
+		    mount_thread, mta) != 0) {
+			(void) close(fd);
+			free(mta);
+			break;
+		}
+		mb->mb_fds[mb->mb_nthreads++] = fd;
+	}
+
+	if (mb->mb_nthreads == 0) {
+		(void) pthread_cond_destroy(&mb->mb_cv);
+		(void) pthread_mutex_destroy(&mb->mb_lock);
+		free(mb);
+		return;
+	}
+
+	hdl->libzfs_mount_batch = mb;
+}
+
+/*
+ * Wait for all the mounts started since zfs_mount_batch_start().  Returns -1
+ * if any of them failed.
  */
 int
-zfs_mount(zfs_handle_t *zhp, const char *options, int flags)
+zfs_mount_batch_end(libzfs_handle_t *hdl)
+{
+	mount_batch_t *mb = hdl->libzfs_mount_batch;
+	int i, ret;
+
+	if (mb == NULL)
+		return (0);
+
+	mount_batch_wait(hdl, NULL);
+
+	(void) pthread_mutex_lock(&mb->mb_lock);
+	mb->mb_exit = B_TRUE;
+	(void) pthread_cond_broadcast(&mb->mb_cv);
+	(void) pthread_mutex_unlock(&mb->mb_lock);
+
+	for (i = 0; i < mb->mb_nthreads; i++) {
+		(void) pthread_join(mb->mb_threads[i], NULL);
+		(void) close(mb->mb_fds[i]);
+	}
+
+	ret = mb->mb_error ? -1 : 0;
+
+	(void) pthread_cond_destroy(&mb->mb_cv);
+	(void) pthread_mutex_destroy(&mb->mb_lock);
+	free(mb);
+	hdl->libzfs_mount_batch = NULL;
+
+	return (ret);
+}
+
+/*
+ * Mount the given filesystem, and set *donep to 1 once it is mounted (or
+ * does not need to be).
+ */
+static int
+zfs_mount_impl(zfs_handle_t *zhp, const char *options, int flags, int *donep)
 {
 	struct stat buf;
 	char mountpoint[ZFS_MAXPROPLEN];
 	char mntopts[MNT_LINE_MAX];
 	libzfs_handle_t *hdl = zhp->zfs_hdl;
+	mount_batch_t *mb = hdl->libzfs_mount_batch;
+	mount_req_t *mr;
 
 	if (options == NULL)
 		mntopts[0] = '\0';
 	else
 		(void) strlcpy(mntopts, options, sizeof (mntopts));
 
-	if (!zfs_is_mountable(zhp, mountpoint, sizeof (mountpoint), NULL))
+	if (!zfs_is_mountable(zhp, mountpoint, sizeof (mountpoint), NULL)) {
+		if (donep != NULL)
+			*donep = 1;
 		return (0);
+	}
+
+	/*
+	 * The mountpoint may be created in, or be hidden by, a filesystem
+	 * that is still being mounted.
+	 */
+	if (mb != NULL)
+		mount_batch_wait(hdl, mountpoint);
 
 	/* Create the directory if it doesn't already exist */
 	if (lstat(mountpoint, &buf) != 0) {
@@ -346,33 +621,50 @@ zfs_mount(zfs_handle_t *zhp, const char *options, int flags)
 		    dgettext(TEXT_DOMAIN, "cannot mount '%s'"), mountpoint));
 	}
 
+	/* hand the mount to the batch threads */
+	if (mb != NULL) {
+		if ((mr = zfs_alloc(hdl, sizeof (mount_req_t))) == NULL)
+			return (-1);
+		(void) strlcpy(mr->mr_name, zhp->zfs_name,
+		    sizeof (mr->mr_name));
+		(void) strlcpy(mr->mr_mountpoint, mountpoint,
+		    sizeof (mr->mr_mountpoint));
+		(void) strlcpy(mr->mr_mntopts, mntopts,
+		    sizeof (mr->mr_mntopts));
+		mr->mr_flags = flags;
+		mr->mr_donep = donep;
+
+		(void) pthread_mutex_lock(&mb->mb_lock);
+		if (mb->mb_tail == NULL)
+			mb->mb_head = mr;
+		else
+			mb->mb_tail->mr_next = mr;
+		mb->mb_tail = mr;
+		(void) pthread_cond_broadcast(&mb->mb_cv);
+		(void) pthread_mutex_unlock(&mb->mb_lock);
+		return (0);
+	}
+
 	/* perform the mount */
 	/* ZFSFUSE */
 	if (zfsfuse_mount(hdl, zfs_get_name(zhp), mountpoint, MS_OPTIONSTR | flags,
-	    MNTTYPE_ZFS, NULL, 0, mntopts, strlen (mntopts)) != 0) {
-		/*
-		 * Generic errors are nasty, but there are just way too many
-		 * from mount(), and they're well-understood.  We pick a few
-		 * common ones to improve upon.
-		 */
-		if (errno == EBUSY) {
-			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
-			    "mountpoint or dataset is busy"));
-		} else if (errno == EPERM) {
-			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
-			    "Insufficient privileges"));
-		} else {
-			zfs_error_aux(hdl, strerror(errno));
-		}
-
-		return (zfs_error_fmt(hdl, EZFS_MOUNTFAILED,
-		    dgettext(TEXT_DOMAIN, "cannot mount '%s'"),
-		    zhp->zfs_name));
-	}
+	    MNTTYPE_ZFS, NULL, 0, mntopts, strlen (mntopts)) != 0)
+		return (mount_error(hdl, zhp->zfs_name, errno));
 
+	if (donep != NULL)
+		*donep = 1;
 	return (0);
 }
 
+/*
+ * Mount the given filesystem.
+ */
+int
+zfs_mount(zfs_handle_t *zhp, const char *options, int flags)
+{
+	return (zfs_mount_impl(zhp, options, flags, NULL));
+}
+
 /*
  * Unmount a single filesystem.
  */
@@ -1195,7 +1487,8 @@ dataset_cmp(const void *a, const void *b)
  * complicated nested hierarchies of mountpoints, we first gather all the
  * datasets and mountpoints within the pool, and sort them by mountpoint.  Once
  * we have the list of all filesystems, we iterate over them in order and mount
- * and/or share each one.
+ * and/or share each one.  The mounts are done as a batch, so filesystems whose
+ * mountpoints do not overlap are mounted in parallel.
  */
 #pragma weak zpool_mount_datasets = zpool_enable_datasets
 int
@@ -1229,18 +1522,20 @@ zpool_enable_datasets(zpool_handle_t *zhp, const char *mntopts, int flags)
 	qsort(cb.cb_datasets, cb.cb_used, sizeof (void *), dataset_cmp);
 
 	/*
-	 * And mount all the datasets, keeping track of which ones
-	 * succeeded or failed. By using zfs_alloc(), the good pointer
+	 * And mount all the datasets in parallel, keeping track of which
+	 * ones succeeded or failed. By using zfs_alloc(), the good pointer
 	 * will always be non-NULL.
 	 */
 	good = zfs_alloc(zhp->zpool_hdl, cb.cb_used * sizeof (int));
 	ret = 0;
+	zfs_mount_batch_start(hdl);
 	for (i = 0; i < cb.cb_used; i++) {
-		if (zfs_mount(cb.cb_datasets[i], mntopts, flags) != 0)
+		if (zfs_mount_impl(cb.cb_datasets[i], mntopts, flags,
+		    &good[i]) != 0)
 			ret = -1;
-		else
-			good[i] = 1;
 	}
+	if (zfs_mount_batch_end(hdl) != 0)
+		ret = -1;
 
 	/*
 	 * Then share all the ones that need to be shared. This needs
@@ -232,6 +232,22 @@ zpool_get_prop(zpool_handle_t *zhp, zpool_prop_t prop, char *buf, size_t len,
 			    (u_longlong_t)intval);
 			break;
 
+		case ZPOOL_PROP_SCRUBRATE:
+		case ZPOOL_PROP_RESILVERRATE:
+			if (intval == 0)
+				(void) strlcpy(buf, "none", len);
+			else
+				(void) zfs_nicenum(intval, buf, len);
+			break;
+
+		case ZPOOL_PROP_SCRUBLATENCY:
+			if (intval == 0)
+				(void) strlcpy(buf, "none", len);
+			else
+				(void) snprintf(buf, len, "%llu",
+				    (u_longlong_t)intval);
+			break;
+
 		case ZPOOL_PROP_HEALTH:
 			verify(nvlist_lookup_nvlist(zpool_get_config(zhp, NULL),
 			    ZPOOL_CONFIG_VDEV_TREE, &nvroot) == 0);
@@ -589,6 +589,7 @@ libzfs_fini(libzfs_handle_t *hdl)
 	zfs_uninit_libshare(hdl);
 	if (hdl->libzfs_log_str)
 		(void) free(hdl->libzfs_log_str);
+	nvlist_free(hdl->libzfs_iter_props);
 	namespace_clear(hdl);
 	free(hdl);
 }
@@ -758,6 +759,44 @@ zfs_ioctl(libzfs_handle_t *hdl, int request, zfs_cmd_t *zc)
 	return (error);
 }
 
+/*
+ * Get the latency histograms of the FUSE operations and ioctls served by
+ * the daemon, see ZFS_IOC_LATENCY_STATS.  If 'reset' is set, the daemon
+ * starts counting afresh once it has returned them.
+ */
+int
+libzfs_latency_stats(libzfs_handle_t *hdl, boolean_t reset, nvlist_t **nvp)
+{
+	zfs_cmd_t zc = { 0 };
+
+	zc.zc_cookie = reset;
+
+	if (zcmd_alloc_dst_nvlist(hdl, &zc, 16 * 1024) != 0)
+		return (-1);
+
+	while (ioctl(hdl->libzfs_fd, ZFS_IOC_LATENCY_STATS, &zc) != 0) {
+		if (errno == ENOMEM) {
+			if (zcmd_expand_dst_nvlist(hdl, &zc) != 0) {
+				zcmd_free_nvlists(&zc);
+				return (-1);
+			}
+		} else {
+			zcmd_free_nvlists(&zc);
+			return (zfs_standard_error(hdl, errno,
+			    dgettext(TEXT_DOMAIN,
+			    "cannot get latency statistics")));
+		}
+	}
+
+	if (zcmd_read_dst_nvlist(hdl, &zc, nvp) != 0) {
+		zcmd_free_nvlists(&zc);
+		return (-1);
+	}
+
+	zcmd_free_nvlists(&zc);
+	return (0);
+}
+
 /*
  * ================================================================
  * API shared by zfs and zpool property management
@@ -29,6 +29,7 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/uio.h>
+#include <sys/select.h>
 #include <unistd.h>
 #include <errno.h>
 
@@ -36,6 +37,14 @@
 
 #include "libzfs_impl.h"
 
+/*
+ * Whether the daemon at the other end of each connection takes
+ * IOCTL_BULK_REQ, as found out by zfsfuse_open().
+ */
+static boolean_t zfsfuse_bulk[FD_SETSIZE];
+
+static int zfsfuse_ioctl_wait(int fd);
+
 int zfsfuse_open(const char *pathname, int flags)
 {
 	struct sockaddr_un name;
@@ -66,6 +75,24 @@ int zfsfuse_open(const char *pathname, int flags)
 		return -1;
 	}
 
+	if(sock < FD_SETSIZE) {
+		zfsfuse_cmd_t cmd = { 0 };
+
+		cmd.cmd_type = IOCTL_REQ;
+		cmd.cmd_u.ioctl_req.cmd = ZFSFUSE_IOC_PROTOCOL;
+		cmd.cmd_u.ioctl_req.arg = ZFSFUSE_PROTOCOL_BULK;
+
+		int ret = -1;
+		if(write(sock, &cmd, sizeof(zfsfuse_cmd_t)) == sizeof(zfsfuse_cmd_t))
+			ret = zfsfuse_ioctl_wait(sock);
+		if(ret == -1) {
+			perror("zfsfuse_open");
+			close(sock);
+			return -1;
+		}
+		zfsfuse_bulk[sock] = (ret == 0);
+	}
+
 	return sock;
 }
 
@@ -136,14 +163,59 @@ int zfsfuse_sendfd(int sock, int fd)
 int zfsfuse_ioctl(int fd, int32_t request, void *arg)
 {
 	zfsfuse_cmd_t cmd;
+	zfs_cmd_t *zc = arg;
 
 	cmd.cmd_type = IOCTL_REQ;
 	cmd.cmd_u.ioctl_req.cmd = request;
 	cmd.cmd_u.ioctl_req.arg = (uint64_t)(uintptr_t) arg;
 
-	if(write(fd, &cmd, sizeof(zfsfuse_cmd_t)) != sizeof(zfsfuse_cmd_t))
+	/* The daemon fetches the zfs_cmd_t itself */
+	if(fd < 0 || fd >= FD_SETSIZE || !zfsfuse_bulk[fd]) {
+		if(write(fd, &cmd, sizeof(zfsfuse_cmd_t)) != sizeof(zfsfuse_cmd_t))
+			return -1;
+		return zfsfuse_ioctl_wait(fd);
+	}
+
+	cmd.cmd_type = IOCTL_BULK_REQ;
+
+	/*
+	 * Ship the zfs_cmd_t and its input nvlists along with the request,
+	 * so that the daemon doesn't have to ask for them one by one.
+	 */
+	struct iovec iov[4];
+	int iovcnt = 0;
+
+	iov[iovcnt].iov_base = &cmd;
+	iov[iovcnt++].iov_len = sizeof(zfsfuse_cmd_t);
+	iov[iovcnt].iov_base = zc;
+	iov[iovcnt++].iov_len = sizeof(zfs_cmd_t);
+
+	if(ZFSFUSE_PRELOAD(zc->zc_nvlist_conf, zc->zc_nvlist_conf_size)) {
+		iov[iovcnt].iov_base = (void *)(uintptr_t) zc->zc_nvlist_conf;
+		iov[iovcnt++].iov_len = zc->zc_nvlist_conf_size;
+	}
+	if(ZFSFUSE_PRELOAD(zc->zc_nvlist_src, zc->zc_nvlist_src_size)) {
+		iov[iovcnt].iov_base = (void *)(uintptr_t) zc->zc_nvlist_src;
+		iov[iovcnt++].iov_len = zc->zc_nvlist_src_size;
+	}
+
+	size_t total = 0;
+	for(int i = 0; i < iovcnt; i++)
+		total += iov[i].iov_len;
+
+	if(writev(fd, iov, iovcnt) != total)
 		return -1;
 
+	return zfsfuse_ioctl_wait(fd);
+}
+
+/*
+ * Serve the daemon's requests for an ioctl until it answers it.
+ */
+static int zfsfuse_ioctl_wait(int fd)
+{
+	zfsfuse_cmd_t cmd;
+
 	for(;;) {
 		if(zfsfuse_ioctl_read_loop(fd, &cmd, sizeof(zfsfuse_cmd_t)) != 0)
 			return -1;
@@ -194,9 +266,19 @@ int zfsfuse_mount(libzfs_handle_t *hdl, const char *spec, const char *dir, int m
 {
 	assert(dataptr == NULL);
 	assert(datalen == 0);
-	assert(mflag == 0);
 	assert(strcmp(fstype, MNTTYPE_ZFS) == 0);
 
+	return zfsfuse_mount_req(hdl->libzfs_fd, spec, dir, mflag, optptr, optlen);
+}
+
+/*
+ * Send a mount request through the given connection and wait for the
+ * daemon to complete it.
+ */
+int zfsfuse_mount_req(int fd, const char *spec, const char *dir, int mflag, char *optptr, int optlen)
+{
+	assert(mflag == 0);
+
 	zfsfuse_cmd_t cmd;
 
 	uint32_t speclen = strlen(spec);
@@ -208,21 +290,21 @@ int zfsfuse_mount(libzfs_handle_t *hdl, const char *spec, const char *dir, int m
 	cmd.cmd_u.mount_req.mflag = mflag;
 	cmd.cmd_u.mount_req.optlen = optlen;
 
-	if(write(hdl->libzfs_fd, &cmd, sizeof(zfsfuse_cmd_t)) != sizeof(zfsfuse_cmd_t))
+	if(write(fd, &cmd, sizeof(zfsfuse_cmd_t)) != sizeof(zfsfuse_cmd_t))
 		return -1;
 
-	if(write(hdl->libzfs_fd, spec, speclen) != speclen)
+	if(write(fd, spec, speclen) != speclen)
 		return -1;
 
-	if(write(hdl->libzfs_fd, dir, dirlen) != dirlen)
+	if(write(fd, dir, dirlen) != dirlen)
 		return -1;
 
-	if(write(hdl->libzfs_fd, optptr, optlen) != optlen)
+	if(write(fd, optptr, optlen) != optlen)
 		return -1;
 
 	uint32_t error;
 
-	if(zfsfuse_ioctl_read_loop(hdl->libzfs_fd, &error, sizeof(uint32_t)) != 0)
+	if(zfsfuse_ioctl_read_loop(fd, &error, sizeof(uint32_t)) != 0)
 		return -1;
 
 	if(error == 0)
@@ -67,6 +67,8 @@ typedef enum arc_buf_contents {
 #define	ARC_NOWAIT	(1 << 2)	/* perform I/O asynchronously */
 #define	ARC_PREFETCH	(1 << 3)	/* I/O is a prefetch */
 #define	ARC_CACHED	(1 << 4)	/* I/O was already in cache */
+#define	ARC_L2CACHE	(1 << 5)	/* cache in L2ARC */
+#define	ARC_INFLIGHT	(1 << 6)	/* hit on a block still being read */
 
 void arc_space_consume(uint64_t space);
 void arc_space_return(uint64_t space);
@@ -88,7 +90,7 @@ int arc_read(zio_t *pio, spa_t *spa, blkptr_t *bp, arc_byteswap_func_t *swap,
     arc_done_func_t *done, void *private, int priority, int flags,
     uint32_t *arc_flags, zbookmark_t *zb);
 zio_t *arc_write(zio_t *pio, spa_t *spa, int checksum, int compress,
-    int ncopies, uint64_t txg, blkptr_t *bp, arc_buf_t *buf,
+    int ncopies, uint64_t txg, blkptr_t *bp, arc_buf_t *buf, boolean_t l2arc,
     arc_done_func_t *ready, arc_done_func_t *done, void *private, int priority,
     int flags, zbookmark_t *zb);
 int arc_free(zio_t *pio, spa_t *spa, uint64_t txg, blkptr_t *bp,
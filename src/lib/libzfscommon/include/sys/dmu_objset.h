@@ -69,12 +69,17 @@ typedef struct objset_impl {
 	uint8_t os_checksum;	/* can change, under dsl_dir's locks */
 	uint8_t os_compress;	/* can change, under dsl_dir's locks */
 	uint8_t os_copies;	/* can change, under dsl_dir's locks */
+	uint8_t os_primary_cache;	/* can change, under dsl_dir's locks */
+	uint8_t os_secondary_cache;	/* can change, under dsl_dir's locks */
+	uint8_t os_sync;	/* can change, under dsl_dir's locks */
+	uint8_t os_logbias;	/* can change, under dsl_dir's locks */
 	uint8_t os_md_checksum;
 	uint8_t os_md_compress;
 
 	/* no lock needed: */
 	struct dmu_tx *os_synctx; /* XXX sketchy */
 	blkptr_t *os_rootbp;
+	zio_t *os_sync_zio;	/* root block write of the syncing txg */
 
 	/* Protected by os_obj_lock */
 	kmutex_t os_obj_lock;
@@ -86,6 +91,9 @@ typedef struct objset_impl {
 	list_t os_free_dnodes[TXG_SIZE];
 	list_t os_dnodes;
 	list_t os_downgraded_dbufs;
+	uint64_t os_zfetch_pending;	/* queued async prefetches */
+	kcondvar_t os_zfetch_cv;
+	uint64_t os_sync_tasks;		/* dnode sync tasks in flight */
 
 	/* stuff we store for the user */
 	kmutex_t os_user_ptr_lock;
@@ -94,6 +102,10 @@ typedef struct objset_impl {
 
 #define	DMU_META_DNODE_OBJECT	0
 
+#define	DMU_OS_IS_L2CACHEABLE(os)				\
+	((os)->os_secondary_cache == ZFS_CACHE_ALL ||		\
+	(os)->os_secondary_cache == ZFS_CACHE_METADATA)
+
 /* called from zpl */
 int dmu_objset_open(const char *name, dmu_objset_type_t type, int mode,
     objset_t **osp);
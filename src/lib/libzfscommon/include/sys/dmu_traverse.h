@@ -96,11 +96,20 @@ struct traverse_handle {
 	uint64_t	th_restarts;
 	zbookmark_t	th_noread;
 	zbookmark_t	th_lastcb;
+	zio_t		*th_prefetch_zio;	/* reads issued ahead */
+	zbookmark_t	th_prefetch[ZB_DEPTH][ZB_MAXLEVEL];
+	zbookmark_t	th_prefetch_dnblk;	/* last dnode block fanned out */
+	taskq_t		*th_taskq;		/* object prefetch threads */
+	uint64_t	th_prefetches;
+	blkptr_t	*th_osbp;		/* objset root, if not the MOS's */
 };
 
 int traverse_dsl_dataset(struct dsl_dataset *ds, uint64_t txg_start,
     int advance, blkptr_cb_t func, void *arg);
 int traverse_zvol(objset_t *os, int advance, blkptr_cb_t func, void *arg);
+void traverse_objset_bp_init(zbookmark_t *zb, uint64_t objset);
+int traverse_objset_bp(spa_t *spa, blkptr_t *osbp, uint64_t txg_start,
+    zbookmark_t *zb, blkptr_cb_t func, void *arg);
 
 traverse_handle_t *traverse_init(spa_t *spa, blkptr_cb_t *func, void *arg,
     int advance, int zio_flags);
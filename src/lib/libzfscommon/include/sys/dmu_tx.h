@@ -60,6 +60,7 @@ struct dmu_tx {
 	void *tx_tempreserve_cookie;
 	struct dmu_tx_hold *tx_needassign_txh;
 	uint8_t tx_anyobj;
+	uint8_t tx_wait_dirty;	/* ERESTART to be delayed by dmu_tx_wait */
 	int tx_err;
 #ifdef ZFS_DEBUG
 	uint64_t tx_space_towrite;
@@ -37,6 +37,7 @@ extern "C" {
 extern uint64_t	zfetch_array_rd_sz;
 
 struct dnode;				/* so we can reference dnode */
+struct objset_impl;
 
 typedef enum zfetch_dirn {
 	ZFETCH_FORWARD = 1,		/* prefetch increasing block numbers */
@@ -50,6 +51,10 @@ typedef struct zstream {
 	uint64_t	zst_stride;	/* length of stride, in blocks */
 	uint64_t	zst_ph_offset;	/* prefetch offset, in blocks */
 	uint64_t	zst_cap;	/* prefetch limit (cap), in blocks */
+	uint64_t	zst_max_cap;	/* adaptive upper bound on zst_cap */
+	uint64_t	zst_hits;	/* accesses since last adaptation */
+	uint64_t	zst_late;	/* ... that found the block in flight */
+	uint64_t	zst_ind_ph;	/* next level 1 blkid to prefetch */
 	kmutex_t	zst_lock;	/* protects stream */
 	clock_t		zst_last;	/* lbolt of last prefetch */
 	avl_node_t	zst_node;	/* embed avl node here */
@@ -63,9 +68,14 @@ typedef struct zfetch {
 	uint64_t	zf_alloc_fail;	/* # of failed attempts to alloc strm */
 } zfetch_t;
 
+void		zfetch_init(void);
+void		zfetch_fini(void);
+void		zfetch_wait(struct objset_impl *);
+
 void		dmu_zfetch_init(zfetch_t *, struct dnode *);
 void		dmu_zfetch_rele(zfetch_t *);
-void		dmu_zfetch(zfetch_t *, uint64_t, uint64_t, int);
+void		dmu_zfetch(zfetch_t *, uint64_t, uint64_t, int, int);
+void		dmu_zfetch_issue(struct dnode *, int, uint64_t, uint64_t);
 
 
 #ifdef	__cplusplus
@@ -47,6 +47,7 @@ typedef struct dsl_pool {
 	struct dsl_dir *dp_root_dir;
 	struct dsl_dir *dp_mos_dir;
 	uint64_t dp_root_dir_obj;
+	taskq_t *dp_sync_taskq;
 
 	/* No lock needed - sync context only */
 	blkptr_t dp_meta_rootbp;
@@ -57,6 +58,7 @@ typedef struct dsl_pool {
 	kmutex_t dp_lock;
 	uint64_t dp_space_towrite[TXG_SIZE];
 	uint64_t dp_tempreserved[TXG_SIZE];
+	hrtime_t dp_last_wakeup;	/* last write throttle wakeup */
 
 	/* Has its own locking */
 	tx_state_t dp_tx;
@@ -84,6 +86,11 @@ int dsl_pool_tempreserve_space(dsl_pool_t *dp, uint64_t space, dmu_tx_t *tx);
 void dsl_pool_tempreserve_clear(dsl_pool_t *dp, int64_t space, dmu_tx_t *tx);
 void dsl_pool_memory_pressure(dsl_pool_t *dp);
 void dsl_pool_willuse_space(dsl_pool_t *dp, int64_t space, dmu_tx_t *tx);
+boolean_t dsl_pool_need_throttle(dsl_pool_t *dp);
+void dsl_pool_throttle(dsl_pool_t *dp);
+void dsl_pool_sync_done(dsl_pool_t *dp, uint64_t written, clock_t delta);
+void dsl_pool_stat_init(void);
+void dsl_pool_stat_fini(void);
 
 #ifdef	__cplusplus
 }
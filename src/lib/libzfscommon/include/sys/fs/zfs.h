@@ -100,6 +100,10 @@ typedef enum {
 	ZFS_PROP_SHARESMB,
 	ZFS_PROP_REFQUOTA,
 	ZFS_PROP_REFRESERVATION,
+	ZFS_PROP_PRIMARYCACHE,
+	ZFS_PROP_SECONDARYCACHE,
+	ZFS_PROP_SYNC,
+	ZFS_PROP_LOGBIAS,
 	ZFS_NUM_PROPS
 } zfs_prop_t;
 
@@ -124,6 +128,9 @@ typedef enum {
 	ZPOOL_PROP_AUTOREPLACE,
 	ZPOOL_PROP_CACHEFILE,
 	ZPOOL_PROP_FAILUREMODE,
+	ZPOOL_PROP_SCRUBRATE,
+	ZPOOL_PROP_RESILVERRATE,
+	ZPOOL_PROP_SCRUBLATENCY,
 	ZPOOL_NUM_PROPS
 } zpool_prop_t;
 
@@ -206,6 +213,23 @@ typedef enum {
 	ZFS_CANMOUNT_NOAUTO = 2
 } zfs_canmount_type_t;
 
+typedef enum zfs_cache_type {
+	ZFS_CACHE_NONE = 0,
+	ZFS_CACHE_METADATA = 1,
+	ZFS_CACHE_ALL = 2
+} zfs_cache_type_t;
+
+typedef enum zfs_sync_type {
+	ZFS_SYNC_STANDARD = 0,
+	ZFS_SYNC_ALWAYS = 1,
+	ZFS_SYNC_DISABLED = 2
+} zfs_sync_type_t;
+
+typedef enum zfs_logbias_op {
+	ZFS_LOGBIAS_LATENCY = 0,
+	ZFS_LOGBIAS_THROUGHPUT = 1
+} zfs_logbias_op_t;
+
 typedef enum zfs_share_op {
 	ZFS_SHARE_NFS = 0,
 	ZFS_UNSHARE_NFS = 1,
@@ -537,9 +561,28 @@ typedef enum zfs_ioc {
 	ZFS_IOC_GET_FSACL,
 	ZFS_IOC_ISCSI_PERM_CHECK,
 	ZFS_IOC_SHARE,
-	ZFS_IOC_INHERIT_PROP
+	ZFS_IOC_INHERIT_PROP,
+	ZFS_IOC_DATASET_LIST_BULK,
+	ZFS_IOC_LATENCY_STATS
 } zfs_ioc_t;
 
+/*
+ * ZFS_IOC_LATENCY_STATS: the daemon returns an nvlist with one nvlist
+ * per class of operations, holding a uint64 array for each operation
+ * that has completed since the last reset: the number of operations, the
+ * total time they took in nanoseconds and a histogram of their latencies.
+ * Bucket i counts the operations that took [2^i, 2^(i+1)) ns, the last
+ * bucket all the slower ones.  A nonzero zc_cookie resets the counters
+ * once they have been returned.
+ */
+#define	ZFS_LATENCY_FUSE	"fuse"
+#define	ZFS_LATENCY_IOCTL	"ioctl"
+
+#define	ZFS_LATENCY_COUNT	0
+#define	ZFS_LATENCY_TOTAL	1
+#define	ZFS_LATENCY_HIST	2
+#define	ZFS_LATENCY_BUCKETS	40
+
 /*
  * Internal SPA load state.  Used by FMA diagnosis engine.
  */
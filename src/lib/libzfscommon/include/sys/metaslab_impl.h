@@ -52,6 +52,7 @@ struct metaslab_group {
 	vdev_t			*mg_vd;
 	metaslab_group_t	*mg_prev;
 	metaslab_group_t	*mg_next;
+	taskq_t			*mg_taskq;
 };
 
 /*
@@ -69,6 +70,7 @@ struct metaslab {
 	space_map_t	ms_freemap[TXG_SIZE];	/* freed this txg	*/
 	space_map_t	ms_map;		/* in-core free space map	*/
 	uint64_t	ms_weight;	/* weight vs. others in group	*/
+	uint64_t	ms_access_txg;	/* keep map loaded until then	*/
 	metaslab_group_t *ms_group;	/* metaslab group		*/
 	avl_node_t	ms_group_node;	/* node in metaslab group tree	*/
 	txg_node_t	ms_txg_node;	/* per-txg dirty metaslab links	*/
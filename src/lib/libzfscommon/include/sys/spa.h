@@ -374,11 +374,21 @@ extern int spa_scrub(spa_t *spa, pool_scrub_type_t type, boolean_t force);
 extern void spa_scrub_suspend(spa_t *spa);
 extern void spa_scrub_resume(spa_t *spa);
 extern void spa_scrub_restart(spa_t *spa, uint64_t txg);
+extern void spa_scrub_block_freed(spa_t *spa, const blkptr_t *bp,
+    uint64_t txg);
 
 /* spa syncing */
 extern void spa_sync(spa_t *spa, uint64_t txg); /* only for DMU use */
 extern void spa_sync_allpools(void);
 
+/* Freeing the remains of destroyed datasets, a few blocks per txg */
+extern void spa_destroy_tree(spa_t *spa, blkptr_t *bp, uint64_t objset,
+    uint64_t mintxg, uint64_t used, dmu_tx_t *tx);
+extern void spa_destroy_bplist(spa_t *spa, uint64_t obj, uint64_t mintxg,
+    uint64_t used, dmu_tx_t *tx);
+extern void spa_destroy_walk(spa_t *spa,
+    void (*func)(spa_t *, blkptr_t *, void *), void *arg);
+
 /*
  * SPA configuration functions in spa_config.c
  */
@@ -438,6 +448,7 @@ extern uint64_t spa_freeze_txg(spa_t *spa);
 extern uint64_t spa_get_alloc(spa_t *spa);
 extern uint64_t spa_get_space(spa_t *spa);
 extern uint64_t spa_get_dspace(spa_t *spa);
+extern uint64_t spa_get_destroy_space(spa_t *spa);
 extern uint64_t spa_get_asize(spa_t *spa, uint64_t lsize);
 extern uint64_t spa_version(spa_t *spa);
 extern int spa_max_replication(spa_t *spa);
@@ -51,6 +51,21 @@ typedef struct spa_error_entry {
 	avl_node_t	se_avl;
 } spa_error_entry_t;
 
+typedef struct spa_scrub_blk {
+	blkptr_t	sb_blk;		/* copy of the block pointer */
+	zbookmark_t	sb_bookmark;	/* where the traverse found it */
+	uint64_t	sb_seq;		/* tie-breaker, in traverse order */
+	int		sb_priority;	/* ZIO_PRIORITY_{SCRUB,RESILVER} */
+	int		sb_flags;	/* ZIO_FLAG_{SCRUB,RESILVER} */
+	avl_node_t	sb_avl;		/* link in spa_scrub_queue */
+} spa_scrub_blk_t;
+
+typedef struct spa_scrub_freed {
+	dva_t		sf_dva;		/* first DVA of the freed block */
+	uint64_t	sf_txg;		/* txg the free belongs to */
+	list_node_t	sf_node;	/* link in spa_scrub_freed */
+} spa_scrub_freed_t;
+
 typedef struct spa_history_phys {
 	uint64_t sh_pool_create_len;	/* ending offset of zpool create */
 	uint64_t sh_phys_max_off;	/* physical EOF */
@@ -112,6 +127,9 @@ struct spa {
 	uint64_t	spa_syncing_txg;	/* txg currently syncing */
 	uint64_t	spa_sync_bplist_obj;	/* object for deferred frees */
 	bplist_t	spa_sync_bplist;	/* deferred-free bplist */
+	uint64_t	spa_destroy_queue_obj;	/* destroyed trees to free */
+	uint64_t	spa_destroy_space;	/* space they still hold */
+	boolean_t	spa_destroy_pending;	/* queue may not be empty */
 	krwlock_t	spa_traverse_lock;	/* traverse vs. spa_sync() */
 	uberblock_t	spa_ubsync;		/* last synced uberblock */
 	uberblock_t	spa_uberblock;		/* current uberblock */
@@ -131,6 +149,11 @@ struct spa {
 	uint8_t		spa_scrub_active;	/* active or suspended? */
 	uint8_t		spa_scrub_type;		/* type of scrub we're doing */
 	uint8_t		spa_scrub_finished;	/* indicator to rotate logs */
+	avl_tree_t	spa_scrub_queue;	/* blocks sorted by DVA */
+	uint64_t	spa_scrub_queued;	/* blocks in spa_scrub_queue */
+	uint64_t	spa_scrub_seq;		/* next spa_scrub_blk_t seq */
+	list_t		spa_scrub_freed;	/* frees to purge from queue */
+	uint8_t		spa_scrub_queueing;	/* track frees for queue */
 	kmutex_t	spa_async_lock;		/* protect async state */
 	kthread_t	*spa_async_thread;	/* thread doing async task */
 	int		spa_async_suspended;	/* async tasks suspended */
@@ -160,6 +183,11 @@ struct spa {
 	kcondvar_t	spa_zio_cv;		/* resume I/O pipeline */
 	kmutex_t	spa_zio_lock;		/* zio error lock */
 	uint8_t		spa_failmode;		/* failure mode for the pool */
+	uint64_t	spa_scrub_rate;		/* scrub bytes/sec, 0 = any */
+	uint64_t	spa_resilver_rate;	/* resilver bytes/sec, 0 = any */
+	uint64_t	spa_scrub_latency;	/* back off above this (ms) */
+	int64_t		spa_scrub_credit;	/* bytes the scrub may issue */
+	hrtime_t	spa_scrub_credit_time;	/* when credit was updated */
 	struct zio_aio_ctx *spa_aio_ctx;	/* asynchronous I/O context */
 	/*
 	 * spa_refcnt & spa_config_lock must be the last elements
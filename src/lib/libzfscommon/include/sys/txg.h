@@ -43,6 +43,7 @@ extern "C" {
 
 #define	TXG_WAIT		1ULL
 #define	TXG_NOWAIT		2ULL
+#define	TXG_WAITED		3ULL	/* TXG_NOWAIT, after dmu_tx_wait() */
 
 typedef struct tx_cpu tx_cpu_t;
 
@@ -48,6 +48,7 @@ extern boolean_t zfs_nocacheflush;
 #define	VDEV_FAULT_COUNT	2
 
 extern int vdev_open(vdev_t *);
+extern void vdev_open_children(vdev_t *);
 extern int vdev_validate(vdev_t *);
 extern void vdev_close(vdev_t *);
 extern int vdev_create(vdev_t *, uint64_t txg, boolean_t isreplace);
@@ -105,6 +106,7 @@ extern void vdev_queue_init(vdev_t *vd);
 extern void vdev_queue_fini(vdev_t *vd);
 extern zio_t *vdev_queue_io(zio_t *zio);
 extern void vdev_queue_io_done(zio_t *zio);
+extern hrtime_t vdev_queue_latency(vdev_t *vd);
 
 extern void vdev_config_dirty(vdev_t *vd);
 extern void vdev_config_clean(vdev_t *vd);
@@ -103,6 +103,8 @@ struct vdev_queue {
 	avl_tree_t	vq_read_tree;
 	avl_tree_t	vq_write_tree;
 	avl_tree_t	vq_pending_tree;
+	hrtime_t	vq_io_latency;	/* average non-scrub I/O latency */
+	hrtime_t	vq_io_complete;	/* last non-scrub I/O completion */
 	kmutex_t	vq_lock;
 };
 
@@ -178,6 +180,8 @@ struct vdev {
 	boolean_t	vdev_checkremove; /* temporary online test	*/
 	boolean_t	vdev_forcefault; /* force online fault		*/
 	boolean_t	vdev_is_failing; /* device errors seen		*/
+	int		vdev_open_error; /* error from vdev_open_children() */
+	nvlist_t	*vdev_validate_label; /* label read by vdev_validate() */
 
 	/*
 	 * For DTrace to work in userland (libzpool) context, these fields must
@@ -39,9 +39,32 @@ extern "C" {
 
 #define	ZFS_CTLDIR_NAME		".zfs"
 
+/*
+ * ZFSFUSE: .zfs and .zfs/snapshot are implemented by zfs_operations.c,
+ * which gives the files of a snapshot inode numbers with the slot of the
+ * snapshot (see zfsctl_snapshot_lookup()) above the 48-bit object number.
+ * fuse_ino_t only has room for that on 64-bit platforms.
+ */
+#ifdef _LP64
+#define	ZFSCTL_INO_SHIFT	48
+#define	ZFSCTL_INO(slot, obj)	\
+	(((uint64_t)(slot) << ZFSCTL_INO_SHIFT) | (obj))
+#define	ZFSCTL_INO_SLOT(ino)	((uint64_t)(ino) >> ZFSCTL_INO_SHIFT)
+#define	ZFSCTL_INO_OBJ(ino)	\
+	((uint64_t)(ino) & ((1ULL << ZFSCTL_INO_SHIFT) - 1))
+#define	ZFSCTL_MAX_SLOT		((1ULL << (64 - ZFSCTL_INO_SHIFT)) - 1)
+
 #define	zfs_has_ctldir(zdp)	\
 	((zdp)->z_id == (zdp)->z_zfsvfs->z_root && \
-	((zdp)->z_zfsvfs->z_ctldir != NULL))
+	!(zdp)->z_zfsvfs->z_issnap)
+#else
+#define	ZFSCTL_INO(slot, obj)	(obj)
+#define	ZFSCTL_INO_SLOT(ino)	0
+#define	ZFSCTL_INO_OBJ(ino)	(ino)
+#define	ZFSCTL_MAX_SLOT		0
+
+#define	zfs_has_ctldir(zdp)	0
+#endif
 #define	zfs_show_ctldir(zdp)	\
 	(zfs_has_ctldir(zdp) && \
 	((zdp)->z_zfsvfs->z_show_ctldir))
@@ -58,6 +81,11 @@ int zfsctl_rename_snapshot(const char *from, const char *to);
 int zfsctl_destroy_snapshot(const char *snapname, int force);
 int zfsctl_umount_snapshots(vfs_t *, int, cred_t *);
 
+/* ZFSFUSE: see zfs_vfsops.c */
+int zfsctl_snapshot_lookup(zfsvfs_t *, const char *, uint64_t *);
+int zfsctl_snapshot_hold(zfsvfs_t *, uint64_t, zfsvfs_t **);
+void zfsctl_snapshot_rele(zfsvfs_t *, zfsvfs_t *);
+
 /* ZFSFUSE: not implemented */
 /*int zfsctl_root_lookup(vnode_t *dvp, char *nm, vnode_t **vpp, pathname_t *pnp,
     int flags, vnode_t *rdir, cred_t *cr, caller_context_t *ct,
@@ -68,8 +96,9 @@ int zfsctl_make_fid(zfsvfs_t *zfsvfsp, uint64_t object, uint32_t gen,
     fid_t *fidp);
 int zfsctl_lookup_objset(vfs_t *vfsp, uint64_t objsetid, zfsvfs_t **zfsvfsp);
 
-#define	ZFSCTL_INO_ROOT		0x1
-#define	ZFSCTL_INO_SNAPDIR	0x2
+/* ZFSFUSE: object numbers far beyond any the DMU gives out */
+#define	ZFSCTL_INO_ROOT		0xffffffffffffULL
+#define	ZFSCTL_INO_SNAPDIR	0xfffffffffffeULL
 
 #ifdef	__cplusplus
 }
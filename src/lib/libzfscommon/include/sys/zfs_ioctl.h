@@ -54,14 +54,44 @@ extern "C" {
 #define	DRR_FLAG_CLONE		(1<<0)
 #define	DRR_FLAG_CI_DATA	(1<<1)
 
+/*
+ * ZFS_IOC_DATASET_LIST_BULK: what to list (zc_objset_type), and the
+ * names of the pairs describing each dataset in the returned nvlist
+ */
+#define	ZFS_LIST_BULK_FILESYSTEMS	0
+#define	ZFS_LIST_BULK_SNAPSHOTS		1
+
+#define	ZFS_LIST_BULK_STATS	"stats"		/* dmu_objset_stats_t */
+#define	ZFS_LIST_BULK_PROPS	"props"		/* property nvlist */
+
 /*
  * zfs-fuse socket messages
  */
 
 enum {
-	IOCTL_REQ, IOCTL_ANS, COPYIN_REQ, COPYINSTR_REQ, COPYINSTR_ANS, COPYOUT_REQ, MOUNT_REQ, GETF_REQ
+	IOCTL_REQ, IOCTL_ANS, COPYIN_REQ, COPYINSTR_REQ, COPYINSTR_ANS, COPYOUT_REQ, MOUNT_REQ, GETF_REQ,
+	IOCTL_BULK_REQ
 };
 
+/*
+ * An IOCTL_BULK_REQ is an IOCTL_REQ followed by the zfs_cmd_t at
+ * ioctl_req.arg and by the nvlists it points to (zc_nvlist_conf, then
+ * zc_nvlist_src) that satisfy ZFSFUSE_PRELOAD(), so that the daemon does
+ * not need a COPYIN_REQ round trip for each of them.
+ */
+#define	ZFSFUSE_PRELOAD_MAX	(1 << 20)
+#define	ZFSFUSE_PRELOAD(ptr, size) \
+	((ptr) != 0 && (size) != 0 && (size) <= ZFSFUSE_PRELOAD_MAX)
+
+/*
+ * Daemons that predate IOCTL_BULK_REQ abort on it, so clients only send it
+ * once an IOCTL_REQ for ZFSFUSE_IOC_PROTOCOL, with the protocol version as
+ * its arg, has been answered with 0.  Older daemons answer EINVAL, as for
+ * any ioctl they don't know.
+ */
+#define	ZFSFUSE_IOC_PROTOCOL	(('F' << 8) | 1)
+#define	ZFSFUSE_PROTOCOL_BULK	1
+
 typedef struct {
 	int32_t cmd_type;
 	union {
@@ -72,6 +72,12 @@ struct zfsvfs {
 	vnode_t		*z_ctldir;	/* .zfs directory pointer */
 	boolean_t	z_show_ctldir;	/* expose .zfs in the root dir */
 	boolean_t	z_issnap;	/* true if this is a snapshot */
+	kmutex_t	z_snap_lock;	/* protects z_snapshots */
+	kcondvar_t	z_snap_cv;	/* a snapshot mount finished */
+	list_t		z_snapshots;	/* snapshots under .zfs/snapshot */
+	uint64_t	z_snap_next;	/* next slot to give out */
+	uint64_t	z_snap_slot;	/* slot of this snapshot */
+	list_node_t	z_ctl_node;	/* on zfsctl_fs_list */
 	boolean_t	z_vscan;	/* virus scan on/off */
 	boolean_t	z_use_fuids;	/* version allows fuids */
 	kmutex_t	z_online_recv_lock; /* recv in prog grabs as WRITER */
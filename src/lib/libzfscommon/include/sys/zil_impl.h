@@ -51,8 +51,9 @@ typedef struct lwb {
 } lwb_t;
 
 /*
- * Vdev flushing: during a zil_commit(), we build up an AVL tree of the vdevs
- * we've touched so we know which ones need a write cache flush at the end.
+ * Vdev flushing: as log blocks (and the blocks they point to) are written,
+ * we build up an AVL tree of the vdevs they went to, so that a zil_commit()
+ * knows which ones need a write cache flush at the end.
  */
 typedef struct zil_vdev_node {
 	uint64_t	zv_vdev;	/* vdev to be flushed */
@@ -72,6 +73,10 @@ struct zilog {
 	zio_t		*zl_root_zio;	/* log writer root zio */
 	uint64_t	zl_itx_seq;	/* next itx sequence number */
 	uint64_t	zl_commit_seq;	/* committed upto this number */
+	uint64_t	zl_issued_seq;	/* issued (maybe in flight) upto */
+	uint64_t	zl_commit_issued; /* # of commits issued */
+	uint64_t	zl_commit_done;	/* # of commits on stable storage */
+	uint64_t	zl_commit_waiters; /* # of zil_commit()s queued */
 	uint64_t	zl_lr_seq;	/* log record sequence number */
 	uint64_t	zl_destroy_txg;	/* txg of last zil_destroy() */
 	uint64_t	zl_replay_seq[TXG_SIZE]; /* seq of last replayed rec */
@@ -90,6 +95,7 @@ struct zilog {
 	uint64_t	zl_prev_used;	/* previous commit log size used */
 	list_t		zl_lwb_list;	/* in-flight log write list */
 	kmutex_t	zl_vdev_lock;	/* protects zl_vdev_tree */
+	kmutex_t	zl_flush_lock;	/* serializes zil_flush_vdevs() */
 	avl_tree_t	zl_vdev_tree;	/* vdevs to flush in zil_commit() */
 	taskq_t		*zl_clean_taskq; /* runs lwb and itx clean tasks */
 	avl_tree_t	zl_dva_tree;	/* track DVAs during log parse */
@@ -97,6 +103,13 @@ struct zilog {
 	uint64_t	zl_replay_blks;	/* number of log blocks replayed */
 };
 
+/*
+ * Log blocks go to separate log devices unless the dataset's logbias
+ * property asks for throughput, in which case they go to the main pool.
+ */
+#define	ZIL_USE_SLOG(zilog)	\
+	((zilog)->zl_os->os->os_logbias == ZFS_LOGBIAS_LATENCY)
+
 typedef struct zil_dva_node {
 	dva_t		zn_dva;
 	avl_node_t	zn_node;
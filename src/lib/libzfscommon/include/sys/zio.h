@@ -252,6 +252,7 @@ struct zio {
 	uint64_t	io_offset;
 	uint64_t	io_deadline;
 	uint64_t	io_timestamp;
+	hrtime_t	io_queued;
 	avl_node_t	io_offset_node;
 	avl_node_t	io_deadline_node;
 	avl_tree_t	*io_vdev_tree;
@@ -329,7 +330,7 @@ extern zio_t *zio_write_phys(zio_t *pio, vdev_t *vd, uint64_t offset,
     boolean_t labels);
 
 extern int zio_alloc_blk(spa_t *spa, uint64_t size, blkptr_t *new_bp,
-    blkptr_t *old_bp, uint64_t txg);
+    blkptr_t *old_bp, uint64_t txg, boolean_t use_slog);
 extern void zio_free_blk(spa_t *spa, blkptr_t *bp, uint64_t txg);
 extern void zio_flush(zio_t *zio, vdev_t *vd);
 
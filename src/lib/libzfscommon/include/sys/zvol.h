@@ -65,6 +65,22 @@ extern int zvol_ioctl(dev_t dev, int cmd, intptr_t arg, int flag, cred_t *cr,
 extern int zvol_busy(void);
 extern void zvol_init(void);
 extern void zvol_fini(void);
+
+/* ZFSFUSE: interface used by the NBD server */
+typedef struct zvol_state zvol_state_t;
+
+extern int zvol_hold(const char *name, zvol_state_t **zvp);
+extern void zvol_rele(zvol_state_t *zv);
+extern int zvol_read_buf(zvol_state_t *zv, uint64_t off, uint64_t len,
+    void *buf);
+extern int zvol_write_buf(zvol_state_t *zv, uint64_t off, uint64_t len,
+    const void *buf, boolean_t sync);
+extern int zvol_free_buf(zvol_state_t *zv, uint64_t off, uint64_t len,
+    boolean_t sync);
+extern void zvol_flush(zvol_state_t *zv);
+extern uint64_t zvol_get_volsize(zvol_state_t *zv);
+extern uint64_t zvol_get_volblocksize(zvol_state_t *zv);
+extern boolean_t zvol_is_readonly(zvol_state_t *zv);
 #endif
 
 #ifdef	__cplusplus
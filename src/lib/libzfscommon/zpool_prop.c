@@ -90,6 +90,12 @@ zpool_prop_init(void)
 	/* default number properties */
 	register_number(ZPOOL_PROP_VERSION, "version", SPA_VERSION,
 	    PROP_DEFAULT, ZFS_TYPE_POOL, "<version>", "VERSION");
+	register_number(ZPOOL_PROP_SCRUBRATE, "scrubrate", 0,
+	    PROP_DEFAULT, ZFS_TYPE_POOL, "<bytes/sec> | none", "SCRUBRATE");
+	register_number(ZPOOL_PROP_RESILVERRATE, "resilverrate", 0,
+	    PROP_DEFAULT, ZFS_TYPE_POOL, "<bytes/sec> | none", "RSLVRATE");
+	register_number(ZPOOL_PROP_SCRUBLATENCY, "scrublatency", 0,
+	    PROP_DEFAULT, ZFS_TYPE_POOL, "<msec> | none", "SCRUBLAT");
 
 	/* default index (boolean) properties */
 	register_index(ZPOOL_PROP_DELEGATION, "delegation", 1, PROP_DEFAULT,
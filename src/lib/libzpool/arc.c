@@ -465,7 +465,6 @@ static void arc_evict_ghost(arc_state_t *state, spa_t *spa, int64_t bytes);
 #define	ARC_BUF_AVAILABLE	(1 << 13)	/* block not in active use */
 #define	ARC_INDIRECT		(1 << 14)	/* this is an indirect block */
 #define	ARC_FREE_IN_PROGRESS	(1 << 15)	/* hdr about to be freed */
-#define	ARC_DONT_L2CACHE	(1 << 16)	/* originated by prefetch */
 #define	ARC_L2_READING		(1 << 17)	/* L2ARC read in progress */
 #define	ARC_L2_WRITING		(1 << 18)	/* L2ARC write in progress */
 #define	ARC_L2_EVICTED		(1 << 19)	/* evicted during I/O */
@@ -477,7 +476,7 @@ static void arc_evict_ghost(arc_state_t *state, spa_t *spa, int64_t bytes);
 #define	HDR_FREED_IN_READ(hdr)	((hdr)->b_flags & ARC_FREED_IN_READ)
 #define	HDR_BUF_AVAILABLE(hdr)	((hdr)->b_flags & ARC_BUF_AVAILABLE)
 #define	HDR_FREE_IN_PROGRESS(hdr)	((hdr)->b_flags & ARC_FREE_IN_PROGRESS)
-#define	HDR_DONT_L2CACHE(hdr)	((hdr)->b_flags & ARC_DONT_L2CACHE)
+#define	HDR_L2CACHE(hdr)	((hdr)->b_flags & ARC_L2CACHE)
 #define	HDR_L2_READING(hdr)	((hdr)->b_flags & ARC_L2_READING)
 #define	HDR_L2_WRITING(hdr)	((hdr)->b_flags & ARC_L2_WRITING)
 #define	HDR_L2_EVICTED(hdr)	((hdr)->b_flags & ARC_L2_EVICTED)
@@ -2287,7 +2286,7 @@ arc_read_done(zio_t *zio)
 
 	hdr->b_flags &= ~(ARC_L2_READING|ARC_L2_EVICTED);
 	if (l2arc_noprefetch && (hdr->b_flags & ARC_PREFETCH))
-		hdr->b_flags |= ARC_DONT_L2CACHE;
+		hdr->b_flags &= ~ARC_L2CACHE;
 
 	/* byteswap if necessary */
 	callback_list = hdr->b_acb;
@@ -2409,6 +2408,8 @@ top:
 
 		if (HDR_IO_IN_PROGRESS(hdr)) {
 
+			*arc_flags |= ARC_INFLIGHT;
+
 			if (*arc_flags & ARC_WAIT) {
 				cv_wait(&hdr->b_cv, hash_lock);
 				mutex_exit(hash_lock);
@@ -2463,6 +2464,8 @@ top:
 		}
 		DTRACE_PROBE1(arc__hit, arc_buf_hdr_t *, hdr);
 		arc_access(hdr, hash_lock);
+		if (*arc_flags & ARC_L2CACHE)
+			hdr->b_flags |= ARC_L2CACHE;
 		mutex_exit(hash_lock);
 		ARCSTAT_BUMP(arcstat_hits);
 		ARCSTAT_CONDSTAT(!(hdr->b_flags & ARC_PREFETCH),
@@ -2527,6 +2530,9 @@ top:
 
 		}
 
+		if (*arc_flags & ARC_L2CACHE)
+			hdr->b_flags |= ARC_L2CACHE;
+
 		acb = kmem_zalloc(sizeof (arc_callback_t), KM_SLEEP);
 		acb->acb_done = done;
 		acb->acb_private = private;
@@ -3001,7 +3007,7 @@ arc_write_done(zio_t *zio)
 
 zio_t *
 arc_write(zio_t *pio, spa_t *spa, int checksum, int compress, int ncopies,
-    uint64_t txg, blkptr_t *bp, arc_buf_t *buf,
+    uint64_t txg, blkptr_t *bp, arc_buf_t *buf, boolean_t l2arc,
     arc_done_func_t *ready, arc_done_func_t *done, void *private, int priority,
     int flags, zbookmark_t *zb)
 {
@@ -3015,6 +3021,8 @@ arc_write(zio_t *pio, spa_t *spa, int checksum, int compress, int ncopies,
 	ASSERT(!HDR_IO_ERROR(hdr));
 	ASSERT((hdr->b_flags & ARC_IO_IN_PROGRESS) == 0);
 	ASSERT(hdr->b_acb == 0);
+	if (l2arc)
+		hdr->b_flags |= ARC_L2CACHE;
 	callback = kmem_zalloc(sizeof (arc_write_callback_t), KM_SLEEP);
 	callback->awcb_ready = ready;
 	callback->awcb_done = done;
@@ -3473,6 +3481,11 @@ arc_fini(void)
  * 7. If an ARC buffer is written (and dirtied) which also exists in the
  * L2ARC, the now stale L2ARC buffer is immediately dropped.
  *
+ * 8. Only buffers tagged with ARC_L2CACHE are eligible.  The DMU sets the
+ * tag on reads and writes according to the dataset's secondarycache
+ * property, so datasets can keep their data (or everything) out of the
+ * L2ARC entirely.
+ *
  * The performance of the L2ARC can be tweaked by a number of tunables, which
  * may be necessary for different workloads:
  *
@@ -3918,7 +3931,7 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev)
 				continue;
 			}
 
-			if (HDR_IO_IN_PROGRESS(ab) || HDR_DONT_L2CACHE(ab)) {
+			if (HDR_IO_IN_PROGRESS(ab) || !HDR_L2CACHE(ab)) {
 				mutex_exit(hash_lock);
 				continue;
 			}
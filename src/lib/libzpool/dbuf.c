@@ -515,6 +515,9 @@ dbuf_read_impl(dmu_buf_impl_t *db, zio_t *zio, uint32_t *flags)
 	zb.zb_level = db->db_level;
 	zb.zb_blkid = db->db_blkid;
 
+	if (DBUF_IS_L2CACHEABLE(db))
+		aflags |= ARC_L2CACHE;
+
 	dbuf_add_ref(db, NULL);
 	/* ZIO_FLAG_CANFAIL callers have to check the parent zio's error */
 	ASSERT3U(db->db_dnode->dn_type, <, DMU_OT_NUMTYPES);
@@ -526,6 +529,8 @@ dbuf_read_impl(dmu_buf_impl_t *db, zio_t *zio, uint32_t *flags)
 	    &aflags, &zb);
 	if (aflags & ARC_CACHED)
 		*flags |= DB_RF_CACHED;
+	if (aflags & ARC_INFLIGHT)
+		*flags |= DB_RF_INFLIGHT;
 }
 
 int
@@ -552,7 +557,7 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 		mutex_exit(&db->db_mtx);
 		if (prefetch)
 			dmu_zfetch(&db->db_dnode->dn_zfetch, db->db.db_offset,
-			    db->db.db_size, TRUE);
+			    db->db.db_size, TRUE, FALSE);
 		if ((flags & DB_RF_HAVESTRUCT) == 0)
 			rw_exit(&db->db_dnode->dn_struct_rwlock);
 	} else if (db->db_state == DB_UNCACHED) {
@@ -566,7 +571,8 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 
 		if (prefetch)
 			dmu_zfetch(&db->db_dnode->dn_zfetch, db->db.db_offset,
-			    db->db.db_size, flags & DB_RF_CACHED);
+			    db->db.db_size, flags & DB_RF_CACHED,
+			    flags & DB_RF_INFLIGHT);
 
 		if ((flags & DB_RF_HAVESTRUCT) == 0)
 			rw_exit(&db->db_dnode->dn_struct_rwlock);
@@ -577,7 +583,7 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 		mutex_exit(&db->db_mtx);
 		if (prefetch)
 			dmu_zfetch(&db->db_dnode->dn_zfetch, db->db.db_offset,
-			    db->db.db_size, TRUE);
+			    db->db.db_size, TRUE, FALSE);
 		if ((flags & DB_RF_HAVESTRUCT) == 0)
 			rw_exit(&db->db_dnode->dn_struct_rwlock);
 
@@ -1504,8 +1510,13 @@ dbuf_destroy(dmu_buf_impl_t *db)
 	arc_space_return(sizeof (dmu_buf_impl_t));
 }
 
+/*
+ * Start an asynchronous read of the given block into the ARC.  Level 0
+ * prefetches read file data; higher levels read the indirect blocks that
+ * a later data prefetch or demand read will need to walk.
+ */
 void
-dbuf_prefetch(dnode_t *dn, uint64_t blkid)
+dbuf_prefetch(dnode_t *dn, int level, uint64_t blkid)
 {
 	dmu_buf_impl_t *db = NULL;
 	blkptr_t *bp = NULL;
@@ -1513,11 +1524,11 @@ dbuf_prefetch(dnode_t *dn, uint64_t blkid)
 	ASSERT(blkid != DB_BONUS_BLKID);
 	ASSERT(RW_LOCK_HELD(&dn->dn_struct_rwlock));
 
-	if (dnode_block_freed(dn, blkid))
+	if (level == 0 && dnode_block_freed(dn, blkid))
 		return;
 
 	/* dbuf_find() returns with db_mtx held */
-	if (db = dbuf_find(dn, 0, blkid)) {
+	if (db = dbuf_find(dn, level, blkid)) {
 		if (refcount_count(&db->db_holds) > 0) {
 			/*
 			 * This dbuf is active.  We assume that it is
@@ -1531,17 +1542,25 @@ dbuf_prefetch(dnode_t *dn, uint64_t blkid)
 		db = NULL;
 	}
 
-	if (dbuf_findbp(dn, 0, blkid, TRUE, &db, &bp) == 0) {
+	if (dbuf_findbp(dn, level, blkid, TRUE, &db, &bp) == 0) {
 		if (bp && !BP_IS_HOLE(bp)) {
 			uint32_t aflags = ARC_NOWAIT | ARC_PREFETCH;
 			zbookmark_t zb;
 			zb.zb_objset = dn->dn_objset->os_dsl_dataset ?
 			    dn->dn_objset->os_dsl_dataset->ds_object : 0;
 			zb.zb_object = dn->dn_object;
-			zb.zb_level = 0;
+			zb.zb_level = level;
 			zb.zb_blkid = blkid;
 
+			if (dn->dn_objset->os_secondary_cache ==
+			    ZFS_CACHE_ALL || ((level > 0 ||
+			    dmu_ot[dn->dn_type].ot_metadata) &&
+			    dn->dn_objset->os_secondary_cache ==
+			    ZFS_CACHE_METADATA))
+				aflags |= ARC_L2CACHE;
+
 			(void) arc_read(NULL, dn->dn_objset->os_spa, bp,
+			    level > 0 ? byteswap_uint64_array :
 			    dmu_ot[dn->dn_type].ot_byteswap,
 			    NULL, NULL, ZIO_PRIORITY_ASYNC_READ,
 			    ZIO_FLAG_CANFAIL | ZIO_FLAG_SPECULATIVE,
@@ -1721,7 +1740,15 @@ dbuf_rele(dmu_buf_impl_t *db, const void *tag)
 			dbuf_evict(db);
 		} else {
 			VERIFY(arc_buf_remove_ref(db->db_buf, db) == 0);
-			mutex_exit(&db->db_mtx);
+			/*
+			 * Datasets with primarycache=none (or =metadata,
+			 * for data blocks) don't keep the block around
+			 * once the last hold is gone.
+			 */
+			if (!DBUF_IS_CACHEABLE(db))
+				dbuf_clear(db);
+			else
+				mutex_exit(&db->db_mtx);
 		}
 	} else {
 		mutex_exit(&db->db_mtx);
@@ -2110,7 +2137,8 @@ dbuf_write(dbuf_dirty_record_t *dr, arc_buf_t *data, int checksum,
 
 	dr->dr_zio = arc_write(zio, os->os_spa, checksum, compress,
 	    dmu_get_replication_level(os, &zb, dn->dn_type), txg,
-	    db->db_blkptr, data, dbuf_write_ready, dbuf_write_done, db,
+	    db->db_blkptr, data, DBUF_IS_L2CACHEABLE(db),
+	    dbuf_write_ready, dbuf_write_done, db,
 	    ZIO_PRIORITY_ASYNC_WRITE, zio_flags, &zb);
 }
 
@@ -328,9 +328,13 @@ dmu_prefetch(objset_t *os, uint64_t object, uint64_t offset, uint64_t len)
 		if (object == 0 || object >= DN_MAX_OBJECT)
 			return;
 
+		/*
+		 * Callers such as readdir prefetch many dnodes in a row;
+		 * don't make them wait on the meta dnode's indirect blocks.
+		 */
 		rw_enter(&dn->dn_struct_rwlock, RW_READER);
 		blkid = dbuf_whichblock(dn, object * sizeof (dnode_phys_t));
-		dbuf_prefetch(dn, blkid);
+		dmu_zfetch_issue(dn, 0, blkid, 1);
 		rw_exit(&dn->dn_struct_rwlock);
 		return;
 	}
@@ -356,7 +360,7 @@ dmu_prefetch(objset_t *os, uint64_t object, uint64_t offset, uint64_t len)
 	if (nblks != 0) {
 		blkid = dbuf_whichblock(dn, offset);
 		for (i = 0; i < nblks; i++)
-			dbuf_prefetch(dn, blkid+i);
+			dbuf_prefetch(dn, 0, blkid+i);
 	}
 
 	rw_exit(&dn->dn_struct_rwlock);
@@ -818,7 +822,8 @@ dmu_sync(zio_t *pio, dmu_buf_t *db_fake,
 	    zio_checksum_select(db->db_dnode->dn_checksum, os->os_checksum),
 	    zio_compress_select(db->db_dnode->dn_compress, os->os_compress),
 	    dmu_get_replication_level(os, &zb, db->db_dnode->dn_type),
-	    txg, bp, dr->dt.dl.dr_data, NULL, dmu_sync_done, in,
+	    txg, bp, dr->dt.dl.dr_data, DBUF_IS_L2CACHEABLE(db),
+	    NULL, dmu_sync_done, in,
 	    ZIO_PRIORITY_SYNC_WRITE, zio_flags, &zb);
 
 	if (pio) {
@@ -1037,6 +1042,7 @@ dmu_init(void)
 {
 	dbuf_init();
 	dnode_init();
+	zfetch_init();
 	arc_init();
 	l2arc_init();
 }
@@ -1045,6 +1051,7 @@ void
 dmu_fini(void)
 {
 	arc_fini();
+	zfetch_fini();
 	dnode_fini();
 	dbuf_fini();
 	l2arc_fini();
@@ -28,6 +28,7 @@
 #include <sys/cred.h>
 #include <sys/zfs_context.h>
 #include <sys/dmu_objset.h>
+#include <sys/dmu_zfetch.h>
 #include <sys/dsl_dir.h>
 #include <sys/dsl_dataset.h>
 #include <sys/dsl_prop.h>
@@ -133,6 +134,86 @@ copies_changed_cb(void *arg, uint64_t newval)
 	osi->os_copies = newval;
 }
 
+static void
+primary_cache_changed_cb(void *arg, uint64_t newval)
+{
+	objset_impl_t *osi = arg;
+
+	/*
+	 * Inheritance and range checking should have been done by now.
+	 */
+	ASSERT(newval == ZFS_CACHE_ALL || newval == ZFS_CACHE_NONE ||
+	    newval == ZFS_CACHE_METADATA);
+
+	osi->os_primary_cache = newval;
+}
+
+static void
+secondary_cache_changed_cb(void *arg, uint64_t newval)
+{
+	objset_impl_t *osi = arg;
+
+	/*
+	 * Inheritance and range checking should have been done by now.
+	 */
+	ASSERT(newval == ZFS_CACHE_ALL || newval == ZFS_CACHE_NONE ||
+	    newval == ZFS_CACHE_METADATA);
+
+	osi->os_secondary_cache = newval;
+}
+
+static void
+sync_changed_cb(void *arg, uint64_t newval)
+{
+	objset_impl_t *osi = arg;
+
+	/*
+	 * Inheritance and range checking should have been done by now.
+	 */
+	ASSERT(newval == ZFS_SYNC_STANDARD || newval == ZFS_SYNC_ALWAYS ||
+	    newval == ZFS_SYNC_DISABLED);
+
+	osi->os_sync = newval;
+}
+
+static void
+logbias_changed_cb(void *arg, uint64_t newval)
+{
+	objset_impl_t *osi = arg;
+
+	/*
+	 * Inheritance and range checking should have been done by now.
+	 */
+	ASSERT(newval == ZFS_LOGBIAS_LATENCY ||
+	    newval == ZFS_LOGBIAS_THROUGHPUT);
+
+	osi->os_logbias = newval;
+}
+
+/*
+ * Drop the property callbacks registered by dmu_objset_open_impl().  This
+ * is also used to unwind a partially completed open, so callbacks which
+ * were never registered (ENOMSG) are silently skipped.
+ */
+static void
+dmu_objset_unregister_cbs(dsl_dataset_t *ds, objset_impl_t *osi)
+{
+	(void) dsl_prop_unregister(ds, "checksum",
+	    checksum_changed_cb, osi);
+	(void) dsl_prop_unregister(ds, "compression",
+	    compression_changed_cb, osi);
+	(void) dsl_prop_unregister(ds, "copies",
+	    copies_changed_cb, osi);
+	(void) dsl_prop_unregister(ds, "primarycache",
+	    primary_cache_changed_cb, osi);
+	(void) dsl_prop_unregister(ds, "secondarycache",
+	    secondary_cache_changed_cb, osi);
+	(void) dsl_prop_unregister(ds, "sync",
+	    sync_changed_cb, osi);
+	(void) dsl_prop_unregister(ds, "logbias",
+	    logbias_changed_cb, osi);
+}
+
 void
 dmu_objset_byteswap(void *buf, size_t size)
 {
@@ -158,6 +239,50 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 	osi->os_dsl_dataset = ds;
 	osi->os_spa = spa;
 	osi->os_rootbp = bp;
+
+	/*
+	 * Note: the changed_cb will be called once before the register
+	 * func returns, thus changing the checksum/compression from the
+	 * default (fletcher2/off).  Snapshots don't need to know, and
+	 * registering would complicate clone promotion, so they (and the
+	 * meta-objset) are always fully cached, with standard sync
+	 * semantics and a latency-biased log.
+	 */
+	osi->os_primary_cache = ZFS_CACHE_ALL;
+	osi->os_secondary_cache = ZFS_CACHE_ALL;
+	if (ds && ds->ds_phys->ds_num_children == 0) {
+		err = dsl_prop_register(ds, "checksum",
+		    checksum_changed_cb, osi);
+		if (err == 0)
+			err = dsl_prop_register(ds, "compression",
+			    compression_changed_cb, osi);
+		if (err == 0)
+			err = dsl_prop_register(ds, "copies",
+			    copies_changed_cb, osi);
+		if (err == 0)
+			err = dsl_prop_register(ds, "primarycache",
+			    primary_cache_changed_cb, osi);
+		if (err == 0)
+			err = dsl_prop_register(ds, "secondarycache",
+			    secondary_cache_changed_cb, osi);
+		if (err == 0)
+			err = dsl_prop_register(ds, "sync",
+			    sync_changed_cb, osi);
+		if (err == 0)
+			err = dsl_prop_register(ds, "logbias",
+			    logbias_changed_cb, osi);
+		if (err) {
+			dmu_objset_unregister_cbs(ds, osi);
+			kmem_free(osi, sizeof (objset_impl_t));
+			return (err);
+		}
+	} else if (ds == NULL) {
+		/* It's the meta-objset. */
+		osi->os_checksum = ZIO_CHECKSUM_FLETCHER_4;
+		osi->os_compress = ZIO_COMPRESS_LZJB;
+		osi->os_copies = spa_max_replication(spa);
+	}
+
 	if (!BP_IS_HOLE(osi->os_rootbp)) {
 		uint32_t aflags = ARC_WAIT;
 		zbookmark_t zb;
@@ -165,6 +290,8 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 		zb.zb_object = 0;
 		zb.zb_level = -1;
 		zb.zb_blkid = 0;
+		if (DMU_OS_IS_L2CACHEABLE(osi))
+			aflags |= ARC_L2CACHE;
 
 		dprintf_bp(osi->os_rootbp, "reading %s", "");
 		err = arc_read(NULL, spa, osi->os_rootbp,
@@ -172,6 +299,8 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 		    arc_getbuf_func, &osi->os_phys_buf,
 		    ZIO_PRIORITY_SYNC_READ, ZIO_FLAG_CANFAIL, &aflags, &zb);
 		if (err) {
+			if (ds && ds->ds_phys->ds_num_children == 0)
+				dmu_objset_unregister_cbs(ds, osi);
 			kmem_free(osi, sizeof (objset_impl_t));
 			return (err);
 		}
@@ -185,34 +314,6 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 		bzero(osi->os_phys, sizeof (objset_phys_t));
 	}
 
-	/*
-	 * Note: the changed_cb will be called once before the register
-	 * func returns, thus changing the checksum/compression from the
-	 * default (fletcher2/off).  Snapshots don't need to know, and
-	 * registering would complicate clone promotion.
-	 */
-	if (ds && ds->ds_phys->ds_num_children == 0) {
-		err = dsl_prop_register(ds, "checksum",
-		    checksum_changed_cb, osi);
-		if (err == 0)
-			err = dsl_prop_register(ds, "compression",
-			    compression_changed_cb, osi);
-		if (err == 0)
-			err = dsl_prop_register(ds, "copies",
-			    copies_changed_cb, osi);
-		if (err) {
-			VERIFY(arc_buf_remove_ref(osi->os_phys_buf,
-			    &osi->os_phys_buf) == 1);
-			kmem_free(osi, sizeof (objset_impl_t));
-			return (err);
-		}
-	} else if (ds == NULL) {
-		/* It's the meta-objset. */
-		osi->os_checksum = ZIO_CHECKSUM_FLETCHER_4;
-		osi->os_compress = ZIO_COMPRESS_LZJB;
-		osi->os_copies = spa_max_replication(spa);
-	}
-
 	osi->os_zil = zil_alloc(&osi->os, &osi->os_phys->os_zil_header);
 
 	/*
@@ -244,6 +345,7 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 	mutex_init(&osi->os_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&osi->os_obj_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&osi->os_user_ptr_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&osi->os_zfetch_cv, NULL, CV_DEFAULT, NULL);
 
 	osi->os_meta_dnode = dnode_special_open(osi,
 	    &osi->os_phys->os_meta_dnode, DMU_META_DNODE_OBJECT);
@@ -343,6 +445,9 @@ dmu_objset_evict_dbufs(objset_t *os)
 	objset_impl_t *osi = os->os;
 	dnode_t *dn;
 
+	/* prefetches still waiting to be issued hold their dnodes */
+	zfetch_wait(osi);
+
 	mutex_enter(&osi->os_lock);
 
 	/* process the mdn last, since the other dnodes have holds on it */
@@ -389,14 +494,8 @@ dmu_objset_evict(dsl_dataset_t *ds, void *arg)
 		ASSERT(list_head(&osi->os_free_dnodes[i]) == NULL);
 	}
 
-	if (ds && ds->ds_phys->ds_num_children == 0) {
-		VERIFY(0 == dsl_prop_unregister(ds, "checksum",
-		    checksum_changed_cb, osi));
-		VERIFY(0 == dsl_prop_unregister(ds, "compression",
-		    compression_changed_cb, osi));
-		VERIFY(0 == dsl_prop_unregister(ds, "copies",
-		    copies_changed_cb, osi));
-	}
+	if (ds && ds->ds_phys->ds_num_children == 0)
+		dmu_objset_unregister_cbs(ds, osi);
 
 	/*
 	 * We should need only a single pass over the dnode list, since
@@ -416,6 +515,7 @@ dmu_objset_evict(dsl_dataset_t *ds, void *arg)
 	mutex_destroy(&osi->os_lock);
 	mutex_destroy(&osi->os_obj_lock);
 	mutex_destroy(&osi->os_user_ptr_lock);
+	cv_destroy(&osi->os_zfetch_cv);
 	kmem_free(osi, sizeof (objset_impl_t));
 }
 
@@ -773,6 +873,17 @@ out:
 	return (err);
 }
 
+/*
+ * Number of dirty dnodes synced by each dp_sync_taskq task.
+ */
+int zfs_sync_dnodes_per_task = 64;
+
+typedef struct sync_dnodes_arg {
+	objset_impl_t *sda_os;
+	list_t sda_list;
+	dmu_tx_t *sda_tx;
+} sync_dnodes_arg_t;
+
 static void
 dmu_objset_sync_dnodes(list_t *list, dmu_tx_t *tx)
 {
@@ -794,6 +905,92 @@ dmu_objset_sync_dnodes(list_t *list, dmu_tx_t *tx)
 	}
 }
 
+/*
+ * Issue the writes of the meta-dnode's blocks and of the root block,
+ * once every dirty dnode has been synced into them.
+ */
+static void
+dmu_objset_sync_done(objset_impl_t *os, dmu_tx_t *tx)
+{
+	list_t *list;
+	dbuf_dirty_record_t *dr;
+
+	list = &os->os_meta_dnode->dn_dirty_records[tx->tx_txg & TXG_MASK];
+	while (dr = list_head(list)) {
+		ASSERT(dr->dr_dbuf->db_level == 0);
+		list_remove(list, dr);
+		if (dr->dr_zio)
+			zio_nowait(dr->dr_zio);
+	}
+	/*
+	 * Free intent log blocks up to this tx.
+	 */
+	zil_sync(os->os_zil, tx);
+	zio_nowait(os->os_sync_zio);
+}
+
+static void
+dmu_objset_sync_rele(objset_impl_t *os, dmu_tx_t *tx)
+{
+	boolean_t last;
+
+	mutex_enter(&os->os_lock);
+	ASSERT(os->os_sync_tasks > 0);
+	last = (--os->os_sync_tasks == 0);
+	mutex_exit(&os->os_lock);
+
+	if (last)
+		dmu_objset_sync_done(os, tx);
+}
+
+static void
+dmu_objset_sync_dnodes_task(void *arg)
+{
+	sync_dnodes_arg_t *sda = arg;
+
+	dmu_objset_sync_dnodes(&sda->sda_list, sda->sda_tx);
+	dmu_objset_sync_rele(sda->sda_os, sda->sda_tx);
+
+	list_destroy(&sda->sda_list);
+	kmem_free(sda, sizeof (sync_dnodes_arg_t));
+}
+
+/*
+ * Hand the dnodes on list to dp_sync_taskq, zfs_sync_dnodes_per_task
+ * at a time.  Each dnode only writes into its own slot of the
+ * meta-dnode's blocks, so they can be synced in any order.
+ */
+static void
+dmu_objset_dispatch_dnodes(objset_impl_t *os, list_t *list, dmu_tx_t *tx)
+{
+	taskq_t *tq = spa_get_dsl(os->os_spa)->dp_sync_taskq;
+	int txgoff = tx->tx_txg & TXG_MASK;
+	sync_dnodes_arg_t *sda;
+	dnode_t *dn;
+	int n;
+
+	while (list_head(list) != NULL) {
+		sda = kmem_alloc(sizeof (sync_dnodes_arg_t), KM_SLEEP);
+		sda->sda_os = os;
+		sda->sda_tx = tx;
+		list_create(&sda->sda_list, sizeof (dnode_t),
+		    offsetof(dnode_t, dn_dirty_link[txgoff]));
+		for (n = 0; n < zfs_sync_dnodes_per_task &&
+		    (dn = list_head(list)) != NULL; n++) {
+			list_remove(list, dn);
+			list_insert_tail(&sda->sda_list, dn);
+		}
+
+		mutex_enter(&os->os_lock);
+		os->os_sync_tasks++;
+		mutex_exit(&os->os_lock);
+
+		if (taskq_dispatch(tq, dmu_objset_sync_dnodes_task, sda,
+		    TQ_SLEEP) == 0)
+			dmu_objset_sync_dnodes_task(sda);
+	}
+}
+
 /* ARGSUSED */
 static void
 ready(zio_t *zio, arc_buf_t *abuf, void *arg)
@@ -842,8 +1039,6 @@ dmu_objset_sync(objset_impl_t *os, zio_t *pio, dmu_tx_t *tx)
 	int txgoff;
 	zbookmark_t zb;
 	zio_t *zio;
-	list_t *list;
-	dbuf_dirty_record_t *dr;
 
 	dprintf_ds(os->os_dsl_dataset, "txg=%llu\n", tx->tx_txg);
 
@@ -874,7 +1069,8 @@ dmu_objset_sync(objset_impl_t *os, zio_t *pio, dmu_tx_t *tx)
 	zio = arc_write(pio, os->os_spa, os->os_md_checksum,
 	    os->os_md_compress,
 	    dmu_get_replication_level(os, &zb, DMU_OT_OBJSET),
-	    tx->tx_txg, os->os_rootbp, os->os_phys_buf, ready, killer, os,
+	    tx->tx_txg, os->os_rootbp, os->os_phys_buf,
+	    DMU_OS_IS_L2CACHEABLE(os), ready, killer, os,
 	    ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_MUSTSUCCEED | ZIO_FLAG_METADATA,
 	    &zb);
 
@@ -885,22 +1081,33 @@ dmu_objset_sync(objset_impl_t *os, zio_t *pio, dmu_tx_t *tx)
 	dnode_sync(os->os_meta_dnode, tx);
 
 	txgoff = tx->tx_txg & TXG_MASK;
+	os->os_sync_zio = zio;
 
-	dmu_objset_sync_dnodes(&os->os_free_dnodes[txgoff], tx);
-	dmu_objset_sync_dnodes(&os->os_dirty_dnodes[txgoff], tx);
-
-	list = &os->os_meta_dnode->dn_dirty_records[txgoff];
-	while (dr = list_head(list)) {
-		ASSERT(dr->dr_dbuf->db_level == 0);
-		list_remove(list, dr);
-		if (dr->dr_zio)
-			zio_nowait(dr->dr_zio);
+	/*
+	 * The MOS is synced last, by the sync thread itself, after
+	 * everything else has dirtied it.
+	 */
+	if (os->os_dsl_dataset == NULL) {
+		dmu_objset_sync_dnodes(&os->os_free_dnodes[txgoff], tx);
+		dmu_objset_sync_dnodes(&os->os_dirty_dnodes[txgoff], tx);
+		dmu_objset_sync_done(os, tx);
+		return;
 	}
+
 	/*
-	 * Free intent log blocks up to this tx.
+	 * Sync the dnodes of datasets in parallel.  Whichever of us drops
+	 * the last hold on os_sync_tasks issues the writes of the blocks
+	 * they were synced into; dsl_pool_sync() waits for the taskq.
 	 */
-	zil_sync(os->os_zil, tx);
-	zio_nowait(zio);
+	mutex_enter(&os->os_lock);
+	ASSERT(os->os_sync_tasks == 0);
+	os->os_sync_tasks = 1;
+	mutex_exit(&os->os_lock);
+
+	dmu_objset_dispatch_dnodes(os, &os->os_free_dnodes[txgoff], tx);
+	dmu_objset_dispatch_dnodes(os, &os->os_dirty_dnodes[txgoff], tx);
+
+	dmu_objset_sync_rele(os, tx);
 }
 
 void
@@ -43,27 +43,154 @@
 
 static char *dmu_recv_tag = "dmu_recv_tag";
 
+/* size of the buffer between the send traversal and its writer thread */
+uint64_t zfs_send_buffer_size = 4 << 20;
+/* the writer waits for this much data before writing, unless done */
+uint64_t zfs_send_write_size = 1 << 20;
+
+/*
+ * Records are produced by backup_cb() in the traversing thread and
+ * copied into a ring buffer; backup_writer() drains the buffer to the
+ * output vnode in large writes, so that reading the snapshot and writing
+ * the stream overlap.  Everything below 'lock' is protected by it.
+ */
 struct backuparg {
 	dmu_replay_record_t *drr;
 	vnode_t *vp;
 	offset_t *off;
 	objset_t *os;
 	zio_cksum_t zc;
+	kmutex_t lock;
+	kcondvar_t cv;
+	char *buf;		/* ring buffer */
+	uint64_t bufsize;
+	uint64_t head;		/* bytes produced */
+	uint64_t tail;		/* bytes written */
+	kthread_t *writer;	/* NULL once the writer has exited */
+	boolean_t done;		/* no more records are coming */
 	int err;
 };
 
+static void
+backup_writer(struct backuparg *ba)
+{
+	ssize_t resid; /* have to get resid to get detailed errno */
+	uint64_t off, len;
+	int err;
+
+	mutex_enter(&ba->lock);
+	for (;;) {
+		while (ba->err == 0 && !ba->done &&
+		    ba->head - ba->tail < MIN(zfs_send_write_size, ba->bufsize))
+			cv_wait(&ba->cv, &ba->lock);
+
+		if (ba->err != 0 || ba->head == ba->tail)
+			break;
+
+		off = ba->tail % ba->bufsize;
+		len = MIN(ba->head - ba->tail, ba->bufsize - off);
+		mutex_exit(&ba->lock);
+
+		err = vn_rdwr(UIO_WRITE, ba->vp,
+		    (caddr_t)ba->buf + off, len,
+		    0, UIO_SYSSPACE, FAPPEND, RLIM64_INFINITY, CRED(), &resid);
+
+		mutex_enter(&ba->lock);
+		if (err != 0) {
+			ba->err = err;
+			break;
+		}
+		ba->tail += len;
+		*ba->off += len;
+		cv_broadcast(&ba->cv);
+	}
+	ba->writer = NULL;
+	cv_broadcast(&ba->cv);
+	mutex_exit(&ba->lock);
+
+	thread_exit();
+}
+
+static void
+backup_start(struct backuparg *ba)
+{
+	mutex_init(&ba->lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&ba->cv, NULL, CV_DEFAULT, NULL);
+	ba->bufsize = P2ROUNDUP(MAX(zfs_send_buffer_size,
+	    sizeof (dmu_replay_record_t)), 8);
+	ba->buf = kmem_alloc(ba->bufsize, KM_SLEEP);
+	ba->head = ba->tail = 0;
+	ba->done = B_FALSE;
+	ba->err = 0;
+	mutex_enter(&ba->lock);
+	ba->writer = thread_create(NULL, 0, backup_writer, ba, 0, &p0,
+	    TS_RUN, minclsyspri);
+	mutex_exit(&ba->lock);
+}
+
+/*
+ * Wait for the writer to drain the buffer (or, if 'error' is set, to
+ * notice that it should give up) and return the first error either side
+ * ran into.
+ */
+static int
+backup_finish(struct backuparg *ba, int error)
+{
+	int err;
+
+	mutex_enter(&ba->lock);
+	if (ba->err == 0)
+		ba->err = error;
+	ba->done = B_TRUE;
+	cv_broadcast(&ba->cv);
+	while (ba->writer != NULL)
+		cv_wait(&ba->cv, &ba->lock);
+	err = ba->err;
+	mutex_exit(&ba->lock);
+
+	kmem_free(ba->buf, ba->bufsize);
+	cv_destroy(&ba->cv);
+	mutex_destroy(&ba->lock);
+
+	return (err);
+}
+
 static int
 dump_bytes(struct backuparg *ba, void *buf, int len)
 {
-	ssize_t resid; /* have to get resid to get detailed errno */
+	uint64_t off, n;
+	int err;
+
 	ASSERT3U(len % 8, ==, 0);
 
 	fletcher_4_incremental_native(buf, len, &ba->zc);
-	ba->err = vn_rdwr(UIO_WRITE, ba->vp,
-	    (caddr_t)buf, len,
-	    0, UIO_SYSSPACE, FAPPEND, RLIM64_INFINITY, CRED(), &resid);
-	*ba->off += len;
-	return (ba->err);
+
+	mutex_enter(&ba->lock);
+	while (len > 0 && ba->err == 0) {
+		if (ba->head - ba->tail == ba->bufsize) {
+			cv_wait(&ba->cv, &ba->lock);
+			continue;
+		}
+		off = ba->head % ba->bufsize;
+		n = MIN(len, MIN(ba->bufsize - (ba->head - ba->tail),
+		    ba->bufsize - off));
+
+		/* the writer only looks at [tail, head) */
+		mutex_exit(&ba->lock);
+		bcopy(buf, ba->buf + off, n);
+		mutex_enter(&ba->lock);
+
+		ba->head += n;
+		buf = (char *)buf + n;
+		len -= n;
+		if (ba->head - ba->tail >=
+		    MIN(zfs_send_write_size, ba->bufsize))
+			cv_broadcast(&ba->cv);
+	}
+	err = ba->err;
+	mutex_exit(&ba->lock);
+
+	return (err);
 }
 
 static int
@@ -286,10 +413,11 @@ dmu_sendbackup(objset_t *tosnap, objset_t *fromsnap, boolean_t fromorigin,
 	ba.os = tosnap;
 	ba.off = off;
 	ZIO_SET_CHECKSUM(&ba.zc, 0, 0, 0, 0);
+	backup_start(&ba);
 
 	if (dump_bytes(&ba, drr, sizeof (dmu_replay_record_t))) {
 		kmem_free(drr, sizeof (dmu_replay_record_t));
-		return (ba.err);
+		return (backup_finish(&ba, 0));
 	}
 
 	err = traverse_dsl_dataset(ds, fromtxg,
@@ -297,24 +425,19 @@ dmu_sendbackup(objset_t *tosnap, objset_t *fromsnap, boolean_t fromorigin,
 	    backup_cb, &ba);
 
 	if (err) {
-		if (err == EINTR && ba.err)
-			err = ba.err;
 		kmem_free(drr, sizeof (dmu_replay_record_t));
-		return (err);
+		return (backup_finish(&ba, err));
 	}
 
 	bzero(drr, sizeof (dmu_replay_record_t));
 	drr->drr_type = DRR_END;
 	drr->drr_u.drr_end.drr_checksum = ba.zc;
 
-	if (dump_bytes(&ba, drr, sizeof (dmu_replay_record_t))) {
-		kmem_free(drr, sizeof (dmu_replay_record_t));
-		return (ba.err);
-	}
+	(void) dump_bytes(&ba, drr, sizeof (dmu_replay_record_t));
 
 	kmem_free(drr, sizeof (dmu_replay_record_t));
 
-	return (0);
+	return (backup_finish(&ba, 0));
 }
 
 struct recvbeginsyncarg {
@@ -702,21 +825,54 @@ dmu_recv_begin(char *tofs, char *tosnap, struct drr_begin *drrb,
 	return (0);
 }
 
+/* bytes of records the receive reader may have queued ahead of the applier */
+uint64_t zfs_recv_queue_size = 16 << 20;
+/* max # of OBJECT and WRITE records applied in one transaction */
+int zfs_recv_batch_records = 32;
+/* max # of bytes of WRITE data applied in one transaction */
+uint64_t zfs_recv_batch_size = 1 << 20;
+
+#define	RECV_MAX_PAYLOAD	(1 << 20)
+
+/*
+ * A record read ahead by restore_reader(), with its payload (the bonus
+ * buffer of an OBJECT record or the data of a WRITE record).
+ */
+typedef struct restore_rec {
+	dmu_replay_record_t rr_drr;	/* header, in host byte order */
+	void		*rr_data;	/* payload */
+	int		rr_len;		/* payload length */
+	boolean_t	rr_new;		/* object is claimed in this batch */
+	boolean_t	rr_blkchg;	/* OBJECT changes the block size */
+	zio_cksum_t	rr_cksum;	/* stream checksum up to here */
+	list_node_t	rr_node;
+} restore_rec_t;
+
+/*
+ * The stream is read by restore_reader() into a queue of records, so
+ * that reading the stream overlaps with applying it.  Everything below
+ * 'lock' is protected by it.
+ */
 struct restorearg {
 	int err;
 	int byteswap;
 	vnode_t *vp;
-	char *buf;
 	uint64_t voff;
-	int bufsize; /* amount of memory allocated for buf */
 	zio_cksum_t cksum;
+	kmutex_t lock;
+	kcondvar_t cv;
+	list_t queue;		/* restore_rec_t, in stream order */
+	uint64_t queued;	/* bytes in queue */
+	kthread_t *reader;	/* NULL once the reader has exited */
+	boolean_t stop;		/* the applier is done with the stream */
+	int rerr;		/* why the reader stopped */
 };
 
-static void *
-restore_read(struct restorearg *ra, int len)
+static int
+restore_read(struct restorearg *ra, void *buf, int len)
 {
-	void *rv;
 	int done = 0;
+	int err;
 
 	/* some things will require 8-byte alignment, so everything must */
 	ASSERT3U(len % 8, ==, 0);
@@ -724,26 +880,25 @@ restore_read(struct restorearg *ra, int len)
 	while (done < len) {
 		ssize_t resid;
 
-		ra->err = vn_rdwr(UIO_READ, ra->vp,
-		    (caddr_t)ra->buf + done, len - done,
+		err = vn_rdwr(UIO_READ, ra->vp,
+		    (caddr_t)buf + done, len - done,
 		    ra->voff, UIO_SYSSPACE, FAPPEND,
 		    RLIM64_INFINITY, CRED(), &resid);
 
 		if (resid == len - done)
-			ra->err = EINVAL;
+			err = EINVAL;
 		ra->voff += len - done - resid;
 		done = len - resid;
-		if (ra->err)
-			return (NULL);
+		if (err)
+			return (err);
 	}
 
 	ASSERT3U(done, ==, len);
-	rv = ra->buf;
 	if (ra->byteswap)
-		fletcher_4_incremental_byteswap(rv, len, &ra->cksum);
+		fletcher_4_incremental_byteswap(buf, len, &ra->cksum);
 	else
-		fletcher_4_incremental_native(rv, len, &ra->cksum);
-	return (rv);
+		fletcher_4_incremental_native(buf, len, &ra->cksum);
+	return (0);
 }
 
 static void
@@ -798,16 +953,8 @@ backup_byteswap(dmu_replay_record_t *drr)
 }
 
 static int
-restore_object(struct restorearg *ra, objset_t *os, struct drr_object *drro)
+restore_object_check(struct drr_object *drro)
 {
-	int err;
-	dmu_tx_t *tx;
-
-	err = dmu_object_info(os, drro->drr_object, NULL);
-
-	if (err != 0 && err != ENOENT)
-		return (EINVAL);
-
 	if (drro->drr_type == DMU_OT_NONE ||
 	    drro->drr_type >= DMU_OT_NUMTYPES ||
 	    drro->drr_bonustype >= DMU_OT_NUMTYPES ||
@@ -819,21 +966,188 @@ restore_object(struct restorearg *ra, objset_t *os, struct drr_object *drro)
 	    drro->drr_bonuslen > DN_MAX_BONUSLEN) {
 		return (EINVAL);
 	}
+	return (0);
+}
+
+static int
+restore_write_check(struct drr_write *drrw)
+{
+	if (drrw->drr_offset + drrw->drr_length < drrw->drr_offset ||
+	    drrw->drr_type >= DMU_OT_NUMTYPES ||
+	    drrw->drr_length > RECV_MAX_PAYLOAD ||
+	    P2PHASE(drrw->drr_length, 8))
+		return (EINVAL);
+	return (0);
+}
+
+static void
+restore_rec_free(restore_rec_t *rr)
+{
+	if (rr->rr_data != NULL)
+		kmem_free(rr->rr_data, rr->rr_len);
+	kmem_free(rr, sizeof (restore_rec_t));
+}
+
+/*
+ * Read records and their payloads until the END record, an error, or a
+ * record we can't make sense of (which the applier will then reject).
+ * Only what belongs to the stream is read, since whatever follows it on
+ * the vnode isn't ours.
+ */
+static void
+restore_reader(struct restorearg *ra)
+{
+	restore_rec_t *rr;
+	boolean_t last = B_FALSE;
+	int err = 0;
+
+	while (!last) {
+		rr = kmem_zalloc(sizeof (restore_rec_t), KM_SLEEP);
+		rr->rr_cksum = ra->cksum;
+
+		err = restore_read(ra, &rr->rr_drr,
+		    sizeof (dmu_replay_record_t));
+		if (err) {
+			restore_rec_free(rr);
+			break;
+		}
+		if (ra->byteswap)
+			backup_byteswap(&rr->rr_drr);
+
+		switch (rr->rr_drr.drr_type) {
+		case DRR_OBJECT:
+		{
+			struct drr_object *drro = &rr->rr_drr.drr_u.drr_object;
+
+			if (restore_object_check(drro))
+				last = B_TRUE;
+			else
+				rr->rr_len = P2ROUNDUP(drro->drr_bonuslen, 8);
+			break;
+		}
+		case DRR_WRITE:
+			if (restore_write_check(&rr->rr_drr.drr_u.drr_write))
+				last = B_TRUE;
+			else
+				rr->rr_len =
+				    rr->rr_drr.drr_u.drr_write.drr_length;
+			break;
+		case DRR_FREEOBJECTS:
+		case DRR_FREE:
+			break;
+		default:
+			last = B_TRUE;
+			break;
+		}
+
+		if (rr->rr_len != 0) {
+			rr->rr_data = kmem_alloc(rr->rr_len, KM_SLEEP);
+			err = restore_read(ra, rr->rr_data, rr->rr_len);
+			if (err) {
+				restore_rec_free(rr);
+				break;
+			}
+		}
+
+		mutex_enter(&ra->lock);
+		while (!ra->stop && ra->queued >= zfs_recv_queue_size)
+			cv_wait(&ra->cv, &ra->lock);
+		if (ra->stop) {
+			mutex_exit(&ra->lock);
+			restore_rec_free(rr);
+			break;
+		}
+		list_insert_tail(&ra->queue, rr);
+		ra->queued += sizeof (restore_rec_t) + rr->rr_len;
+		cv_broadcast(&ra->cv);
+		mutex_exit(&ra->lock);
+	}
 
-	tx = dmu_tx_create(os);
+	mutex_enter(&ra->lock);
+	ra->rerr = err;
+	ra->reader = NULL;
+	cv_broadcast(&ra->cv);
+	mutex_exit(&ra->lock);
+
+	thread_exit();
+}
+
+/*
+ * Take the next record off the queue.  If 'wait' is set, wait for the
+ * reader to produce one; NULL then means the reader has stopped.
+ */
+static restore_rec_t *
+restore_next(struct restorearg *ra, boolean_t wait)
+{
+	restore_rec_t *rr;
+
+	mutex_enter(&ra->lock);
+	while ((rr = list_head(&ra->queue)) == NULL && wait &&
+	    ra->reader != NULL)
+		cv_wait(&ra->cv, &ra->lock);
+	if (rr != NULL) {
+		list_remove(&ra->queue, rr);
+		ra->queued -= sizeof (restore_rec_t) + rr->rr_len;
+		cv_broadcast(&ra->cv);
+	}
+	mutex_exit(&ra->lock);
+
+	return (rr);
+}
+
+static restore_rec_t *
+restore_peek(struct restorearg *ra)
+{
+	restore_rec_t *rr;
+
+	mutex_enter(&ra->lock);
+	rr = list_head(&ra->queue);
+	mutex_exit(&ra->lock);
+
+	return (rr);
+}
+
+static void
+restore_start(struct restorearg *ra)
+{
+	mutex_init(&ra->lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&ra->cv, NULL, CV_DEFAULT, NULL);
+	list_create(&ra->queue, sizeof (restore_rec_t),
+	    offsetof(restore_rec_t, rr_node));
+	mutex_enter(&ra->lock);
+	ra->reader = thread_create(NULL, 0, restore_reader, ra, 0, &p0,
+	    TS_RUN, minclsyspri);
+	mutex_exit(&ra->lock);
+}
+
+static void
+restore_stop(struct restorearg *ra)
+{
+	restore_rec_t *rr;
+
+	mutex_enter(&ra->lock);
+	ra->stop = B_TRUE;
+	cv_broadcast(&ra->cv);
+	while (ra->reader != NULL)
+		cv_wait(&ra->cv, &ra->lock);
+	mutex_exit(&ra->lock);
+
+	while ((rr = list_head(&ra->queue)) != NULL) {
+		list_remove(&ra->queue, rr);
+		restore_rec_free(rr);
+	}
+	list_destroy(&ra->queue);
+	cv_destroy(&ra->cv);
+	mutex_destroy(&ra->lock);
+}
 
-	if (err == ENOENT) {
+static void
+restore_object_hold(dmu_tx_t *tx, struct drr_object *drro, boolean_t new)
+{
+	if (new) {
 		/* currently free, want to be allocated */
 		dmu_tx_hold_bonus(tx, DMU_NEW_OBJECT);
 		dmu_tx_hold_write(tx, DMU_NEW_OBJECT, 0, 1);
-		err = dmu_tx_assign(tx, TXG_WAIT);
-		if (err) {
-			dmu_tx_abort(tx);
-			return (err);
-		}
-		err = dmu_object_claim(os, drro->drr_object,
-		    drro->drr_type, drro->drr_blksz,
-		    drro->drr_bonustype, drro->drr_bonuslen, tx);
 	} else {
 		/* currently allocated, want to be allocated */
 		dmu_tx_hold_bonus(tx, drro->drr_object);
@@ -842,36 +1156,36 @@ restore_object(struct restorearg *ra, objset_t *os, struct drr_object *drro)
 		 * hold_write
 		 */
 		dmu_tx_hold_write(tx, drro->drr_object, 0, 1);
-		err = dmu_tx_assign(tx, TXG_WAIT);
-		if (err) {
-			dmu_tx_abort(tx);
-			return (err);
-		}
+	}
+}
 
+static int
+restore_object_apply(struct restorearg *ra, objset_t *os,
+    struct drr_object *drro, void *data, boolean_t new, dmu_tx_t *tx)
+{
+	int err;
+
+	if (new) {
+		err = dmu_object_claim(os, drro->drr_object,
+		    drro->drr_type, drro->drr_blksz,
+		    drro->drr_bonustype, drro->drr_bonuslen, tx);
+	} else {
 		err = dmu_object_reclaim(os, drro->drr_object,
 		    drro->drr_type, drro->drr_blksz,
 		    drro->drr_bonustype, drro->drr_bonuslen, tx);
 	}
-	if (err) {
-		dmu_tx_commit(tx);
+	if (err)
 		return (EINVAL);
-	}
 
 	dmu_object_set_checksum(os, drro->drr_object, drro->drr_checksum, tx);
 	dmu_object_set_compress(os, drro->drr_object, drro->drr_compress, tx);
 
 	if (drro->drr_bonuslen) {
 		dmu_buf_t *db;
-		void *data;
 		VERIFY(0 == dmu_bonus_hold(os, drro->drr_object, FTAG, &db));
 		dmu_buf_will_dirty(db, tx);
 
 		ASSERT3U(db->db_size, >=, drro->drr_bonuslen);
-		data = restore_read(ra, P2ROUNDUP(drro->drr_bonuslen, 8));
-		if (data == NULL) {
-			dmu_tx_commit(tx);
-			return (ra->err);
-		}
 		bcopy(data, db->db_data, drro->drr_bonuslen);
 		if (ra->byteswap) {
 			dmu_ot[drro->drr_bonustype].ot_byteswap(db->db_data,
@@ -879,10 +1193,39 @@ restore_object(struct restorearg *ra, objset_t *os, struct drr_object *drro)
 		}
 		dmu_buf_rele(db, FTAG);
 	}
-	dmu_tx_commit(tx);
 	return (0);
 }
 
+static int
+restore_object(struct restorearg *ra, objset_t *os, struct drr_object *drro,
+    void *data)
+{
+	boolean_t new;
+	int err;
+	dmu_tx_t *tx;
+
+	err = dmu_object_info(os, drro->drr_object, NULL);
+
+	if (err != 0 && err != ENOENT)
+		return (EINVAL);
+
+	if (restore_object_check(drro))
+		return (EINVAL);
+
+	new = (err == ENOENT);
+
+	tx = dmu_tx_create(os);
+	restore_object_hold(tx, drro, new);
+	err = dmu_tx_assign(tx, TXG_WAIT);
+	if (err) {
+		dmu_tx_abort(tx);
+		return (err);
+	}
+	err = restore_object_apply(ra, os, drro, data, new, tx);
+	dmu_tx_commit(tx);
+	return (err);
+}
+
 /* ARGSUSED */
 static int
 restore_freeobjects(struct restorearg *ra, objset_t *os,
@@ -917,22 +1260,26 @@ restore_freeobjects(struct restorearg *ra, objset_t *os,
 	return (0);
 }
 
+static void
+restore_write_apply(struct restorearg *ra, objset_t *os,
+    struct drr_write *drrw, void *data, dmu_tx_t *tx)
+{
+	if (ra->byteswap)
+		dmu_ot[drrw->drr_type].ot_byteswap(data, drrw->drr_length);
+	dmu_write(os, drrw->drr_object,
+	    drrw->drr_offset, drrw->drr_length, data, tx);
+}
+
 static int
 restore_write(struct restorearg *ra, objset_t *os,
-    struct drr_write *drrw)
+    struct drr_write *drrw, void *data)
 {
 	dmu_tx_t *tx;
-	void *data;
 	int err;
 
-	if (drrw->drr_offset + drrw->drr_length < drrw->drr_offset ||
-	    drrw->drr_type >= DMU_OT_NUMTYPES)
+	if (restore_write_check(drrw))
 		return (EINVAL);
 
-	data = restore_read(ra, drrw->drr_length);
-	if (data == NULL)
-		return (ra->err);
-
 	if (dmu_object_info(os, drrw->drr_object, NULL) != 0)
 		return (EINVAL);
 
@@ -945,14 +1292,162 @@ restore_write(struct restorearg *ra, objset_t *os,
 		dmu_tx_abort(tx);
 		return (err);
 	}
-	if (ra->byteswap)
-		dmu_ot[drrw->drr_type].ot_byteswap(data, drrw->drr_length);
-	dmu_write(os, drrw->drr_object,
-	    drrw->drr_offset, drrw->drr_length, data, tx);
+	restore_write_apply(ra, os, drrw, data, tx);
 	dmu_tx_commit(tx);
 	return (0);
 }
 
+/*
+ * Can rr be applied in the same transaction as the records already in
+ * 'batch'?  Sets rr_new (and rr_blkchg) for restore_batch().
+ */
+static boolean_t
+restore_batch_ok(objset_t *os, list_t *batch, restore_rec_t *rr)
+{
+	dmu_object_info_t doi;
+	restore_rec_t *prev;
+	uint64_t object;
+	int err;
+
+	if (rr->rr_drr.drr_type == DRR_OBJECT) {
+		struct drr_object *drro = &rr->rr_drr.drr_u.drr_object;
+
+		object = drro->drr_object;
+		if (restore_object_check(drro))
+			return (B_FALSE);
+	} else if (rr->rr_drr.drr_type == DRR_WRITE) {
+		object = rr->rr_drr.drr_u.drr_write.drr_object;
+		if (restore_write_check(&rr->rr_drr.drr_u.drr_write))
+			return (B_FALSE);
+	} else {
+		return (B_FALSE);
+	}
+
+	for (prev = list_head(batch); prev != NULL;
+	    prev = list_next(batch, prev)) {
+		if (prev->rr_drr.drr_type == DRR_OBJECT &&
+		    prev->rr_drr.drr_u.drr_object.drr_object == object)
+			break;
+	}
+
+	if (rr->rr_drr.drr_type == DRR_OBJECT) {
+		if (prev != NULL)
+			return (B_FALSE);
+		err = dmu_object_info(os, object, &doi);
+		if (err != 0 && err != ENOENT)
+			return (B_FALSE);
+		rr->rr_new = (err == ENOENT);
+		rr->rr_blkchg = (err == 0 && doi.doi_data_block_size !=
+		    rr->rr_drr.drr_u.drr_object.drr_blksz);
+	} else if (prev != NULL) {
+		/*
+		 * Writes are held against the object's current block
+		 * size, so don't write in the same transaction that
+		 * changes it.
+		 */
+		if (prev->rr_blkchg)
+			return (B_FALSE);
+		rr->rr_new = prev->rr_new;
+	} else {
+		if (dmu_object_info(os, object, NULL) != 0)
+			return (B_FALSE);
+		rr->rr_new = B_FALSE;
+	}
+
+	return (B_TRUE);
+}
+
+/*
+ * Apply the run of OBJECT and WRITE records starting with 'first' that
+ * the reader has already queued, up to the batch limits, in a single
+ * transaction.  A stream of many small files is mostly such runs, and
+ * creating, assigning and committing a transaction per record would
+ * otherwise dominate.  If the combined transaction can't be assigned,
+ * the records are applied one at a time, which is what would have
+ * happened anyway.
+ */
+static int
+restore_batch(struct restorearg *ra, objset_t *os, restore_rec_t *first)
+{
+	list_t batch;
+	restore_rec_t *rr;
+	uint64_t bytes = 0;
+	int n = 0;
+	dmu_tx_t *tx;
+	int err = 0;
+
+	list_create(&batch, sizeof (restore_rec_t),
+	    offsetof(restore_rec_t, rr_node));
+
+	if (!restore_batch_ok(os, &batch, first)) {
+		/* let the single-record path find what's wrong */
+		if (first->rr_drr.drr_type == DRR_OBJECT)
+			err = restore_object(ra, os,
+			    &first->rr_drr.drr_u.drr_object, first->rr_data);
+		else
+			err = restore_write(ra, os,
+			    &first->rr_drr.drr_u.drr_write, first->rr_data);
+		restore_rec_free(first);
+		list_destroy(&batch);
+		return (err);
+	}
+
+	rr = first;
+	for (;;) {
+		list_insert_tail(&batch, rr);
+		bytes += rr->rr_len;
+		n++;
+		if (n >= zfs_recv_batch_records || bytes >= zfs_recv_batch_size)
+			break;
+		if ((rr = restore_peek(ra)) == NULL ||
+		    bytes + rr->rr_len > zfs_recv_batch_size ||
+		    !restore_batch_ok(os, &batch, rr))
+			break;
+		VERIFY(restore_next(ra, B_FALSE) == rr);
+	}
+
+	tx = dmu_tx_create(os);
+	for (rr = list_head(&batch); rr != NULL; rr = list_next(&batch, rr)) {
+		if (rr->rr_drr.drr_type == DRR_OBJECT) {
+			restore_object_hold(tx, &rr->rr_drr.drr_u.drr_object,
+			    rr->rr_new);
+		} else {
+			struct drr_write *drrw = &rr->rr_drr.drr_u.drr_write;
+			dmu_tx_hold_write(tx, rr->rr_new ?
+			    DMU_NEW_OBJECT : drrw->drr_object,
+			    drrw->drr_offset, drrw->drr_length);
+		}
+	}
+	if (dmu_tx_assign(tx, TXG_WAIT) != 0) {
+		dmu_tx_abort(tx);
+		tx = NULL;
+	}
+
+	while ((rr = list_head(&batch)) != NULL) {
+		list_remove(&batch, rr);
+		if (err == 0 && rr->rr_drr.drr_type == DRR_OBJECT) {
+			struct drr_object *drro = &rr->rr_drr.drr_u.drr_object;
+			err = (tx == NULL) ?
+			    restore_object(ra, os, drro, rr->rr_data) :
+			    restore_object_apply(ra, os, drro, rr->rr_data,
+			    rr->rr_new, tx);
+		} else if (err == 0) {
+			struct drr_write *drrw = &rr->rr_drr.drr_u.drr_write;
+			if (tx == NULL)
+				err = restore_write(ra, os, drrw, rr->rr_data);
+			else
+				restore_write_apply(ra, os, drrw,
+				    rr->rr_data, tx);
+		}
+		restore_rec_free(rr);
+	}
+
+	if (tx != NULL)
+		dmu_tx_commit(tx);
+	list_destroy(&batch);
+	return (err);
+}
+
 /* ARGSUSED */
 static int
 restore_free(struct restorearg *ra, objset_t *os,
@@ -1007,7 +1502,7 @@ dmu_recv_abort_cleanup(dmu_recv_cookie_t *drc)
 			(void) dsl_dataset_rollback(drc->drc_real_ds,
 			    DMU_OST_NONE);
 		}
-		dsl_dataset_close(drc->drc_real_ds, lmode, FTAG);
+		dsl_dataset_close(drc->drc_real_ds, lmode, dmu_recv_tag);
 	}
 }
 
@@ -1018,9 +1513,8 @@ int
 dmu_recv_stream(dmu_recv_cookie_t *drc, vnode_t *vp, offset_t *voffp)
 {
 	struct restorearg ra = { 0 };
-	dmu_replay_record_t *drr;
+	restore_rec_t *rr;
 	objset_t *os;
-	zio_cksum_t pcksum;
 
 	if (drc->drc_drrb->drr_magic == BSWAP_64(DMU_BACKUP_MAGIC))
 		ra.byteswap = TRUE;
@@ -1054,8 +1548,6 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, vnode_t *vp, offset_t *voffp)
 
 	ra.vp = vp;
 	ra.voff = *voffp;
-	ra.bufsize = 1<<20;
-	ra.buf = kmem_alloc(ra.bufsize, KM_SLEEP);
 
 	/* these were verified in dmu_recv_begin */
 	ASSERT(drc->drc_drrb->drr_version == DMU_BACKUP_STREAM_VERSION);
@@ -1068,72 +1560,56 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, vnode_t *vp, offset_t *voffp)
 
 	ASSERT(drc->drc_real_ds->ds_phys->ds_flags & DS_FLAG_INCONSISTENT);
 
+	restore_start(&ra);
+
 	/*
-	 * Read records and process them.
+	 * Process records as the reader hands them over.
 	 */
-	pcksum = ra.cksum;
-	while (ra.err == 0 &&
-	    NULL != (drr = restore_read(&ra, sizeof (*drr)))) {
+	while (ra.err == 0 && NULL != (rr = restore_next(&ra, B_TRUE))) {
+		dmu_replay_record_t *drr = &rr->rr_drr;
+
 		if (issig(JUSTLOOKING) && issig(FORREAL)) {
+			restore_rec_free(rr);
 			ra.err = EINTR;
 			goto out;
 		}
 
-		if (ra.byteswap)
-			backup_byteswap(drr);
-
 		switch (drr->drr_type) {
 		case DRR_OBJECT:
-		{
-			/*
-			 * We need to make a copy of the record header,
-			 * because restore_{object,write} may need to
-			 * restore_read(), which will invalidate drr.
-			 */
-			struct drr_object drro = drr->drr_u.drr_object;
-			ra.err = restore_object(&ra, os, &drro);
-			break;
-		}
-		case DRR_FREEOBJECTS:
-		{
-			struct drr_freeobjects drrfo =
-			    drr->drr_u.drr_freeobjects;
-			ra.err = restore_freeobjects(&ra, os, &drrfo);
-			break;
-		}
 		case DRR_WRITE:
-		{
-			struct drr_write drrw = drr->drr_u.drr_write;
-			ra.err = restore_write(&ra, os, &drrw);
+			ra.err = restore_batch(&ra, os, rr);
+			continue;
+		case DRR_FREEOBJECTS:
+			ra.err = restore_freeobjects(&ra, os,
+			    &drr->drr_u.drr_freeobjects);
 			break;
-		}
 		case DRR_FREE:
-		{
-			struct drr_free drrf = drr->drr_u.drr_free;
-			ra.err = restore_free(&ra, os, &drrf);
+			ra.err = restore_free(&ra, os, &drr->drr_u.drr_free);
 			break;
-		}
 		case DRR_END:
-		{
-			struct drr_end drre = drr->drr_u.drr_end;
 			/*
-			 * We compare against the *previous* checksum
-			 * value, because the stored checksum is of
-			 * everything before the DRR_END record.
+			 * We compare against the checksum of everything
+			 * before the DRR_END record, because that is what
+			 * the stored checksum covers.
 			 */
-			if (!ZIO_CHECKSUM_EQUAL(drre.drr_checksum, pcksum))
+			if (!ZIO_CHECKSUM_EQUAL(drr->drr_u.drr_end.drr_checksum,
+			    rr->rr_cksum))
 				ra.err = ECKSUM;
+			restore_rec_free(rr);
 			goto out;
-		}
 		default:
+			restore_rec_free(rr);
 			ra.err = EINVAL;
 			goto out;
 		}
-		pcksum = ra.cksum;
+		restore_rec_free(rr);
 	}
+	if (ra.err == 0)
+		ra.err = ra.rerr;
 	ASSERT(ra.err != 0);
 
 out:
+	restore_stop(&ra);
 	dmu_objset_close(os);
 
 	if (ra.err != 0) {
@@ -1145,7 +1621,6 @@ out:
 		dmu_recv_abort_cleanup(drc);
 	}
 
-	kmem_free(ra.buf, ra.bufsize);
 	*voffp = ra.voff;
 	return (ra.err);
 }
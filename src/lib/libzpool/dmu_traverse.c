@@ -37,6 +37,24 @@
 #include <sys/dmu_impl.h>
 #include <sys/zvol.h>
 
+/* # of sibling blocks to read ahead of the visitor, 0 to disable */
+int zfs_traverse_prefetch_limit = 32;
+/* # of threads prefetching the block trees of upcoming objects */
+int zfs_traverse_threads = 4;
+/* # of dnode blocks that may be queued for those threads */
+int zfs_traverse_maxalloc = 8;
+
+typedef struct traverse_prefetch_arg {
+	traverse_handle_t *tp_th;
+	uint64_t	tp_txg;		/* last synced txg when dispatched */
+	uint64_t	tp_mintxg;	/* only fetch blocks born after this */
+	uint64_t	tp_objset;
+	uint64_t	tp_blkid;	/* which block of the meta-dnode */
+	int		tp_first;	/* first dnode in the block to fetch */
+	int		tp_locked;	/* must hold the traverse lock */
+	dnode_phys_t	*tp_dnp;	/* copy of the dnode block */
+} traverse_prefetch_arg_t;
+
 #define	BP_SPAN_SHIFT(level, width)	((level) * (width))
 
 #define	BP_EQUAL(b1, b2)				\
@@ -318,6 +336,272 @@ traverse_callback(traverse_handle_t *th, zseg_t *zseg, traverse_blk_cache_t *bc)
 	return (th->th_func(bc, th->th_spa, th->th_arg));
 }
 
+/*
+ * Prefetches may always fail, whatever the traversal's own reads may do.
+ * A scrub's are still scrub I/O: they go at scrub priority, and are kept
+ * out of the latency that the scrub backs off on.
+ */
+#define	TRAVERSE_PREFETCH_FLAGS(th)				\
+	(ZIO_FLAG_CANFAIL | ZIO_FLAG_SPECULATIVE |		\
+	((th)->th_zio_flags & ZIO_FLAG_SCRUB_THREAD))
+
+#define	TRAVERSE_PREFETCH_PRIORITY(th)				\
+	(((th)->th_zio_flags & ZIO_FLAG_SCRUB_THREAD) ?		\
+	ZIO_PRIORITY_SCRUB : ZIO_PRIORITY_ASYNC_READ)
+
+/*
+ * Prefetching.
+ *
+ * The visitor reads one block at a time, so without help a traversal
+ * runs at the latency of a single disk.  Two things keep it busy:
+ *
+ *  - As find_block() walks an indirect block (or a dnode's blkptrs),
+ *    traverse_prefetch() keeps the next zfs_traverse_prefetch_limit
+ *    siblings that will be visited in flight, as ARC prefetches.
+ *
+ *  - Whenever the visitor moves into a new dnode block, the objects
+ *    after the current one are handed to a small pool of threads that
+ *    read their top-level indirect blocks and prefetch the level below.
+ *
+ * Callbacks are still made from the visitor alone, in bookmark order;
+ * the prefetch work only warms the ARC, which traverse_read() checks
+ * with arc_tryread().  A block pointer is only valid while the tree it
+ * came from is the synced one, so every read is issued under the
+ * traverse lock (unless ADVANCE_NOLOCK says the tree is static) and
+ * waited for before that lock is dropped.
+ */
+
+static void
+traverse_prefetch_read(traverse_handle_t *th, zio_t *pio, blkptr_t *bp,
+    zbookmark_t *zb)
+{
+	uint32_t aflags = ARC_NOWAIT | ARC_PREFETCH;
+
+	(void) arc_read(pio, th->th_spa, bp, zb->zb_level > 0 ?
+	    byteswap_uint64_array : dmu_ot[BP_GET_TYPE(bp)].ot_byteswap,
+	    NULL, NULL, TRAVERSE_PREFETCH_PRIORITY(th),
+	    TRAVERSE_PREFETCH_FLAGS(th), &aflags, zb);
+}
+
+/*
+ * Wait for the visitor's outstanding prefetches.  Returns nonzero if
+ * there were any.
+ */
+static int
+traverse_prefetch_wait(traverse_handle_t *th)
+{
+	if (th->th_prefetch_zio == NULL)
+		return (0);
+
+	(void) zio_wait(th->th_prefetch_zio);
+	th->th_prefetch_zio = NULL;
+	return (1);
+}
+
+/*
+ * bc is about to be read from bp[i]; make sure its next siblings in
+ * bp[0 .. nbp - 1] are on their way.  The window is topped up once the
+ * visitor is halfway through it.
+ */
+static void
+traverse_prefetch(traverse_handle_t *th, zseg_t *zseg, traverse_blk_cache_t *bc,
+    zbookmark_t *pzb, blkptr_t *bp, int i, int nbp)
+{
+	zbookmark_t *zb = &bc->bc_bookmark;
+	zbookmark_t czb;
+	uint64_t limit = zfs_traverse_prefetch_limit;
+	uint64_t blkid;
+	int j;
+
+	if (zfs_traverse_prefetch_limit <= 0 || bc->bc_data == NULL)
+		return;
+
+	if (pzb->zb_objset != zb->zb_objset ||
+	    pzb->zb_object != zb->zb_object ||
+	    pzb->zb_level != zb->zb_level ||
+	    pzb->zb_blkid < zb->zb_blkid ||
+	    pzb->zb_blkid > zb->zb_blkid + limit)
+		*pzb = *zb;
+	else if (pzb->zb_blkid > zb->zb_blkid + limit / 2)
+		return;
+
+	blkid = pzb->zb_blkid;
+
+	for (j = i + (blkid - zb->zb_blkid);
+	    j < nbp && blkid < zb->zb_blkid + limit; j++, blkid++) {
+		if (bp[j].blk_birth <= zseg->seg_mintxg || BP_IS_HOLE(&bp[j]))
+			continue;
+
+		if (th->th_prefetch_zio == NULL)
+			th->th_prefetch_zio = zio_root(th->th_spa, NULL, NULL,
+			    ZIO_FLAG_CANFAIL);
+
+		SET_BOOKMARK(&czb, zb->zb_objset, zb->zb_object,
+		    zb->zb_level, blkid);
+		traverse_prefetch_read(th, th->th_prefetch_zio, &bp[j], &czb);
+		th->th_prefetches++;
+	}
+
+	pzb->zb_blkid = blkid;
+}
+
+/*
+ * Read the top of one object's block tree and prefetch the level below.
+ * Returns the number of blocks requested, at most 'budget'.
+ */
+static int
+traverse_prefetch_dnode(traverse_prefetch_arg_t *tp, zio_t *pio,
+    dnode_phys_t *dnp, uint64_t object, int budget)
+{
+	traverse_handle_t *th = tp->tp_th;
+	spa_t *spa = th->th_spa;
+	int data = (th->th_advance & ADVANCE_DATA);
+	int level = dnp->dn_nlevels - 1;
+	int wshift = dnp->dn_indblkshift - SPA_BLKPTRSHIFT;
+	zbookmark_t zb;
+	int i, j, n = 0;
+
+	for (i = 0; i < dnp->dn_nblkptr && n < budget; i++) {
+		blkptr_t *bp = &dnp->dn_blkptr[i];
+		arc_buf_t *buf = NULL;
+		uint32_t aflags = ARC_WAIT;
+		blkptr_t *cbp;
+
+		if (bp->blk_birth <= tp->tp_mintxg || BP_IS_HOLE(bp))
+			continue;
+
+		SET_BOOKMARK(&zb, tp->tp_objset, object, level, i);
+
+		if (level == 0) {
+			if (data) {
+				traverse_prefetch_read(th, pio, bp, &zb);
+				n++;
+			}
+			continue;
+		}
+
+		(void) arc_read(NULL, spa, bp, byteswap_uint64_array,
+		    arc_getbuf_func, &buf, TRAVERSE_PREFETCH_PRIORITY(th),
+		    TRAVERSE_PREFETCH_FLAGS(th), &aflags, &zb);
+		n++;
+
+		if (buf == NULL)
+			continue;
+
+		cbp = buf->b_data;
+		for (j = 0; j < (1 << wshift) && n < budget &&
+		    (level > 1 || data); j++) {
+			if (cbp[j].blk_birth <= tp->tp_mintxg ||
+			    BP_IS_HOLE(&cbp[j]))
+				continue;
+			SET_BOOKMARK(&zb, tp->tp_objset, object, level - 1,
+			    ((uint64_t)i << wshift) + j);
+			traverse_prefetch_read(th, pio, &cbp[j], &zb);
+			n++;
+		}
+
+		(void) arc_buf_remove_ref(buf, &buf);
+	}
+
+	return (n);
+}
+
+static void
+traverse_prefetch_task(void *arg)
+{
+	traverse_prefetch_arg_t *tp = arg;
+	spa_t *spa = tp->tp_th->th_spa;
+	krwlock_t *rw = spa_traverse_rwlock(spa);
+	int budget = zfs_traverse_prefetch_limit;
+	zio_t *pio;
+	int i;
+
+	if (tp->tp_locked) {
+		rw_enter(rw, RW_READER);
+		/*
+		 * If spa_sync() got in ahead of us, the block pointers we
+		 * copied may since have been freed.
+		 */
+		if (spa_last_synced_txg(spa) != tp->tp_txg) {
+			rw_exit(rw);
+			goto out;
+		}
+	}
+
+	pio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+
+	for (i = tp->tp_first; i < DNODES_PER_BLOCK && budget > 0; i++) {
+		if (tp->tp_locked && spa_traverse_wanted(spa))
+			break;
+		if (tp->tp_dnp[i].dn_type == DMU_OT_NONE)
+			continue;
+		budget -= traverse_prefetch_dnode(tp, pio, &tp->tp_dnp[i],
+		    tp->tp_blkid * DNODES_PER_BLOCK + i, budget);
+	}
+
+	(void) zio_wait(pio);
+
+	if (tp->tp_locked)
+		rw_exit(rw);
+out:
+	zio_buf_free(tp->tp_dnp, 1 << DNODE_BLOCK_SHIFT);
+	kmem_free(tp, sizeof (traverse_prefetch_arg_t));
+}
+
+/*
+ * The visitor has just found 'object' in the dnode block cached at
+ * th_cache[ZB_MDN_CACHE][0].  Hand the objects after it to the prefetch
+ * threads, once per dnode block.  If they're all busy we don't wait.
+ */
+static void
+traverse_prefetch_objects(traverse_handle_t *th, zseg_t *zseg,
+    uint64_t object)
+{
+	traverse_blk_cache_t *bc = &th->th_cache[ZB_MDN_CACHE][0];
+	zbookmark_t *zb = &bc->bc_bookmark;
+	zbookmark_t *pzb = &th->th_prefetch_dnblk;
+	traverse_prefetch_arg_t *tp;
+	int first = (object % DNODES_PER_BLOCK) + 1;
+
+	/*
+	 * A walk of a destroyed objset (th_osbp) frees blocks as it visits
+	 * them, maybe while a prefetch thread holds them; it goes alone.
+	 */
+	if (zfs_traverse_threads <= 0 || zfs_traverse_prefetch_limit <= 0 ||
+	    th->th_osbp != NULL || first >= DNODES_PER_BLOCK ||
+	    zseg->seg_start.zb_object == zseg->seg_end.zb_object)
+		return;
+
+	if (pzb->zb_objset == zb->zb_objset && pzb->zb_level == zb->zb_level &&
+	    pzb->zb_blkid == zb->zb_blkid)
+		return;
+
+	*pzb = *zb;
+
+	if (th->th_taskq == NULL)
+		th->th_taskq = taskq_create("traverse_prefetch",
+		    zfs_traverse_threads, minclsyspri, zfs_traverse_threads,
+		    MAX(zfs_traverse_threads, zfs_traverse_maxalloc),
+		    TASKQ_PREPOPULATE);
+
+	tp = kmem_alloc(sizeof (traverse_prefetch_arg_t), KM_SLEEP);
+	tp->tp_th = th;
+	tp->tp_txg = spa_last_synced_txg(th->th_spa);
+	tp->tp_mintxg = zseg->seg_mintxg;
+	tp->tp_objset = zb->zb_objset;
+	tp->tp_blkid = zb->zb_blkid;
+	tp->tp_first = first;
+	tp->tp_locked = th->th_locked;
+	tp->tp_dnp = zio_buf_alloc(1 << DNODE_BLOCK_SHIFT);
+	bcopy(bc->bc_data, tp->tp_dnp, 1 << DNODE_BLOCK_SHIFT);
+
+	if (taskq_dispatch(th->th_taskq, traverse_prefetch_task, tp,
+	    TQ_NOSLEEP) == 0) {
+		zio_buf_free(tp->tp_dnp, 1 << DNODE_BLOCK_SHIFT);
+		kmem_free(tp, sizeof (traverse_prefetch_arg_t));
+	}
+}
+
 static int
 traverse_read(traverse_handle_t *th, traverse_blk_cache_t *bc, blkptr_t *bp,
 	dnode_phys_t *dnp)
@@ -345,7 +629,9 @@ traverse_read(traverse_handle_t *th, traverse_blk_cache_t *bc, blkptr_t *bp,
 
 	if (compare_bookmark(zb, &th->th_noread, dnp, 0) == 0) {
 		error = EIO;
-	} else if (arc_tryread(th->th_spa, bp, bc->bc_data) == 0) {
+	} else if (arc_tryread(th->th_spa, bp, bc->bc_data) == 0 ||
+	    (traverse_prefetch_wait(th) &&
+	    arc_tryread(th->th_spa, bp, bc->bc_data) == 0)) {
 		error = 0;
 		th->th_arc_hits++;
 	} else {
@@ -412,6 +698,9 @@ find_block(traverse_handle_t *th, zseg_t *zseg, dnode_phys_t *dnp, int depth)
 		SET_BOOKMARK(&bc->bc_bookmark, zb->zb_objset, zb->zb_object,
 		    level, blkid);
 
+		traverse_prefetch(th, zseg, bc, &th->th_prefetch[depth][level],
+		    bp, i, nbp);
+
 		if (rc = traverse_read(th, bc, bp + i, dnp)) {
 			if (rc != EAGAIN) {
 				SET_BOOKMARK_LB(zb, level, blkid);
@@ -568,19 +857,39 @@ traverse_segment(traverse_handle_t *th, zseg_t *zseg, blkptr_t *mosbp)
 	dprintf("<%llu, %llu, %d, %llx>\n",
 	    zb->zb_objset, zb->zb_object, zb->zb_level, zb->zb_blkid);
 
-	bc = &th->th_cache[ZB_MOS_CACHE][ZB_MAXLEVEL - 1];
-	dn = &((objset_phys_t *)bc->bc_data)->os_meta_dnode;
+	/*
+	 * If we were given the objset's root, go straight to it: the
+	 * objset may no longer be reachable from the MOS.
+	 */
+	if (th->th_osbp != NULL) {
+		ASSERT(zb->zb_objset != 0);
+
+		bc = &th->th_cache[ZB_MDN_CACHE][ZB_MAXLEVEL - 1];
+		dn = &((objset_phys_t *)bc->bc_data)->os_meta_dnode;
 
-	SET_BOOKMARK(&bc->bc_bookmark, 0, 0, -1, 0);
+		SET_BOOKMARK(&bc->bc_bookmark, zb->zb_objset, 0, -1, 0);
+
+		rc = traverse_read(th, bc, th->th_osbp, dn);
+
+		/* If we get ERESTART, none of the objset can be reached */
+		if (rc)
+			return (rc == ERESTART ? ERANGE : rc);
+	} else {
+		bc = &th->th_cache[ZB_MOS_CACHE][ZB_MAXLEVEL - 1];
+		dn = &((objset_phys_t *)bc->bc_data)->os_meta_dnode;
 
-	rc = traverse_read(th, bc, mosbp, dn);
+		SET_BOOKMARK(&bc->bc_bookmark, 0, 0, -1, 0);
 
-	if (rc)		/* If we get ERESTART, we've got nowhere left to go */
-		return (rc == ERESTART ? EINTR : rc);
+		rc = traverse_read(th, bc, mosbp, dn);
+
+		/* If we get ERESTART, we've got nowhere left to go */
+		if (rc)
+			return (rc == ERESTART ? EINTR : rc);
+	}
 
 	ASSERT(dn->dn_nlevels < ZB_MAXLEVEL);
 
-	if (zb->zb_objset != 0) {
+	if (zb->zb_objset != 0 && th->th_osbp == NULL) {
 		uint64_t objset = zb->zb_objset;
 		dsl_dataset_phys_t *dsp;
 
@@ -610,6 +919,7 @@ traverse_segment(traverse_handle_t *th, zseg_t *zseg, blkptr_t *mosbp)
 		 */
 		if (th->th_advance & ADVANCE_NOLOCK) {
 			ASSERT(th->th_locked);
+			(void) traverse_prefetch_wait(th);
 			rw_exit(spa_traverse_rwlock(th->th_spa));
 			th->th_locked = 0;
 		}
@@ -659,6 +969,8 @@ traverse_segment(traverse_handle_t *th, zseg_t *zseg, blkptr_t *mosbp)
 		if (rc != 0)
 			return (rc);
 
+		traverse_prefetch_objects(th, zseg, object);
+
 		dn = dn_tmp;
 	}
 
@@ -772,6 +1084,8 @@ traverse_more(traverse_handle_t *th)
 	rc = traverse_segment(th, zseg, mosbp);
 	ASSERT(rc == ERANGE || rc == EAGAIN || rc == EINTR);
 
+	(void) traverse_prefetch_wait(th);
+
 	if (th->th_locked)
 		rw_exit(rw);
 	th->th_locked = 0;
@@ -858,6 +1172,58 @@ traverse_add_pool(traverse_handle_t *th, uint64_t mintxg, uint64_t maxtxg)
 		    0, 0, -1, 0);
 }
 
+/*
+ * Set *zb to where traverse_objset_bp() starts on objset 'objset'.
+ */
+void
+traverse_objset_bp_init(zbookmark_t *zb, uint64_t objset)
+{
+	SET_BOOKMARK(zb, objset, 1, 0, 0);
+}
+
+/*
+ * Visit, in post-order, the blocks born after txg_start of the objset
+ * whose objset_phys_t *osbp points to, from *zb on.  Nothing but the
+ * block pointer need remain of the objset (this is how the remains of
+ * destroyed datasets are freed), so long as the blocks not yet visited
+ * aren't freed behind our back.
+ *
+ * If func returns EINTR, so do we, with *zb left at the block it was
+ * called on; calling us again with that bookmark picks up from there.
+ * Otherwise we visit every block and return 0.  A block that can't be
+ * read is passed to func with bc_errno set, and func must return
+ * ERESTART: the blocks under it are then skipped.  zb->zb_objset only
+ * names the objset in bookmarks (and error reports), and mustn't be 0.
+ */
+int
+traverse_objset_bp(spa_t *spa, blkptr_t *osbp, uint64_t txg_start,
+    zbookmark_t *zb, blkptr_cb_t func, void *arg)
+{
+	traverse_handle_t *th;
+	zseg_t *zseg;
+	int err;
+
+	ASSERT(zb->zb_objset != 0);
+
+	th = traverse_init(spa, func, arg, ADVANCE_POST, ZIO_FLAG_CANFAIL);
+	th->th_osbp = osbp;
+
+	traverse_add_segment(th, txg_start, -1ULL,
+	    zb->zb_objset, zb->zb_object, zb->zb_level, zb->zb_blkid,
+	    zb->zb_objset, 0, -1, 0);
+
+	while ((err = traverse_more(th)) == EAGAIN)
+		continue;
+
+	if (err == EINTR) {
+		zseg = list_head(&th->th_seglist);
+		*zb = zseg->seg_start;
+	}
+
+	traverse_fini(th);
+	return (err);
+}
+
 traverse_handle_t *
 traverse_init(spa_t *spa, blkptr_cb_t func, void *arg, int advance,
     int zio_flags)
@@ -873,6 +1239,7 @@ traverse_init(spa_t *spa, blkptr_cb_t func, void *arg, int advance,
 	th->th_advance = advance;
 	th->th_lastcb.zb_level = ZB_NO_LEVEL;
 	th->th_noread.zb_level = ZB_NO_LEVEL;
+	th->th_prefetch_dnblk.zb_level = ZB_NO_LEVEL;
 	th->th_zio_flags = zio_flags;
 
 	list_create(&th->th_seglist, sizeof (zseg_t),
@@ -880,6 +1247,7 @@ traverse_init(spa_t *spa, blkptr_cb_t func, void *arg, int advance,
 
 	for (d = 0; d < ZB_DEPTH; d++) {
 		for (l = 0; l < ZB_MAXLEVEL; l++) {
+			th->th_prefetch[d][l].zb_level = ZB_NO_LEVEL;
 			if ((advance & ADVANCE_DATA) ||
 			    l != 0 || d != ZB_DN_CACHE)
 				th->th_cache[d][l].bc_data =
@@ -896,6 +1264,11 @@ traverse_fini(traverse_handle_t *th)
 	int d, l;
 	zseg_t *zseg;
 
+	ASSERT(th->th_prefetch_zio == NULL);
+
+	if (th->th_taskq != NULL)
+		taskq_destroy(th->th_taskq);
+
 	for (d = 0; d < ZB_DEPTH; d++)
 		for (l = 0; l < ZB_MAXLEVEL; l++)
 			if (th->th_cache[d][l].bc_data != NULL)
@@ -909,8 +1282,9 @@ traverse_fini(traverse_handle_t *th)
 
 	list_destroy(&th->th_seglist);
 
-	dprintf("%llu hit, %llu ARC, %llu IO, %llu cb, %llu sync, %llu again\n",
-	    th->th_hits, th->th_arc_hits, th->th_reads, th->th_callbacks,
+	dprintf("%llu hit, %llu ARC, %llu IO, %llu prefetch, %llu cb, "
+	    "%llu sync, %llu again\n", th->th_hits, th->th_arc_hits,
+	    th->th_reads, th->th_prefetches, th->th_callbacks,
 	    th->th_syncs, th->th_restarts);
 
 	kmem_free(th, sizeof (*th));
@@ -884,9 +884,15 @@ dmu_tx_unassign(dmu_tx_t *tx)
  * (2)	TXG_NOWAIT.  If we can't assign into the current open txg without
  *	blocking, returns immediately with ERESTART.  This should be used
  *	whenever you're holding locks.  On an ERESTART error, the caller
- *	should drop locks, do a dmu_tx_wait(tx), and try again.
+ *	should drop locks, do a dmu_tx_wait(tx), and try again.  This is
+ *	also how writers are throttled while the open txg fills up: the
+ *	delay happens in dmu_tx_wait().
  *
- * (3)	A specific txg.  Use this if you need to ensure that multiple
+ * (3)	TXG_WAITED.  Like TXG_NOWAIT, but for the retry after an ERESTART
+ *	and dmu_tx_wait(): the caller has already been delayed, so the
+ *	write throttle lets it through.
+ *
+ * (4)	A specific txg.  Use this if you need to ensure that multiple
  *	transactions all sync in the same txg.  Like TXG_NOWAIT, it
  *	returns ERESTART if it can't assign you into the requested txg.
  */
@@ -899,6 +905,21 @@ dmu_tx_assign(dmu_tx_t *tx, uint64_t txg_how)
 	ASSERT(txg_how != 0);
 	ASSERT(!dsl_pool_sync_context(tx->tx_pool));
 
+	/*
+	 * Slow down writers while the open txg is filling up, before we
+	 * hold it open.  A TXG_NOWAIT caller holds locks, so it sleeps in
+	 * dmu_tx_wait() after dropping them instead of here, and retries
+	 * with TXG_WAITED.  Callers asking for a specific txg are not
+	 * delayed.
+	 */
+	if (txg_how == TXG_WAIT) {
+		dsl_pool_throttle(tx->tx_pool);
+	} else if (txg_how == TXG_NOWAIT &&
+	    dsl_pool_need_throttle(tx->tx_pool)) {
+		tx->tx_wait_dirty = B_TRUE;
+		return (ERESTART);
+	}
+
 	while ((err = dmu_tx_try_assign(tx, txg_how)) != 0) {
 		dmu_tx_unassign(tx);
 
@@ -920,6 +941,12 @@ dmu_tx_wait(dmu_tx_t *tx)
 
 	ASSERT(tx->tx_txg == 0);
 
+	if (tx->tx_wait_dirty) {
+		dsl_pool_throttle(tx->tx_pool);
+		tx->tx_wait_dirty = B_FALSE;
+		return;
+	}
+
 	/*
 	 * It's possible that the pool has become active after this thread
 	 * has tried to obtain a tx. If that's the case then his
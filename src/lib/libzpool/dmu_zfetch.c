@@ -40,25 +40,112 @@
 int zfs_prefetch_disable = 0;
 
 /* max # of streams per zfetch */
-uint32_t	zfetch_max_streams = 8;
+uint32_t	zfetch_max_streams = 16;
 /* min time before stream reclaim */
 uint32_t	zfetch_min_sec_reap = 2;
-/* max number of blocks to fetch at a time */
+/* initial max number of blocks to fetch at a time */
 uint32_t	zfetch_block_cap = 256;
+/* max distance, in bytes, an adapting stream may prefetch ahead (64Mb) */
+uint64_t	zfetch_max_distance = 64 * 1024 * 1024;
+/* # of stream hits between prefetch distance adjustments */
+uint32_t	zfetch_adapt_interval = 32;
+/* % of late hits (block still in flight) above which a stream goes deeper */
+uint32_t	zfetch_late_pct = 10;
 /* number of bytes in a array_read at which we stop prefetching (1Mb) */
 uint64_t	zfetch_array_rd_sz = 1024 * 1024;
+/* # of threads issuing prefetch i/o on behalf of readers */
+int		zfetch_threads = 4;
+/* # of outstanding prefetch requests before readers issue their own */
+int		zfetch_maxalloc = 1024;
+
+/*
+ * Prefetches are handed off to zfetch_taskq so that the reader does not
+ * have to walk (and possibly read) indirect blocks for every block it
+ * prefetches.  A request holds its dnode until it has been issued.
+ */
+typedef struct zfetch_req {
+	dnode_t		*zr_dnode;
+	int		zr_level;
+	uint64_t	zr_blkid;
+	uint64_t	zr_nblks;
+} zfetch_req_t;
+
+static taskq_t *zfetch_taskq;
 
 /* forward decls for static routines */
+static void		dmu_zfetch_adapt(zfetch_t *, zstream_t *);
 static int		dmu_zfetch_colinear(zfetch_t *, zstream_t *);
 static void		dmu_zfetch_dofetch(zfetch_t *, zstream_t *);
-static uint64_t		dmu_zfetch_fetch(dnode_t *, uint64_t, uint64_t);
-static uint64_t		dmu_zfetch_fetchsz(dnode_t *, uint64_t, uint64_t);
-static int		dmu_zfetch_find(zfetch_t *, zstream_t *, int);
+static uint64_t		dmu_zfetch_fetch(dnode_t *, int, uint64_t, uint64_t);
+static uint64_t		dmu_zfetch_fetchsz(dnode_t *, int, uint64_t, uint64_t);
+static int		dmu_zfetch_find(zfetch_t *, zstream_t *, int, int);
+static void		dmu_zfetch_issue_done(zfetch_req_t *);
+static void		dmu_zfetch_issue_task(void *);
 static int		dmu_zfetch_stream_insert(zfetch_t *, zstream_t *);
 static zstream_t	*dmu_zfetch_stream_reclaim(zfetch_t *);
 static void		dmu_zfetch_stream_remove(zfetch_t *, zstream_t *);
 static int		dmu_zfetch_streams_equal(zstream_t *, zstream_t *);
 
+void
+zfetch_init(void)
+{
+	zfetch_taskq = taskq_create("zfetch_taskq", zfetch_threads,
+	    minclsyspri, zfetch_threads, zfetch_maxalloc, TASKQ_PREPOPULATE);
+}
+
+void
+zfetch_fini(void)
+{
+	taskq_destroy(zfetch_taskq);
+	zfetch_taskq = NULL;
+}
+
+/*
+ * Wait for the prefetches handed to zfetch_taskq on behalf of this objset
+ * to be issued, so that they no longer hold any of its dnodes.  We can't
+ * simply wait for the taskq to drain, since readers of other objsets may
+ * keep it busy indefinitely.
+ */
+void
+zfetch_wait(objset_impl_t *os)
+{
+	mutex_enter(&os->os_lock);
+	while (os->os_zfetch_pending != 0)
+		cv_wait(&os->os_zfetch_cv, &os->os_lock);
+	mutex_exit(&os->os_lock);
+}
+
+/*
+ * Adjust how far ahead a stream may prefetch.  A "late" hit is a read of a
+ * block whose prefetch was issued but has not yet completed: the stream is
+ * consuming data faster than the devices return it, so prefetch further
+ * ahead.  If no hits were late over a whole interval, back off slowly
+ * towards the default so that idle streams don't pin memory in the ARC.
+ * Called with zst_lock held.
+ */
+static void
+dmu_zfetch_adapt(zfetch_t *zf, zstream_t *zs)
+{
+	uint64_t	max_cap;
+
+	ASSERT(MUTEX_HELD(&zs->zst_lock));
+
+	if (zs->zst_hits < zfetch_adapt_interval)
+		return;
+
+	max_cap = MAX(zfetch_block_cap,
+	    zfetch_max_distance >> zf->zf_dnode->dn_datablkshift);
+
+	if (zs->zst_late * 100 > zs->zst_hits * zfetch_late_pct) {
+		zs->zst_max_cap = MIN(max_cap, 2 * zs->zst_max_cap);
+	} else if (zs->zst_late == 0) {
+		zs->zst_max_cap = MAX(zfetch_block_cap,
+		    zs->zst_max_cap - (zs->zst_max_cap >> 3));
+	}
+	zs->zst_hits = 0;
+	zs->zst_late = 0;
+}
+
 /*
  * Given a zfetch structure and a zstream structure, determine whether the
  * blocks to be read are part of a co-linear pair of existing prefetch
@@ -153,7 +240,7 @@ dmu_zfetch_dofetch(zfetch_t *zf, zstream_t *zs)
 	uint64_t	blocks_fetched;
 
 	zs->zst_stride = MAX((int64_t)zs->zst_stride, zs->zst_len);
-	zs->zst_cap = MIN(zfetch_block_cap, 2 * zs->zst_cap);
+	zs->zst_cap = MIN(zs->zst_max_cap, 2 * zs->zst_cap);
 
 	prefetch_tail = MAX((int64_t)zs->zst_ph_offset,
 	    (int64_t)(zs->zst_offset + zs->zst_stride));
@@ -183,7 +270,7 @@ dmu_zfetch_dofetch(zfetch_t *zf, zstream_t *zs)
 		if (prefetch_len > zs->zst_len)
 			break;
 
-		blocks_fetched = dmu_zfetch_fetch(zf->zf_dnode,
+		blocks_fetched = dmu_zfetch_fetch(zf->zf_dnode, 0,
 		    prefetch_ofst, zs->zst_len);
 
 		prefetch_tail += zs->zst_stride;
@@ -193,6 +280,32 @@ dmu_zfetch_dofetch(zfetch_t *zf, zstream_t *zs)
 	}
 	zs->zst_ph_offset = prefetch_tail;
 	zs->zst_last = lbolt;
+
+	/*
+	 * Stay ahead of the data prefetch with the level 1 indirect blocks
+	 * it will need, so that issuing it never has to wait on an indirect
+	 * block read.  Only done for forward sequential streams, which are
+	 * the ones that run far enough ahead for this to matter; a strided
+	 * stream's window spans cap strides, which on a sparse object can
+	 * be millions of indirect blocks, mostly holes.
+	 */
+	if (zs->zst_direction == ZFETCH_FORWARD &&
+	    zs->zst_stride == zs->zst_len &&
+	    zf->zf_dnode->dn_nlevels > 1) {
+		dnode_t		*dn = zf->zf_dnode;
+		int		epbs = dn->dn_indblkshift - SPA_BLKPTRSHIFT;
+		uint64_t	ind_first;
+		uint64_t	ind_last;
+
+		ind_first = MAX(zs->zst_ind_ph, prefetch_tail >> epbs);
+		ind_last = (prefetch_limit +
+		    (prefetch_limit - zs->zst_offset)) >> epbs;
+		if (ind_first <= ind_last) {
+			(void) dmu_zfetch_fetch(dn, 1, ind_first,
+			    ind_last - ind_first + 1);
+			zs->zst_ind_ph = ind_last + 1;
+		}
+	}
 }
 
 /*
@@ -222,18 +335,88 @@ dmu_zfetch_init(zfetch_t *zf, dnode_t *dno)
  * and fetches it.
  */
 static uint64_t
-dmu_zfetch_fetch(dnode_t *dn, uint64_t blkid, uint64_t nblks)
+dmu_zfetch_fetch(dnode_t *dn, int level, uint64_t blkid, uint64_t nblks)
 {
 	uint64_t	fetchsz;
+
+	fetchsz = dmu_zfetch_fetchsz(dn, level, blkid, nblks);
+
+	if (fetchsz > 0)
+		dmu_zfetch_issue(dn, level, blkid, fetchsz);
+
+	return (fetchsz);
+}
+
+/*
+ * Hand a range of blocks to zfetch_taskq to be prefetched.  If the taskq
+ * is backed up, or the dnode is going away, prefetch them from the
+ * caller's thread instead, just as if there were no taskq.
+ */
+void
+dmu_zfetch_issue(dnode_t *dn, int level, uint64_t blkid, uint64_t nblks)
+{
+	objset_impl_t	*os = dn->dn_objset;
+	zfetch_req_t	*zr;
 	uint64_t	i;
 
-	fetchsz = dmu_zfetch_fetchsz(dn, blkid, nblks);
+	ASSERT(RW_LOCK_HELD(&dn->dn_struct_rwlock));
+
+	if (zfetch_taskq != NULL) {
+		zr = kmem_alloc(sizeof (zfetch_req_t), KM_SLEEP);
+		zr->zr_dnode = dn;
+		zr->zr_level = level;
+		zr->zr_blkid = blkid;
+		zr->zr_nblks = nblks;
 
-	for (i = 0; i < fetchsz; i++) {
-		dbuf_prefetch(dn, blkid + i);
+		if (!dnode_add_ref(dn, zr)) {
+			kmem_free(zr, sizeof (zfetch_req_t));
+		} else {
+			mutex_enter(&os->os_lock);
+			os->os_zfetch_pending++;
+			mutex_exit(&os->os_lock);
+			if (taskq_dispatch(zfetch_taskq, dmu_zfetch_issue_task,
+			    zr, TQ_NOSLEEP) != 0)
+				return;
+			dmu_zfetch_issue_done(zr);
+		}
 	}
 
-	return (fetchsz);
+	for (i = 0; i < nblks; i++)
+		dbuf_prefetch(dn, level, blkid + i);
+}
+
+/*
+ * Drop a request's dnode hold and let zfetch_wait() know it is gone.
+ */
+static void
+dmu_zfetch_issue_done(zfetch_req_t *zr)
+{
+	dnode_t		*dn = zr->zr_dnode;
+	objset_impl_t	*os = dn->dn_objset;
+
+	dnode_rele(dn, zr);
+	kmem_free(zr, sizeof (zfetch_req_t));
+
+	mutex_enter(&os->os_lock);
+	ASSERT(os->os_zfetch_pending > 0);
+	if (--os->os_zfetch_pending == 0)
+		cv_broadcast(&os->os_zfetch_cv);
+	mutex_exit(&os->os_lock);
+}
+
+static void
+dmu_zfetch_issue_task(void *arg)
+{
+	zfetch_req_t	*zr = arg;
+	dnode_t		*dn = zr->zr_dnode;
+	uint64_t	i;
+
+	rw_enter(&dn->dn_struct_rwlock, RW_READER);
+	for (i = 0; i < zr->zr_nblks; i++)
+		dbuf_prefetch(dn, zr->zr_level, zr->zr_blkid + i);
+	rw_exit(&dn->dn_struct_rwlock);
+
+	dmu_zfetch_issue_done(zr);
 }
 
 /*
@@ -244,18 +427,22 @@ dmu_zfetch_fetch(dnode_t *dn, uint64_t blkid, uint64_t nblks)
  * stream won't result in the same data being prefetched multiple times.
  */
 static uint64_t
-dmu_zfetch_fetchsz(dnode_t *dn, uint64_t blkid, uint64_t nblks)
+dmu_zfetch_fetchsz(dnode_t *dn, int level, uint64_t blkid, uint64_t nblks)
 {
 	uint64_t	fetchsz;
+	uint64_t	maxblkid;
+
+	maxblkid = dn->dn_maxblkid >>
+	    (level * (dn->dn_indblkshift - SPA_BLKPTRSHIFT));
 
-	if (blkid > dn->dn_maxblkid) {
+	if (blkid > maxblkid) {
 		return (0);
 	}
 
 	/* compute fetch size */
-	if (blkid + nblks + 1 > dn->dn_maxblkid) {
-		fetchsz = (dn->dn_maxblkid - blkid) + 1;
-		ASSERT(blkid + fetchsz - 1 <= dn->dn_maxblkid);
+	if (blkid + nblks + 1 > maxblkid) {
+		fetchsz = (maxblkid - blkid) + 1;
+		ASSERT(blkid + fetchsz - 1 <= maxblkid);
 	} else {
 		fetchsz = nblks;
 	}
@@ -270,7 +457,7 @@ dmu_zfetch_fetchsz(dnode_t *dn, uint64_t blkid, uint64_t nblks)
  * located and returns true, otherwise it returns false
  */
 static int
-dmu_zfetch_find(zfetch_t *zf, zstream_t *zh, int prefetched)
+dmu_zfetch_find(zfetch_t *zf, zstream_t *zh, int prefetched, int late)
 {
 	zstream_t	*zs;
 	int64_t		diff;
@@ -432,6 +619,10 @@ top:
 			}
 		} else {
 			rc = 1;
+			zs->zst_hits++;
+			if (late)
+				zs->zst_late++;
+			dmu_zfetch_adapt(zf, zs);
 			dmu_zfetch_dofetch(zf, zs);
 			mutex_exit(&zs->zst_lock);
 		}
@@ -569,9 +760,12 @@ dmu_zfetch_streams_equal(zstream_t *zs1, zstream_t *zs2)
 /*
  * This is the prefetch entry point.  It calls all of the other dmu_zfetch
  * routines to create, delete, find, or operate upon prefetch streams.
+ * "late" is set when the block was found still being read in by an
+ * earlier prefetch.
  */
 void
-dmu_zfetch(zfetch_t *zf, uint64_t offset, uint64_t size, int prefetched)
+dmu_zfetch(zfetch_t *zf, uint64_t offset, uint64_t size, int prefetched,
+    int late)
 {
 	zstream_t	zst;
 	zstream_t	*newstream;
@@ -596,7 +790,7 @@ dmu_zfetch(zfetch_t *zf, uint64_t offset, uint64_t size, int prefetched)
 	zst.zst_len = (P2ROUNDUP(offset + size, blksz) -
 	    P2ALIGN(offset, blksz)) >> blkshft;
 
-	fetched = dmu_zfetch_find(zf, &zst, prefetched);
+	fetched = dmu_zfetch_find(zf, &zst, prefetched, late);
 	if (!fetched) {
 		fetched = dmu_zfetch_colinear(zf, &zst);
 	}
@@ -634,6 +828,7 @@ dmu_zfetch(zfetch_t *zf, uint64_t offset, uint64_t size, int prefetched)
 		newstream->zst_stride = zst.zst_len;
 		newstream->zst_ph_offset = zst.zst_len + zst.zst_offset;
 		newstream->zst_cap = zst.zst_len;
+		newstream->zst_max_cap = zfetch_block_cap;
 		newstream->zst_direction = ZFETCH_FORWARD;
 		newstream->zst_last = lbolt;
 
@@ -1085,33 +1085,35 @@ dsl_dataset_unique(dsl_dataset_t *ds)
 	return (ds->ds_phys->ds_unique_bytes);
 }
 
-struct killarg {
-	int64_t *usedp;
-	int64_t *compressedp;
-	int64_t *uncompressedp;
-	zio_t *zio;
-	dmu_tx_t *tx;
-};
-
-static int
-kill_blkptr(traverse_blk_cache_t *bc, spa_t *spa, void *arg)
+/*
+ * Compute the space taken by the blocks of head dataset ds that were born
+ * after its previous snapshot (or origin) ds_prev: that's what ds refers
+ * to, less what ds_prev refers to, plus what of it has died since, which
+ * is on our deadlist.  These are the blocks that destroying ds, or
+ * rolling it back, frees.
+ */
+static void
+dsl_dataset_head_space(dsl_dataset_t *ds, dsl_dataset_t *ds_prev,
+    uint64_t *usedp, uint64_t *compp, uint64_t *uncompp)
 {
-	struct killarg *ka = arg;
-	blkptr_t *bp = &bc->bc_blkptr;
+	uint64_t dlused, dlcomp, dluncomp;
 
-	ASSERT3U(bc->bc_errno, ==, 0);
+	*usedp = ds->ds_phys->ds_used_bytes;
+	*compp = ds->ds_phys->ds_compressed_bytes;
+	*uncompp = ds->ds_phys->ds_uncompressed_bytes;
 
-	/*
-	 * Since this callback is not called concurrently, no lock is
-	 * needed on the accounting values.
-	 */
-	*ka->usedp += bp_get_dasize(spa, bp);
-	*ka->compressedp += BP_GET_PSIZE(bp);
-	*ka->uncompressedp += BP_GET_UCSIZE(bp);
-	/* XXX check for EIO? */
-	(void) arc_free(ka->zio, spa, ka->tx->tx_txg, bp, NULL, NULL,
-	    ARC_NOWAIT);
-	return (0);
+	if (ds_prev == NULL) {
+		ASSERT(bplist_empty(&ds->ds_deadlist));
+		return;
+	}
+
+	VERIFY(0 == bplist_space(&ds->ds_deadlist, &dlused, &dlcomp,
+	    &dluncomp));
+
+	ASSERT3U(dlused, <=, ds_prev->ds_phys->ds_used_bytes);
+	*usedp -= ds_prev->ds_phys->ds_used_bytes - dlused;
+	*compp -= ds_prev->ds_phys->ds_compressed_bytes - dlcomp;
+	*uncompp -= ds_prev->ds_phys->ds_uncompressed_bytes - dluncomp;
 }
 
 /* ARGSUSED */
@@ -1134,8 +1136,8 @@ dsl_dataset_rollback_check(void *arg1, void *arg2, dmu_tx_t *tx)
 		return (EINVAL);
 
 	/*
-	 * If we made changes this txg, traverse_dsl_dataset won't find
-	 * them.  Try again.
+	 * If we made changes this txg, they aren't in ds_bp yet, so we
+	 * wouldn't free them.  Try again.
 	 */
 	if (ds->ds_phys->ds_bp.blk_birth >= tx->tx_txg)
 		return (EAGAIN);
@@ -1173,38 +1175,38 @@ dsl_dataset_rollback_sync(void *arg1, void *arg2, cred_t *cr, dmu_tx_t *tx)
 		ds->ds_user_ptr = NULL;
 	}
 
-	/* Zero out the deadlist. */
-	bplist_close(&ds->ds_deadlist);
-	bplist_destroy(mos, ds->ds_phys->ds_deadlist_obj, tx);
-	ds->ds_phys->ds_deadlist_obj =
-	    bplist_create(mos, DSL_DEADLIST_BLOCKSIZE, tx);
-	VERIFY(0 == bplist_open(&ds->ds_deadlist, mos,
-	    ds->ds_phys->ds_deadlist_obj));
-
 	{
-		/* Free blkptrs that we gave birth to */
-		zio_t *zio;
-		int64_t used = 0, compressed = 0, uncompressed = 0;
-		struct killarg ka;
+		/*
+		 * Free blkptrs that we gave birth to.  The walk of the
+		 * old tree, and the freeing, is left to spa_sync(), a
+		 * few blocks per txg.
+		 */
+		uint64_t used, compressed, uncompressed;
 		int64_t delta;
 
-		zio = zio_root(tx->tx_pool->dp_spa, NULL, NULL,
-		    ZIO_FLAG_MUSTSUCCEED);
-		ka.usedp = &used;
-		ka.compressedp = &compressed;
-		ka.uncompressedp = &uncompressed;
-		ka.zio = zio;
-		ka.tx = tx;
-		(void) traverse_dsl_dataset(ds, ds->ds_phys->ds_prev_snap_txg,
-		    ADVANCE_POST, kill_blkptr, &ka);
-		(void) zio_wait(zio);
+		dsl_dataset_head_space(ds, ds->ds_prev, &used, &compressed,
+		    &uncompressed);
+
+		if (ds->ds_phys->ds_bp.blk_birth >
+		    ds->ds_phys->ds_prev_snap_txg)
+			spa_destroy_tree(tx->tx_pool->dp_spa,
+			    &ds->ds_phys->ds_bp, ds->ds_object,
+			    ds->ds_phys->ds_prev_snap_txg, used, tx);
 
 		/* only deduct space beyond any refreservation */
-		delta = parent_delta(ds, -used);
+		delta = parent_delta(ds, -(int64_t)used);
 		dsl_dir_diduse_space(ds->ds_dir,
 		    delta, -compressed, -uncompressed, tx);
 	}
 
+	/* Zero out the deadlist. */
+	bplist_close(&ds->ds_deadlist);
+	bplist_destroy(mos, ds->ds_phys->ds_deadlist_obj, tx);
+	ds->ds_phys->ds_deadlist_obj =
+	    bplist_create(mos, DSL_DEADLIST_BLOCKSIZE, tx);
+	VERIFY(0 == bplist_open(&ds->ds_deadlist, mos,
+	    ds->ds_phys->ds_deadlist_obj));
+
 	if (ds->ds_prev) {
 		/* Change our contents to that of the prev snapshot */
 		ASSERT3U(ds->ds_prev->ds_object, ==,
@@ -1306,8 +1308,8 @@ dsl_dataset_destroy_check(void *arg1, void *arg2, dmu_tx_t *tx)
 		return (EINVAL);
 
 	/*
-	 * If we made changes this txg, traverse_dsl_dataset won't find
-	 * them.  Try again.
+	 * If we made changes this txg, they aren't in ds_bp yet, so we
+	 * wouldn't free them.  Try again.
 	 */
 	if (ds->ds_phys->ds_bp.blk_birth >= tx->tx_txg)
 		return (EAGAIN);
@@ -1321,7 +1323,6 @@ dsl_dataset_destroy_sync(void *arg1, void *tag, cred_t *cr, dmu_tx_t *tx)
 {
 	dsl_dataset_t *ds = arg1;
 	int64_t used = 0, compressed = 0, uncompressed = 0;
-	zio_t *zio;
 	int err;
 	int after_branch_point = FALSE;
 	dsl_pool_t *dp = ds->ds_dir->dd_pool;
@@ -1369,8 +1370,6 @@ dsl_dataset_destroy_sync(void *arg1, void *tag, cred_t *cr, dmu_tx_t *tx)
 		}
 	}
 
-	zio = zio_root(dp->dp_spa, NULL, NULL, ZIO_FLAG_MUSTSUCCEED);
-
 	if (ds->ds_phys->ds_next_snap_obj != 0) {
 		blkptr_t bp;
 		dsl_dataset_t *ds_next;
@@ -1398,7 +1397,9 @@ dsl_dataset_destroy_sync(void *arg1, void *tag, cred_t *cr, dmu_tx_t *tx)
 		 * Transfer to our deadlist (which will become next's
 		 * new deadlist) any entries from next's current
 		 * deadlist which were born before prev, and free the
-		 * other entries.
+		 * other entries.  Those stay where they are: next's
+		 * old deadlist is handed to spa_sync(), which frees
+		 * them a few at a time over the following txgs.
 		 *
 		 * XXX we're doing this long task with the config lock held
 		 */
@@ -1417,15 +1418,18 @@ dsl_dataset_destroy_sync(void *arg1, void *tag, cred_t *cr, dmu_tx_t *tx)
 				used += bp_get_dasize(dp->dp_spa, &bp);
 				compressed += BP_GET_PSIZE(&bp);
 				uncompressed += BP_GET_UCSIZE(&bp);
-				/* XXX check return value? */
-				(void) arc_free(zio, dp->dp_spa, tx->tx_txg,
-				    &bp, NULL, NULL, ARC_NOWAIT);
 			}
 		}
 
-		/* free next's deadlist */
+		/* free next's deadlist, and what's left on it */
 		bplist_close(&ds_next->ds_deadlist);
-		bplist_destroy(mos, ds_next->ds_phys->ds_deadlist_obj, tx);
+		if (used != 0)
+			spa_destroy_bplist(dp->dp_spa,
+			    ds_next->ds_phys->ds_deadlist_obj,
+			    ds->ds_phys->ds_prev_snap_txg, used, tx);
+		else
+			bplist_destroy(mos, ds_next->ds_phys->ds_deadlist_obj,
+			    tx);
 
 		/* set next's deadlist to our deadlist */
 		ds_next->ds_phys->ds_deadlist_obj =
@@ -1511,36 +1515,36 @@ dsl_dataset_destroy_sync(void *arg1, void *tag, cred_t *cr, dmu_tx_t *tx)
 		 * Destroy the deadlist.  Unless it's a clone, the
 		 * deadlist should be empty.  (If it's a clone, it's
 		 * safe to ignore the deadlist contents.)
+		 *
+		 * Everything that we point to (that's born after the
+		 * previous snapshot, if we are a clone) is to be freed.
+		 * Only work out how much that is here; the walk of our
+		 * tree, and the freeing, is left to spa_sync(), a few
+		 * blocks per txg.
 		 */
-		struct killarg ka;
+		uint64_t dsused, dscomp, dsuncomp;
 
 		ASSERT(after_branch_point || bplist_empty(&ds->ds_deadlist));
+		dsl_dataset_head_space(ds, ds_prev, &dsused, &dscomp,
+		    &dsuncomp);
+		used = dsused;
+		compressed = dscomp;
+		uncompressed = dsuncomp;
+		ASSERT(spa_version(dp->dp_spa) <
+		    SPA_VERSION_UNIQUE_ACCURATE ||
+		    used == ds->ds_phys->ds_unique_bytes);
+
 		bplist_close(&ds->ds_deadlist);
 		bplist_destroy(mos, ds->ds_phys->ds_deadlist_obj, tx);
 		ds->ds_phys->ds_deadlist_obj = 0;
 
-		/*
-		 * Free everything that we point to (that's born after
-		 * the previous snapshot, if we are a clone)
-		 *
-		 * XXX we're doing this long task with the config lock held
-		 */
-		ka.usedp = &used;
-		ka.compressedp = &compressed;
-		ka.uncompressedp = &uncompressed;
-		ka.zio = zio;
-		ka.tx = tx;
-		err = traverse_dsl_dataset(ds, ds->ds_phys->ds_prev_snap_txg,
-		    ADVANCE_POST, kill_blkptr, &ka);
-		ASSERT3U(err, ==, 0);
-		ASSERT(spa_version(dp->dp_spa) <
-		    SPA_VERSION_UNIQUE_ACCURATE ||
-		    used == ds->ds_phys->ds_unique_bytes);
+		if (ds->ds_phys->ds_bp.blk_birth >
+		    ds->ds_phys->ds_prev_snap_txg)
+			spa_destroy_tree(dp->dp_spa, &ds->ds_phys->ds_bp,
+			    ds->ds_object, ds->ds_phys->ds_prev_snap_txg,
+			    used, tx);
 	}
 
-	err = zio_wait(zio);
-	ASSERT3U(err, ==, 0);
-
 	dsl_dir_diduse_space(ds->ds_dir, -used, -compressed, -uncompressed, tx);
 
 	if (ds->ds_phys->ds_snapnames_zapobj) {
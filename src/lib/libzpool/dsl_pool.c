@@ -36,10 +36,57 @@
 #include <sys/zio.h>
 #include <sys/zfs_context.h>
 #include <sys/fs/zfs.h>
+#include <sys/kstat.h>
 
 int zfs_no_write_throttle = 0;
 uint64_t zfs_write_limit_override = 0;
 
+/*
+ * The write throttle.  Once the open txg holds more than
+ * zfs_delay_min_dirty_percent of its write limit, each new transaction is
+ * delayed before it is assigned, by
+ *
+ *	zfs_delay_scale * (dirty - min) / (limit - dirty)
+ *
+ * nanoseconds.  The delay is zfs_delay_scale halfway between the minimum
+ * and the limit and grows without bound (up to zfs_delay_max_ns) as the
+ * txg fills up, so writers are slowed to the rate at which the pool can
+ * sync well before the txg is full and they have to wait for it to sync.
+ * Delayed writers are released one delay apart rather than all at once.
+ */
+int zfs_delay_min_dirty_percent = 60;
+uint64_t zfs_delay_scale = 500000;		/* 500us */
+uint64_t zfs_delay_max_ns = 100000000;		/* 100ms */
+
+/*
+ * Threads syncing the dirty dnodes of datasets in parallel (see
+ * dmu_objset_sync()).  The MOS is still synced by the sync thread alone.
+ */
+int zfs_sync_taskq_threads = 8;
+
+kstat_t *dp_ksp = NULL;
+
+typedef struct dp_stats {
+	kstat_named_t dp_stat_delays;
+	kstat_named_t dp_stat_delay_time;
+	kstat_named_t dp_stat_write_limit_waits;
+	kstat_named_t dp_stat_write_limit;
+	kstat_named_t dp_stat_sync_throughput;
+} dp_stats_t;
+
+static dp_stats_t dp_stats = {
+	{ "delays",		KSTAT_DATA_UINT64 },
+	{ "delay_time_ns",	KSTAT_DATA_UINT64 },
+	{ "write_limit_waits",	KSTAT_DATA_UINT64 },
+	{ "write_limit",	KSTAT_DATA_UINT64 },
+	{ "sync_throughput",	KSTAT_DATA_UINT64 }
+};
+
+#define	DPSTAT_INCR(stat, val) \
+	atomic_add_64(&dp_stats.stat.value.ui64, (val));
+#define	DPSTAT_BUMP(stat)	DPSTAT_INCR(stat, 1)
+#define	DPSTAT_SET(stat, val)	dp_stats.stat.value.ui64 = (val)
+
 static int
 dsl_pool_open_mos_dir(dsl_pool_t *dp, dsl_dir_t **ddp)
 {
@@ -80,6 +127,10 @@ dsl_pool_open_impl(spa_t *spa, uint64_t txg)
 
 	mutex_init(&dp->dp_lock, NULL, MUTEX_DEFAULT, NULL);
 
+	dp->dp_sync_taskq = taskq_create("dp_sync_taskq",
+	    zfs_sync_taskq_threads, minclsyspri, zfs_sync_taskq_threads,
+	    INT_MAX, TASKQ_PREPOPULATE);
+
 	return (dp);
 }
 
@@ -138,6 +189,8 @@ dsl_pool_close(dsl_pool_t *dp)
 	txg_list_destroy(&dp->dp_dirty_dirs);
 	list_destroy(&dp->dp_synced_datasets);
 
+	taskq_destroy(dp->dp_sync_taskq);
+
 	arc_flush(dp->dp_spa);
 	txg_fini(dp);
 	rw_destroy(&dp->dp_config_rwlock);
@@ -194,6 +247,8 @@ dsl_pool_sync(dsl_pool_t *dp, uint64_t txg)
 			dmu_buf_rele(ds->ds_dbuf, ds);
 		dsl_dataset_sync(ds, zio, tx);
 	}
+	/* the datasets' dnodes are synced by dp_sync_taskq */
+	taskq_wait(dp->dp_sync_taskq);
 	err = zio_wait(zio);
 	ASSERT(err == 0);
 
@@ -229,14 +284,16 @@ dsl_pool_zil_clean(dsl_pool_t *dp)
 }
 
 /*
- * TRUE if the current thread is the tx_sync_thread or if we
- * are being called from SPA context during pool initialization.
+ * TRUE if the current thread is the tx_sync_thread or one of the
+ * dp_sync_taskq threads working for it, or if we are being called
+ * from SPA context during pool initialization.
  */
 int
 dsl_pool_sync_context(dsl_pool_t *dp)
 {
 	return (curthread == dp->dp_tx.tx_sync_thread ||
-	    spa_get_dsl(dp->dp_spa) == NULL);
+	    spa_get_dsl(dp->dp_spa) == NULL ||
+	    taskq_member(dp->dp_sync_taskq, curthread));
 }
 
 uint64_t
@@ -253,13 +310,18 @@ dsl_pool_adjustedsize(dsl_pool_t *dp, boolean_t netfree)
 	 * If we're trying to assess whether it's OK to do a free,
 	 * cut the reservation in half to allow forward progress
 	 * (e.g. make it possible to rm(1) files from a full pool).
+	 *
+	 * The remains of destroyed datasets that spa_sync() has yet to
+	 * free are no longer charged to any dataset, but can't be
+	 * allocated yet either, so keep them out of the pool's size.
 	 */
 	space = spa_get_dspace(dp->dp_spa);
 	resv = MAX(space >> 6, SPA_MINDEVSIZE >> 1);
 	if (netfree)
 		resv >>= 1;
+	resv += spa_get_destroy_space(dp->dp_spa);
 
-	return (space - resv);
+	return (space > resv ? space - resv : 0);
 }
 
 int
@@ -281,25 +343,23 @@ dsl_pool_tempreserve_space(dsl_pool_t *dp, uint64_t space, dmu_tx_t *tx)
 	 * with only half the requested reserve: this is because the
 	 * reserve requests are worst-case, and we really don't want to
 	 * throttle based off of worst-case estimates.
+	 *
+	 * Writers are normally slowed down by dsl_pool_throttle() long
+	 * before this point; the txg filling up means they could not be
+	 * slowed enough.
 	 */
 	if (write_limit > 0) {
 		reserved = dp->dp_space_towrite[tx->tx_txg & TXG_MASK]
 		    + dp->dp_tempreserved[tx->tx_txg & TXG_MASK] / 2;
 
-		if (reserved && reserved > write_limit)
+		if (reserved && reserved > write_limit) {
+			DPSTAT_BUMP(dp_stat_write_limit_waits);
 			return (ERESTART);
+		}
 	}
 
 	atomic_add_64(&dp->dp_tempreserved[tx->tx_txg & TXG_MASK], space);
 
-	/*
-	 * If this transaction group is over 7/8ths capacity, delay
-	 * the caller 1 clock tick.  This will slow down the "fill"
-	 * rate until the sync process can catch up with us.
-	 */
-	if (reserved && reserved > (write_limit - write_limit << 3))
-		txg_delay(dp, tx->tx_txg, 1);
-
 	return (0);
 }
 
@@ -337,3 +397,120 @@ dsl_pool_willuse_space(dsl_pool_t *dp, int64_t space, dmu_tx_t *tx)
 		mutex_exit(&dp->dp_lock);
 	}
 }
+
+/*
+ * How long to delay a writer according to how much dirty data the open
+ * txg holds (see the comment at zfs_delay_scale), or 0 if it needn't be.
+ */
+static hrtime_t
+dsl_pool_dirty_delay(dsl_pool_t *dp)
+{
+	uint64_t txg = dp->dp_tx.tx_open_txg;
+	uint64_t write_limit = (zfs_write_limit_override ?
+	    zfs_write_limit_override : dp->dp_write_limit);
+	uint64_t dirty, delay_min;
+
+	if (zfs_no_write_throttle || write_limit == 0)
+		return (0);
+
+	/* same estimate, and same slop, as dsl_pool_tempreserve_space() */
+	dirty = dp->dp_space_towrite[txg & TXG_MASK] +
+	    dp->dp_tempreserved[txg & TXG_MASK] / 2;
+	delay_min = write_limit / 100 * zfs_delay_min_dirty_percent;
+
+	/* a full txg is left to dsl_pool_tempreserve_space() */
+	if (dirty <= delay_min || dirty >= write_limit)
+		return (0);
+
+	return (MIN(zfs_delay_max_ns,
+	    zfs_delay_scale * (dirty - delay_min) / (write_limit - dirty)));
+}
+
+/*
+ * Whether dsl_pool_throttle() would delay a writer right now.
+ */
+boolean_t
+dsl_pool_need_throttle(dsl_pool_t *dp)
+{
+	return (dsl_pool_dirty_delay(dp) != 0);
+}
+
+/*
+ * Delay the caller according to how much dirty data the open txg holds.
+ * Called before a transaction is assigned, and without any locks that
+ * other writers may need, so that nothing is held up while we sleep.
+ */
+void
+dsl_pool_throttle(dsl_pool_t *dp)
+{
+	hrtime_t delay, now, wakeup;
+
+	if ((delay = dsl_pool_dirty_delay(dp)) == 0)
+		return;
+
+	now = gethrtime();
+	mutex_enter(&dp->dp_lock);
+	wakeup = MAX(now, dp->dp_last_wakeup) + delay;
+	dp->dp_last_wakeup = wakeup;
+	mutex_exit(&dp->dp_lock);
+
+	zfs_sleep_until(wakeup);
+
+	DPSTAT_BUMP(dp_stat_delays);
+	DPSTAT_INCR(dp_stat_delay_time, wakeup - now);
+}
+
+/*
+ * Called by the sync thread after each txg, with the amount of data
+ * written and how long (in ticks) the sync took.  Keeps the time it takes
+ * to sync a txg close to zfs_txg_synctime by scaling the write limit to
+ * the measured sync throughput.
+ */
+void
+dsl_pool_sync_done(dsl_pool_t *dp, uint64_t written, clock_t delta)
+{
+	extern int zfs_txg_synctime;
+	extern uint64_t zfs_write_limit_min;
+	extern uint64_t zfs_write_limit_inflated;
+	clock_t target = zfs_txg_synctime * hz;
+
+	if (delta > 0)
+		DPSTAT_SET(dp_stat_sync_throughput, written * hz / delta);
+
+	if (delta > target) {
+		uint64_t old = MIN(dp->dp_write_limit, written);
+
+		dp->dp_write_limit = MAX(zfs_write_limit_min,
+		    old * target / delta);
+	} else if (written >= dp->dp_write_limit &&
+	    delta >> 3 < target >> 3) {
+		uint64_t rescale =
+		    MIN((100 * target) / delta, 200);
+
+		dp->dp_write_limit = MIN(zfs_write_limit_inflated,
+		    written * rescale / 100);
+	}
+
+	DPSTAT_SET(dp_stat_write_limit, dp->dp_write_limit);
+}
+
+void
+dsl_pool_stat_init(void)
+{
+	dp_ksp = kstat_create("zfs", 0, "write_throttle", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (dp_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (dp_ksp != NULL) {
+		dp_ksp->ks_data = &dp_stats;
+		kstat_install(dp_ksp);
+	}
+}
+
+void
+dsl_pool_stat_fini(void)
+{
+	if (dp_ksp != NULL) {
+		kstat_delete(dp_ksp);
+		dp_ksp = NULL;
+	}
+}
@@ -421,6 +421,7 @@ extern vnode_t *rootdir;
 #define	hz	119	/* frequency when using gethrtime() >> 23 for lbolt */
 
 extern void delay(clock_t ticks);
+extern void zfs_sleep_until(hrtime_t wakeup);
 
 #define	gethrestime_sec() time(NULL)
 
@@ -31,6 +31,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <zlib.h>
 #include <sys/spa.h>
 #include <sys/stat.h>
@@ -715,6 +716,22 @@ delay(clock_t ticks)
 	poll(0, 0, ticks * (1000 / hz));
 }
 
+/*
+ * Sleep until the given gethrtime(), for delays finer than a clock tick.
+ */
+void
+zfs_sleep_until(hrtime_t wakeup)
+{
+	hrtime_t now;
+	struct timespec ts;
+
+	while ((now = gethrtime()) < wakeup) {
+		ts.tv_sec = (wakeup - now) / NANOSEC;
+		ts.tv_nsec = (wakeup - now) % NANOSEC;
+		(void) nanosleep(&ts, NULL);
+	}
+}
+
 /*
  * Find highest one bit set.
  *	Returns bit number + 1 of highest bit that is set, otherwise returns 0.
@@ -37,6 +37,34 @@
 uint64_t metaslab_aliquot = 512ULL << 10;
 uint64_t metaslab_gang_bang = SPA_MAXBLOCKSIZE + 1;	/* force gang blocks */
 
+#define	METASLAB_WEIGHT_PRIMARY		(1ULL << 63)
+#define	METASLAB_WEIGHT_SECONDARY	(1ULL << 62)
+#define	METASLAB_ACTIVE_MASK		\
+	(METASLAB_WEIGHT_PRIMARY | METASLAB_WEIGHT_SECONDARY)
+#define	METASLAB_SMO_BONUS_MULTIPLIER	2
+
+/*
+ * After every txg, the space maps of the metaslab_preload_limit best
+ * metaslabs of each group are loaded from the group's taskq, so that
+ * allocating threads rarely have to wait for space_map_load().
+ */
+int metaslab_preload_enabled = 1;
+int metaslab_preload_limit = SPA_DVAS_PER_BP;
+
+/*
+ * Number of txgs a space map stays loaded after its metaslab was last
+ * activated or preloaded.
+ */
+uint64_t metaslab_unload_delay = TXG_SIZE * 2;
+
+/*
+ * Condense a space map object when it is metaslab_condense_pct percent
+ * of the size the in-core map would take to write out, or larger, and
+ * at least metaslab_condense_min_size bytes long.
+ */
+int metaslab_condense_pct = 200;
+uint64_t metaslab_condense_min_size = 1ULL << SPACE_MAP_BLOCKSHIFT;
+
 /*
  * ==========================================================================
  * Metaslab classes
@@ -151,6 +179,8 @@ metaslab_group_create(metaslab_class_t *mc, vdev_t *vd)
 	    sizeof (metaslab_t), offsetof(struct metaslab, ms_group_node));
 	mg->mg_aliquot = metaslab_aliquot * MAX(1, vd->vdev_children);
 	mg->mg_vd = vd;
+	mg->mg_taskq = taskq_create("metaslab_preload", 1, minclsyspri,
+	    metaslab_preload_limit, INT_MAX, TASKQ_PREPOPULATE);
 	metaslab_class_add(mc, mg);
 
 	return (mg);
@@ -159,6 +189,7 @@ metaslab_group_create(metaslab_class_t *mc, vdev_t *vd)
 void
 metaslab_group_destroy(metaslab_group_t *mg)
 {
+	taskq_destroy(mg->mg_taskq);
 	avl_destroy(&mg->mg_metaslab_tree);
 	mutex_destroy(&mg->mg_lock);
 	kmem_free(mg, sizeof (metaslab_group_t));
@@ -203,31 +234,148 @@ metaslab_group_sort(metaslab_group_t *mg, metaslab_t *msp, uint64_t weight)
 	mutex_exit(&mg->mg_lock);
 }
 
-/*
- * ==========================================================================
- * The first-fit block allocator
- * ==========================================================================
- */
 static void
-metaslab_ff_load(space_map_t *sm)
+metaslab_preload(void *arg)
 {
-	ASSERT(sm->sm_ppd == NULL);
-	sm->sm_ppd = kmem_zalloc(64 * sizeof (uint64_t), KM_SLEEP);
+	metaslab_t *msp = arg;
+	spa_t *spa = msp->ms_group->mg_vd->vdev_spa;
+
+	mutex_enter(&msp->ms_lock);
+	if (space_map_load(&msp->ms_map, zfs_metaslab_ops, SM_FREE,
+	    &msp->ms_smo, spa->spa_meta_objset) == 0)
+		msp->ms_access_txg = spa_last_synced_txg(spa) +
+		    metaslab_unload_delay;
+	mutex_exit(&msp->ms_lock);
 }
 
 static void
-metaslab_ff_unload(space_map_t *sm)
+metaslab_evict(void *arg)
 {
-	kmem_free(sm->sm_ppd, 64 * sizeof (uint64_t));
-	sm->sm_ppd = NULL;
+	metaslab_t *msp = arg;
+	spa_t *spa = msp->ms_group->mg_vd->vdev_spa;
+	int t;
+
+	mutex_enter(&msp->ms_lock);
+
+	/*
+	 * Only an inactive metaslab with no allocations waiting to sync
+	 * can drop its map; see metaslab_sync_done().  We may run while a
+	 * txg syncs, too: once metaslab_sync() has emptied this txg's
+	 * allocmap into ms_smo_syncing, ms_smo lacks those allocations
+	 * until metaslab_sync_done(), and a map reloaded from it would hand
+	 * them out again.  So the synced and syncing smo must also agree.
+	 */
+	if (!msp->ms_map.sm_loaded || (msp->ms_weight & METASLAB_ACTIVE_MASK) ||
+	    msp->ms_access_txg >= spa_last_synced_txg(spa) ||
+	    bcmp(&msp->ms_smo, &msp->ms_smo_syncing, sizeof (msp->ms_smo))) {
+		mutex_exit(&msp->ms_lock);
+		return;
+	}
+	for (t = 0; t < TXG_SIZE; t++) {
+		if (msp->ms_allocmap[t].sm_space != 0) {
+			mutex_exit(&msp->ms_lock);
+			return;
+		}
+	}
+
+	space_map_unload(&msp->ms_map);
+	mutex_exit(&msp->ms_lock);
 }
 
+/*
+ * Queue background loads of the best metaslabs in the group, and the
+ * eviction of maps that have fallen out of use.  metaslab_sync_done()
+ * only ever sees dirty metaslabs, so without the latter a preloaded map
+ * that is never allocated from would stay in core forever.
+ *
+ * We can't take ms_lock under mg_lock, so the map state is only a hint
+ * here; the tasks check it again under ms_lock.
+ */
+void
+metaslab_group_preload(metaslab_group_t *mg)
+{
+	spa_t *spa = mg->mg_vd->vdev_spa;
+	avl_tree_t *t = &mg->mg_metaslab_tree;
+	metaslab_t *msp;
+	int m = 0;
+
+	if (!metaslab_preload_enabled)
+		return;
+
+	mutex_enter(&mg->mg_lock);
+	for (msp = avl_first(t); msp != NULL; msp = AVL_NEXT(t, msp)) {
+		space_map_t *sm = &msp->ms_map;
+
+		if (m < metaslab_preload_limit && msp->ms_weight != 0) {
+			m++;
+			if (!sm->sm_loaded && !sm->sm_loading)
+				(void) taskq_dispatch(mg->mg_taskq,
+				    metaslab_preload, msp, TQ_NOSLEEP);
+		} else if (sm->sm_loaded &&
+		    (msp->ms_weight & METASLAB_ACTIVE_MASK) == 0 &&
+		    msp->ms_access_txg < spa_last_synced_txg(spa)) {
+			(void) taskq_dispatch(mg->mg_taskq,
+			    metaslab_evict, msp, TQ_NOSLEEP);
+		}
+	}
+	mutex_exit(&mg->mg_lock);
+}
+
+void
+metaslab_group_preload_wait(metaslab_group_t *mg)
+{
+	taskq_wait(mg->mg_taskq);
+}
+
+void
+metaslab_class_preload_wait(metaslab_class_t *mc)
+{
+	metaslab_group_t *mg;
+
+	if ((mg = mc->mc_rotor) == NULL)
+		return;
+
+	do {
+		metaslab_group_preload_wait(mg);
+	} while ((mg = mg->mg_next) != mc->mc_rotor);
+}
+
+/*
+ * ==========================================================================
+ * Common allocator routines
+ * ==========================================================================
+ */
+static int
+metaslab_segsize_compare(const void *x1, const void *x2)
+{
+	const space_seg_t *s1 = x1;
+	const space_seg_t *s2 = x2;
+	uint64_t ss_size1 = s1->ss_end - s1->ss_start;
+	uint64_t ss_size2 = s2->ss_end - s2->ss_start;
+
+	if (ss_size1 < ss_size2)
+		return (-1);
+	if (ss_size1 > ss_size2)
+		return (1);
+
+	if (s1->ss_start < s2->ss_start)
+		return (-1);
+	if (s1->ss_start > s2->ss_start)
+		return (1);
+
+	return (0);
+}
+
+/*
+ * This is a helper function that can be used by the allocator to find
+ * a suitable block to allocate.  It searches the specified AVL tree,
+ * which is either the offset-sorted map itself or the size-sorted
+ * picker-private tree, starting at the cursor.
+ */
 static uint64_t
-metaslab_ff_alloc(space_map_t *sm, uint64_t size)
+metaslab_block_picker(avl_tree_t *t, uint64_t *cursor, uint64_t size,
+    uint64_t align)
 {
-	avl_tree_t *t = &sm->sm_root;
-	uint64_t align = size & -size;
-	uint64_t *cursor = (uint64_t *)sm->sm_ppd + highbit(align) - 1;
 	space_seg_t *ss, ssearch;
 	avl_index_t where;
 
@@ -256,31 +404,146 @@ metaslab_ff_alloc(space_map_t *sm, uint64_t size)
 		return (-1ULL);
 
 	*cursor = 0;
-	return (metaslab_ff_alloc(sm, size));
+	return (metaslab_block_picker(t, cursor, size, align));
+}
+
+static void
+metaslab_pp_load(space_map_t *sm)
+{
+	space_seg_t *ss;
+
+	ASSERT(sm->sm_ppd == NULL);
+	sm->sm_ppd = kmem_zalloc(64 * sizeof (uint64_t), KM_SLEEP);
+
+	sm->sm_pp_root = kmem_alloc(sizeof (avl_tree_t), KM_SLEEP);
+	avl_create(sm->sm_pp_root, metaslab_segsize_compare,
+	    sizeof (space_seg_t), offsetof(struct space_seg, ss_pp_node));
+
+	for (ss = avl_first(&sm->sm_root); ss; ss = AVL_NEXT(&sm->sm_root, ss))
+		avl_add(sm->sm_pp_root, ss);
+}
+
+static void
+metaslab_pp_unload(space_map_t *sm)
+{
+	void *cookie = NULL;
+
+	kmem_free(sm->sm_ppd, 64 * sizeof (uint64_t));
+	sm->sm_ppd = NULL;
+
+	while (avl_destroy_nodes(sm->sm_pp_root, &cookie) != NULL) {
+		/* tear down the tree; the segments belong to sm_root */
+	}
+
+	avl_destroy(sm->sm_pp_root);
+	kmem_free(sm->sm_pp_root, sizeof (avl_tree_t));
+	sm->sm_pp_root = NULL;
 }
 
 /* ARGSUSED */
 static void
-metaslab_ff_claim(space_map_t *sm, uint64_t start, uint64_t size)
+metaslab_pp_claim(space_map_t *sm, uint64_t start, uint64_t size)
 {
 	/* No need to update cursor */
 }
 
 /* ARGSUSED */
 static void
-metaslab_ff_free(space_map_t *sm, uint64_t start, uint64_t size)
+metaslab_pp_free(space_map_t *sm, uint64_t start, uint64_t size)
 {
 	/* No need to update cursor */
 }
 
-static space_map_ops_t metaslab_ff_ops = {
-	metaslab_ff_load,
-	metaslab_ff_unload,
+/*
+ * Return the maximum contiguous segment within the metaslab.
+ */
+static uint64_t
+metaslab_pp_maxsize(space_map_t *sm)
+{
+	avl_tree_t *t = sm->sm_pp_root;
+	space_seg_t *ss;
+
+	if (t == NULL || (ss = avl_last(t)) == NULL)
+		return (0ULL);
+
+	return (ss->ss_end - ss->ss_start);
+}
+
+/*
+ * ==========================================================================
+ * The first-fit block allocator
+ * ==========================================================================
+ */
+static uint64_t
+metaslab_ff_alloc(space_map_t *sm, uint64_t size)
+{
+	avl_tree_t *t = &sm->sm_root;
+	uint64_t align = size & -size;
+	uint64_t *cursor = (uint64_t *)sm->sm_ppd + highbit(align) - 1;
+
+	return (metaslab_block_picker(t, cursor, size, align));
+}
+
+space_map_ops_t metaslab_ff_ops = {
+	metaslab_pp_load,
+	metaslab_pp_unload,
 	metaslab_ff_alloc,
-	metaslab_ff_claim,
-	metaslab_ff_free
+	metaslab_pp_claim,
+	metaslab_pp_free,
+	metaslab_pp_maxsize
+};
+
+/*
+ * ==========================================================================
+ * Dynamic block allocator -
+ * Uses the first-fit allocation scheme until space gets low and then
+ * adjusts to a best-fit allocation method.  Uses metaslab_df_alloc_threshold
+ * and metaslab_df_free_pct to determine when to switch the allocation scheme.
+ * ==========================================================================
+ */
+uint64_t metaslab_df_alloc_threshold = SPA_MAXBLOCKSIZE;	/* bytes */
+int metaslab_df_free_pct = 30;					/* percent */
+
+static uint64_t
+metaslab_df_alloc(space_map_t *sm, uint64_t size)
+{
+	avl_tree_t *t = &sm->sm_root;
+	uint64_t align = size & -size;
+	uint64_t *cursor = (uint64_t *)sm->sm_ppd + highbit(align) - 1;
+	uint64_t max_size = metaslab_pp_maxsize(sm);
+	int free_pct = sm->sm_space * 100 / sm->sm_size;
+
+	ASSERT(MUTEX_HELD(sm->sm_lock));
+	ASSERT3U(avl_numnodes(&sm->sm_root), ==, avl_numnodes(sm->sm_pp_root));
+
+	if (max_size < size)
+		return (-1ULL);
+
+	/*
+	 * If we're running low on space switch to using the size
+	 * sorted AVL tree (best-fit).  Searching it from a cursor of
+	 * zero lands on the smallest segment that can hold the block.
+	 */
+	if (max_size < metaslab_df_alloc_threshold ||
+	    free_pct < metaslab_df_free_pct) {
+		t = sm->sm_pp_root;
+		*cursor = 0;
+	}
+
+	return (metaslab_block_picker(t, cursor, size, 1ULL));
+}
+
+space_map_ops_t metaslab_df_ops = {
+	metaslab_pp_load,
+	metaslab_pp_unload,
+	metaslab_df_alloc,
+	metaslab_pp_claim,
+	metaslab_pp_free,
+	metaslab_pp_maxsize
 };
 
+space_map_ops_t *zfs_metaslab_ops = &metaslab_df_ops;
+
 /*
  * ==========================================================================
  * Metaslabs
@@ -362,12 +625,6 @@ metaslab_fini(metaslab_t *msp)
 	kmem_free(msp, sizeof (metaslab_t));
 }
 
-#define	METASLAB_WEIGHT_PRIMARY		(1ULL << 63)
-#define	METASLAB_WEIGHT_SECONDARY	(1ULL << 62)
-#define	METASLAB_ACTIVE_MASK		\
-	(METASLAB_WEIGHT_PRIMARY | METASLAB_WEIGHT_SECONDARY)
-#define	METASLAB_SMO_BONUS_MULTIPLIER	2
-
 static uint64_t
 metaslab_weight(metaslab_t *msp)
 {
@@ -419,17 +676,19 @@ static int
 metaslab_activate(metaslab_t *msp, uint64_t activation_weight)
 {
 	space_map_t *sm = &msp->ms_map;
+	spa_t *spa = msp->ms_group->mg_vd->vdev_spa;
 
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
 
 	if ((msp->ms_weight & METASLAB_ACTIVE_MASK) == 0) {
-		int error = space_map_load(sm, &metaslab_ff_ops,
-		    SM_FREE, &msp->ms_smo,
-		    msp->ms_group->mg_vd->vdev_spa->spa_meta_objset);
+		int error = space_map_load(sm, zfs_metaslab_ops,
+		    SM_FREE, &msp->ms_smo, spa->spa_meta_objset);
 		if (error) {
 			metaslab_group_sort(msp->ms_group, msp, 0);
 			return (error);
 		}
+		msp->ms_access_txg = spa_last_synced_txg(spa) +
+		    metaslab_unload_delay;
 		metaslab_group_sort(msp->ms_group, msp,
 		    msp->ms_weight | activation_weight);
 	}
@@ -452,6 +711,29 @@ metaslab_passivate(metaslab_t *msp, uint64_t size)
 	ASSERT((msp->ms_weight & METASLAB_ACTIVE_MASK) == 0);
 }
 
+/*
+ * Decide whether the metaslab's space map object has grown enough past
+ * its in-core map to be worth rewriting.  Written out as a pure allocmap,
+ * the in-core map takes about one entry per free segment.
+ */
+static boolean_t
+metaslab_should_condense(metaslab_t *msp)
+{
+	space_map_t *sm = &msp->ms_map;
+	space_map_obj_t *smo = &msp->ms_smo_syncing;
+	uint64_t optimal_size;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	if (!sm->sm_loaded)
+		return (B_FALSE);
+
+	optimal_size = sizeof (uint64_t) * avl_numnodes(&sm->sm_root);
+
+	return (smo->smo_objsize >= metaslab_condense_min_size &&
+	    smo->smo_objsize * 100 >= optimal_size * metaslab_condense_pct);
+}
+
 /*
  * Write a metaslab to disk in the context of the specified transaction group.
  */
@@ -498,11 +780,10 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 
 	space_map_walk(freemap, space_map_add, freed_map);
 
-	if (sm->sm_loaded && spa_sync_pass(spa) == 1 && smo->smo_objsize >=
-	    2 * sizeof (uint64_t) * avl_numnodes(&sm->sm_root)) {
+	if (spa_sync_pass(spa) == 1 && metaslab_should_condense(msp)) {
 		/*
-		 * The in-core space map representation is twice as compact
-		 * as the on-disk one, so it's time to condense the latter
+		 * The in-core space map representation is much more compact
+		 * than the on-disk one, so it's time to condense the latter
 		 * by generating a pure allocmap from first principles.
 		 *
 		 * This metaslab is 100% allocated,
@@ -590,10 +871,12 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 
 	/*
 	 * If the map is loaded but no longer active, evict it as soon as all
-	 * future allocations have synced.  (If we unloaded it now and then
+	 * future allocations have synced and it hasn't been used for
+	 * metaslab_unload_delay txgs.  (If we unloaded it now and then
 	 * loaded a moment later, the map wouldn't reflect those allocations.)
 	 */
-	if (sm->sm_loaded && (msp->ms_weight & METASLAB_ACTIVE_MASK) == 0) {
+	if (sm->sm_loaded && (msp->ms_weight & METASLAB_ACTIVE_MASK) == 0 &&
+	    msp->ms_access_txg < txg) {
 		int evictable = 1;
 
 		for (t = 1; t < TXG_CONCURRENT_STATES; t++)
@@ -696,7 +979,13 @@ metaslab_group_alloc(metaslab_group_t *mg, uint64_t size, uint64_t txg,
 		if ((offset = space_map_alloc(&msp->ms_map, size)) != -1ULL)
 			break;
 
-		metaslab_passivate(msp, size - 1);
+		/*
+		 * Passivate at the largest free segment, so that we don't
+		 * keep selecting a fragmented metaslab for blocks that it
+		 * can no longer hold.
+		 */
+		metaslab_passivate(msp,
+		    MIN(size - 1, space_map_maxsize(&msp->ms_map)));
 
 		mutex_exit(&msp->ms_lock);
 	}
@@ -67,7 +67,40 @@
 
 int zio_taskq_threads = 8;
 
+/*
+ * The blocks left behind by destroying a dataset or snapshot, or rolling
+ * one back, are freed by spa_sync() from the destroy queue, at most
+ * zfs_free_max_blocks blocks and zfs_free_max_time_ms milliseconds per txg.
+ */
+uint64_t zfs_free_max_blocks = 100000;
+int zfs_free_max_time_ms = 1000;
+
+/*
+ * Memory, in bytes, the scrub thread may use to sort the blocks it has
+ * found by on-disk location before reading them.
+ */
+uint64_t zfs_scrub_queue_max = 16ULL << 20;
+
+/*
+ * While foreground i/o to a vdev is slower than the pool's scrublatency,
+ * scrub reads from it are held back zfs_scrub_backoff_ms at a time, but
+ * for no more than zfs_scrub_backoff_max_ms per read.
+ */
+int zfs_scrub_backoff_ms = 100;
+int zfs_scrub_backoff_max_ms = 1000;
+
+/*
+ * Bounds of the scrubrate and resilverrate pool properties (other than 0,
+ * for no limit).  Reads that get ahead of the rate are held back in slices
+ * of at most zfs_scrub_backoff_ms, so that the scrub still yields promptly
+ * to spa_sync() and to requests to stop.
+ */
+#define	SPA_SCRUB_RATE_MIN	(1ULL << 20)
+#define	SPA_SCRUB_RATE_MAX	(1ULL << 40)
+
 static void spa_sync_props(void *arg1, void *arg2, cred_t *cr, dmu_tx_t *tx);
+static int spa_destroy_load(spa_t *spa);
+static int spa_scrub_blk_compare(const void *a, const void *b);
 
 /*
  * ==========================================================================
@@ -304,6 +337,19 @@ spa_prop_validate(spa_t *spa, nvlist_t *props)
 				error = EINVAL;
 			break;
 
+		case ZPOOL_PROP_SCRUBRATE:
+		case ZPOOL_PROP_RESILVERRATE:
+			error = nvpair_value_uint64(elem, &intval);
+			if (!error && intval != 0 &&
+			    (intval < SPA_SCRUB_RATE_MIN ||
+			    intval > SPA_SCRUB_RATE_MAX))
+				error = EINVAL;
+			break;
+
+		case ZPOOL_PROP_SCRUBLATENCY:
+			error = nvpair_value_uint64(elem, &intval);
+			break;
+
 		case ZPOOL_PROP_BOOTFS:
 			if (spa_version(spa) < SPA_VERSION_BOOTFS) {
 				error = ENOTSUP;
@@ -521,6 +567,12 @@ spa_activate(spa_t *spa)
 	avl_create(&spa->spa_errlist_last,
 	    spa_error_entry_compare, sizeof (spa_error_entry_t),
 	    offsetof(spa_error_entry_t, se_avl));
+
+	avl_create(&spa->spa_scrub_queue,
+	    spa_scrub_blk_compare, sizeof (spa_scrub_blk_t),
+	    offsetof(spa_scrub_blk_t, sb_avl));
+	list_create(&spa->spa_scrub_freed, sizeof (spa_scrub_freed_t),
+	    offsetof(spa_scrub_freed_t, sf_node));
 }
 
 /*
@@ -568,6 +620,10 @@ spa_deactivate(spa_t *spa)
 	avl_destroy(&spa->spa_errlist_scrub);
 	avl_destroy(&spa->spa_errlist_last);
 
+	ASSERT(spa->spa_scrub_queued == 0);
+	avl_destroy(&spa->spa_scrub_queue);
+	list_destroy(&spa->spa_scrub_freed);
+
 	spa->spa_state = POOL_STATE_UNINITIALIZED;
 }
 
@@ -634,6 +690,12 @@ spa_unload(spa_t *spa)
 		spa->spa_sync_on = B_FALSE;
 	}
 
+	/*
+	 * Wait for any metaslab preloads, which read the MOS, to finish.
+	 */
+	metaslab_class_preload_wait(spa->spa_normal_class);
+	metaslab_class_preload_wait(spa->spa_log_class);
+
 	/*
 	 * Wait for any outstanding prefetch I/O to complete.
 	 */
@@ -1171,6 +1233,21 @@ spa_load(spa_t *spa, nvlist_t *config, spa_load_state_t state, int mosconfig)
 		goto out;
 	}
 
+	/*
+	 * Load the queue of destroyed datasets that are still to be freed.
+	 * If we have an older pool, or nothing was ever destroyed, this
+	 * will not be present.
+	 */
+	error = zap_lookup(spa->spa_meta_objset,
+	    DMU_POOL_DIRECTORY_OBJECT, DMU_POOL_DESTROY_QUEUE,
+	    sizeof (uint64_t), 1, &spa->spa_destroy_queue_obj);
+	if ((error != 0 && error != ENOENT) || spa_destroy_load(spa) != 0) {
+		vdev_set_state(rvd, B_TRUE, VDEV_STATE_CANT_OPEN,
+		    VDEV_AUX_CORRUPT_DATA);
+		error = EIO;
+		goto out;
+	}
+
 	/*
 	 * Load the bit that tells us to use the new accounting function
 	 * (raid-z deflation).  If we have an older pool, this will not
@@ -1307,6 +1384,18 @@ spa_load(spa_t *spa, nvlist_t *config, spa_load_state_t state, int mosconfig)
 		    spa->spa_pool_props_object,
 		    zpool_prop_to_name(ZPOOL_PROP_FAILUREMODE),
 		    sizeof (uint64_t), 1, &spa->spa_failmode);
+		(void) zap_lookup(spa->spa_meta_objset,
+		    spa->spa_pool_props_object,
+		    zpool_prop_to_name(ZPOOL_PROP_SCRUBRATE),
+		    sizeof (uint64_t), 1, &spa->spa_scrub_rate);
+		(void) zap_lookup(spa->spa_meta_objset,
+		    spa->spa_pool_props_object,
+		    zpool_prop_to_name(ZPOOL_PROP_RESILVERRATE),
+		    sizeof (uint64_t), 1, &spa->spa_resilver_rate);
+		(void) zap_lookup(spa->spa_meta_objset,
+		    spa->spa_pool_props_object,
+		    zpool_prop_to_name(ZPOOL_PROP_SCRUBLATENCY),
+		    sizeof (uint64_t), 1, &spa->spa_scrub_latency);
 	}
 
 	/*
@@ -2025,6 +2114,11 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 	spa->spa_bootfs = zpool_prop_default_numeric(ZPOOL_PROP_BOOTFS);
 	spa->spa_delegation = zpool_prop_default_numeric(ZPOOL_PROP_DELEGATION);
 	spa->spa_failmode = zpool_prop_default_numeric(ZPOOL_PROP_FAILUREMODE);
+	spa->spa_scrub_rate = zpool_prop_default_numeric(ZPOOL_PROP_SCRUBRATE);
+	spa->spa_resilver_rate =
+	    zpool_prop_default_numeric(ZPOOL_PROP_RESILVERRATE);
+	spa->spa_scrub_latency =
+	    zpool_prop_default_numeric(ZPOOL_PROP_SCRUBLATENCY);
 	if (props)
 		spa_sync_props(spa, props, CRED(), tx);
 
@@ -2476,6 +2570,16 @@ spa_export_common(char *pool, int new_state, nvlist_t **oldconfig)
 		spa_scrub_resume(spa);
 		VERIFY(spa_scrub(spa, POOL_SCRUB_NONE, B_TRUE) == 0);
 
+		/*
+		 * Whatever is left on the destroy queue would be leaked by
+		 * any other software that imports the pool, so free it all
+		 * before an export.  Each txg frees what its budget allows.
+		 */
+		if (new_state == POOL_STATE_EXPORTED) {
+			while (spa->spa_destroy_pending)
+				txg_wait_synced(spa->spa_dsl_pool, 0);
+		}
+
 		/*
 		 * We want this to be reflected on every label,
 		 * so mark them all dirty.  spa_unload() will do the
@@ -3383,6 +3487,87 @@ spa_scrub_io_done(zio_t *zio)
 	mutex_exit(&spa->spa_scrub_lock);
 }
 
+/*
+ * Has the scrub thread been asked to stop, or to get out of the way?
+ */
+static boolean_t
+spa_scrub_yield_wanted(spa_t *spa)
+{
+	return (spa->spa_scrub_stop || spa->spa_scrub_suspended ||
+	    spa->spa_scrub_restart_txg != 0 || spa->spa_traverse_wanted);
+}
+
+static hrtime_t
+spa_scrub_vdev_latency(vdev_t *vd)
+{
+	hrtime_t latency = 0;
+	int c;
+
+	if (vd->vdev_children == 0)
+		return (vdev_queue_latency(vd));
+
+	for (c = 0; c < vd->vdev_children; c++)
+		latency = MAX(latency,
+		    spa_scrub_vdev_latency(vd->vdev_child[c]));
+
+	return (latency);
+}
+
+/*
+ * Hold the scrub thread back before it reads bp: first while foreground
+ * i/o to the vdev holding bp's first copy is slower than scrublatency,
+ * then for as long as it takes to keep within scrubrate (or resilverrate).
+ * The rate is enforced with a credit of bytes that accrues at that rate,
+ * up to a tenth of a second's worth.  We may be called with
+ * spa_traverse_lock held, so the wait for the rate is cut short, and
+ * left as debt in the credit, as soon as the scrub should yield.
+ */
+static void
+spa_scrub_throttle(spa_t *spa, blkptr_t *bp, int flags)
+{
+	uint64_t rate, target;
+	int64_t burst;
+	hrtime_t now, wakeup;
+	int waited;
+	vdev_t *vd;
+
+	target = spa->spa_scrub_latency * 1000000;
+	if (target != 0) {
+		vd = vdev_lookup_top(spa, DVA_GET_VDEV(&bp->blk_dva[0]));
+		for (waited = 0; waited < zfs_scrub_backoff_max_ms &&
+		    vd != NULL && !spa_scrub_yield_wanted(spa) &&
+		    spa_scrub_vdev_latency(vd) > target;
+		    waited += zfs_scrub_backoff_ms)
+			delay(MAX(1, zfs_scrub_backoff_ms * hz / 1000));
+	}
+
+	rate = (flags & ZIO_FLAG_RESILVER) ?
+	    spa->spa_resilver_rate : spa->spa_scrub_rate;
+	if (rate == 0)
+		return;
+
+	/*
+	 * Microseconds times a rate of at most SPA_SCRUB_RATE_MAX can't
+	 * overflow for the one second we accrue at most.
+	 */
+	now = gethrtime();
+	burst = MAX(rate / 10, SPA_MAXBLOCKSIZE);
+	spa->spa_scrub_credit += MIN(now - spa->spa_scrub_credit_time,
+	    NANOSEC) / 1000 * MIN(rate, SPA_SCRUB_RATE_MAX) / 1000000;
+	spa->spa_scrub_credit = MIN(spa->spa_scrub_credit, burst);
+	spa->spa_scrub_credit_time = now;
+
+	spa->spa_scrub_credit -= BP_GET_PSIZE(bp) * BP_GET_NDVAS(bp);
+	if (spa->spa_scrub_credit >= 0)
+		return;
+
+	wakeup = now + -spa->spa_scrub_credit * (NANOSEC / 1000) /
+	    (MAX(rate, SPA_SCRUB_RATE_MIN) / 1000);
+	while ((now = gethrtime()) < wakeup && !spa_scrub_yield_wanted(spa))
+		zfs_sleep_until(MIN(wakeup,
+		    now + (hrtime_t)zfs_scrub_backoff_ms * 1000000));
+}
+
 static void
 spa_scrub_io_start(spa_t *spa, blkptr_t *bp, int priority, int flags,
     zbookmark_t *zb)
@@ -3390,6 +3575,8 @@ spa_scrub_io_start(spa_t *spa, blkptr_t *bp, int priority, int flags,
 	size_t size = BP_GET_LSIZE(bp);
 	void *data;
 
+	spa_scrub_throttle(spa, bp, flags);
+
 	mutex_enter(&spa->spa_scrub_lock);
 	/*
 	 * Do not give too much work to vdev(s).
@@ -3411,6 +3598,187 @@ spa_scrub_io_start(spa_t *spa, blkptr_t *bp, int priority, int flags,
 	    spa_scrub_io_done, NULL, priority, flags, zb));
 }
 
+/*
+ * Reading blocks in the order the traverse finds them is random I/O on
+ * any pool that has seen some churn.  Instead, the scrub thread queues
+ * them sorted by top-level vdev and offset of their first DVA, and reads
+ * the queue in that order whenever it fills up and once the traverse is
+ * done.  The queue is only touched by the scrub thread, or by spa_sync()
+ * while the scrub thread is suspended.
+ */
+static int
+spa_scrub_blk_compare(const void *a, const void *b)
+{
+	const spa_scrub_blk_t *sa = a;
+	const spa_scrub_blk_t *sb = b;
+	const dva_t *da = &sa->sb_blk.blk_dva[0];
+	const dva_t *db = &sb->sb_blk.blk_dva[0];
+
+	if (DVA_GET_VDEV(da) != DVA_GET_VDEV(db))
+		return (DVA_GET_VDEV(da) < DVA_GET_VDEV(db) ? -1 : 1);
+
+	if (DVA_GET_OFFSET(da) != DVA_GET_OFFSET(db))
+		return (DVA_GET_OFFSET(da) < DVA_GET_OFFSET(db) ? -1 : 1);
+
+	if (sa->sb_seq != sb->sb_seq)
+		return (sa->sb_seq < sb->sb_seq ? -1 : 1);
+
+	return (0);
+}
+
+/*
+ * Find the first queued block at or after the given DVA.
+ */
+static spa_scrub_blk_t *
+spa_scrub_queue_find(spa_t *spa, const dva_t *dva)
+{
+	spa_scrub_blk_t key;
+	avl_index_t where;
+
+	key.sb_blk.blk_dva[0] = *dva;
+	key.sb_seq = 0;
+
+	VERIFY(avl_find(&spa->spa_scrub_queue, &key, &where) == NULL);
+	return (avl_nearest(&spa->spa_scrub_queue, where, AVL_AFTER));
+}
+
+static void
+spa_scrub_queue_remove(spa_t *spa, spa_scrub_blk_t *sb)
+{
+	avl_remove(&spa->spa_scrub_queue, sb);
+	spa->spa_scrub_queued--;
+	kmem_free(sb, sizeof (spa_scrub_blk_t));
+}
+
+static void
+spa_scrub_queue_discard(spa_t *spa)
+{
+	spa_scrub_blk_t *sb;
+	void *cookie = NULL;
+
+	while ((sb = avl_destroy_nodes(&spa->spa_scrub_queue,
+	    &cookie)) != NULL)
+		kmem_free(sb, sizeof (spa_scrub_blk_t));
+
+	spa->spa_scrub_queued = 0;
+}
+
+/*
+ * Read the queued blocks.  Each vdev's blocks go out in offset order, but
+ * we take one block from each top-level vdev in turn so that all of them
+ * are kept busy.  Returns B_TRUE once the queue is empty, or B_FALSE if
+ * we stopped early because the scrub thread has been asked to yield.
+ */
+static boolean_t
+spa_scrub_queue_issue(spa_t *spa)
+{
+	spa_scrub_blk_t *sb;
+	dva_t next;
+
+	bzero(&next, sizeof (dva_t));
+
+	sb = avl_first(&spa->spa_scrub_queue);
+	while (sb != NULL) {
+		if (spa_scrub_yield_wanted(spa))
+			return (B_FALSE);
+
+		spa_scrub_io_start(spa, &sb->sb_blk, sb->sb_priority,
+		    sb->sb_flags, &sb->sb_bookmark);
+
+		/*
+		 * Move on to the lowest queued offset on the next vdev,
+		 * wrapping around to the first vdev after the last one.
+		 */
+		DVA_SET_VDEV(&next, DVA_GET_VDEV(&sb->sb_blk.blk_dva[0]) + 1);
+		spa_scrub_queue_remove(spa, sb);
+
+		if ((sb = spa_scrub_queue_find(spa, &next)) == NULL)
+			sb = avl_first(&spa->spa_scrub_queue);
+	}
+
+	ASSERT(spa->spa_scrub_queued == 0);
+	return (B_TRUE);
+}
+
+static void
+spa_scrub_enqueue(spa_t *spa, blkptr_t *bp, int priority, int flags,
+    zbookmark_t *zb)
+{
+	spa_scrub_blk_t *sb;
+
+	sb = kmem_alloc(sizeof (spa_scrub_blk_t), KM_SLEEP);
+	sb->sb_blk = *bp;
+	sb->sb_bookmark = *zb;
+	sb->sb_seq = ++spa->spa_scrub_seq;
+	sb->sb_priority = priority;
+	sb->sb_flags = flags;
+
+	avl_add(&spa->spa_scrub_queue, sb);
+	spa->spa_scrub_queued++;
+
+	if (spa->spa_scrub_queued * sizeof (spa_scrub_blk_t) >=
+	    zfs_scrub_queue_max)
+		(void) spa_scrub_queue_issue(spa);
+}
+
+/*
+ * Blocks stay on the queue across txgs, so one of them may be freed, and
+ * its space reused, before we get to read it; worse, a scrub of the stale
+ * block pointer could then "repair" whatever has been written there since.
+ * So while the scrub thread is queueing, every free is noted here, and
+ * spa_sync() drops the freed blocks from the queue before the new ubsync,
+ * which no longer references them, goes into effect.
+ */
+void
+spa_scrub_block_freed(spa_t *spa, const blkptr_t *bp, uint64_t txg)
+{
+	spa_scrub_freed_t *sf;
+
+	if (!spa->spa_scrub_queueing)
+		return;
+
+	sf = kmem_alloc(sizeof (spa_scrub_freed_t), KM_SLEEP);
+	sf->sf_dva = bp->blk_dva[0];
+	sf->sf_txg = txg;
+
+	mutex_enter(&spa->spa_scrub_lock);
+	if (spa->spa_scrub_queueing) {
+		list_insert_tail(&spa->spa_scrub_freed, sf);
+		sf = NULL;
+	}
+	mutex_exit(&spa->spa_scrub_lock);
+
+	if (sf != NULL)
+		kmem_free(sf, sizeof (spa_scrub_freed_t));
+}
+
+/*
+ * Called by spa_sync() with the scrub thread suspended, once txg is synced.
+ */
+static void
+spa_scrub_purge(spa_t *spa, uint64_t txg)
+{
+	spa_scrub_freed_t *sf, *sf_next;
+	spa_scrub_blk_t *sb;
+
+	mutex_enter(&spa->spa_scrub_lock);
+	ASSERT(!spa->spa_scrub_active);
+	for (sf = list_head(&spa->spa_scrub_freed); sf != NULL; sf = sf_next) {
+		sf_next = list_next(&spa->spa_scrub_freed, sf);
+		if (sf->sf_txg > txg)
+			continue;
+		sb = spa_scrub_queue_find(spa, &sf->sf_dva);
+		if (sb != NULL && DVA_GET_VDEV(&sb->sb_blk.blk_dva[0]) ==
+		    DVA_GET_VDEV(&sf->sf_dva) &&
+		    DVA_GET_OFFSET(&sb->sb_blk.blk_dva[0]) ==
+		    DVA_GET_OFFSET(&sf->sf_dva))
+			spa_scrub_queue_remove(spa, sb);
+		list_remove(&spa->spa_scrub_freed, sf);
+		kmem_free(sf, sizeof (spa_scrub_freed_t));
+	}
+	mutex_exit(&spa->spa_scrub_lock);
+}
+
 /* ARGSUSED */
 static int
 spa_scrub_cb(traverse_blk_cache_t *bc, spa_t *spa, void *a)
@@ -3471,10 +3839,10 @@ spa_scrub_cb(traverse_blk_cache_t *bc, spa_t *spa, void *a)
 	}
 
 	if (spa->spa_scrub_type == POOL_SCRUB_EVERYTHING)
-		spa_scrub_io_start(spa, bp, ZIO_PRIORITY_SCRUB,
+		spa_scrub_enqueue(spa, bp, ZIO_PRIORITY_SCRUB,
 		    ZIO_FLAG_SCRUB, &bc->bc_bookmark);
 	else if (needs_resilver)
-		spa_scrub_io_start(spa, bp, ZIO_PRIORITY_RESILVER,
+		spa_scrub_enqueue(spa, bp, ZIO_PRIORITY_RESILVER,
 		    ZIO_FLAG_RESILVER, &bc->bc_bookmark);
 
 	return (0);
@@ -3488,10 +3856,20 @@ spa_scrub_thread(spa_t *spa)
 	vdev_t *rvd = spa->spa_root_vdev;
 	pool_scrub_type_t scrub_type = spa->spa_scrub_type;
 	int error = 0;
+	spa_scrub_freed_t *sf;
 	boolean_t complete;
 
 	CALLB_CPR_INIT(&cprinfo, &spa->spa_scrub_lock, callb_generic_cpr, FTAG);
 
+	/*
+	 * Start noting frees for the scrub queue before the wait below,
+	 * so that no txg that syncs after the traverse starts can miss it.
+	 */
+	mutex_enter(&spa->spa_scrub_lock);
+	ASSERT(list_is_empty(&spa->spa_scrub_freed));
+	spa->spa_scrub_queueing = B_TRUE;
+	mutex_exit(&spa->spa_scrub_lock);
+
 	/*
 	 * If we're restarting due to a snapshot create/delete,
 	 * wait for that to complete.
@@ -3512,6 +3890,7 @@ spa_scrub_thread(spa_t *spa)
 	spa->spa_scrub_errors = 0;
 	spa->spa_scrub_active = 1;
 	ASSERT(spa->spa_scrub_inflight == 0);
+	ASSERT(spa->spa_scrub_queued == 0);
 
 	while (!spa->spa_scrub_stop) {
 		CALLB_CPR_SAFE_BEGIN(&cprinfo);
@@ -3528,11 +3907,27 @@ spa_scrub_thread(spa_t *spa)
 
 		mutex_exit(&spa->spa_scrub_lock);
 		error = traverse_more(th);
+		/*
+		 * Once the traverse is done, keep going until everything
+		 * it queued has been read.
+		 */
+		if (error == 0 && !spa_scrub_queue_issue(spa))
+			error = EAGAIN;
 		mutex_enter(&spa->spa_scrub_lock);
 		if (error != EAGAIN)
 			break;
 	}
 
+	/*
+	 * Anything still queued is being abandoned along with this pass.
+	 */
+	spa_scrub_queue_discard(spa);
+	spa->spa_scrub_queueing = B_FALSE;
+	while ((sf = list_head(&spa->spa_scrub_freed)) != NULL) {
+		list_remove(&spa->spa_scrub_freed, sf);
+		kmem_free(sf, sizeof (spa_scrub_freed_t));
+	}
+
 	while (spa->spa_scrub_inflight)
 		cv_wait(&spa->spa_scrub_io_cv, &spa->spa_scrub_lock);
 
@@ -3748,7 +4143,7 @@ spa_scrub(spa_t *spa, pool_scrub_type_t type, boolean_t force)
 		spa->spa_scrub_maxtxg = maxtxg;
 		spa->spa_scrub_th = traverse_init(spa, spa_scrub_cb, NULL,
 		    ADVANCE_PRE | ADVANCE_PRUNE | ADVANCE_ZIL,
-		    ZIO_FLAG_CANFAIL);
+		    ZIO_FLAG_CANFAIL | ZIO_FLAG_SCRUB_THREAD);
 		traverse_add_pool(spa->spa_scrub_th, mintxg, maxtxg);
 		spa->spa_scrub_thread = thread_create(NULL, 0,
 		    spa_scrub_thread, spa, 0, &p0, TS_RUN, minclsyspri);
@@ -3933,6 +4328,345 @@ spa_sync_deferred_frees(spa_t *spa, uint64_t txg)
 	dmu_tx_commit(tx);
 }
 
+/*
+ * The destroy queue.
+ *
+ * Destroying a dataset, or rolling one back, leaves behind a tree of
+ * blocks to free; destroying a snapshot leaves a bplist (the next
+ * snapshot's old deadlist) of them.  Rather than free them all in the
+ * txg that does the destroy, which can take a very long time, we record
+ * them in the destroy queue, a ZAP object in the MOS, and spa_sync()
+ * frees them a few at a time.  Each entry keeps track of how far we've
+ * got, so that we pick up from there in the next txg, even after a
+ * crash.  Trees are walked in post-order, so a block is only freed once
+ * nothing below it remains to be visited.
+ *
+ * The queue has no pool version of its own: other software would ignore
+ * it, and leak whatever is still on it.  So spa_export() finishes it
+ * before letting the pool go, and only a pool that wasn't exported
+ * cleanly can hand a queue over.
+ */
+typedef struct spa_destroy_entry {
+	blkptr_t	sde_bp;		/* root of the tree, or a hole */
+	uint64_t	sde_bplist;	/* bplist object, or 0 for a tree */
+	uint64_t	sde_mintxg;	/* only free blocks born after this */
+	uint64_t	sde_used;	/* space still to be freed */
+	uint64_t	sde_itor;	/* bplist: next entry to visit */
+	zbookmark_t	sde_bookmark;	/* tree: next block to visit */
+} spa_destroy_entry_t;
+
+#define	SDE_WORDS	(sizeof (spa_destroy_entry_t) / sizeof (uint64_t))
+
+typedef struct spa_destroy_arg {
+	spa_destroy_entry_t *sda_sde;
+	zio_t		*sda_zio;
+	uint64_t	sda_txg;
+	uint64_t	sda_freed;
+	hrtime_t	sda_deadline;
+	void		(*sda_func)(spa_t *, blkptr_t *, void *);
+	void		*sda_arg;
+} spa_destroy_arg_t;
+
+static int
+spa_destroy_load(spa_t *spa)
+{
+	objset_t *mos = spa->spa_meta_objset;
+	spa_destroy_entry_t sde;
+	zap_cursor_t zc;
+	zap_attribute_t za;
+	int error = 0;
+
+	spa->spa_destroy_space = 0;
+	spa->spa_destroy_pending = B_FALSE;
+
+	if (spa->spa_destroy_queue_obj == 0)
+		return (0);
+
+	for (zap_cursor_init(&zc, mos, spa->spa_destroy_queue_obj);
+	    zap_cursor_retrieve(&zc, &za) == 0;
+	    zap_cursor_advance(&zc)) {
+		error = zap_lookup(mos, spa->spa_destroy_queue_obj, za.za_name,
+		    sizeof (uint64_t), SDE_WORDS, &sde);
+		if (error)
+			break;
+		spa->spa_destroy_space += sde.sde_used;
+		spa->spa_destroy_pending = B_TRUE;
+	}
+	zap_cursor_fini(&zc);
+
+	return (error);
+}
+
+static void
+spa_destroy_enqueue(spa_t *spa, const char *name, spa_destroy_entry_t *sde,
+    dmu_tx_t *tx)
+{
+	objset_t *mos = spa->spa_meta_objset;
+
+	ASSERT(dmu_tx_is_syncing(tx));
+
+	if (spa->spa_destroy_queue_obj == 0) {
+		spa->spa_destroy_queue_obj = zap_create(mos,
+		    DMU_OT_OBJECT_DIRECTORY, DMU_OT_NONE, 0, tx);
+		VERIFY(zap_add(mos, DMU_POOL_DIRECTORY_OBJECT,
+		    DMU_POOL_DESTROY_QUEUE, sizeof (uint64_t), 1,
+		    &spa->spa_destroy_queue_obj, tx) == 0);
+	}
+
+	VERIFY(zap_add(mos, spa->spa_destroy_queue_obj, name,
+	    sizeof (uint64_t), SDE_WORDS, sde, tx) == 0);
+
+	spa->spa_destroy_space += sde->sde_used;
+	spa->spa_destroy_pending = B_TRUE;
+}
+
+/*
+ * Queue the blocks born after mintxg in the tree under *bp, the root of
+ * objset 'objset', to be freed; used is the space they take.
+ */
+void
+spa_destroy_tree(spa_t *spa, blkptr_t *bp, uint64_t objset, uint64_t mintxg,
+    uint64_t used, dmu_tx_t *tx)
+{
+	spa_destroy_entry_t sde = { 0 };
+	char name[32];
+
+	ASSERT(bp->blk_birth > mintxg);
+
+	sde.sde_bp = *bp;
+	sde.sde_mintxg = mintxg;
+	sde.sde_used = used;
+	traverse_objset_bp_init(&sde.sde_bookmark, objset);
+
+	/* The root is the last block we free, so its DVA stays unique */
+	(void) snprintf(name, sizeof (name), "%llx:%llx",
+	    (u_longlong_t)DVA_GET_VDEV(BP_IDENTITY(bp)),
+	    (u_longlong_t)DVA_GET_OFFSET(BP_IDENTITY(bp)));
+
+	spa_destroy_enqueue(spa, name, &sde, tx);
+}
+
+/*
+ * Queue the blocks born after mintxg on bplist obj to be freed, and the
+ * bplist itself to be destroyed after them; used is the space they take.
+ */
+void
+spa_destroy_bplist(spa_t *spa, uint64_t obj, uint64_t mintxg, uint64_t used,
+    dmu_tx_t *tx)
+{
+	spa_destroy_entry_t sde = { 0 };
+	char name[32];
+
+	sde.sde_bplist = obj;
+	sde.sde_mintxg = mintxg;
+	sde.sde_used = used;
+
+	(void) snprintf(name, sizeof (name), "%llx", (u_longlong_t)obj);
+
+	spa_destroy_enqueue(spa, name, &sde, tx);
+}
+
+/*
+ * Call func on the blocks of *sde that are still to be freed, moving
+ * its bookmark (or iterator) past each one for which func returns 0.
+ * Stops, returning func's error, at the first for which it doesn't.
+ *
+ * What can't be read is passed over, and its blocks are leaked: the
+ * queue outlives the txg that filled it, so anything that stopped us
+ * for good would stop us again in every txg, and after every import.
+ * A tree's unreadable blocks are passed to func with bc_errno set.  If
+ * the rest of a bplist can't be read, we stop as if it had ended.
+ */
+static int
+spa_destroy_visit(spa_t *spa, spa_destroy_entry_t *sde, blkptr_cb_t *func,
+    void *arg)
+{
+	traverse_blk_cache_t bc = { 0 };
+	bplist_t bpl = { 0 };
+	uint64_t itor;
+	int err;
+
+	if (sde->sde_bplist == 0)
+		return (traverse_objset_bp(spa, &sde->sde_bp, sde->sde_mintxg,
+		    &sde->sde_bookmark, func, arg));
+
+	mutex_init(&bpl.bpl_lock, NULL, MUTEX_DEFAULT, NULL);
+	err = bplist_open(&bpl, spa->spa_meta_objset, sde->sde_bplist);
+
+	for (;;) {
+		itor = sde->sde_itor;
+		if (err == 0)
+			err = bplist_iterate(&bpl, &itor, &bc.bc_blkptr);
+		if (err != 0) {
+			if (err != ENOENT)
+				cmn_err(CE_WARN, "pool '%s': error %d reading "
+				    "destroyed bplist %llu; leaking the rest "
+				    "of it", spa_name(spa), err,
+				    (u_longlong_t)sde->sde_bplist);
+			err = 0;
+			break;
+		}
+		if (bc.bc_blkptr.blk_birth > sde->sde_mintxg &&
+		    (err = func(&bc, spa, arg)) != 0)
+			break;
+		sde->sde_itor = itor;
+	}
+
+	bplist_close(&bpl);
+	mutex_destroy(&bpl.bpl_lock);
+
+	return (err);
+}
+
+static int
+spa_destroy_free_cb(traverse_blk_cache_t *bc, spa_t *spa, void *arg)
+{
+	spa_destroy_arg_t *sda = arg;
+	spa_destroy_entry_t *sde = sda->sda_sde;
+	blkptr_t *bp = &bc->bc_blkptr;
+	uint64_t used;
+
+	/*
+	 * We can't find what's under a block we can't read, so leave
+	 * all of it, the block included, where it is.  Whatever space of
+	 * sde_used that accounts for is given up when the entry is done.
+	 */
+	if (bc->bc_errno != 0) {
+		zbookmark_t *zb = &bc->bc_bookmark;
+
+		cmn_err(CE_WARN, "pool '%s': error %d reading destroyed "
+		    "block <%llu, %llu, %lld, %llx>; leaking it and the "
+		    "blocks under it", spa_name(spa), bc->bc_errno,
+		    (u_longlong_t)zb->zb_objset, (u_longlong_t)zb->zb_object,
+		    (longlong_t)zb->zb_level, (u_longlong_t)zb->zb_blkid);
+
+		used = MIN(bp_get_dasize(spa, bp), sde->sde_used);
+		sde->sde_used -= used;
+		spa->spa_destroy_space -= used;
+		return (ERESTART);
+	}
+
+	if (sda->sda_freed >= zfs_free_max_blocks ||
+	    gethrtime() >= sda->sda_deadline)
+		return (EINTR);
+
+	used = MIN(bp_get_dasize(spa, bp), sde->sde_used);
+	sde->sde_used -= used;
+	spa->spa_destroy_space -= used;
+	sda->sda_freed++;
+
+	(void) arc_free(sda->sda_zio, spa, sda->sda_txg, bp, NULL, NULL,
+	    ARC_NOWAIT);
+	return (0);
+}
+
+/*
+ * Free what we can of the destroy queue within this txg's budget.
+ */
+static void
+spa_sync_destroy_queue(spa_t *spa, uint64_t txg)
+{
+	objset_t *mos = spa->spa_meta_objset;
+	uint64_t obj = spa->spa_destroy_queue_obj;
+	spa_destroy_arg_t sda = { 0 };
+	spa_destroy_entry_t sde;
+	zap_cursor_t zc;
+	zap_attribute_t za;
+	dmu_tx_t *tx;
+	int err;
+
+	ASSERT(obj != 0);
+
+	tx = dmu_tx_create_assigned(spa->spa_dsl_pool, txg);
+
+	sda.sda_sde = &sde;
+	sda.sda_zio = zio_root(spa, NULL, NULL, ZIO_FLAG_CONFIG_HELD);
+	sda.sda_txg = txg;
+	sda.sda_deadline = gethrtime() +
+	    (hrtime_t)zfs_free_max_time_ms * 1000000;
+
+	/*
+	 * Finished entries are removed, so the first one in the ZAP is
+	 * always the one to carry on with.
+	 */
+	for (;;) {
+		zap_cursor_init(&zc, mos, obj);
+		err = zap_cursor_retrieve(&zc, &za);
+		zap_cursor_fini(&zc);
+		if (err != 0) {
+			ASSERT3U(err, ==, ENOENT);
+			break;
+		}
+
+		VERIFY(zap_lookup(mos, obj, za.za_name, sizeof (uint64_t),
+		    SDE_WORDS, &sde) == 0);
+
+		err = spa_destroy_visit(spa, &sde, spa_destroy_free_cb, &sda);
+		if (err != 0) {
+			ASSERT3U(err, ==, EINTR);
+			VERIFY(zap_update(mos, obj, za.za_name,
+			    sizeof (uint64_t), SDE_WORDS, &sde, tx) == 0);
+			break;
+		}
+
+		VERIFY(zap_remove(mos, obj, za.za_name, tx) == 0);
+		/* If the bplist itself can't be read, it's leaked too */
+		if (sde.sde_bplist != 0)
+			(void) dmu_object_free(mos, sde.sde_bplist, tx);
+		spa->spa_destroy_space -= sde.sde_used;
+	}
+
+	spa->spa_destroy_pending = (err == EINTR);
+
+	err = zio_wait(sda.sda_zio);
+	ASSERT3U(err, ==, 0);
+
+	dmu_tx_commit(tx);
+}
+
+static int
+spa_destroy_walk_cb(traverse_blk_cache_t *bc, spa_t *spa, void *arg)
+{
+	spa_destroy_arg_t *sda = arg;
+
+	if (bc->bc_errno != 0)
+		return (ERESTART);
+
+	sda->sda_func(spa, &bc->bc_blkptr, sda->sda_arg);
+	return (0);
+}
+
+/*
+ * Call func on every block still waiting in the destroy queue.  zdb uses
+ * this so as not to take them for leaked.
+ */
+void
+spa_destroy_walk(spa_t *spa, void (*func)(spa_t *, blkptr_t *, void *),
+    void *arg)
+{
+	objset_t *mos = spa->spa_meta_objset;
+	spa_destroy_arg_t sda = { 0 };
+	spa_destroy_entry_t sde;
+	zap_cursor_t zc;
+	zap_attribute_t za;
+
+	if (spa->spa_destroy_queue_obj == 0)
+		return;
+
+	sda.sda_func = func;
+	sda.sda_arg = arg;
+
+	for (zap_cursor_init(&zc, mos, spa->spa_destroy_queue_obj);
+	    zap_cursor_retrieve(&zc, &za) == 0;
+	    zap_cursor_advance(&zc)) {
+		if (zap_lookup(mos, spa->spa_destroy_queue_obj, za.za_name,
+		    sizeof (uint64_t), SDE_WORDS, &sde) == 0)
+			(void) spa_destroy_visit(spa, &sde,
+			    spa_destroy_walk_cb, &sda);
+	}
+	zap_cursor_fini(&zc);
+}
+
 static void
 spa_sync_nvlist(spa_t *spa, uint64_t obj, nvlist_t *nv, dmu_tx_t *tx)
 {
@@ -4161,6 +4895,15 @@ spa_sync_props(void *arg1, void *arg2, cred_t *cr, dmu_tx_t *tx)
 			case ZPOOL_PROP_FAILUREMODE:
 				spa->spa_failmode = intval;
 				break;
+			case ZPOOL_PROP_SCRUBRATE:
+				spa->spa_scrub_rate = intval;
+				break;
+			case ZPOOL_PROP_RESILVERRATE:
+				spa->spa_resilver_rate = intval;
+				break;
+			case ZPOOL_PROP_SCRUBLATENCY:
+				spa->spa_scrub_latency = intval;
+				break;
 			default:
 				break;
 			}
@@ -4236,6 +4979,12 @@ spa_sync(spa_t *spa, uint64_t txg)
 	    !txg_list_empty(&dp->dp_sync_tasks, txg))
 		spa_sync_deferred_frees(spa, txg);
 
+	/*
+	 * Free some more of what destroyed datasets have left behind.
+	 */
+	if (spa->spa_destroy_pending)
+		spa_sync_destroy_queue(spa, txg);
+
 	/*
 	 * Iterate to convergence.
 	 */
@@ -4317,6 +5066,8 @@ spa_sync(spa_t *spa, uint64_t txg)
 
 	spa_scrub_suspend(spa);		/* stop scrubbing and finish I/Os */
 
+	spa_scrub_purge(spa, txg);	/* drop freed blocks from its queue */
+
 	rw_enter(&spa->spa_traverse_lock, RW_WRITER);
 	spa->spa_traverse_wanted = 0;
 	spa->spa_ubsync = spa->spa_uberblock;
@@ -1125,6 +1125,16 @@ spa_get_dspace(spa_t *spa)
 		return (spa->spa_root_vdev->vdev_stat.vs_space);
 }
 
+/*
+ * Return the (raid-z-deflated) space held by the remains of destroyed
+ * datasets that are still waiting to be freed.
+ */
+uint64_t
+spa_get_destroy_space(spa_t *spa)
+{
+	return (spa->spa_destroy_space);
+}
+
 /* ARGSUSED */
 uint64_t
 spa_get_asize(spa_t *spa, uint64_t lsize)
@@ -1245,6 +1255,7 @@ spa_init(int mode)
 	dmu_init();
 	zil_init();
 	vdev_cache_stat_init();
+	dsl_pool_stat_init();
 	zfs_prop_init();
 	zpool_prop_init();
 	spa_config_load();
@@ -1255,6 +1266,7 @@ spa_fini(void)
 {
 	spa_evict_all();
 
+	dsl_pool_stat_fini();
 	vdev_cache_stat_fini();
 	zil_fini();
 	dmu_fini();
@@ -276,7 +276,6 @@ txg_sync_thread(dsl_pool_t *dp)
 	tx_state_t *tx = &dp->dp_tx;
 	callb_cpr_t cpr;
 	uint64_t timeout, start, delta, timer;
-	int target;
 
 	txg_thread_enter(tx, &cpr);
 
@@ -361,20 +360,7 @@ txg_sync_thread(dsl_pool_t *dp)
 		 * Attempt to keep the sync time consistant by adjusting the
 		 * amount of write traffic allowed into each transaction group.
 		 */
-		target = zfs_txg_synctime * hz;
-		if (delta > target) {
-			uint64_t old = MIN(dp->dp_write_limit, written);
-
-			dp->dp_write_limit = MAX(zfs_write_limit_min,
-			    old * target / delta);
-		} else if (written >= dp->dp_write_limit &&
-		    delta >> 3 < target >> 3) {
-			uint64_t rescale =
-			    MIN((100 * target) / delta, 200);
-
-			dp->dp_write_limit = MIN(zfs_write_limit_inflated,
-			    written * rescale / 100);
-		}
+		dsl_pool_sync_done(dp, written, delta);
 
 		mutex_enter(&tx->tx_sync_lock);
 		rw_enter(&tx->tx_suspend, RW_WRITER);
@@ -60,6 +60,9 @@ static vdev_ops_t *vdev_ops_table[] = {
 /* maximum scrub/resilver I/O queue */
 int zfs_scrub_limit = 70;
 
+/* maximum number of devices opened, or whose labels are read, at once */
+int vdev_open_threads = 16;
+
 /*
  * Given a vdev type, return the appropriate ops vector.
  */
@@ -733,6 +736,7 @@ vdev_metaslab_init(vdev_t *vd, uint64_t txg)
 	uint64_t oldc = vd->vdev_ms_count;
 	uint64_t newc = vd->vdev_asize >> vd->vdev_ms_shift;
 	metaslab_t **mspp;
+	uint64_t *objects = NULL;
 	int error;
 
 	if (vd->vdev_ms_shift == 0)	/* not being allocated from yet */
@@ -760,19 +764,38 @@ vdev_metaslab_init(vdev_t *vd, uint64_t txg)
 	vd->vdev_ms = mspp;
 	vd->vdev_ms_count = newc;
 
+	/*
+	 * When opening an existing pool, read the space map object numbers
+	 * of all the new metaslabs at once and prefetch their dnodes, so
+	 * that loading a large vdev doesn't wait for one dnode block at a
+	 * time.
+	 */
+	if (txg == 0 && newc > oldc) {
+		objects = kmem_alloc((newc - oldc) * sizeof (uint64_t),
+		    KM_SLEEP);
+		error = dmu_read(mos, vd->vdev_ms_array,
+		    oldc * sizeof (uint64_t), (newc - oldc) * sizeof (uint64_t),
+		    objects);
+		if (error) {
+			kmem_free(objects, (newc - oldc) * sizeof (uint64_t));
+			return (error);
+		}
+		for (m = oldc; m < newc; m++)
+			dmu_prefetch(mos, objects[m - oldc], 0, 0);
+	}
+
 	for (m = oldc; m < newc; m++) {
 		space_map_obj_t smo = { 0, 0, 0 };
 		if (txg == 0) {
-			uint64_t object = 0;
-			error = dmu_read(mos, vd->vdev_ms_array,
-			    m * sizeof (uint64_t), sizeof (uint64_t), &object);
-			if (error)
-				return (error);
+			uint64_t object = objects[m - oldc];
 			if (object != 0) {
 				dmu_buf_t *db;
 				error = dmu_bonus_hold(mos, object, FTAG, &db);
-				if (error)
+				if (error) {
+					kmem_free(objects,
+					    (newc - oldc) * sizeof (uint64_t));
 					return (error);
+				}
 				ASSERT3U(db->db_size, >=, sizeof (smo));
 				bcopy(db->db_data, &smo, sizeof (smo));
 				ASSERT3U(smo.smo_object, ==, object);
@@ -783,6 +806,9 @@ vdev_metaslab_init(vdev_t *vd, uint64_t txg)
 		    m << vd->vdev_ms_shift, 1ULL << vd->vdev_ms_shift, txg);
 	}
 
+	if (objects != NULL)
+		kmem_free(objects, (newc - oldc) * sizeof (uint64_t));
+
 	return (0);
 }
 
@@ -793,6 +819,7 @@ vdev_metaslab_fini(vdev_t *vd)
 	uint64_t count = vd->vdev_ms_count;
 
 	if (vd->vdev_ms != NULL) {
+		metaslab_group_preload_wait(vd->vdev_mg);
 		for (m = 0; m < count; m++)
 			if (vd->vdev_ms[m] != NULL)
 				metaslab_fini(vd->vdev_ms[m]);
@@ -816,6 +843,43 @@ vdev_probe(vdev_t *vd)
 	return (0);
 }
 
+/*
+ * Interior vdevs open their children concurrently, each from a taskq
+ * thread, so that opening and probing a wide pool takes about as long as
+ * its slowest device instead of the sum of all of them.  The result of
+ * each open is left in the child's vdev_open_error.
+ */
+static void
+vdev_open_child(void *arg)
+{
+	vdev_t *vd = arg;
+
+	vd->vdev_open_error = vdev_open(vd);
+}
+
+void
+vdev_open_children(vdev_t *vd)
+{
+	taskq_t *tq;
+	int children = vd->vdev_children;
+	int c;
+
+	if (children == 1) {
+		vdev_open_child(vd->vdev_child[0]);
+		return;
+	}
+
+	tq = taskq_create("vdev_open", MIN(children, vdev_open_threads),
+	    minclsyspri, children, children, TASKQ_PREPOPULATE);
+
+	for (c = 0; c < children; c++)
+		if (taskq_dispatch(tq, vdev_open_child, vd->vdev_child[c],
+		    TQ_SLEEP) == 0)
+			vdev_open_child(vd->vdev_child[c]);
+
+	taskq_destroy(tq);
+}
+
 /*
  * Prepare a virtual device for access.
  */
@@ -981,17 +1045,65 @@ vdev_open(vdev_t *vd)
 }
 
 /*
- * Called once the vdevs are all opened, this routine validates the label
- * contents.  This needs to be done before vdev_load() so that we don't
- * inadvertently do repair I/Os to the wrong device.
- *
- * This function will only return failure if one of the vdevs indicates that it
- * has since been destroyed or exported.  This is only possible if
- * /etc/zfs/zpool.cache was readonly at the time.  Otherwise, the vdev state
- * will be updated but the function will return 0.
+ * The labels of the leaves under the vdev being validated are read in
+ * parallel before vdev_validate_impl() checks them, since each read waits
+ * for a device.  The checks themselves stay serial, as a bad label changes
+ * the state of the parent vdevs.
  */
-int
-vdev_validate(vdev_t *vd)
+static void
+vdev_validate_read(void *arg)
+{
+	vdev_t *vd = arg;
+
+	vd->vdev_validate_label = vdev_label_read_config(vd);
+}
+
+static int
+vdev_validate_count(vdev_t *vd)
+{
+	int c, count = 0;
+
+	for (c = 0; c < vd->vdev_children; c++)
+		count += vdev_validate_count(vd->vdev_child[c]);
+
+	if (vd->vdev_ops->vdev_op_leaf && !vdev_is_dead(vd))
+		count++;
+
+	return (count);
+}
+
+static void
+vdev_validate_dispatch(vdev_t *vd, taskq_t *tq)
+{
+	int c;
+
+	for (c = 0; c < vd->vdev_children; c++)
+		vdev_validate_dispatch(vd->vdev_child[c], tq);
+
+	if (vd->vdev_ops->vdev_op_leaf && !vdev_is_dead(vd) &&
+	    taskq_dispatch(tq, vdev_validate_read, vd, TQ_SLEEP) == 0)
+		vdev_validate_read(vd);
+}
+
+/*
+ * Free the labels left over when vdev_validate_impl() bailed out early.
+ */
+static void
+vdev_validate_free(vdev_t *vd)
+{
+	int c;
+
+	for (c = 0; c < vd->vdev_children; c++)
+		vdev_validate_free(vd->vdev_child[c]);
+
+	if (vd->vdev_validate_label != NULL) {
+		nvlist_free(vd->vdev_validate_label);
+		vd->vdev_validate_label = NULL;
+	}
+}
+
+static int
+vdev_validate_impl(vdev_t *vd)
 {
 	spa_t *spa = vd->vdev_spa;
 	int c;
@@ -1000,7 +1112,7 @@ vdev_validate(vdev_t *vd)
 	uint64_t state;
 
 	for (c = 0; c < vd->vdev_children; c++)
-		if (vdev_validate(vd->vdev_child[c]) != 0)
+		if (vdev_validate_impl(vd->vdev_child[c]) != 0)
 			return (EBADF);
 
 	/*
@@ -1010,7 +1122,12 @@ vdev_validate(vdev_t *vd)
 	 */
 	if (vd->vdev_ops->vdev_op_leaf && !vdev_is_dead(vd)) {
 
-		if ((label = vdev_label_read_config(vd)) == NULL) {
+		if ((label = vd->vdev_validate_label) != NULL)
+			vd->vdev_validate_label = NULL;
+		else
+			label = vdev_label_read_config(vd);
+
+		if (label == NULL) {
 			vdev_set_state(vd, B_TRUE, VDEV_STATE_CANT_OPEN,
 			    VDEV_AUX_BAD_LABEL);
 			return (0);
@@ -1057,6 +1174,36 @@ vdev_validate(vdev_t *vd)
 	return (0);
 }
 
+/*
+ * Called once the vdevs are all opened, this routine validates the label
+ * contents.  This needs to be done before vdev_load() so that we don't
+ * inadvertently do repair I/Os to the wrong device.
+ *
+ * This function will only return failure if one of the vdevs indicates that it
+ * has since been destroyed or exported.  This is only possible if
+ * /etc/zfs/zpool.cache was readonly at the time.  Otherwise, the vdev state
+ * will be updated but the function will return 0.
+ */
+int
+vdev_validate(vdev_t *vd)
+{
+	taskq_t *tq;
+	int leaves, error;
+
+	if ((leaves = vdev_validate_count(vd)) > 1) {
+		tq = taskq_create("vdev_validate",
+		    MIN(leaves, vdev_open_threads), minclsyspri, leaves,
+		    leaves, TASKQ_PREPOPULATE);
+		vdev_validate_dispatch(vd, tq);
+		taskq_destroy(tq);
+	}
+
+	error = vdev_validate_impl(vd);
+	vdev_validate_free(vd);
+
+	return (error);
+}
+
 /*
  * Close a virtual device.
  */
@@ -1359,13 +1506,17 @@ vdev_load(vdev_t *vd)
 		vdev_load(vd->vdev_child[c]);
 
 	/*
-	 * If this is a top-level vdev, initialize its metaslabs.
+	 * If this is a top-level vdev, initialize its metaslabs and start
+	 * loading the space maps we're going to allocate from first.
 	 */
-	if (vd == vd->vdev_top &&
-	    (vd->vdev_ashift == 0 || vd->vdev_asize == 0 ||
-	    vdev_metaslab_init(vd, 0) != 0))
-		vdev_set_state(vd, B_FALSE, VDEV_STATE_CANT_OPEN,
-		    VDEV_AUX_CORRUPT_DATA);
+	if (vd == vd->vdev_top) {
+		if (vd->vdev_ashift == 0 || vd->vdev_asize == 0 ||
+		    vdev_metaslab_init(vd, 0) != 0)
+			vdev_set_state(vd, B_FALSE, VDEV_STATE_CANT_OPEN,
+			    VDEV_AUX_CORRUPT_DATA);
+		else if (vd->vdev_mg != NULL)
+			metaslab_group_preload(vd->vdev_mg);
+	}
 
 	/*
 	 * If this is a leaf vdev, load its DTL.
@@ -1423,6 +1574,9 @@ vdev_sync_done(vdev_t *vd, uint64_t txg)
 
 	while (msp = txg_list_remove(&vd->vdev_ms_list, TXG_CLEAN(txg)))
 		metaslab_sync_done(msp, txg);
+
+	if (vd->vdev_mg != NULL)
+		metaslab_group_preload(vd->vdev_mg);
 }
 
 void
@@ -135,10 +135,12 @@ vdev_mirror_open(vdev_t *vd, uint64_t *asize, uint64_t *ashift)
 		return (EINVAL);
 	}
 
+	vdev_open_children(vd);
+
 	for (c = 0; c < vd->vdev_children; c++) {
 		cvd = vd->vdev_child[c];
 
-		if ((ret = vdev_open(cvd)) != 0) {
+		if ((ret = cvd->vdev_open_error) != 0) {
 			lasterror = ret;
 			numerrors++;
 			continue;
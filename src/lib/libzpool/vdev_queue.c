@@ -55,6 +55,16 @@ int zfs_vdev_ramp_rate = 2;
  */
 int zfs_vdev_aggregation_limit = SPA_MAXBLOCKSIZE;
 
+/*
+ * The latency of non-scrub i/os, from the time they are queued until they
+ * complete, is tracked as a moving average with a weight of
+ * 1/2^zfs_vdev_latency_shift per i/o, for the scrub to back off on.  Once
+ * there has been no such i/o for zfs_vdev_latency_idle_ms, the device is
+ * considered idle.
+ */
+int zfs_vdev_latency_shift = 3;
+int zfs_vdev_latency_idle_ms = 1000;
+
 /*
  * Virtual device vector for disk I/O scheduling.
  */
@@ -271,6 +281,7 @@ vdev_queue_io(zio_t *zio)
 
 	mutex_enter(&vq->vq_lock);
 
+	zio->io_queued = gethrtime();
 	zio->io_deadline = (zio->io_timestamp >> zfs_vdev_time_shift) +
 	    zio->io_priority;
 
@@ -291,17 +302,39 @@ vdev_queue_io(zio_t *zio)
 	return (nio);
 }
 
+static void
+vdev_queue_latency_update(vdev_queue_t *vq, zio_t *zio, hrtime_t now)
+{
+	ASSERT(MUTEX_HELD(&vq->vq_lock));
+
+	if (zio->io_flags & ZIO_FLAG_SCRUB_THREAD)
+		return;
+
+	vq->vq_io_latency += ((now - zio->io_queued) - vq->vq_io_latency) >>
+	    zfs_vdev_latency_shift;
+	vq->vq_io_complete = now;
+}
+
 void
 vdev_queue_io_done(zio_t *zio)
 {
 	vdev_queue_t *vq = &zio->io_vd->vdev_queue;
-	zio_t *nio;
+	hrtime_t now = gethrtime();
+	zio_t *nio, *dio;
 	int i;
 
 	mutex_enter(&vq->vq_lock);
 
 	avl_remove(&vq->vq_pending_tree, zio);
 
+	if (zio->io_done == vdev_queue_agg_io_done) {
+		for (dio = zio->io_delegate_list; dio != NULL;
+		    dio = dio->io_delegate_next)
+			vdev_queue_latency_update(vq, dio, now);
+	} else {
+		vdev_queue_latency_update(vq, zio, now);
+	}
+
 	for (i = 0; i < zfs_vdev_ramp_rate; i++) {
 		nio = vdev_queue_io_to_issue(vq, zfs_vdev_max_pending);
 		if (nio == NULL)
@@ -318,3 +351,22 @@ vdev_queue_io_done(zio_t *zio)
 
 	mutex_exit(&vq->vq_lock);
 }
+
+/*
+ * Average latency of recent non-scrub i/o to this leaf vdev, or zero if
+ * it has been idle.
+ */
+hrtime_t
+vdev_queue_latency(vdev_t *vd)
+{
+	vdev_queue_t *vq = &vd->vdev_queue;
+	hrtime_t latency = 0;
+
+	mutex_enter(&vq->vq_lock);
+	if (gethrtime() - vq->vq_io_complete <
+	    (hrtime_t)zfs_vdev_latency_idle_ms * 1000000)
+		latency = vq->vq_io_latency;
+	mutex_exit(&vq->vq_lock);
+
+	return (latency);
+}
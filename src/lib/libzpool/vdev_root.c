@@ -63,11 +63,13 @@ vdev_root_open(vdev_t *vd, uint64_t *asize, uint64_t *ashift)
 		return (EINVAL);
 	}
 
+	vdev_open_children(vd);
+
 	for (c = 0; c < vd->vdev_children; c++) {
 		vdev_t *cvd = vd->vdev_child[c];
 		int error;
 
-		if ((error = vdev_open(cvd)) != 0) {
+		if ((error = cvd->vdev_open_error) != 0) {
 			lasterror = error;
 			numerrors++;
 			continue;
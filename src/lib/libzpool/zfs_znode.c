@@ -1056,12 +1056,14 @@ zfs_no_putpage(vnode_t *vp, page_t *pp, u_offset_t *offp, size_t *lenp,
  *		off	- start of section to free.
  *		len	- length of section to free (0 => to EOF).
  *		flag	- current file open mode flags.
+ *		waited	- retrying after an ERESTART (and dmu_tx_wait()).
  *
  * 	RETURN:	0 if success
  *		error code if failure
  */
 int
-zfs_freesp(znode_t *zp, uint64_t off, uint64_t len, int flag, boolean_t log)
+zfs_freesp(znode_t *zp, uint64_t off, uint64_t len, int flag, boolean_t log,
+    boolean_t waited)
 {
 	vnode_t *vp = ZTOV(zp);
 	dmu_tx_t *tx;
@@ -1146,7 +1148,7 @@ zfs_freesp(znode_t *zp, uint64_t off, uint64_t len, int flag, boolean_t log)
 		dmu_tx_hold_free(tx, zp->z_id, off, len ? len : DMU_OBJECT_END);
 	}
 
-	error = dmu_tx_assign(tx, zfsvfs->z_assign);
+	error = dmu_tx_assign(tx, waited ? TXG_WAITED : zfsvfs->z_assign);
 	if (error) {
 		if (error == ERESTART && zfsvfs->z_assign == TXG_NOWAIT)
 			dmu_tx_wait(tx);
@@ -354,7 +354,7 @@ zil_create(zilog_t *zilog)
 		txg = dmu_tx_get_txg(tx);
 
 		error = zio_alloc_blk(zilog->zl_spa, ZIL_MIN_BLKSZ, &blk,
-		    NULL, txg);
+		    NULL, txg, ZIL_USE_SLOG(zilog));
 
 		if (error == 0)
 			zil_init_log_chain(zilog, &blk);
@@ -554,12 +554,10 @@ zil_add_block(zilog_t *zilog, blkptr_t *bp)
 	if (zfs_nocacheflush)
 		return;
 
-	ASSERT(zilog->zl_writer);
-
 	/*
-	 * Even though we're zl_writer, we still need a lock because the
-	 * zl_get_data() callbacks may have dmu_sync() done callbacks
-	 * that will run concurrently.
+	 * Blocks are added as their writes complete: from log block and
+	 * dmu_sync() done callbacks, which may run concurrently with each
+	 * other and with the zl_writer.
 	 */
 	mutex_enter(&zilog->zl_vdev_lock);
 	for (i = 0; i < ndvas; i++) {
@@ -582,26 +580,32 @@ zil_flush_vdevs(zilog_t *zilog)
 	zil_vdev_node_t *zv;
 	zio_t *zio;
 
-	ASSERT(zilog->zl_writer);
-
 	/*
-	 * We don't need zl_vdev_lock here because we're the zl_writer,
-	 * and all zl_get_data() callbacks are done.
+	 * Several commits may be in flight.  A vdev is only in the tree once
+	 * a write to it has completed, so whoever takes it out flushes every
+	 * completed write there.  Flushes are serialized, so by the time we
+	 * get here any of our writes taken out by an earlier commit have been
+	 * flushed too.
 	 */
-	if (avl_numnodes(t) == 0)
+	mutex_enter(&zilog->zl_flush_lock);
+	if (avl_numnodes(t) == 0) {
+		mutex_exit(&zilog->zl_flush_lock);
 		return;
+	}
 
 	spa_config_enter(spa, RW_READER, FTAG);
 
 	zio = zio_root(spa, NULL, NULL,
 	    ZIO_FLAG_CONFIG_HELD | ZIO_FLAG_CANFAIL);
 
+	mutex_enter(&zilog->zl_vdev_lock);
 	while ((zv = avl_destroy_nodes(t, &cookie)) != NULL) {
 		vdev_t *vd = vdev_lookup_top(spa, zv->zv_vdev);
 		if (vd != NULL)
 			zio_flush(zio, vd);
 		kmem_free(zv, sizeof (*zv));
 	}
+	mutex_exit(&zilog->zl_vdev_lock);
 
 	/*
 	 * Wait for all the flushes to complete.  Not all devices actually
@@ -610,6 +614,7 @@ zil_flush_vdevs(zilog_t *zilog)
 	(void) zio_wait(zio);
 
 	spa_config_exit(spa, FTAG);
+	mutex_exit(&zilog->zl_flush_lock);
 }
 
 /*
@@ -628,6 +633,10 @@ zil_lwb_write_done(zio_t *zio)
 	 */
 	txg_rele_to_sync(&lwb->lwb_txgh);
 
+	/* Record the block for later vdev flushing */
+	if (zio->io_error == 0)
+		zil_add_block(zilog, &lwb->lwb_blk);
+
 	zio_buf_free(lwb->lwb_buf, lwb->lwb_sz);
 	mutex_enter(&zilog->zl_lock);
 	lwb->lwb_buf = NULL;
@@ -705,7 +714,8 @@ zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
 
 	BP_ZERO(bp);
 	/* pass the old blkptr in order to spread log blocks across devs */
-	error = zio_alloc_blk(spa, zil_blksz, bp, &lwb->lwb_blk, txg);
+	error = zio_alloc_blk(spa, zil_blksz, bp, &lwb->lwb_blk, txg,
+	    ZIL_USE_SLOG(zilog));
 	if (error) {
 		dmu_tx_t *tx = dmu_tx_create_assigned(zilog->zl_dmu_pool, txg);
 
@@ -760,9 +770,6 @@ zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
 	list_insert_tail(&zilog->zl_lwb_list, nlwb);
 	mutex_exit(&zilog->zl_lock);
 
-	/* Record the block for later vdev flushing */
-	zil_add_block(zilog, &lwb->lwb_blk);
-
 	/*
 	 * kick off the write for the old log block
 	 */
@@ -956,8 +963,10 @@ zil_commit_writer(zilog_t *zilog, uint64_t seq, uint64_t foid)
 {
 	uint64_t txg;
 	uint64_t commit_seq = 0;
+	uint64_t ticket;
 	itx_t *itx, *itx_next = (itx_t *)-1;
 	lwb_t *lwb;
+	zio_t *root_zio;
 	spa_t *spa;
 
 	zilog->zl_writer = B_TRUE;
@@ -1060,23 +1069,60 @@ zil_commit_writer(zilog_t *zilog, uint64_t seq, uint64_t foid)
 	zilog->zl_prev_used = zilog->zl_cur_used;
 	zilog->zl_cur_used = 0;
 
+	root_zio = zilog->zl_root_zio;
+	zilog->zl_root_zio = NULL;
+
+	/*
+	 * Our log blocks are on their way.  Unless we failed to allocate
+	 * the next one (and so have to wait for the txg to sync), let the
+	 * next writer fill and issue new log blocks while ours are in
+	 * flight; zil_commit() callers whose records we wrote wait for us
+	 * instead of becoming writers themselves.
+	 */
+	mutex_enter(&zilog->zl_lock);
+	ticket = ++zilog->zl_commit_issued;
+	ASSERT3U(commit_seq, >=, zilog->zl_issued_seq);
+	zilog->zl_issued_seq = commit_seq;
+	if (lwb != NULL) {
+		zilog->zl_writer = B_FALSE;
+		cv_broadcast(&zilog->zl_cv_writer);
+	}
+	mutex_exit(&zilog->zl_lock);
+
 	/*
 	 * Wait if necessary for the log blocks to be on stable storage.
 	 */
-	if (zilog->zl_root_zio) {
+	if (root_zio) {
 		DTRACE_PROBE1(zil__cw3, zilog_t *, zilog);
-		(void) zio_wait(zilog->zl_root_zio);
+		(void) zio_wait(root_zio);
 		DTRACE_PROBE1(zil__cw4, zilog_t *, zilog);
 		zil_flush_vdevs(zilog);
 	}
 
-	if (zilog->zl_log_error || lwb == NULL) {
-		zilog->zl_log_error = 0;
+	if (lwb == NULL)
 		txg_wait_synced(zilog->zl_dmu_pool, 0);
-	}
 
+	/*
+	 * The log chain is only good up to its first missing block, so
+	 * commits become stable in the order they were issued.  A failed
+	 * log write breaks the chain for every commit issued after it,
+	 * until the txg syncs.
+	 */
 	mutex_enter(&zilog->zl_lock);
-	zilog->zl_writer = B_FALSE;
+	while (zilog->zl_commit_done != ticket - 1)
+		cv_wait(&zilog->zl_cv_writer, &zilog->zl_lock);
+
+	if (zilog->zl_log_error) {
+		mutex_exit(&zilog->zl_lock);
+		txg_wait_synced(zilog->zl_dmu_pool, 0);
+		mutex_enter(&zilog->zl_lock);
+		if (zilog->zl_commit_issued == ticket)
+			zilog->zl_log_error = B_FALSE;
+	}
+
+	zilog->zl_commit_done = ticket;
+	if (lwb == NULL)
+		zilog->zl_writer = B_FALSE;
 
 	ASSERT3U(commit_seq, >=, zilog->zl_commit_seq);
 	zilog->zl_commit_seq = commit_seq;
@@ -1086,6 +1132,10 @@ zil_commit_writer(zilog_t *zilog, uint64_t seq, uint64_t foid)
  * Push zfs transactions to stable storage up to the supplied sequence number.
  * If foid is 0 push out all transactions, otherwise push only those
  * for that file or might have been used to create that file.
+ *
+ * Callers whose transactions are already being written by an in-flight
+ * commit just wait for it.  Callers queued behind a busy writer are
+ * grouped: the first of them to become writer pushes out everything.
  */
 void
 zil_commit(zilog_t *zilog, uint64_t seq, uint64_t foid)
@@ -1093,16 +1143,32 @@ zil_commit(zilog_t *zilog, uint64_t seq, uint64_t foid)
 	if (zilog == NULL || seq == 0)
 		return;
 
+	/* sync=disabled: synchronous semantics are left to txg sync */
+	if (zilog->zl_os->os->os_sync == ZFS_SYNC_DISABLED)
+		return;
+
 	mutex_enter(&zilog->zl_lock);
 
 	seq = MIN(seq, zilog->zl_itx_seq);	/* cap seq at largest itx seq */
 
-	while (zilog->zl_writer) {
-		cv_wait(&zilog->zl_cv_writer, &zilog->zl_lock);
+	for (;;) {
 		if (seq < zilog->zl_commit_seq) {
 			mutex_exit(&zilog->zl_lock);
 			return;
 		}
+		if (seq < zilog->zl_issued_seq) {
+			cv_wait(&zilog->zl_cv_writer, &zilog->zl_lock);
+			continue;
+		}
+		if (!zilog->zl_writer)
+			break;
+		zilog->zl_commit_waiters++;
+		cv_wait(&zilog->zl_cv_writer, &zilog->zl_lock);
+		zilog->zl_commit_waiters--;
+	}
+	if (zilog->zl_commit_waiters != 0) {
+		seq = zilog->zl_itx_seq;
+		foid = 0;
 	}
 	zil_commit_writer(zilog, seq, foid); /* drops zl_lock */
 	/* wake up others waiting on the commit */
@@ -1210,6 +1276,7 @@ zil_alloc(objset_t *os, zil_header_t *zh_phys)
 	    offsetof(lwb_t, lwb_node));
 
 	mutex_init(&zilog->zl_vdev_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&zilog->zl_flush_lock, NULL, MUTEX_DEFAULT, NULL);
 
 	avl_create(&zilog->zl_vdev_tree, zil_vdev_compare,
 	    sizeof (zil_vdev_node_t), offsetof(zil_vdev_node_t, zv_node));
@@ -1237,6 +1304,7 @@ zil_free(zilog_t *zilog)
 
 	avl_destroy(&zilog->zl_vdev_tree);
 	mutex_destroy(&zilog->zl_vdev_lock);
+	mutex_destroy(&zilog->zl_flush_lock);
 
 	ASSERT(list_head(&zilog->zl_itx_list) == NULL);
 	list_destroy(&zilog->zl_itx_list);
@@ -1346,7 +1414,8 @@ zil_suspend(zilog_t *zilog)
 	 * Wait for any in-flight log writes to complete.
 	 */
 	mutex_enter(&zilog->zl_lock);
-	while (zilog->zl_writer)
+	while (zilog->zl_writer ||
+	    zilog->zl_commit_done != zilog->zl_commit_issued)
 		cv_wait(&zilog->zl_cv_writer, &zilog->zl_lock);
 	mutex_exit(&zilog->zl_lock);
 
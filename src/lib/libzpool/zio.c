@@ -1684,6 +1684,7 @@ zio_dva_free(zio_t *zio)
 {
 	blkptr_t *bp = zio->io_bp;
 
+	spa_scrub_block_freed(zio->io_spa, bp, zio->io_txg);
 	metaslab_free(zio->io_spa, bp, zio->io_txg, B_FALSE);
 
 	BP_ZERO(bp);
@@ -2023,12 +2024,13 @@ zio_io_should_fail(uint16_t range)
 
 /*
  * Try to allocate an intent log block.  Return 0 on success, errno on failure.
+ * Unless use_slog is false, separate log devices are tried first.
  */
 int
 zio_alloc_blk(spa_t *spa, uint64_t size, blkptr_t *new_bp, blkptr_t *old_bp,
-    uint64_t txg)
+    uint64_t txg, boolean_t use_slog)
 {
-	int error;
+	int error = ENOSPC;
 
 	spa_config_enter(spa, RW_READER, FTAG);
 
@@ -2041,8 +2043,9 @@ zio_alloc_blk(spa_t *spa, uint64_t size, blkptr_t *new_bp, blkptr_t *old_bp,
 	 * We were passed the previous log block's DVA in bp->blk_dva[0].
 	 * We use that as a hint for which vdev to allocate from next.
 	 */
-	error = metaslab_alloc(spa, spa->spa_log_class, size,
-	    new_bp, 1, txg, old_bp, B_TRUE);
+	if (use_slog)
+		error = metaslab_alloc(spa, spa->spa_log_class, size,
+		    new_bp, 1, txg, old_bp, B_TRUE);
 
 	if (error)
 		error = metaslab_alloc(spa, spa->spa_normal_class, size,
@@ -2075,6 +2078,7 @@ zio_free_blk(spa_t *spa, blkptr_t *bp, uint64_t txg)
 
 	spa_config_enter(spa, RW_READER, FTAG);
 
+	spa_scrub_block_freed(spa, bp, txg);
 	metaslab_free(spa, bp, txg, B_FALSE);
 
 	spa_config_exit(spa, FTAG);
@@ -31,6 +31,7 @@
 
 #include <stdio.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <fuse/fuse.h>
 
 #include "zfs_ioctl.h"
@@ -38,19 +39,59 @@
 #include "util.h"
 
 #define MAX_CONNECTIONS 100
+#define NUM_IOCTL_THREADS 8
+
+/* The listening socket, done_fd[0] and the idle connections */
+#define MAX_FDS (MAX_CONNECTIONS + 2)
 
 boolean_t exit_listener = B_FALSE;
 
+/*
+ * listener_loop() polls the idle connections and hands each one with a
+ * pending request to the ioctl threads through this queue. The thread
+ * that takes it processes one request and gives the connection back
+ * through done_fd (or -1 if it was closed), so that a connection is never
+ * polled while its request is still being served.
+ *
+ * A connection is queued at most once, so the queue never holds more
+ * than MAX_CONNECTIONS entries.
+ */
+static int work_queue[MAX_CONNECTIONS];
+static int work_head;
+static int work_count;
+static pthread_mutex_t work_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cv = PTHREAD_COND_INITIALIZER;
+
+static boolean_t work_exit = B_FALSE;
+
+static pthread_t ioctl_threads[NUM_IOCTL_THREADS];
+static int done_fd[2];
+
 int cmd_ioctl_req(int sock, zfsfuse_cmd_t *cmd)
 {
 	dev_t dev = {0};
 
+	if(cmd->cmd_u.ioctl_req.cmd == ZFSFUSE_IOC_PROTOCOL)
+		return zfsfuse_socket_ioctl_write(sock, cmd->cmd_u.ioctl_req.arg <= ZFSFUSE_PROTOCOL_BULK ? 0 : ENOTSUP);
+
+	/* cur_fd is per-thread, see zfsfuse_socket.c */
 	cur_fd = sock;
 	int ioctl_ret = zfsdev_ioctl(dev, cmd->cmd_u.ioctl_req.cmd, (uintptr_t) cmd->cmd_u.ioctl_req.arg, 0, NULL, NULL);
 	cur_fd = -1;
 
 	return zfsfuse_socket_ioctl_write(sock, ioctl_ret);
 }
+int cmd_ioctl_bulk_req(int sock, zfsfuse_cmd_t *cmd)
+{
+	int ret = -1;
+
+	if(zfsfuse_socket_read_preload(sock, cmd->cmd_u.ioctl_req.arg) == 0)
+		ret = cmd_ioctl_req(sock, cmd);
+
+	zfsfuse_socket_free_preload();
+
+	return ret;
+}
 
 int cmd_mount_req(int sock, zfsfuse_cmd_t *cmd)
 {
@@ -88,16 +129,106 @@ int cmd_mount_req(int sock, zfsfuse_cmd_t *cmd)
 	return error ? -1 : 0;
 }
 
+/*
+ * Read and process one request from a connection.
+ * Returns -1 if the connection should be closed.
+ */
+static int cmd_handle(int sock)
+{
+	zfsfuse_cmd_t cmd;
+
+	if(zfsfuse_socket_read_loop(sock, &cmd, sizeof(zfsfuse_cmd_t)) == -1)
+		return -1;
+
+	switch(cmd.cmd_type) {
+		case IOCTL_REQ:
+			return cmd_ioctl_req(sock, &cmd);
+		case IOCTL_BULK_REQ:
+			return cmd_ioctl_bulk_req(sock, &cmd);
+		case MOUNT_REQ:
+			return cmd_mount_req(sock, &cmd);
+		default:
+			/*
+			 * We can't tell how much of what follows belongs to
+			 * this request, so fail it and drop the connection.
+			 */
+			fprintf(stderr, "Warning: unknown request type %i, closing connection.\n", cmd.cmd_type);
+			(void) zfsfuse_socket_ioctl_write(sock, ENOTSUP);
+			break;
+	}
+
+	return -1;
+}
+
+static void *ioctl_thread_loop(void *arg)
+{
+	VERIFY(pthread_mutex_lock(&work_mtx) == 0);
+
+	for(;;) {
+		while(work_count == 0 && !work_exit)
+			VERIFY(pthread_cond_wait(&work_cv, &work_mtx) == 0);
+
+		if(work_count == 0)
+			break;
+
+		int sock = work_queue[work_head];
+		work_head = (work_head + 1) % MAX_CONNECTIONS;
+		work_count--;
+
+		VERIFY(pthread_mutex_unlock(&work_mtx) == 0);
+
+		if(cmd_handle(sock) != 0) {
+			close(sock);
+			sock = -1;
+		}
+
+		/* Give the connection back to listener_loop() */
+		VERIFY(write(done_fd[1], &sock, sizeof(int)) == sizeof(int));
+
+		VERIFY(pthread_mutex_lock(&work_mtx) == 0);
+	}
+
+	VERIFY(pthread_mutex_unlock(&work_mtx) == 0);
+
+	return NULL;
+}
+
+static void queue_request(int sock)
+{
+	VERIFY(pthread_mutex_lock(&work_mtx) == 0);
+
+	ASSERT(work_count < MAX_CONNECTIONS);
+	work_queue[(work_head + work_count) % MAX_CONNECTIONS] = sock;
+	work_count++;
+
+	VERIFY(pthread_cond_signal(&work_cv) == 0);
+	VERIFY(pthread_mutex_unlock(&work_mtx) == 0);
+}
+
 void *listener_loop(void *arg)
 {
 	int *ioctl_fd = (int *) arg;
 
-	struct pollfd fds[MAX_CONNECTIONS];
+	struct pollfd fds[MAX_FDS];
+
+	/* Connections currently being served by an ioctl thread */
+	int busy = 0;
+
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, done_fd) == -1) {
+		perror("socketpair");
+		return NULL;
+	}
+
+	for(int i = 0; i < NUM_IOCTL_THREADS; i++)
+		VERIFY(pthread_create(&ioctl_threads[i], NULL, ioctl_thread_loop, NULL) == 0);
 
 	fds[0].fd = *ioctl_fd;
 	fds[0].events = POLLIN;
 
-	int nfds = 1;
+	fds[1].fd = done_fd[0];
+	fds[1].events = POLLIN;
+
+	int nfds = 2;
 
 	while(!exit_listener) {
 		/* Poll all sockets with a 1 second timeout */
@@ -134,7 +265,7 @@ void *listener_loop(void *arg)
 					continue;
 				}
 
-				if(nfds == MAX_CONNECTIONS) {
+				if(nfds - 2 + busy == MAX_CONNECTIONS) {
 					fprintf(stderr, "Warning: connection limit reached (%i), closing connection.\n", MAX_CONNECTIONS);
 					close(sock);
 					continue;
@@ -144,36 +275,26 @@ void *listener_loop(void *arg)
 				fds[nfds].events = POLLIN;
 				fds[nfds].revents = 0;
 				nfds++;
-			} else {
-				/* Handle request */
+			} else if(i == 1) {
+				/* An ioctl thread is done with a connection */
 
-				zfsfuse_cmd_t cmd;
-				int sock = fds[i].fd;
-				if(zfsfuse_socket_read_loop(sock, &cmd, sizeof(zfsfuse_cmd_t)) == -1) {
-					close(sock);
-					fds[i].fd = -1;
+				int sock;
+				VERIFY(zfsfuse_socket_read_loop(done_fd[0], &sock, sizeof(int)) == 0);
+				busy--;
+
+				if(sock == -1)
 					continue;
-				}
 
-				switch(cmd.cmd_type) {
-					case IOCTL_REQ:
-						if(cmd_ioctl_req(sock, &cmd) != 0) {
-							close(sock);
-							fds[i].fd = -1;
-							continue;
-						}
-						break;
-					case MOUNT_REQ:
-						if(cmd_mount_req(sock, &cmd) != 0) {
-							close(sock);
-							fds[i].fd = -1;
-							continue;
-						}
-						break;
-					default:
-						abort();
-						break;
-				}
+				fds[nfds].fd = sock;
+				fds[nfds].events = POLLIN;
+				fds[nfds].revents = 0;
+				nfds++;
+			} else {
+				/* Hand the request to an ioctl thread */
+
+				queue_request(fds[i].fd);
+				fds[i].fd = -1;
+				busy++;
 			}
 		}
 
@@ -189,5 +310,20 @@ void *listener_loop(void *arg)
 		nfds = write_ptr;
 	}
 
+	/* Let the ioctl threads finish what they have queued and exit */
+	VERIFY(pthread_mutex_lock(&work_mtx) == 0);
+	work_exit = B_TRUE;
+	VERIFY(pthread_cond_broadcast(&work_cv) == 0);
+	VERIFY(pthread_mutex_unlock(&work_mtx) == 0);
+
+	for(int i = 0; i < NUM_IOCTL_THREADS; i++) {
+		int ret = pthread_join(ioctl_threads[i], NULL);
+		if(ret != 0)
+			fprintf(stderr, "Warning: pthread_join() on ioctl thread %i returned %i\n", i, ret);
+	}
+
+	close(done_fd[0]);
+	close(done_fd[1]);
+
 	return NULL;
 }
@@ -32,7 +32,9 @@
 #include <sys/disp.h>
 #include <sys/kmem.h>
 #include <errno.h>
+#include <stdint.h>
 #include <pthread.h>
+#include <sys/uio.h>
 
 #include "fuse.h"
 #include "fuse_listener.h"
@@ -41,11 +43,40 @@
 
 #define MAX_FILESYSTEMS 1000
 
+/*
+ * The request and reply headers and the opcodes of the FUSE kernel
+ * protocol that are needed to decide whether a request must wait for an
+ * automounted filesystem (see fuse_kernel.h, which libfuse doesn't install).
+ */
+struct zfsfuse_in_header {
+	uint32_t len;
+	uint32_t opcode;
+	uint64_t unique;
+	uint64_t nodeid;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t pid;
+	uint32_t padding;
+};
+
+struct zfsfuse_out_header {
+	uint32_t len;
+	int32_t error;
+	uint64_t unique;
+};
+
+#define ZFSFUSE_FORGET		2
+#define ZFSFUSE_INIT		26
+#define ZFSFUSE_INTERRUPT	36
+#define ZFSFUSE_DESTROY		38
+#define ZFSFUSE_BATCH_FORGET	42
+
 typedef struct fuse_fs_info {
 	int fd;
 	size_t bufsize;
 	struct fuse_chan *ch;
 	struct fuse_session *se;
+	automount_t *am;
 	int mntlen;
 } fuse_fs_info_t;
 
@@ -63,6 +94,9 @@ char *mountpoints[MAX_FDS];
 pthread_t fuse_threads[NUM_THREADS];
 pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
 
+/* Serializes writers of newfs_fd, mounts can run concurrently */
+pthread_mutex_t newfs_mtx = PTHREAD_MUTEX_INITIALIZER;
+
 kmem_cache_t *file_info_cache = NULL;
 
 int zfsfuse_listener_init()
@@ -91,7 +125,10 @@ void zfsfuse_listener_exit()
 	close(newfs_fd[1]);
 }
 
-int zfsfuse_newfs(char *mntpoint, struct fuse_chan *ch)
+/*
+ * am is NULL unless the filesystem is automounted, see util.c
+ */
+int zfsfuse_newfs(char *mntpoint, struct fuse_chan *ch, automount_t *am)
 {
 	fuse_fs_info_t info = { 0 };
 
@@ -99,17 +136,24 @@ int zfsfuse_newfs(char *mntpoint, struct fuse_chan *ch)
 	info.bufsize = fuse_chan_bufsize(ch);
 	info.ch = ch;
 	info.se = fuse_chan_session(ch);
+	info.am = am;
 	info.mntlen = strlen(mntpoint);
 
+	VERIFY(pthread_mutex_lock(&newfs_mtx) == 0);
+
 	if(write(newfs_fd[1], &info, sizeof(info)) != sizeof(info)) {
 		perror("Warning (while writing fsinfo to newfs_fd)");
+		VERIFY(pthread_mutex_unlock(&newfs_mtx) == 0);
 		return -1;
 	}
 
 	if(write(newfs_fd[1], mntpoint, info.mntlen) != info.mntlen) {
 		perror("Warning (while writing mntpoint to newfs_fd)");
+		VERIFY(pthread_mutex_unlock(&newfs_mtx) == 0);
 		return -1;
 	}
+
+	VERIFY(pthread_mutex_unlock(&newfs_mtx) == 0);
 	return 0;
 }
 
@@ -199,6 +243,47 @@ static void destroy_fs(int i)
 	free(mountpoints[i]);
 }
 
+/*
+ * Process a request for an automounted filesystem, mounting it first
+ * unless the request doesn't need it.  If the filesystem can't be
+ * mounted, the request fails with the error.
+ */
+static void automount_process(fuse_fs_info_t *fs, const char *buf, size_t len)
+{
+	const struct zfsfuse_in_header *in = (const struct zfsfuse_in_header *) buf;
+
+	if(len < sizeof(*in)) {
+		fuse_session_process(fs->se, buf, len, fs->ch);
+		return;
+	}
+
+	switch(in->opcode) {
+		case ZFSFUSE_FORGET:
+		case ZFSFUSE_INIT:
+		case ZFSFUSE_INTERRUPT:
+		case ZFSFUSE_DESTROY:
+		case ZFSFUSE_BATCH_FORGET:
+			fuse_session_process(fs->se, buf, len, fs->ch);
+			return;
+	}
+
+	int error = automount_enter(fs->am);
+	if(error == 0) {
+		fuse_session_process(fs->se, buf, len, fs->ch);
+		automount_exit(fs->am);
+		return;
+	}
+
+	struct zfsfuse_out_header out;
+	out.len = sizeof(out);
+	out.error = -error;
+	out.unique = in->unique;
+
+	struct iovec iov = { &out, sizeof(out) };
+	if(fuse_chan_send(fs->ch, &iov, 1) != 0)
+		perror("Warning (while replying to a request that couldn't be automounted)");
+}
+
 static void *zfsfuse_listener_loop(void *arg)
 {
 	size_t bufsize = 0;
@@ -255,8 +340,7 @@ static void *zfsfuse_listener_loop(void *arg)
 				if(res == 0)
 					continue;
 
-				struct fuse_session *se = fsinfo[i].se;
-				struct fuse_chan *ch = fsinfo[i].ch;
+				fuse_fs_info_t fs = fsinfo[i];
 
 				/*
 				 * While we process this request, we let another
@@ -264,7 +348,10 @@ static void *zfsfuse_listener_loop(void *arg)
 				 */
 				VERIFY(pthread_mutex_unlock(&mtx) == 0);
 
-				fuse_session_process(se, buf, res, ch);
+				if(fs.am != NULL)
+					automount_process(&fs, buf, res);
+				else
+					fuse_session_process(fs.se, buf, res, fs.ch);
 
 				/* Acquire the mutex before proceeding */
 				VERIFY(pthread_mutex_lock(&mtx) == 0);
@@ -31,6 +31,7 @@
 #include <sys/vnode.h>
 
 #include "fuse.h"
+#include "util.h"
 
 typedef struct file_info {
 	vnode_t *vp;
@@ -44,6 +45,6 @@ extern boolean_t exit_fuse_listener;
 extern int zfsfuse_listener_init();
 extern int zfsfuse_listener_start();
 extern void zfsfuse_listener_exit();
-extern int zfsfuse_newfs(char *mntpoint, struct fuse_chan *ch);
+extern int zfsfuse_newfs(char *mntpoint, struct fuse_chan *ch, automount_t *am);
 
 #endif
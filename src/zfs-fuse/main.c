@@ -24,12 +24,15 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <signal.h>
 #include <getopt.h>
 
 #include "util.h"
 #include "fuse_listener.h"
+#include "nbd_listener.h"
 
 static const char *cf_pidfile = NULL;
 static int cf_daemonize = 1;
@@ -71,6 +74,26 @@ static struct option longopts[] = {
 	  NULL,
 	  'p'
 	},
+	{ "automount",
+	  0,
+	  &automount_enabled,
+	  1
+	},
+	{ "automount-timeout",
+	  1,
+	  NULL,
+	  't'
+	},
+	{ "nbd-socket",
+	  1,
+	  NULL,
+	  's'
+	},
+	{ "nbd-port",
+	  1,
+	  NULL,
+	  'n'
+	},
 	{ "help",
 	  0,
 	  NULL,
@@ -83,7 +106,7 @@ void print_usage(int argc, char *argv[]) {
 	const char *progname = "zfs-fuse";
 	if (argc > 0)
 		progname = argv[0];
-	fprintf(stderr, "Usage: %s [--no-daemon] [-p | --pidfile filename] [-h | --help]\n", progname);
+	fprintf(stderr, "Usage: %s [--no-daemon] [-p | --pidfile filename] [--automount] [--automount-timeout seconds] [--nbd-socket path] [--nbd-port port] [-h | --help]\n", progname);
 }
 
 static void parse_args(int argc, char *argv[])
@@ -103,6 +126,26 @@ static void parse_args(int argc, char *argv[])
 				}
 				cf_pidfile = optarg;
 				break;
+			case 't': ;
+				char *end;
+				long timeout = strtol(optarg, &end, 10);
+				if (end == optarg || *end != '\0' || timeout < 0 || timeout > INT_MAX) {
+					print_usage(argc, argv);
+					exit(1);
+				}
+				automount_timeout = timeout;
+				break;
+			case 's':
+				nbd_socket_path = optarg;
+				break;
+			case 'n': ;
+				long port = strtol(optarg, &end, 10);
+				if (end == optarg || *end != '\0' || port < 0 || port > 65535) {
+					print_usage(argc, argv);
+					exit(1);
+				}
+				nbd_port = port;
+				break;
 			case 0:
 				break; /* flag is not NULL */
 			default:
@@ -0,0 +1,874 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2006 Ricardo Correia.
+ * Use is subject to license terms.
+ */
+
+/*
+ * A Network Block Device server that exports ZFS volumes, since there is
+ * no way to create block devices from userspace otherwise.  Clients ask
+ * for a volume (or a snapshot of one) by its dataset name, e.g.
+ *
+ *	nbd-client -unix /etc/zfs/nbd_socket -N pool/vol /dev/nbd0
+ *
+ * Only the fixed newstyle handshake is supported.  Each connection has a
+ * thread that reads requests and hands them to nbd_taskq, so that a
+ * client can have many requests in flight; the replies are sent by the
+ * taskq threads in the order the requests complete.
+ *
+ * NBD has no authentication, so the UNIX socket is only accessible to
+ * root and the TCP port only listens on the loopback address.  Failing
+ * to set up either is not fatal: the daemon just runs without it.
+ */
+
+#include <sys/debug.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/poll.h>
+#include <sys/cmn_err.h>
+#include <sys/zfs_context.h>
+#include <sys/nvpair.h>
+#include <sys/dmu.h>
+#include <sys/zvol.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <endian.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "zfsfuse_socket.h"
+#include "nbd_listener.h"
+
+#define NBD_MAX_CONNECTIONS 64
+#define NBD_NUM_THREADS 16
+
+/*
+ * Largest read or write request, which is also what clients assume when
+ * they don't ask.  Longer trims are fine since they carry no data.
+ */
+#define NBD_MAX_REQUEST (32 << 20)
+
+/* Request data a connection may have buffered before it stops reading */
+#define NBD_MAX_INFLIGHT (64 << 20)
+
+/* Longest option the client may send during the handshake */
+#define NBD_MAX_OPTION 4096
+
+/* Handshake */
+#define NBD_MAGIC		0x4e42444d41474943ULL	/* "NBDMAGIC" */
+#define NBD_IHAVEOPT		0x49484156454f5054ULL	/* "IHAVEOPT" */
+#define NBD_REP_MAGIC		0x0003e889045565a9ULL
+
+#define NBD_FLAG_FIXED_NEWSTYLE	(1 << 0)
+#define NBD_FLAG_NO_ZEROES	(1 << 1)
+
+#define NBD_OPT_EXPORT_NAME	1
+#define NBD_OPT_ABORT		2
+#define NBD_OPT_INFO		6
+#define NBD_OPT_GO		7
+
+#define NBD_REP_ACK		1
+#define NBD_REP_INFO		3
+#define NBD_REP_ERR_UNSUP	0x80000001
+#define NBD_REP_ERR_INVALID	0x80000003
+#define NBD_REP_ERR_UNKNOWN	0x80000006
+
+#define NBD_INFO_EXPORT		0
+#define NBD_INFO_BLOCK_SIZE	3
+
+/* Transmission */
+#define NBD_FLAG_HAS_FLAGS	(1 << 0)
+#define NBD_FLAG_READ_ONLY	(1 << 1)
+#define NBD_FLAG_SEND_FLUSH	(1 << 2)
+#define NBD_FLAG_SEND_FUA	(1 << 3)
+#define NBD_FLAG_SEND_TRIM	(1 << 5)
+#define NBD_FLAG_CAN_MULTI_CONN	(1 << 8)
+
+#define NBD_REQUEST_MAGIC	0x25609513
+#define NBD_REPLY_MAGIC		0x67446698
+
+#define NBD_CMD_READ		0
+#define NBD_CMD_WRITE		1
+#define NBD_CMD_DISC		2
+#define NBD_CMD_FLUSH		3
+#define NBD_CMD_TRIM		4
+
+#define NBD_CMD_FLAG_FUA	(1 << 0)
+
+#define NBD_CMD_HAS_DATA(type) \
+	((type) == NBD_CMD_READ || (type) == NBD_CMD_WRITE)
+
+/* Error numbers of the protocol, which happen to match Linux' */
+#define NBD_EPERM		1
+#define NBD_EIO			5
+#define NBD_ENOMEM		12
+#define NBD_EINVAL		22
+#define NBD_ENOSPC		28
+#define NBD_EOVERFLOW		75
+
+const char *nbd_socket_path = NBD_SOCK_NAME;
+int nbd_port = 0;
+
+typedef struct nbd_conn {
+	struct nbd_conn *nc_next;
+	int nc_fd;
+	zvol_state_t *nc_zv;
+	pthread_mutex_t nc_mtx;		/* protects the fields below */
+	pthread_cond_t nc_cv;		/* signaled when a request is done */
+	int nc_inflight;		/* requests being processed */
+	uint64_t nc_inflight_bytes;	/* ... and the data they hold */
+	pthread_mutex_t nc_send_mtx;	/* serializes replies */
+} nbd_conn_t;
+
+typedef struct nbd_req {
+	nbd_conn_t *nr_conn;
+	uint16_t nr_flags;
+	uint16_t nr_type;
+	char nr_handle[8];		/* opaque, sent back as it came */
+	uint64_t nr_offset;
+	uint32_t nr_length;
+	void *nr_buf;
+} nbd_req_t;
+
+/* Protects the connection list */
+static pthread_mutex_t nbd_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t nbd_cv = PTHREAD_COND_INITIALIZER;
+static nbd_conn_t *nbd_conns = NULL;
+static int nbd_nconns = 0;
+
+static taskq_t *nbd_taskq;
+
+static int nbd_unix_fd = -1;
+static int nbd_tcp_fd = -1;
+
+static boolean_t nbd_exit = B_FALSE;
+static boolean_t nbd_thread_started = B_FALSE;
+static pthread_t nbd_thread;
+
+static int nbd_read(int fd, void *buf, size_t len)
+{
+	return zfsfuse_socket_read_loop(fd, buf, len);
+}
+
+/*
+ * Send a header and an optional payload in as few segments as possible.
+ */
+static int nbd_send(int fd, void *hdr, size_t hdrlen, void *data, size_t datalen)
+{
+	struct iovec iov[2];
+	int iovcnt = 0;
+
+	iov[iovcnt].iov_base = hdr;
+	iov[iovcnt++].iov_len = hdrlen;
+	if(datalen != 0) {
+		iov[iovcnt].iov_base = data;
+		iov[iovcnt++].iov_len = datalen;
+	}
+
+	struct iovec *iovp = iov;
+	while(iovcnt > 0) {
+		ssize_t ret = writev(fd, iovp, iovcnt);
+		if(ret == -1) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		while(iovcnt > 0 && ret >= iovp->iov_len) {
+			ret -= iovp->iov_len;
+			iovp++;
+			iovcnt--;
+		}
+		if(iovcnt > 0) {
+			iovp->iov_base = (char *) iovp->iov_base + ret;
+			iovp->iov_len -= ret;
+		}
+	}
+
+	return 0;
+}
+
+static int nbd_errno(int error)
+{
+	switch(error) {
+		case 0:
+			return 0;
+		case EPERM:
+		case EROFS:
+			return NBD_EPERM;
+		case ENOMEM:
+			return NBD_ENOMEM;
+		case EINVAL:
+			return NBD_EINVAL;
+		case ENOSPC:
+		case EDQUOT:
+			return NBD_ENOSPC;
+		case EOVERFLOW:
+			return NBD_EOVERFLOW;
+		default:
+			return NBD_EIO;
+	}
+}
+
+/*
+ * Handshake
+ */
+
+static int nbd_send_opt_reply(int fd, uint32_t opt, uint32_t type, void *data, uint32_t len)
+{
+	struct {
+		uint64_t magic;
+		uint32_t opt;
+		uint32_t type;
+		uint32_t len;
+	} __attribute__((packed)) rep;
+
+	rep.magic = htobe64(NBD_REP_MAGIC);
+	rep.opt = htobe32(opt);
+	rep.type = htobe32(type);
+	rep.len = htobe32(len);
+
+	return nbd_send(fd, &rep, sizeof(rep), data, len);
+}
+
+static uint16_t nbd_export_flags(zvol_state_t *zv)
+{
+	uint16_t flags = NBD_FLAG_HAS_FLAGS | NBD_FLAG_SEND_FLUSH |
+	    NBD_FLAG_SEND_FUA | NBD_FLAG_SEND_TRIM | NBD_FLAG_CAN_MULTI_CONN;
+
+	if(zvol_is_readonly(zv))
+		flags |= NBD_FLAG_READ_ONLY;
+
+	return flags;
+}
+
+/*
+ * NBD_OPT_EXPORT_NAME: the whole option is the name, and there is no
+ * way to report an error except by closing the connection.
+ */
+static int nbd_opt_export_name(nbd_conn_t *nc, char *name, uint32_t cflags)
+{
+	int error = zvol_hold(name, &nc->nc_zv);
+	if(error != 0) {
+		cmn_err(CE_WARN, "NBD client asked for %s: error %i.", name, error);
+		return -1;
+	}
+
+	struct {
+		uint64_t size;
+		uint16_t flags;
+		char zeroes[124];
+	} __attribute__((packed)) rep = { 0 };
+
+	rep.size = htobe64(zvol_get_volsize(nc->nc_zv));
+	rep.flags = htobe16(nbd_export_flags(nc->nc_zv));
+
+	size_t len = sizeof(rep);
+	if(cflags & NBD_FLAG_NO_ZEROES)
+		len -= sizeof(rep.zeroes);
+
+	return nbd_send(nc->nc_fd, &rep, len, NULL, 0);
+}
+
+/*
+ * NBD_OPT_INFO and NBD_OPT_GO.  Returns 1 if the transmission phase
+ * should start, 0 to go on with the handshake and -1 on errors.
+ */
+static int nbd_opt_go(nbd_conn_t *nc, uint32_t opt, char *data, uint32_t len)
+{
+	uint32_t namelen;
+	uint16_t nreqs;
+	boolean_t want_bs = B_FALSE;
+
+	if(len < 4 + 2)
+		return nbd_send_opt_reply(nc->nc_fd, opt, NBD_REP_ERR_INVALID, NULL, 0);
+
+	memcpy(&namelen, data, 4);
+	namelen = be32toh(namelen);
+
+	if(namelen > len - 4 - 2)
+		return nbd_send_opt_reply(nc->nc_fd, opt, NBD_REP_ERR_INVALID, NULL, 0);
+
+	memcpy(&nreqs, data + 4 + namelen, 2);
+	nreqs = be16toh(nreqs);
+
+	if(len != 4 + namelen + 2 + 2 * nreqs)
+		return nbd_send_opt_reply(nc->nc_fd, opt, NBD_REP_ERR_INVALID, NULL, 0);
+
+	for(int i = 0; i < nreqs; i++) {
+		uint16_t req;
+		memcpy(&req, data + 4 + namelen + 2 + 2 * i, 2);
+		if(be16toh(req) == NBD_INFO_BLOCK_SIZE)
+			want_bs = B_TRUE;
+	}
+
+	/* The name is followed by the request count, which is no longer needed */
+	char *name = data + 4;
+	name[namelen] = '\0';
+
+	zvol_state_t *zv;
+	int error = zvol_hold(name, &zv);
+	if(error != 0)
+		return nbd_send_opt_reply(nc->nc_fd, opt, NBD_REP_ERR_UNKNOWN, NULL, 0);
+
+	struct {
+		uint16_t type;
+		uint64_t size;
+		uint16_t flags;
+	} __attribute__((packed)) info;
+
+	info.type = htobe16(NBD_INFO_EXPORT);
+	info.size = htobe64(zvol_get_volsize(zv));
+	info.flags = htobe16(nbd_export_flags(zv));
+
+	int ret = nbd_send_opt_reply(nc->nc_fd, opt, NBD_REP_INFO, &info, sizeof(info));
+
+	if(ret == 0 && want_bs) {
+		struct {
+			uint16_t type;
+			uint32_t min;
+			uint32_t preferred;
+			uint32_t max;
+		} __attribute__((packed)) bs;
+
+		bs.type = htobe16(NBD_INFO_BLOCK_SIZE);
+		bs.min = htobe32(1);
+		bs.preferred = htobe32(MAX(zvol_get_volblocksize(zv), 4096));
+		bs.max = htobe32(NBD_MAX_REQUEST);
+
+		ret = nbd_send_opt_reply(nc->nc_fd, opt, NBD_REP_INFO, &bs, sizeof(bs));
+	}
+
+	if(ret == 0)
+		ret = nbd_send_opt_reply(nc->nc_fd, opt, NBD_REP_ACK, NULL, 0);
+
+	if(ret != 0 || opt == NBD_OPT_INFO) {
+		zvol_rele(zv);
+		return ret;
+	}
+
+	nc->nc_zv = zv;
+	return 1;
+}
+
+/*
+ * Returns 0 once a volume has been opened for the transmission phase.
+ */
+static int nbd_handshake(nbd_conn_t *nc)
+{
+	struct {
+		uint64_t magic;
+		uint64_t opt_magic;
+		uint16_t flags;
+	} __attribute__((packed)) hello;
+
+	hello.magic = htobe64(NBD_MAGIC);
+	hello.opt_magic = htobe64(NBD_IHAVEOPT);
+	hello.flags = htobe16(NBD_FLAG_FIXED_NEWSTYLE | NBD_FLAG_NO_ZEROES);
+
+	if(nbd_send(nc->nc_fd, &hello, sizeof(hello), NULL, 0) != 0)
+		return -1;
+
+	uint32_t cflags;
+	if(nbd_read(nc->nc_fd, &cflags, sizeof(cflags)) != 0)
+		return -1;
+
+	cflags = be32toh(cflags);
+	if(cflags & ~(NBD_FLAG_FIXED_NEWSTYLE | NBD_FLAG_NO_ZEROES))
+		return -1;
+
+	char data[NBD_MAX_OPTION + 1];
+
+	for(;;) {
+		struct {
+			uint64_t magic;
+			uint32_t opt;
+			uint32_t len;
+		} __attribute__((packed)) req;
+
+		if(nbd_read(nc->nc_fd, &req, sizeof(req)) != 0)
+			return -1;
+
+		uint32_t opt = be32toh(req.opt);
+		uint32_t len = be32toh(req.len);
+
+		if(be64toh(req.magic) != NBD_IHAVEOPT || len > NBD_MAX_OPTION)
+			return -1;
+
+		if(nbd_read(nc->nc_fd, data, len) != 0)
+			return -1;
+		data[len] = '\0';
+
+		int ret;
+
+		switch(opt) {
+			case NBD_OPT_EXPORT_NAME:
+				return nbd_opt_export_name(nc, data, cflags);
+			case NBD_OPT_ABORT:
+				(void) nbd_send_opt_reply(nc->nc_fd, opt, NBD_REP_ACK, NULL, 0);
+				return -1;
+			case NBD_OPT_INFO:
+			case NBD_OPT_GO:
+				ret = nbd_opt_go(nc, opt, data, len);
+				if(ret != 0)
+					return ret == 1 ? 0 : -1;
+				break;
+			default:
+				if(nbd_send_opt_reply(nc->nc_fd, opt, NBD_REP_ERR_UNSUP, NULL, 0) != 0)
+					return -1;
+				break;
+		}
+	}
+}
+
+/*
+ * Transmission
+ */
+
+static int nbd_reply(nbd_req_t *nr, int error)
+{
+	nbd_conn_t *nc = nr->nr_conn;
+
+	struct {
+		uint32_t magic;
+		uint32_t error;
+		char handle[8];
+	} __attribute__((packed)) rep;
+
+	rep.magic = htobe32(NBD_REPLY_MAGIC);
+	rep.error = htobe32(nbd_errno(error));
+	memcpy(rep.handle, nr->nr_handle, sizeof(rep.handle));
+
+	/* Reads carry their data, unless they failed */
+	size_t datalen = 0;
+	if(nr->nr_type == NBD_CMD_READ && error == 0)
+		datalen = nr->nr_length;
+
+	VERIFY(pthread_mutex_lock(&nc->nc_send_mtx) == 0);
+	int ret = nbd_send(nc->nc_fd, &rep, sizeof(rep), nr->nr_buf, datalen);
+	VERIFY(pthread_mutex_unlock(&nc->nc_send_mtx) == 0);
+
+	/* Wake up the connection thread, which will find the socket closed */
+	if(ret != 0)
+		(void) shutdown(nc->nc_fd, SHUT_RDWR);
+
+	return ret;
+}
+
+static void nbd_req_done(nbd_req_t *nr)
+{
+	nbd_conn_t *nc = nr->nr_conn;
+
+	VERIFY(pthread_mutex_lock(&nc->nc_mtx) == 0);
+	ASSERT(nc->nc_inflight > 0);
+	nc->nc_inflight--;
+	if(NBD_CMD_HAS_DATA(nr->nr_type))
+		nc->nc_inflight_bytes -= nr->nr_length;
+	VERIFY(pthread_cond_broadcast(&nc->nc_cv) == 0);
+	VERIFY(pthread_mutex_unlock(&nc->nc_mtx) == 0);
+
+	free(nr->nr_buf);
+	free(nr);
+}
+
+/*
+ * Runs in nbd_taskq.
+ */
+static void nbd_req_process(void *arg)
+{
+	nbd_req_t *nr = arg;
+	zvol_state_t *zv = nr->nr_conn->nc_zv;
+	boolean_t fua = (nr->nr_flags & NBD_CMD_FLAG_FUA) != 0;
+	int error = 0;
+
+	switch(nr->nr_type) {
+		case NBD_CMD_READ:
+			error = zvol_read_buf(zv, nr->nr_offset, nr->nr_length, nr->nr_buf);
+			break;
+		case NBD_CMD_WRITE:
+			error = zvol_write_buf(zv, nr->nr_offset, nr->nr_length, nr->nr_buf, fua);
+			break;
+		case NBD_CMD_TRIM:
+			error = zvol_free_buf(zv, nr->nr_offset, nr->nr_length, fua);
+			break;
+		case NBD_CMD_FLUSH:
+			zvol_flush(zv);
+			break;
+		default:
+			error = EINVAL;
+			break;
+	}
+
+	(void) nbd_reply(nr, error);
+	nbd_req_done(nr);
+}
+
+/*
+ * Read requests until the client disconnects, and dispatch them.
+ */
+static void nbd_transmission(nbd_conn_t *nc)
+{
+	for(;;) {
+		struct {
+			uint32_t magic;
+			uint16_t flags;
+			uint16_t type;
+			char handle[8];
+			uint64_t offset;
+			uint32_t length;
+		} __attribute__((packed)) req;
+
+		if(nbd_read(nc->nc_fd, &req, sizeof(req)) != 0)
+			return;
+
+		if(be32toh(req.magic) != NBD_REQUEST_MAGIC) {
+			cmn_err(CE_WARN, "NBD protocol error, closing connection.");
+			return;
+		}
+
+		nbd_req_t *nr = calloc(1, sizeof(nbd_req_t));
+		if(nr == NULL)
+			return;
+
+		nr->nr_conn = nc;
+		nr->nr_flags = be16toh(req.flags);
+		nr->nr_type = be16toh(req.type);
+		memcpy(nr->nr_handle, req.handle, sizeof(nr->nr_handle));
+		nr->nr_offset = be64toh(req.offset);
+		nr->nr_length = be32toh(req.length);
+
+		if(nr->nr_type == NBD_CMD_DISC) {
+			free(nr);
+			return;
+		}
+
+		boolean_t has_data = NBD_CMD_HAS_DATA(nr->nr_type);
+
+		/*
+		 * The payload of an oversized write can't be skipped
+		 * reliably, so give up on the connection.
+		 */
+		if(has_data && nr->nr_length > NBD_MAX_REQUEST) {
+			cmn_err(CE_WARN, "NBD request of %u bytes is too large, closing connection.", nr->nr_length);
+			free(nr);
+			return;
+		}
+
+		VERIFY(pthread_mutex_lock(&nc->nc_mtx) == 0);
+
+		/* Don't buffer more than NBD_MAX_INFLIGHT bytes of data */
+		if(has_data) {
+			while(nc->nc_inflight > 0 &&
+			    nc->nc_inflight_bytes + nr->nr_length > NBD_MAX_INFLIGHT)
+				VERIFY(pthread_cond_wait(&nc->nc_cv, &nc->nc_mtx) == 0);
+			nc->nc_inflight_bytes += nr->nr_length;
+		}
+		nc->nc_inflight++;
+
+		VERIFY(pthread_mutex_unlock(&nc->nc_mtx) == 0);
+
+		if(has_data) {
+			/* Not zeroed: reads of holes fill it in too */
+			nr->nr_buf = malloc(MAX(nr->nr_length, 1));
+			if(nr->nr_buf == NULL) {
+				/* The write payload can't be skipped either */
+				nbd_req_done(nr);
+				return;
+			}
+		}
+
+		if(nr->nr_type == NBD_CMD_WRITE &&
+		   nbd_read(nc->nc_fd, nr->nr_buf, nr->nr_length) != 0) {
+			nbd_req_done(nr);
+			return;
+		}
+
+		if(taskq_dispatch(nbd_taskq, nbd_req_process, nr, TQ_SLEEP) == 0)
+			nbd_req_process(nr);
+	}
+}
+
+static void *nbd_conn_loop(void *arg)
+{
+	nbd_conn_t *nc = arg;
+
+	if(nbd_handshake(nc) == 0)
+		nbd_transmission(nc);
+
+	/* Wait for the requests that are still being processed */
+	VERIFY(pthread_mutex_lock(&nc->nc_mtx) == 0);
+	while(nc->nc_inflight > 0)
+		VERIFY(pthread_cond_wait(&nc->nc_cv, &nc->nc_mtx) == 0);
+	VERIFY(pthread_mutex_unlock(&nc->nc_mtx) == 0);
+
+	/* Under nbd_mtx, since nbd_listener_exit() may be shutting it down */
+	VERIFY(pthread_mutex_lock(&nbd_mtx) == 0);
+	close(nc->nc_fd);
+	nc->nc_fd = -1;
+	VERIFY(pthread_mutex_unlock(&nbd_mtx) == 0);
+
+	if(nc->nc_zv != NULL)
+		zvol_rele(nc->nc_zv);
+
+	VERIFY(pthread_mutex_lock(&nbd_mtx) == 0);
+
+	nbd_conn_t **ncp;
+	for(ncp = &nbd_conns; *ncp != nc; ncp = &(*ncp)->nc_next)
+		ASSERT(*ncp != NULL);
+	*ncp = nc->nc_next;
+	nbd_nconns--;
+
+	VERIFY(pthread_cond_broadcast(&nbd_cv) == 0);
+	VERIFY(pthread_mutex_unlock(&nbd_mtx) == 0);
+
+	VERIFY(pthread_mutex_destroy(&nc->nc_send_mtx) == 0);
+	VERIFY(pthread_cond_destroy(&nc->nc_cv) == 0);
+	VERIFY(pthread_mutex_destroy(&nc->nc_mtx) == 0);
+	free(nc);
+
+	return NULL;
+}
+
+static void nbd_accept(int listen_fd)
+{
+	int fd = accept(listen_fd, NULL, NULL);
+	if(fd == -1) {
+		if(errno != EINTR && errno != EAGAIN)
+			perror("accept");
+		return;
+	}
+
+	if(listen_fd == nbd_tcp_fd) {
+		int one = 1;
+		(void) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+
+	nbd_conn_t *nc = calloc(1, sizeof(nbd_conn_t));
+	if(nc == NULL) {
+		close(fd);
+		return;
+	}
+
+	nc->nc_fd = fd;
+	VERIFY(pthread_mutex_init(&nc->nc_mtx, NULL) == 0);
+	VERIFY(pthread_cond_init(&nc->nc_cv, NULL) == 0);
+	VERIFY(pthread_mutex_init(&nc->nc_send_mtx, NULL) == 0);
+
+	VERIFY(pthread_mutex_lock(&nbd_mtx) == 0);
+
+	if(nbd_nconns == NBD_MAX_CONNECTIONS) {
+		VERIFY(pthread_mutex_unlock(&nbd_mtx) == 0);
+		cmn_err(CE_WARN, "NBD connection limit reached (%i), closing connection.", NBD_MAX_CONNECTIONS);
+		goto error;
+	}
+
+	pthread_attr_t attr;
+	pthread_t thread;
+
+	VERIFY(pthread_attr_init(&attr) == 0);
+	VERIFY(pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) == 0);
+	int ret = pthread_create(&thread, &attr, nbd_conn_loop, nc);
+	VERIFY(pthread_attr_destroy(&attr) == 0);
+
+	if(ret != 0) {
+		VERIFY(pthread_mutex_unlock(&nbd_mtx) == 0);
+		cmn_err(CE_WARN, "Error creating NBD connection thread.");
+		goto error;
+	}
+
+	nc->nc_next = nbd_conns;
+	nbd_conns = nc;
+	nbd_nconns++;
+
+	VERIFY(pthread_mutex_unlock(&nbd_mtx) == 0);
+	return;
+
+error:
+	VERIFY(pthread_mutex_destroy(&nc->nc_send_mtx) == 0);
+	VERIFY(pthread_cond_destroy(&nc->nc_cv) == 0);
+	VERIFY(pthread_mutex_destroy(&nc->nc_mtx) == 0);
+	free(nc);
+	close(fd);
+}
+
+static void *nbd_listener_loop(void *arg)
+{
+	struct pollfd fds[2];
+	int nfds = 0;
+
+	if(nbd_unix_fd != -1) {
+		fds[nfds].fd = nbd_unix_fd;
+		fds[nfds++].events = POLLIN;
+	}
+	if(nbd_tcp_fd != -1) {
+		fds[nfds].fd = nbd_tcp_fd;
+		fds[nfds++].events = POLLIN;
+	}
+
+	while(!nbd_exit) {
+		/* Poll with a 1 second timeout to notice nbd_exit */
+		int ret = poll(fds, nfds, 1000);
+		if(ret == 0 || (ret == -1 && errno == EINTR))
+			continue;
+
+		if(ret == -1) {
+			perror("poll");
+			break;
+		}
+
+		for(int i = 0; i < nfds; i++)
+			if(fds[i].revents != 0)
+				nbd_accept(fds[i].fd);
+	}
+
+	return NULL;
+}
+
+static int nbd_socket_unix(const char *path)
+{
+	struct sockaddr_un name;
+
+	int sock = socket(PF_LOCAL, SOCK_STREAM, 0);
+	if(sock == -1) {
+		int err = errno;
+		cmn_err(CE_WARN, "Error creating UNIX socket: %s.", strerror(err));
+		return -1;
+	}
+
+	name.sun_family = AF_LOCAL;
+	strncpy(name.sun_path, path, sizeof(name.sun_path));
+	name.sun_path[sizeof(name.sun_path) - 1] = '\0';
+
+	unlink(path);
+
+	/* Before listen(), so no one can connect while it's world-writable */
+	if(bind(sock, (struct sockaddr *) &name, SUN_LEN(&name)) != 0 ||
+	   chmod(path, S_IRUSR | S_IWUSR) != 0 ||
+	   listen(sock, 5) != 0) {
+		int err = errno;
+		cmn_err(CE_WARN, "Error binding UNIX socket to %s: %s.", path, strerror(err));
+		unlink(path);
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+static int nbd_socket_tcp(int port)
+{
+	struct sockaddr_in addr;
+	int one = 1;
+
+	int sock = socket(PF_INET, SOCK_STREAM, 0);
+	if(sock == -1) {
+		int err = errno;
+		cmn_err(CE_WARN, "Error creating TCP socket: %s.", strerror(err));
+		return -1;
+	}
+
+	(void) setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	/* Only local clients: NBD has no authentication */
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+
+	if(bind(sock, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+	   listen(sock, 5) != 0) {
+		int err = errno;
+		cmn_err(CE_WARN, "Error binding TCP socket to port %i: %s.", port, strerror(err));
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+int nbd_listener_init()
+{
+	if(nbd_socket_path[0] != '\0' &&
+	   (nbd_unix_fd = nbd_socket_unix(nbd_socket_path)) == -1)
+		cmn_err(CE_WARN, "Not serving volumes on %s.", nbd_socket_path);
+
+	if(nbd_port != 0 && (nbd_tcp_fd = nbd_socket_tcp(nbd_port)) == -1)
+		cmn_err(CE_WARN, "Not serving volumes on port %i.", nbd_port);
+
+	if(nbd_unix_fd == -1 && nbd_tcp_fd == -1)
+		return 0;
+
+	nbd_taskq = taskq_create("nbd_taskq", NBD_NUM_THREADS, minclsyspri,
+	    NBD_NUM_THREADS, INT_MAX, TASKQ_PREPOPULATE);
+
+	if(pthread_create(&nbd_thread, NULL, nbd_listener_loop, NULL) != 0) {
+		cmn_err(CE_WARN, "Error creating NBD listener thread.");
+		return -1;
+	}
+
+	nbd_thread_started = B_TRUE;
+
+	return 0;
+}
+
+void nbd_listener_exit()
+{
+	if(nbd_thread_started) {
+		nbd_exit = B_TRUE;
+		if(pthread_join(nbd_thread, NULL) != 0)
+			cmn_err(CE_WARN, "Error in pthread_join().");
+		nbd_thread_started = B_FALSE;
+	}
+
+	/* Disconnect the clients and wait for their volumes to be closed */
+	VERIFY(pthread_mutex_lock(&nbd_mtx) == 0);
+	for(nbd_conn_t *nc = nbd_conns; nc != NULL; nc = nc->nc_next)
+		if(nc->nc_fd != -1)
+			(void) shutdown(nc->nc_fd, SHUT_RDWR);
+	while(nbd_nconns > 0)
+		VERIFY(pthread_cond_wait(&nbd_cv, &nbd_mtx) == 0);
+	VERIFY(pthread_mutex_unlock(&nbd_mtx) == 0);
+
+	if(nbd_taskq != NULL) {
+		taskq_destroy(nbd_taskq);
+		nbd_taskq = NULL;
+	}
+
+	if(nbd_unix_fd != -1) {
+		close(nbd_unix_fd);
+		unlink(nbd_socket_path);
+		nbd_unix_fd = -1;
+	}
+
+	if(nbd_tcp_fd != -1) {
+		close(nbd_tcp_fd);
+		nbd_tcp_fd = -1;
+	}
+}
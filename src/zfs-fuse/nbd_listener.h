@@ -0,0 +1,42 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2006 Ricardo Correia.
+ * Use is subject to license terms.
+ */
+
+#ifndef ZFSFUSE_NBD_LISTENER_H
+#define ZFSFUSE_NBD_LISTENER_H
+
+#include <sys/fs/zfs.h>
+
+#define NBD_SOCK_NAME ZPOOL_CACHE_DIR "/nbd_socket"
+
+/* UNIX socket to serve volumes on, or "" for none */
+extern const char *nbd_socket_path;
+
+/* TCP port to serve volumes on at 127.0.0.1, or 0 for none */
+extern int nbd_port;
+
+extern int nbd_listener_init();
+extern void nbd_listener_exit();
+
+#endif
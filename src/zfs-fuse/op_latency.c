@@ -0,0 +1,221 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2006 Ricardo Correia.
+ * Use is subject to license terms.
+ */
+
+/*
+ * Latency histograms of the FUSE operations and ioctls served by the
+ * daemon.
+ *
+ * Each thread counts the operations it completes in its own lat_thread_t,
+ * so that recording one is a few uncontended atomic increments. A reader
+ * sums the counters of all threads (and of the threads that have exited)
+ * under lat_mtx, loading each one atomically so that it never sees half
+ * of a 64-bit update. The counters of a histogram aren't read together,
+ * so an operation recorded during the read may be in its count but not
+ * yet in its buckets. Resetting doesn't touch the counters of other
+ * threads: it remembers the sums it was given as a baseline, which later
+ * reads subtract.
+ */
+
+#include <sys/debug.h>
+#include <sys/kmem.h>
+#include <sys/systm.h>
+#include <sys/atomic.h>
+#include <pthread.h>
+
+#include "op_latency.h"
+
+#define LAT_NOPS (LAT_FUSE_NOPS + LAT_IOCTL_NOPS)
+
+struct lat_hist {
+	uint64_t lh_count;
+	uint64_t lh_total;			/* ns */
+	uint64_t lh_buckets[ZFS_LATENCY_BUCKETS];
+};
+
+typedef struct lat_thread {
+	lat_hist_t lt_hist[LAT_NOPS];
+	struct lat_thread *lt_next;
+	struct lat_thread *lt_prev;
+} lat_thread_t;
+
+static const char *op_latency_fuse_names[LAT_FUSE_NOPS] = {
+	"lookup", "getattr", "setattr", "access", "readlink", "open",
+	"create", "read", "write", "fsync", "release", "opendir",
+	"readdir", "mkdir", "rmdir", "mknod", "symlink", "link", "unlink",
+	"rename", "statfs"
+};
+
+static pthread_mutex_t lat_mtx = PTHREAD_MUTEX_INITIALIZER;
+static lat_thread_t *lat_threads;		/* live threads */
+static lat_hist_t lat_exited[LAT_NOPS];	/* threads that have exited */
+static lat_hist_t lat_base[LAT_NOPS];		/* sums at the last reset */
+
+static pthread_once_t lat_once = PTHREAD_ONCE_INIT;
+static pthread_key_t lat_key;
+static __thread lat_thread_t *lat_self;
+
+/* src may be another thread's, which it updates with atomics */
+static void lat_hist_add(lat_hist_t *dst, lat_hist_t *src)
+{
+	dst->lh_count += atomic_add_64_nv(&src->lh_count, 0);
+	dst->lh_total += atomic_add_64_nv(&src->lh_total, 0);
+	for(int b = 0; b < ZFS_LATENCY_BUCKETS; b++)
+		dst->lh_buckets[b] += atomic_add_64_nv(&src->lh_buckets[b], 0);
+}
+
+/* Fold the counters of an exiting thread into lat_exited */
+static void lat_thread_exit(void *arg)
+{
+	lat_thread_t *lt = arg;
+
+	VERIFY(pthread_mutex_lock(&lat_mtx) == 0);
+
+	for(int op = 0; op < LAT_NOPS; op++)
+		lat_hist_add(&lat_exited[op], &lt->lt_hist[op]);
+
+	if(lt->lt_prev != NULL)
+		lt->lt_prev->lt_next = lt->lt_next;
+	else
+		lat_threads = lt->lt_next;
+	if(lt->lt_next != NULL)
+		lt->lt_next->lt_prev = lt->lt_prev;
+
+	VERIFY(pthread_mutex_unlock(&lat_mtx) == 0);
+
+	/* In case a later destructor records an operation */
+	lat_self = NULL;
+
+	kmem_free(lt, sizeof(lat_thread_t));
+}
+
+static void lat_key_create()
+{
+	VERIFY(pthread_key_create(&lat_key, lat_thread_exit) == 0);
+}
+
+static lat_thread_t *lat_thread_create()
+{
+	VERIFY(pthread_once(&lat_once, lat_key_create) == 0);
+
+	lat_thread_t *lt = kmem_zalloc(sizeof(lat_thread_t), KM_SLEEP);
+
+	VERIFY(pthread_mutex_lock(&lat_mtx) == 0);
+	lt->lt_next = lat_threads;
+	if(lat_threads != NULL)
+		lat_threads->lt_prev = lt;
+	lat_threads = lt;
+	VERIFY(pthread_mutex_unlock(&lat_mtx) == 0);
+
+	VERIFY(pthread_setspecific(lat_key, lt) == 0);
+
+	lat_self = lt;
+	return lt;
+}
+
+void op_latency_record(int op, hrtime_t start)
+{
+	ASSERT(op >= 0 && op < LAT_NOPS);
+
+	uint64_t ns = gethrtime() - start;
+
+	lat_thread_t *lt = lat_self;
+	if(lt == NULL)
+		lt = lat_thread_create();
+
+	int b = 0;
+	for(uint64_t v = ns >> 1; v != 0 && b < ZFS_LATENCY_BUCKETS - 1; v >>= 1)
+		b++;
+
+	lat_hist_t *lh = &lt->lt_hist[op];
+	atomic_inc_64(&lh->lh_count);
+	atomic_add_64(&lh->lh_total, ns);
+	atomic_inc_64(&lh->lh_buckets[b]);
+}
+
+static void lat_add_op(nvlist_t *nvl, const char *name, const lat_hist_t *lh, const lat_hist_t *base)
+{
+	uint64_t val[ZFS_LATENCY_HIST + ZFS_LATENCY_BUCKETS];
+
+	if(lh->lh_count == base->lh_count)
+		return;
+
+	val[ZFS_LATENCY_COUNT] = lh->lh_count - base->lh_count;
+	val[ZFS_LATENCY_TOTAL] = lh->lh_total - base->lh_total;
+	for(int b = 0; b < ZFS_LATENCY_BUCKETS; b++)
+		val[ZFS_LATENCY_HIST + b] = lh->lh_buckets[b] - base->lh_buckets[b];
+
+	VERIFY(nvlist_add_uint64_array(nvl, name, val, sizeof(val) / sizeof(val[0])) == 0);
+}
+
+lat_hist_t *op_latency_get(nvlist_t *nvl, const char *(*ioc_name)(uint_t))
+{
+	lat_hist_t *snap = kmem_zalloc(LAT_NOPS * sizeof(lat_hist_t), KM_SLEEP);
+	lat_hist_t *base = kmem_alloc(LAT_NOPS * sizeof(lat_hist_t), KM_SLEEP);
+
+	VERIFY(pthread_mutex_lock(&lat_mtx) == 0);
+	for(int op = 0; op < LAT_NOPS; op++) {
+		lat_hist_add(&snap[op], &lat_exited[op]);
+		for(lat_thread_t *lt = lat_threads; lt != NULL; lt = lt->lt_next)
+			lat_hist_add(&snap[op], &lt->lt_hist[op]);
+	}
+	bcopy(lat_base, base, sizeof(lat_base));
+	VERIFY(pthread_mutex_unlock(&lat_mtx) == 0);
+
+	nvlist_t *fuse, *ioctl;
+	VERIFY(nvlist_alloc(&fuse, NV_UNIQUE_NAME, KM_SLEEP) == 0);
+	VERIFY(nvlist_alloc(&ioctl, NV_UNIQUE_NAME, KM_SLEEP) == 0);
+
+	for(int op = 0; op < LAT_FUSE_NOPS; op++)
+		lat_add_op(fuse, op_latency_fuse_names[op], &snap[op], &base[op]);
+
+	for(uint_t vec = 0; vec < LAT_IOCTL_NOPS; vec++) {
+		const char *name = ioc_name(vec);
+		if(name != NULL)
+			lat_add_op(ioctl, name, &snap[LAT_IOCTL(vec)], &base[LAT_IOCTL(vec)]);
+	}
+
+	VERIFY(nvlist_add_nvlist(nvl, ZFS_LATENCY_FUSE, fuse) == 0);
+	VERIFY(nvlist_add_nvlist(nvl, ZFS_LATENCY_IOCTL, ioctl) == 0);
+	nvlist_free(fuse);
+	nvlist_free(ioctl);
+
+	kmem_free(base, LAT_NOPS * sizeof(lat_hist_t));
+	return snap;
+}
+
+void op_latency_reset(lat_hist_t *snap)
+{
+	VERIFY(pthread_mutex_lock(&lat_mtx) == 0);
+	/* Don't go back to an older baseline if resets race */
+	for(int op = 0; op < LAT_NOPS; op++)
+		if(snap[op].lh_count > lat_base[op].lh_count)
+			lat_base[op] = snap[op];
+	VERIFY(pthread_mutex_unlock(&lat_mtx) == 0);
+}
+
+void op_latency_free(lat_hist_t *snap)
+{
+	kmem_free(snap, LAT_NOPS * sizeof(lat_hist_t));
+}
@@ -0,0 +1,82 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2006 Ricardo Correia.
+ * Use is subject to license terms.
+ */
+
+#ifndef ZFSFUSE_OP_LATENCY_H
+#define ZFSFUSE_OP_LATENCY_H
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/nvpair.h>
+#include <sys/fs/zfs.h>
+
+/* FUSE operations, in the order of op_latency_fuse_names[] */
+typedef enum {
+	LAT_FUSE_LOOKUP,
+	LAT_FUSE_GETATTR,
+	LAT_FUSE_SETATTR,
+	LAT_FUSE_ACCESS,
+	LAT_FUSE_READLINK,
+	LAT_FUSE_OPEN,
+	LAT_FUSE_CREATE,
+	LAT_FUSE_READ,
+	LAT_FUSE_WRITE,
+	LAT_FUSE_FSYNC,
+	LAT_FUSE_RELEASE,
+	LAT_FUSE_OPENDIR,
+	LAT_FUSE_READDIR,
+	LAT_FUSE_MKDIR,
+	LAT_FUSE_RMDIR,
+	LAT_FUSE_MKNOD,
+	LAT_FUSE_SYMLINK,
+	LAT_FUSE_LINK,
+	LAT_FUSE_UNLINK,
+	LAT_FUSE_RENAME,
+	LAT_FUSE_STATFS,
+	LAT_FUSE_NOPS
+} lat_fuse_op_t;
+
+/* Room for every ioctl; zfs_ioctl_init() checks that they fit */
+#define LAT_IOCTL_NOPS 64
+
+/*
+ * Account one operation that started at the given gethrtime().
+ * zfsdev_ioctl() records ioctl vec as LAT_IOCTL(vec).
+ */
+#define LAT_IOCTL(vec) (LAT_FUSE_NOPS + (vec))
+
+extern void op_latency_record(int op, hrtime_t start);
+
+/*
+ * Add the operations that completed since the last reset to nvl,
+ * naming the ioctls with ioc_name(vec) (skipped where it returns NULL).
+ * op_latency_reset() then starts counting afresh from that point.
+ */
+typedef struct lat_hist lat_hist_t;
+
+extern lat_hist_t *op_latency_get(nvlist_t *nvl, const char *(*ioc_name)(uint_t));
+extern void op_latency_reset(lat_hist_t *snap);
+extern void op_latency_free(lat_hist_t *snap);
+
+#endif
@@ -28,9 +28,12 @@
 #include <sys/types.h>
 #include <sys/cred.h>
 #include <sys/cmn_err.h>
+#include <sys/dmu.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
+#include <time.h>
 #include <pthread.h>
 
 #include "libsolkerncompat.h"
@@ -39,6 +42,7 @@
 
 #include "cmd_listener.h"
 #include "fuse_listener.h"
+#include "nbd_listener.h"
 
 #include "fuse.h"
 #include "zfs_operations.h"
@@ -55,6 +59,9 @@ int num_filesystems;
 extern vfsops_t *zfs_vfsops;
 extern int zfs_vfsinit(int fstype, char *name);
 
+static int automount_start();
+static void automount_stop();
+
 void do_daemon(const char *pidfile)
 {
 	chdir("/");
@@ -104,11 +111,21 @@ int do_init()
 
 	listener_thread_started = B_TRUE;
 
+	if(automount_start() != 0)
+		return -1;
+
+	if(nbd_listener_init() != 0)
+		return -1;
+
 	return zfsfuse_listener_init();
 }
 
 void do_exit()
 {
+	automount_stop();
+
+	nbd_listener_exit();
+
 	if(listener_thread_started) {
 		exit_listener = B_TRUE;
 		if(pthread_join(listener_thread, NULL) != 0)
@@ -133,6 +150,307 @@ void do_exit()
 uint32_t mounted = 0;
 #endif
 
+/*
+ * Automount mode (--automount): do_mount() only sets up the FUSE mount,
+ * which costs little, and the dataset itself is mounted by
+ * automount_enter() when the first request for it arrives.  Datasets that
+ * haven't been used for automount_timeout seconds are unmounted again by
+ * automount_reaper(), leaving the FUSE mount in place.  The vfs_t outlives
+ * these cycles since it is the userdata of the FUSE session.
+ */
+int automount_enabled = 0;
+int automount_timeout = 600;
+
+/* How often automount_reaper() looks for idle filesystems, in seconds */
+#define AUTOMOUNT_INTERVAL 10
+
+typedef enum {
+	AM_UNMOUNTED,
+	AM_MOUNTING,
+	AM_MOUNTED,
+	AM_UNMOUNTING
+} automount_state_t;
+
+struct automount {
+	automount_t *am_next;
+	vfs_t *am_vfs;
+	char *am_spec;
+	char *am_dir;
+	automount_state_t am_state;
+	int am_active;		/* requests being processed */
+	time_t am_last;		/* when the last request finished */
+	pthread_mutex_t am_mtx;
+	pthread_cond_t am_cv;	/* signaled when am_state changes */
+};
+
+/* Protects the list, and is held by the reaper while it unmounts */
+static pthread_mutex_t automount_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t automount_cv = PTHREAD_COND_INITIALIZER;
+static automount_t *automounts = NULL;
+
+static boolean_t automount_exit_reaper = B_FALSE;
+static boolean_t automount_reaper_started = B_FALSE;
+static pthread_t automount_reaper_thread;
+
+static int automount_mount(automount_t *am)
+{
+	struct mounta uap = {am->am_spec, am->am_dir, MS_SYSSPACE, NULL, "", 0};
+
+	int ret = VFS_MOUNT(am->am_vfs, rootdir, &uap, kcred);
+	if(ret != 0) {
+		cmn_err(CE_WARN, "Error %i mounting %s on %s on demand.", ret, am->am_spec, am->am_dir);
+		return ret;
+	}
+
+#ifdef DEBUG
+	atomic_inc_32(&mounted);
+#endif
+
+	return 0;
+}
+
+static int automount_unmount(automount_t *am)
+{
+	vfs_t *vfs = am->am_vfs;
+
+	VFS_SYNC(vfs, 0, kcred);
+
+	/* Fails with EBUSY while files are open */
+	int ret = VFS_UNMOUNT(vfs, 0, kcred);
+	if(ret != 0)
+		return ret;
+
+	/*
+	 * Free the filesystem but keep the vfs_t, which is held by us
+	 * alone now, for the next automount_mount().
+	 */
+	ASSERT(vfs->vfs_count == 1);
+	VFS_FREEVFS(vfs);
+
+	vfsops_t *vfsops = vfs->vfs_op;
+	memset(vfs, 0, sizeof(vfs_t));
+	VFS_INIT(vfs, vfsops, 0);
+	VFS_HOLD(vfs);
+
+#ifdef DEBUG
+	atomic_dec_32(&mounted);
+#endif
+
+	return 0;
+}
+
+/*
+ * Called before a request for an automounted filesystem is processed.
+ * Mounts the dataset if needed and keeps it mounted until automount_exit().
+ */
+int automount_enter(automount_t *am)
+{
+	int ret = 0;
+
+	VERIFY(pthread_mutex_lock(&am->am_mtx) == 0);
+
+	for(;;) {
+		if(am->am_state == AM_MOUNTED)
+			break;
+
+		if(am->am_state == AM_UNMOUNTED) {
+			am->am_state = AM_MOUNTING;
+			VERIFY(pthread_mutex_unlock(&am->am_mtx) == 0);
+
+			ret = automount_mount(am);
+
+			VERIFY(pthread_mutex_lock(&am->am_mtx) == 0);
+			am->am_state = ret == 0 ? AM_MOUNTED : AM_UNMOUNTED;
+			VERIFY(pthread_cond_broadcast(&am->am_cv) == 0);
+			break;
+		}
+
+		VERIFY(pthread_cond_wait(&am->am_cv, &am->am_mtx) == 0);
+	}
+
+	if(ret == 0)
+		am->am_active++;
+
+	VERIFY(pthread_mutex_unlock(&am->am_mtx) == 0);
+
+	return ret;
+}
+
+void automount_exit(automount_t *am)
+{
+	VERIFY(pthread_mutex_lock(&am->am_mtx) == 0);
+	ASSERT(am->am_active > 0);
+	am->am_active--;
+	am->am_last = time(NULL);
+	VERIFY(pthread_mutex_unlock(&am->am_mtx) == 0);
+}
+
+static void automount_free(automount_t *am)
+{
+	VERIFY(pthread_cond_destroy(&am->am_cv) == 0);
+	VERIFY(pthread_mutex_destroy(&am->am_mtx) == 0);
+	free(am->am_dir);
+	free(am->am_spec);
+	free(am);
+}
+
+static automount_t *automount_create(vfs_t *vfs, const char *spec, const char *dir)
+{
+	automount_t *am = calloc(1, sizeof(automount_t));
+	if(am == NULL)
+		return NULL;
+
+	am->am_spec = strdup(spec);
+	am->am_dir = strdup(dir);
+	if(am->am_spec == NULL || am->am_dir == NULL) {
+		free(am->am_dir);
+		free(am->am_spec);
+		free(am);
+		return NULL;
+	}
+
+	am->am_vfs = vfs;
+	am->am_state = AM_UNMOUNTED;
+	VERIFY(pthread_mutex_init(&am->am_mtx, NULL) == 0);
+	VERIFY(pthread_cond_init(&am->am_cv, NULL) == 0);
+
+	VERIFY(pthread_mutex_lock(&automount_mtx) == 0);
+	am->am_next = automounts;
+	automounts = am;
+	VERIFY(pthread_mutex_unlock(&automount_mtx) == 0);
+
+	return am;
+}
+
+static automount_t *automount_remove(vfs_t *vfs)
+{
+	automount_t *am, **amp;
+
+	VERIFY(pthread_mutex_lock(&automount_mtx) == 0);
+
+	for(amp = &automounts; (am = *amp) != NULL; amp = &am->am_next) {
+		if(am->am_vfs == vfs) {
+			*amp = am->am_next;
+			break;
+		}
+	}
+
+	VERIFY(pthread_mutex_unlock(&automount_mtx) == 0);
+
+	return am;
+}
+
+/*
+ * Called when the FUSE session of a filesystem is destroyed.
+ * Returns B_TRUE if vfs is mounted and the caller must unmount it,
+ * otherwise vfs has been freed.
+ */
+boolean_t automount_fini(vfs_t *vfs)
+{
+	automount_t *am = automount_remove(vfs);
+	if(am == NULL)
+		return B_TRUE;
+
+	VERIFY(pthread_mutex_lock(&am->am_mtx) == 0);
+	while(am->am_state == AM_MOUNTING || am->am_state == AM_UNMOUNTING)
+		VERIFY(pthread_cond_wait(&am->am_cv, &am->am_mtx) == 0);
+	boolean_t mounted = am->am_state == AM_MOUNTED;
+	VERIFY(pthread_mutex_unlock(&am->am_mtx) == 0);
+
+	automount_free(am);
+
+	if(mounted)
+		return B_TRUE;
+
+	kmem_free(vfs, sizeof(vfs_t));
+	return B_FALSE;
+}
+
+static void *automount_reaper(void *arg)
+{
+	VERIFY(pthread_mutex_lock(&automount_mtx) == 0);
+
+	while(!automount_exit_reaper) {
+		struct timespec ts;
+		VERIFY(clock_gettime(CLOCK_REALTIME, &ts) == 0);
+		ts.tv_sec += AUTOMOUNT_INTERVAL;
+
+		(void) pthread_cond_timedwait(&automount_cv, &automount_mtx, &ts);
+
+		time_t now = time(NULL);
+
+		for(automount_t *am = automounts; am != NULL && !automount_exit_reaper; am = am->am_next) {
+			VERIFY(pthread_mutex_lock(&am->am_mtx) == 0);
+
+			if(am->am_state != AM_MOUNTED || am->am_active != 0 ||
+			   now - am->am_last < automount_timeout) {
+				VERIFY(pthread_mutex_unlock(&am->am_mtx) == 0);
+				continue;
+			}
+
+			am->am_state = AM_UNMOUNTING;
+			VERIFY(pthread_mutex_unlock(&am->am_mtx) == 0);
+
+			int ret = automount_unmount(am);
+
+			VERIFY(pthread_mutex_lock(&am->am_mtx) == 0);
+			if(ret == 0) {
+				am->am_state = AM_UNMOUNTED;
+			} else {
+				/* Still in use, try again after another timeout */
+				am->am_state = AM_MOUNTED;
+				am->am_last = now;
+			}
+			VERIFY(pthread_cond_broadcast(&am->am_cv) == 0);
+			VERIFY(pthread_mutex_unlock(&am->am_mtx) == 0);
+		}
+	}
+
+	VERIFY(pthread_mutex_unlock(&automount_mtx) == 0);
+
+	return NULL;
+}
+
+static int automount_start()
+{
+	if(!automount_enabled || automount_timeout == 0)
+		return 0;
+
+	if(pthread_create(&automount_reaper_thread, NULL, automount_reaper, NULL) != 0) {
+		cmn_err(CE_WARN, "Error creating automount thread.");
+		return -1;
+	}
+
+	automount_reaper_started = B_TRUE;
+
+	return 0;
+}
+
+static void automount_stop()
+{
+	if(!automount_reaper_started)
+		return;
+
+	VERIFY(pthread_mutex_lock(&automount_mtx) == 0);
+	automount_exit_reaper = B_TRUE;
+	VERIFY(pthread_cond_signal(&automount_cv) == 0);
+	VERIFY(pthread_mutex_unlock(&automount_mtx) == 0);
+
+	if(pthread_join(automount_reaper_thread, NULL) != 0)
+		cmn_err(CE_WARN, "Error in pthread_join().");
+
+	automount_reaper_started = B_FALSE;
+}
+
+/*
+ * Undo the mount of vfs by do_mount(), if it got that far.
+ */
+static void mount_abort(vfs_t *vfs)
+{
+	if(automount_fini(vfs))
+		VERIFY(do_umount(vfs, B_FALSE) == 0);
+}
+
 int do_mount(char *spec, char *dir, int mflag, char *opt)
 {
 	VERIFY(mflag == 0);
@@ -147,21 +465,40 @@ int do_mount(char *spec, char *dir, int mflag, char *opt)
 
 	struct mounta uap = {spec, dir, mflag | MS_SYSSPACE, NULL, opt, strlen(opt)};
 
+	automount_t *am = NULL;
+
 	int ret;
-	if ((ret = VFS_MOUNT(vfs, rootdir, &uap, kcred)) != 0) {
+	if(automount_enabled) {
+		/*
+		 * The dataset is mounted when it is first accessed, just
+		 * make sure that it exists.
+		 */
+		objset_t *os;
+		if((ret = dmu_objset_open(spec, DMU_OST_ZFS, DS_MODE_STANDARD | DS_MODE_READONLY, &os)) != 0) {
+			kmem_free(vfs, sizeof(vfs_t));
+			return ret;
+		}
+		dmu_objset_close(os);
+
+		if((am = automount_create(vfs, spec, dir)) == NULL) {
+			kmem_free(vfs, sizeof(vfs_t));
+			return ENOMEM;
+		}
+	} else if ((ret = VFS_MOUNT(vfs, rootdir, &uap, kcred)) != 0) {
 		kmem_free(vfs, sizeof(vfs_t));
 		return ret;
 	}
 
 #ifdef DEBUG
-	atomic_inc_32(&mounted);;
+	if(am == NULL)
+		atomic_inc_32(&mounted);
 
 	fprintf(stderr, "mounting %s\n", dir);
 #endif
 
 	char *fuse_opts;
 	if(asprintf(&fuse_opts, FUSE_OPTIONS, spec) == -1) {
-		VERIFY(do_umount(vfs, B_FALSE) == 0);
+		mount_abort(vfs);
 		return ENOMEM;
 	}
 
@@ -172,7 +509,7 @@ int do_mount(char *spec, char *dir, int mflag, char *opt)
 	   fuse_opt_add_arg(&args, fuse_opts) == -1) {
 		fuse_opt_free_args(&args);
 		free(fuse_opts);
-		VERIFY(do_umount(vfs, B_FALSE) == 0);
+		mount_abort(vfs);
 		return ENOMEM;
 	}
 	free(fuse_opts);
@@ -180,7 +517,7 @@ int do_mount(char *spec, char *dir, int mflag, char *opt)
 	int fd = fuse_mount(dir, &args);
 
 	if(fd == -1) {
-		VERIFY(do_umount(vfs, B_FALSE) == 0);
+		mount_abort(vfs);
 		return EIO;
 	}
 
@@ -188,7 +525,7 @@ int do_mount(char *spec, char *dir, int mflag, char *opt)
 	fuse_opt_free_args(&args);
 
 	if(se == NULL) {
-		VERIFY(do_umount(vfs, B_FALSE) == 0); /* ZFSFUSE: FIXME?? */
+		mount_abort(vfs); /* ZFSFUSE: FIXME?? */
 		close(fd);
 		fuse_unmount(dir);
 		return EIO;
@@ -197,6 +534,7 @@ int do_mount(char *spec, char *dir, int mflag, char *opt)
 	struct fuse_chan *ch = fuse_kern_chan_new(fd);
 	if(ch == NULL) {
 		fuse_session_destroy(se);
+		mount_abort(vfs);
 		close(fd);
 		fuse_unmount(dir);
 		return EIO;
@@ -204,8 +542,9 @@ int do_mount(char *spec, char *dir, int mflag, char *opt)
 
 	fuse_session_add_chan(se, ch);
 
-	if(zfsfuse_newfs(dir, ch) != 0) {
+	if(zfsfuse_newfs(dir, ch, am) != 0) {
 		fuse_session_destroy(se);
+		mount_abort(vfs);
 		close(fd);
 		fuse_unmount(dir);
 		return EIO;
@@ -35,4 +35,13 @@ extern void do_exit();
 extern int do_mount(char *spec, char *dir, int mflag, char *opt);
 extern int do_umount(vfs_t *vfs, boolean_t force);
 
+typedef struct automount automount_t;
+
+extern int automount_enabled;
+extern int automount_timeout;
+
+extern int automount_enter(automount_t *am);
+extern void automount_exit(automount_t *am);
+extern boolean_t automount_fini(vfs_t *vfs);
+
 #endif
@@ -70,6 +70,8 @@
 #include "zfs_prop.h"
 #include "zfs_deleg.h"
 
+#include "op_latency.h"
+
 extern struct modlfs zfs_modlfs;
 
 extern void zfs_init(void);
@@ -1153,6 +1155,40 @@ retry:
 	return (error);
 }
 
+/*
+ * Gather the stats and (if nvp is not NULL) the properties of an objset,
+ * as returned by ZFS_IOC_OBJSET_STATS.
+ */
+static int
+zfs_objset_stats_get(objset_t *os, dmu_objset_stats_t *stat, nvlist_t **nvp)
+{
+	nvlist_t *nv;
+	int error;
+
+	dmu_objset_fast_stat(os, stat);
+
+	if (nvp == NULL)
+		return (0);
+
+	if ((error = dsl_prop_get_all(os, &nv)) != 0)
+		return (error);
+
+	dmu_objset_stats(os, nv);
+	/*
+	 * NB: zvol_get_stats() will read the objset contents,
+	 * which we aren't supposed to do with a
+	 * DS_MODE_STANDARD open, because it could be
+	 * inconsistent.  So this is a bit of a workaround...
+	 */
+	if (!stat->dds_inconsistent) {
+		if (dmu_objset_type(os) == DMU_OST_ZVOL)
+			VERIFY(zvol_get_stats(os, nv) == 0);
+	}
+
+	*nvp = nv;
+	return (0);
+}
+
 /*
  * inputs:
  * zc_name		name of filesystem
@@ -1174,21 +1210,9 @@ zfs_ioc_objset_stats(zfs_cmd_t *zc)
 	if ((error = zfs_os_open_retry(zc->zc_name, &os)) != 0)
 		return (error);
 
-	dmu_objset_fast_stat(os, &zc->zc_objset_stats);
-
-	if (zc->zc_nvlist_dst != 0 &&
-	    (error = dsl_prop_get_all(os, &nv)) == 0) {
-		dmu_objset_stats(os, nv);
-		/*
-		 * NB: zvol_get_stats() will read the objset contents,
-		 * which we aren't supposed to do with a
-		 * DS_MODE_STANDARD open, because it could be
-		 * inconsistent.  So this is a bit of a workaround...
-		 */
-		if (!zc->zc_objset_stats.dds_inconsistent) {
-			if (dmu_objset_type(os) == DMU_OST_ZVOL)
-				VERIFY(zvol_get_stats(os, nv) == 0);
-		}
+	if ((error = zfs_objset_stats_get(os, &zc->zc_objset_stats,
+	    zc->zc_nvlist_dst != 0 ? &nv : NULL)) == 0 &&
+	    zc->zc_nvlist_dst != 0) {
 		error = put_nvlist(zc, nv);
 		nvlist_free(nv);
 	}
@@ -1361,6 +1385,188 @@ zfs_ioc_snapshot_list_next(zfs_cmd_t *zc)
 	return (error);
 }
 
+/*
+ * Add the stats and properties of one dataset to a ZFS_IOC_DATASET_LIST_BULK
+ * reply, and return an estimate of the packed size of the new entry in
+ * *sizep.  If 'wanted' is not NULL, only the properties named in it are
+ * returned.
+ */
+static int
+zfs_list_bulk_add(nvlist_t *list, char *name, nvlist_t *wanted,
+    size_t *sizep)
+{
+	objset_t *os;
+	dmu_objset_stats_t stat;
+	nvlist_t *entry, *props;
+	nvpair_t *elem;
+	size_t size;
+	int error;
+
+	if ((error = zfs_os_open_retry(name, &os)) != 0)
+		return (error);
+
+	error = zfs_objset_stats_get(os, &stat, &props);
+	dmu_objset_close(os);
+	if (error != 0)
+		return (error);
+
+	if (wanted != NULL) {
+		nvlist_t *all = props;
+		nvlist_t *propval;
+
+		VERIFY(nvlist_alloc(&props, NV_UNIQUE_NAME, KM_SLEEP) == 0);
+		for (elem = nvlist_next_nvpair(wanted, NULL); elem != NULL;
+		    elem = nvlist_next_nvpair(wanted, elem)) {
+			if (nvlist_lookup_nvlist(all, nvpair_name(elem),
+			    &propval) == 0)
+				VERIFY(nvlist_add_nvlist(props,
+				    nvpair_name(elem), propval) == 0);
+		}
+		nvlist_free(all);
+	}
+
+	VERIFY(nvlist_alloc(&entry, NV_UNIQUE_NAME, KM_SLEEP) == 0);
+	VERIFY(nvlist_add_byte_array(entry, ZFS_LIST_BULK_STATS,
+	    (uchar_t *)&stat, sizeof (stat)) == 0);
+	VERIFY(nvlist_add_nvlist(entry, ZFS_LIST_BULK_PROPS, props) == 0);
+	nvlist_free(props);
+
+	/* pair header, name and embedded nvlist header; generous */
+	VERIFY(nvlist_size(entry, &size, NV_ENCODE_NATIVE) == 0);
+	*sizep = size + strlen(name) + 64;
+
+	VERIFY(nvlist_add_nvlist(list, name, entry) == 0);
+	nvlist_free(entry);
+	return (0);
+}
+
+/*
+ * inputs:
+ * zc_name		name of filesystem
+ * zc_objset_type	ZFS_LIST_BULK_FILESYSTEMS or ZFS_LIST_BULK_SNAPSHOTS
+ * zc_cookie		zap cursor
+ * zc_obj		maximum number of datasets to return
+ * zc_nvlist_src{_size}	optional nvlist naming the properties to return
+ * zc_nvlist_dst_size	size of buffer for the dataset nvlist
+ *
+ * outputs:
+ * zc_cookie		zap cursor to continue from
+ * zc_nvlist_dst	nvlist of datasets in cursor order, each an nvlist
+ *			of ZFS_LIST_BULK_STATS and ZFS_LIST_BULK_PROPS
+ * zc_nvlist_dst_size	size of the dataset nvlist
+ * zc_value		alternate root
+ *
+ * Returns as many datasets as fit in the buffer, ESRCH if there are none
+ * left, and ENOMEM (with the cursor unchanged) if not even the first one
+ * fits.
+ */
+static int
+zfs_ioc_dataset_list_bulk(zfs_cmd_t *zc)
+{
+	objset_t *os;
+	nvlist_t *wanted = NULL;
+	nvlist_t *list;
+	char name[MAXNAMELEN];
+	char *p;
+	uint64_t cookie, start = zc->zc_cookie;
+	uint64_t count = 0;
+	size_t size, total = 0;
+	boolean_t snaps = (zc->zc_objset_type == ZFS_LIST_BULK_SNAPSHOTS);
+	int error;
+
+	if (zc->zc_nvlist_src != 0 &&
+	    (error = get_nvlist(zc->zc_nvlist_src, zc->zc_nvlist_src_size,
+	    &wanted)) != 0)
+		return (error);
+
+	if ((error = zfs_os_open_retry(zc->zc_name, &os)) != 0) {
+		nvlist_free(wanted);
+		return (error == ENOENT ? ESRCH : error);
+	}
+
+	(void) strlcpy(name, zc->zc_name, sizeof (name));
+	if (snaps) {
+		/*
+		 * A dataset name of maximum length cannot have any
+		 * snapshots.
+		 */
+		if (strlcat(name, "@", sizeof (name)) >= MAXNAMELEN) {
+			dmu_objset_close(os);
+			nvlist_free(wanted);
+			return (ESRCH);
+		}
+	} else {
+		p = strrchr(name, '/');
+		if (p == NULL || p[1] != '\0')
+			(void) strlcat(name, "/", sizeof (name));
+	}
+	p = name + strlen(name);
+
+	VERIFY(nvlist_alloc(&list, NV_UNIQUE_NAME, KM_SLEEP) == 0);
+
+	while (zc->zc_obj == 0 || count < zc->zc_obj) {
+		cookie = zc->zc_cookie;
+		if (snaps) {
+			error = dmu_snapshot_list_next(os,
+			    sizeof (name) - (p - name), p, NULL,
+			    &zc->zc_cookie, NULL);
+		} else {
+			do {
+				error = dmu_dir_list_next(os,
+				    sizeof (name) - (p - name), p, NULL,
+				    &zc->zc_cookie);
+			} while (error == 0 && !INGLOBALZONE(curproc) &&
+			    !zone_dataset_visible(name, NULL));
+		}
+		if (error != 0) {
+			if (error == ENOENT)
+				error = 0;
+			break;
+		}
+
+		/*
+		 * Skip hidden datasets (ie. with a '$' in their name), and
+		 * datasets destroyed since we read their name.
+		 */
+		if (strchr(p, '$') != NULL)
+			continue;
+		if ((error = zfs_list_bulk_add(list, name, wanted,
+		    &size)) != 0) {
+			if (error == ENOENT) {
+				error = 0;
+				continue;
+			}
+			break;
+		}
+
+		/*
+		 * Stop before the buffer overflows, and let the caller
+		 * continue from this dataset.
+		 */
+		if (count > 0 && total + size > zc->zc_nvlist_dst_size) {
+			VERIFY(nvlist_remove(list, name,
+			    DATA_TYPE_NVLIST) == 0);
+			zc->zc_cookie = cookie;
+			break;
+		}
+		total += size;
+		count++;
+	}
+	spa_altroot(dmu_objset_spa(os), zc->zc_value, sizeof (zc->zc_value));
+	dmu_objset_close(os);
+	nvlist_free(wanted);
+
+	if (error == 0 && count == 0)
+		error = ESRCH;
+	if (error == 0)
+		error = put_nvlist(zc, list);
+	if (error != 0)
+		zc->zc_cookie = start;
+
+	nvlist_free(list);
+	return (error);
+}
+
 int
 zfs_set_prop_nvlist(const char *name, nvlist_t *nvl)
 {
@@ -1472,8 +1678,10 @@ zfs_set_prop_nvlist(const char *name, nvlist_t *nvl)
 			break;
 
 		case ZFS_PROP_VOLSIZE:
-			/* ZFSFUSE: ZVols not implemented */
-			return ENXIO;
+			if ((error = nvpair_value_uint64(elem, &intval)) != 0 ||
+			    (error = zvol_set_volsize(name, 0, intval)) != 0)
+				return (error);
+			break;
 
 		case ZFS_PROP_VOLBLOCKSIZE:
 			/* ZFSFUSE: ZVols not implemented */
@@ -1932,9 +2140,8 @@ zfs_ioc_create(zfs_cmd_t *zc)
 		cbfunc = zfs_create_cb;
 		break;
 	case DMU_OST_ZVOL:
-		/* ZFSFUSE: TODO Implement ZVOLs */
-		/*cbfunc = zvol_create_cb;*/
-		return ENOSYS;
+		cbfunc = zvol_create_cb;
+		break;
 	default:
 		cbfunc = NULL;
 		break;
@@ -2006,8 +2213,6 @@ zfs_ioc_create(zfs_cmd_t *zc)
 				volblocksize = zfs_prop_default_numeric(
 				    ZFS_PROP_VOLBLOCKSIZE);
 
-/* ZFSFUSE: TODO Implement ZVOLs */
-#if 0
 			if ((error = zvol_check_volblocksize(
 			    volblocksize)) != 0 ||
 			    (error = zvol_check_volsize(volsize,
@@ -2015,7 +2220,6 @@ zfs_ioc_create(zfs_cmd_t *zc)
 				nvlist_free(nvprops);
 				return (error);
 			}
-#endif
 		} else if (type == DMU_OST_ZFS) {
 			uint64_t version;
 			int error;
@@ -2099,11 +2303,9 @@ zfs_ioc_snapshot(zfs_cmd_t *zc)
 int
 zfs_unmount_snap(char *name, void *arg)
 {
-	/* ZFSFUSE: TODO */
-#if 0
 	char *snapname = arg;
 	char *cp;
-	vfs_t *vfsp = NULL;
+	int err = 0;
 
 	/*
 	 * Snapshots (which are under .zfs control) must be unmounted
@@ -2113,30 +2315,14 @@ zfs_unmount_snap(char *name, void *arg)
 	if (snapname) {
 		(void) strcat(name, "@");
 		(void) strcat(name, snapname);
-		vfsp = zfs_get_vfs(name);
+		err = zfsctl_destroy_snapshot(name, MS_FORCE);
 		cp = strchr(name, '@');
 		*cp = '\0';
 	} else if (strchr(name, '@')) {
-		vfsp = zfs_get_vfs(name);
+		err = zfsctl_destroy_snapshot(name, MS_FORCE);
 	}
 
-	if (vfsp) {
-		/*
-		 * Always force the unmount for snapshots.
-		 */
-		int flag = MS_FORCE;
-		int err;
-
-		if ((err = vn_vfswlock(vfsp->vfs_vnodecovered)) != 0) {
-			VFS_RELE(vfsp);
-			return (err);
-		}
-		VFS_RELE(vfsp);
-		if ((err = dounmount(vfsp, flag, kcred)) != 0)
-			return (err);
-	}
-#endif
-	return (0);
+	return (err);
 }
 
 /*
@@ -2790,6 +2976,61 @@ zfs_ioc_share(zfs_cmd_t *zc)
 #endif
 }
 
+/*
+ * Names of the ioctls in latency statistics, in the order of zfs_ioc_vec
+ */
+static const char *zfs_ioc_names[] = {
+	"pool_create", "pool_destroy", "pool_import", "pool_export",
+	"pool_configs", "pool_stats", "pool_tryimport", "pool_scrub",
+	"pool_freeze", "pool_upgrade", "pool_get_history", "vdev_add",
+	"vdev_remove", "vdev_set_state", "vdev_attach", "vdev_detach",
+	"vdev_setpath", "objset_stats", "objset_zplprops",
+	"dataset_list_next", "snapshot_list_next", "set_prop",
+	"create_minor", "remove_minor", "create", "destroy",
+	"rollback", "rename", "recv", "send", "inject_fault",
+	"clear_fault", "inject_list_next", "error_log", "clear",
+	"promote", "destroy_snaps", "snapshot", "dsobj_to_dsname",
+	"obj_to_path", "pool_set_props", "pool_get_props", "set_fsacl",
+	"get_fsacl", "iscsi_perm_check", "share", "inherit_prop",
+	"dataset_list_bulk", "latency_stats"
+};
+
+static const char *
+zfs_ioc_name(uint_t vec)
+{
+	if (vec >= sizeof (zfs_ioc_names) / sizeof (zfs_ioc_names[0]))
+		return (NULL);
+	return (zfs_ioc_names[vec]);
+}
+
+/*
+ * inputs:
+ * zc_cookie		nonzero to reset the statistics once returned
+ * zc_nvlist_dst_size	size of buffer for the statistics nvlist
+ *
+ * outputs:
+ * zc_nvlist_dst	nvlist of ZFS_LATENCY_FUSE and ZFS_LATENCY_IOCTL
+ *			latency histograms
+ */
+static int
+zfs_ioc_latency_stats(zfs_cmd_t *zc)
+{
+	nvlist_t *nvl;
+	lat_hist_t *snap;
+	int error;
+
+	VERIFY(nvlist_alloc(&nvl, NV_UNIQUE_NAME, KM_SLEEP) == 0);
+	snap = op_latency_get(nvl, zfs_ioc_name);
+
+	error = put_nvlist(zc, nvl);
+	if (error == 0 && zc->zc_cookie != 0)
+		op_latency_reset(snap);
+
+	op_latency_free(snap);
+	nvlist_free(nvl);
+	return (error);
+}
+
 /*
  * pool create, destroy, and export don't log the history as part of
  * zfsdev_ioctl, but rather zfs_ioc_pool_create, and zfs_ioc_pool_export
@@ -2846,6 +3087,8 @@ static zfs_ioc_vec_t zfs_ioc_vec[] = {
 	    DATASET_NAME, B_FALSE },
 	{ zfs_ioc_share, zfs_secpolicy_share, DATASET_NAME, B_FALSE },
 	{ zfs_ioc_inherit_prop, zfs_secpolicy_inherit, DATASET_NAME, B_TRUE },
+	{ zfs_ioc_dataset_list_bulk, zfs_secpolicy_read, DATASET_NAME, B_FALSE },
+	{ zfs_ioc_latency_stats, zfs_secpolicy_none, NO_NAME, B_FALSE },
 };
 
 int
@@ -2854,6 +3097,7 @@ zfsdev_ioctl(dev_t dev, int cmd, intptr_t arg, int flag, cred_t *cr, int *rvalp)
 	zfs_cmd_t *zc;
 	uint_t vec;
 	int error, rc;
+	hrtime_t start = gethrtime();
 
 /* zfs-fuse: not implemented */
 #if 0
@@ -2907,6 +3151,8 @@ zfsdev_ioctl(dev_t dev, int cmd, intptr_t arg, int flag, cred_t *cr, int *rvalp)
 	}
 
 	kmem_free(zc, sizeof (zfs_cmd_t));
+
+	op_latency_record(LAT_IOCTL(vec), start);
 	return (error);
 }
 
@@ -3026,10 +3272,14 @@ zfs_ioctl_init(void)
 {
 	spa_init(FREAD | FWRITE);
 
+	/* zfs-fuse: latency statistics have a slot for each ioctl */
+	VERIFY(sizeof (zfs_ioc_vec) / sizeof (zfs_ioc_vec[0]) <= LAT_IOCTL_NOPS);
+	VERIFY(sizeof (zfs_ioc_names) / sizeof (zfs_ioc_names[0]) ==
+	    sizeof (zfs_ioc_vec) / sizeof (zfs_ioc_vec[0]));
+
 	zfs_init();
 
-	/* zfs-fuse: not implemented */
-	/*zvol_init();*/
+	zvol_init();
 
 #if 0
 	if ((error = mod_install(&modlinkage)) != 0) {
@@ -3058,7 +3308,7 @@ zfs_ioctl_fini(void)
 {
 	int error = 0;
 
-	if (spa_busy() || zfs_busy() || /*zvol_busy() ||*/ zio_injection_enabled)
+	if (spa_busy() || zfs_busy() || zvol_busy() || zio_injection_enabled)
 		return (EBUSY);
 
 #if 0
@@ -3066,8 +3316,7 @@ zfs_ioctl_fini(void)
 		return (error);
 #endif
 
-	/* zfs-fuse: not implemented */
-	/*zvol_fini();*/
+	zvol_fini();
 
 	zfs_fini();
 	spa_fini();
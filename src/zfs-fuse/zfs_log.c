@@ -458,10 +458,11 @@ zfs_log_write(zilog_t *zilog, dmu_tx_t *tx, int txtype,
 	 * Writes are handled in three different ways:
 	 *
 	 * WR_INDIRECT:
-	 *    If the write is greater than zfs_immediate_write_sz and there are
-	 *    no separate logs in this pool then later *if* we need to log the
-	 *    write then dmu_sync() is used to immediately write the block and
-	 *    its block pointer is put in the log record.
+	 *    If the dataset's logbias is throughput, or the write is greater
+	 *    than zfs_immediate_write_sz and there are no separate logs in
+	 *    this pool, then later *if* we need to log the write then
+	 *    dmu_sync() is used to immediately write the block and its block
+	 *    pointer is put in the log record.
 	 * WR_COPIED:
 	 *    If we know we'll immediately be committing the
 	 *    transaction (FSYNC or FDSYNC), the we allocate a larger
@@ -471,8 +472,10 @@ zfs_log_write(zilog_t *zilog, dmu_tx_t *tx, int txtype,
 	 *    flush the write later then a buffer is allocated and
 	 *    we retrieve the data using the dmu.
 	 */
-	slogging = spa_has_slogs(zilog->zl_spa);
-	if (resid > zfs_immediate_write_sz && !slogging)
+	slogging = spa_has_slogs(zilog->zl_spa) && ZIL_USE_SLOG(zilog);
+	if (!ZIL_USE_SLOG(zilog))
+		write_state = WR_INDIRECT;
+	else if (resid > zfs_immediate_write_sz && !slogging)
 		write_state = WR_INDIRECT;
 	else if (ioflag & (FSYNC | FDSYNC))
 		write_state = WR_COPIED;
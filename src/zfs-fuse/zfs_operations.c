@@ -33,6 +33,7 @@
 #include <sys/cred_impl.h>
 #include <sys/zfs_vfsops.h>
 #include <sys/zfs_znode.h>
+#include <sys/zfs_ctldir.h>
 #include <sys/mode.h>
 #include <sys/fcntl.h>
 
@@ -43,9 +44,16 @@
 
 #include "util.h"
 #include "fuse_listener.h"
+#include "op_latency.h"
 
 #define ZFS_MAGIC 0x2f52f5
 
+/* The .zfs and .zfs/snapshot directories */
+#define ZFSFUSE_CTLDIR(ino) ((ino) == ZFSCTL_INO_ROOT || (ino) == ZFSCTL_INO_SNAPDIR)
+
+/* Inodes under .zfs, which are all read-only */
+#define ZFSFUSE_READONLY(ino) (ZFSCTL_INO_SLOT(ino) != 0 || ZFSFUSE_CTLDIR(ino))
+
 static void zfsfuse_getcred(fuse_req_t req, cred_t *cred)
 {
 	const struct fuse_ctx *ctx = fuse_req_ctx(req);
@@ -58,6 +66,10 @@ static void zfsfuse_destroy(void *userdata)
 {
 	vfs_t *vfs = (vfs_t *) userdata;
 
+	/* An automounted filesystem may not be mounted at all */
+	if(!automount_fini(vfs))
+		return;
+
 	struct timespec req;
 	req.tv_sec = 0;
 	req.tv_nsec = 100000000; /* 100 ms */
@@ -77,17 +89,15 @@ static void zfsfuse_destroy(void *userdata)
 #endif
 }
 
-static void zfsfuse_statfs(fuse_req_t req)
+static int zfsfuse_statfs(fuse_req_t req)
 {
 	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
 
 	struct statvfs64 zfs_stat;
 
 	int ret = VFS_STATVFS(vfs, &zfs_stat);
-	if(ret != 0) {
-		fuse_reply_err(req, ret);
-		return;
-	}
+	if(ret != 0)
+		return ret;
 
 	struct statvfs stat = { 0 };
 
@@ -107,6 +117,62 @@ static void zfsfuse_statfs(fuse_req_t req)
 	stat.f_namemax = zfs_stat.f_namemax;
 
 	fuse_reply_statfs(req, &stat);
+
+	return 0;
+}
+
+static void zfsfuse_statfs_helper(fuse_req_t req)
+{
+	hrtime_t start = gethrtime();
+
+	int error = zfsfuse_statfs(req);
+	if(error)
+		fuse_reply_err(req, error);
+
+	op_latency_record(LAT_FUSE_STATFS, start);
+}
+
+/*
+ * The inode number the kernel knows a znode by: the root directory of the
+ * filesystem is inode 1, and the files of a snapshot under .zfs/snapshot
+ * carry the slot of the snapshot.
+ */
+static fuse_ino_t zfsfuse_ino(znode_t *zp)
+{
+	zfsvfs_t *zfsvfs = zp->z_zfsvfs;
+
+	if(zfsvfs->z_issnap)
+		return ZFSCTL_INO(zfsvfs->z_snap_slot, zp->z_id);
+
+	return zp->z_id == 3 ? 1 : zp->z_id;
+}
+
+/*
+ * Find the filesystem an inode belongs to, and its object number there.
+ * A snapshot stays mounted until zfsfuse_putfs(), so ZFS_ENTER() can't
+ * fail on it in between.
+ */
+static int zfsfuse_getfs(fuse_req_t req, fuse_ino_t ino, zfsvfs_t **zfsvfsp, uint64_t *objp)
+{
+	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
+	zfsvfs_t *zfsvfs = vfs->vfs_data;
+
+	*objp = ZFSCTL_INO_OBJ(ino);
+
+	if(ZFSCTL_INO_SLOT(ino) == 0) {
+		*zfsvfsp = zfsvfs;
+		return 0;
+	}
+
+	return zfsctl_snapshot_hold(zfsvfs, ZFSCTL_INO_SLOT(ino), zfsvfsp);
+}
+
+static void zfsfuse_putfs(fuse_req_t req, zfsvfs_t *zfsvfs)
+{
+	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
+
+	if(zfsvfs != vfs->vfs_data)
+		zfsctl_snapshot_rele(vfs->vfs_data, zfsvfs);
 }
 
 static int zfsfuse_stat(vnode_t *vp, struct stat *stbuf, cred_t *cred)
@@ -124,7 +190,7 @@ static int zfsfuse_stat(vnode_t *vp, struct stat *stbuf, cred_t *cred)
 	memset(stbuf, 0, sizeof(struct stat));
 
 	stbuf->st_dev = vattr.va_fsid;
-	stbuf->st_ino = vattr.va_nodeid == 3 ? 1 : vattr.va_nodeid;
+	stbuf->st_ino = zfsfuse_ino(VTOZ(vp));
 	stbuf->st_mode = VTTOIF(vattr.va_type) | vattr.va_mode;
 	stbuf->st_nlink = vattr.va_nlink;
 	stbuf->st_uid = vattr.va_uid;
@@ -140,7 +206,11 @@ static int zfsfuse_stat(vnode_t *vp, struct stat *stbuf, cred_t *cred)
 	return 0;
 }
 
-static int zfsfuse_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+/*
+ * .zfs and .zfs/snapshot have no znodes.  They take their attributes from
+ * the root directory of the filesystem, and are read-only.
+ */
+static int zfsfuse_ctldir_stat(fuse_req_t req, fuse_ino_t ino, struct stat *stbuf)
 {
 	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
 	zfsvfs_t *zfsvfs = vfs->vfs_data;
@@ -149,9 +219,211 @@ static int zfsfuse_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info
 
 	znode_t *znode;
 
-	int error = zfs_zget(zfsvfs, ino, &znode, B_TRUE);
+	int error = zfs_zget(zfsvfs, zfsvfs->z_root, &znode, B_TRUE);
+	if(!error) {
+		error = zfsfuse_stat(ZTOV(znode), stbuf, kcred);
+		VN_RELE(ZTOV(znode));
+	}
+
+	ZFS_EXIT(zfsvfs);
+
+	if(error)
+		return error;
+
+	stbuf->st_ino = ino;
+	stbuf->st_mode = S_IFDIR | 0555;
+	stbuf->st_nlink = 2;
+	stbuf->st_size = 0;
+	stbuf->st_blocks = 0;
+
+	return 0;
+}
+
+/*
+ * Look up .zfs in the root directory (parent is the root), snapshot in
+ * .zfs, or a snapshot in .zfs/snapshot, whose root directory is mounted
+ * to answer.
+ */
+static int zfsfuse_ctldir_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
+	zfsvfs_t *zfsvfs = vfs->vfs_data;
+
+	struct fuse_entry_param e = { 0 };
+
+	e.attr_timeout = 0.0;
+	e.entry_timeout = 0.0;
+
+	int error;
+
+	if(parent != ZFSCTL_INO_SNAPDIR) {
+		if(parent == ZFSCTL_INO_ROOT && strcmp(name, "snapshot") != 0)
+			return ENOENT;
+
+		e.ino = parent == ZFSCTL_INO_ROOT ? ZFSCTL_INO_SNAPDIR : ZFSCTL_INO_ROOT;
+		error = zfsfuse_ctldir_stat(req, e.ino, &e.attr);
+	} else {
+		uint64_t slot;
+
+		ZFS_ENTER(zfsvfs);
+		error = zfsctl_snapshot_lookup(zfsvfs, name, &slot);
+		ZFS_EXIT(zfsvfs);
+
+		if(error)
+			return error;
+
+		zfsvfs_t *snapzfsvfs;
+		uint64_t obj;
+
+		error = zfsfuse_getfs(req, ZFSCTL_INO(slot, 0), &snapzfsvfs, &obj);
+		if(error)
+			return error;
+
+		ZFS_ENTER(snapzfsvfs);
+
+		znode_t *znode;
+
+		error = zfs_zget(snapzfsvfs, snapzfsvfs->z_root, &znode, B_FALSE);
+		if(!error) {
+			cred_t cred;
+			zfsfuse_getcred(req, &cred);
+
+			e.ino = zfsfuse_ino(znode);
+			e.generation = znode->z_phys->zp_gen;
+			error = zfsfuse_stat(ZTOV(znode), &e.attr, &cred);
+
+			VN_RELE(ZTOV(znode));
+		}
+
+		ZFS_EXIT(snapzfsvfs);
+		zfsfuse_putfs(req, snapzfsvfs);
+	}
+
+	if(!error)
+		fuse_reply_entry(req, &e);
+
+	return error;
+}
+
+/*
+ * Directory offsets 0 and 1 are "." and "..".  The ones after them are
+ * "snapshot" in .zfs, and the cursors of dmu_snapshot_list_next() plus 2
+ * in .zfs/snapshot.
+ */
+static int zfsfuse_ctldir_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off)
+{
+	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
+	zfsvfs_t *zfsvfs = vfs->vfs_data;
+
+	char *outbuf = kmem_alloc(size, KM_NOSLEEP);
+	if(outbuf == NULL)
+		return ENOMEM;
+
+	ZFS_ENTER(zfsvfs);
+
+	char snapname[MAXNAMELEN];
+	struct stat fstat = { 0 };
+
+	int outbuf_off = 0;
+	int outbuf_resid = size;
+
+	int error = 0;
+
+	for(;;) {
+		const char *name;
+		uint64_t next;
+
+		if(off == 0) {
+			name = ".";
+			fstat.st_ino = ino;
+			next = 1;
+		} else if(off == 1) {
+			name = "..";
+			fstat.st_ino = ino == ZFSCTL_INO_ROOT ? 1 : ZFSCTL_INO_ROOT;
+			next = 2;
+		} else if(ino == ZFSCTL_INO_ROOT) {
+			if(off > 2)
+				break;
+			name = "snapshot";
+			fstat.st_ino = ZFSCTL_INO_SNAPDIR;
+			next = 3;
+		} else {
+			uint64_t slot;
+
+			next = off - 2;
+			error = dmu_snapshot_list_next(zfsvfs->z_os, MAXNAMELEN, snapname, NULL, &next, NULL);
+			if(error) {
+				if(error == ENOENT)
+					error = 0;
+				break;
+			}
+			next += 2;
+
+			/*
+			 * Report the inode lookup gives the snapshot's root.
+			 * A snapshot's root is the same object as its
+			 * filesystem's, so there's no need to mount it.
+			 */
+			error = zfsctl_snapshot_lookup(zfsvfs, snapname, &slot);
+			if(error == ENOENT) {
+				/* Destroyed since we listed it */
+				error = 0;
+				off = next;
+				continue;
+			}
+			if(error)
+				break;
+			name = snapname;
+			fstat.st_ino = ZFSCTL_INO(slot, zfsvfs->z_root);
+		}
+
+		int dsize = fuse_dirent_size(strlen(name));
+		if(dsize > outbuf_resid)
+			break;
+
+		fuse_add_dirent(outbuf + outbuf_off, name, &fstat, next);
+
+		outbuf_off += dsize;
+		outbuf_resid -= dsize;
+		off = next;
+	}
+
+	ZFS_EXIT(zfsvfs);
+
+	if(!error)
+		fuse_reply_buf(req, outbuf, outbuf_off);
+
+	kmem_free(outbuf, size);
+
+	return error;
+}
+
+static int zfsfuse_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	struct stat stbuf;
+
+	if(ZFSFUSE_CTLDIR(ino)) {
+		int error = zfsfuse_ctldir_stat(req, ino, &stbuf);
+		if(!error)
+			fuse_reply_attr(req, &stbuf, 0.0);
+		return error;
+	}
+
+	zfsvfs_t *zfsvfs;
+	uint64_t obj;
+
+	int error = zfsfuse_getfs(req, ino, &zfsvfs, &obj);
+	if(error)
+		return error;
+
+	ZFS_ENTER(zfsvfs);
+
+	znode_t *znode;
+
+	error = zfs_zget(zfsvfs, obj, &znode, B_TRUE);
 	if(error) {
 		ZFS_EXIT(zfsvfs);
+		zfsfuse_putfs(req, zfsvfs);
 		/* If the inode we are trying to get was recently deleted
 		   dnode_hold_impl will return EEXIST instead of ENOENT */
 		return error == EEXIST ? ENOENT : error;
@@ -164,11 +436,11 @@ static int zfsfuse_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info
 	cred_t cred;
 	zfsfuse_getcred(req, &cred);
 
-	struct stat stbuf;
 	error = zfsfuse_stat(vp, &stbuf, &cred);
 
 	VN_RELE(vp);
 	ZFS_EXIT(zfsvfs);
+	zfsfuse_putfs(req, zfsvfs);
 
 	if(!error)
 		fuse_reply_attr(req, &stbuf, 0.0);
@@ -178,11 +450,15 @@ static int zfsfuse_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info
 
 static void zfsfuse_getattr_helper(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
+	hrtime_t start = gethrtime();
+
 	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
 
 	int error = zfsfuse_getattr(req, real_ino, fi);
 	if(error)
 		fuse_reply_err(req, error);
+
+	op_latency_record(LAT_FUSE_GETATTR, start);
 }
 
 static int zfsfuse_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
@@ -190,16 +466,24 @@ static int zfsfuse_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
 	if(strlen(name) >= MAXNAMELEN)
 		return ENAMETOOLONG;
 
-	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
-	zfsvfs_t *zfsvfs = vfs->vfs_data;
+	if(ZFSFUSE_CTLDIR(parent))
+		return zfsfuse_ctldir_lookup(req, parent, name);
+
+	zfsvfs_t *zfsvfs;
+	uint64_t obj;
+
+	int error = zfsfuse_getfs(req, parent, &zfsvfs, &obj);
+	if(error)
+		return error;
 
 	ZFS_ENTER(zfsvfs);
 
 	znode_t *znode;
 
-	int error = zfs_zget(zfsvfs, parent, &znode, B_TRUE);
+	error = zfs_zget(zfsvfs, obj, &znode, B_TRUE);
 	if(error) {
 		ZFS_EXIT(zfsvfs);
+		zfsfuse_putfs(req, zfsvfs);
 		/* If the inode we are trying to get was recently deleted
 		   dnode_hold_impl will return EEXIST instead of ENOENT */
 		return error == EEXIST ? ENOENT : error;
@@ -209,6 +493,13 @@ static int zfsfuse_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
 	vnode_t *dvp = ZTOV(znode);
 	ASSERT(dvp != NULL);
 
+	if(zfs_has_ctldir(znode) && strcmp(name, ZFS_CTLDIR_NAME) == 0) {
+		VN_RELE(dvp);
+		ZFS_EXIT(zfsvfs);
+		zfsfuse_putfs(req, zfsvfs);
+		return zfsfuse_ctldir_lookup(req, parent, name);
+	}
+
 	vnode_t *vp = NULL;
 
 	cred_t cred;
@@ -226,10 +517,7 @@ static int zfsfuse_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
 	if(vp == NULL)
 		goto out;
 
-	e.ino = VTOZ(vp)->z_id;
-	if(e.ino == 3)
-		e.ino = 1;
-
+	e.ino = zfsfuse_ino(VTOZ(vp));
 	e.generation = VTOZ(vp)->z_phys->zp_gen;
 
 	error = zfsfuse_stat(vp, &e.attr, &cred);
@@ -239,6 +527,7 @@ out:
 		VN_RELE(vp);
 	VN_RELE(dvp);
 	ZFS_EXIT(zfsvfs);
+	zfsfuse_putfs(req, zfsvfs);
 
 	if(!error)
 		fuse_reply_entry(req, &e);
@@ -248,25 +537,49 @@ out:
 
 static void zfsfuse_lookup_helper(fuse_req_t req, fuse_ino_t parent, const char *name)
 {
+	hrtime_t start = gethrtime();
+
 	fuse_ino_t real_parent = parent == 1 ? 3 : parent;
 
 	int error = zfsfuse_lookup(req, real_parent, name);
 	if(error)
 		fuse_reply_err(req, error);
+
+	op_latency_record(LAT_FUSE_LOOKUP, start);
 }
 
 static int zfsfuse_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
-	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
-	zfsvfs_t *zfsvfs = vfs->vfs_data;
+	if(ZFSFUSE_CTLDIR(ino)) {
+		/* See zfsfuse_ctldir_readdir() */
+		file_info_t *info = kmem_cache_alloc(file_info_cache, KM_NOSLEEP);
+		if(info == NULL)
+			return ENOMEM;
+
+		info->vp = NULL;
+		info->flags = FREAD;
+
+		fi->fh = (uint64_t) (uintptr_t) info;
+
+		fuse_reply_open(req, fi);
+		return 0;
+	}
+
+	zfsvfs_t *zfsvfs;
+	uint64_t obj;
+
+	int error = zfsfuse_getfs(req, ino, &zfsvfs, &obj);
+	if(error)
+		return error;
 
 	ZFS_ENTER(zfsvfs);
 
 	znode_t *znode;
 
-	int error = zfs_zget(zfsvfs, ino, &znode, B_TRUE);
+	error = zfs_zget(zfsvfs, obj, &znode, B_TRUE);
 	if(error) {
 		ZFS_EXIT(zfsvfs);
+		zfsfuse_putfs(req, zfsvfs);
 		/* If the inode we are trying to get was recently deleted
 		   dnode_hold_impl will return EEXIST instead of ENOENT */
 		return error == EEXIST ? ENOENT : error;
@@ -314,6 +627,7 @@ out:
 	if(error)
 		VN_RELE(vp);
 	ZFS_EXIT(zfsvfs);
+	zfsfuse_putfs(req, zfsvfs);
 
 	if(!error)
 		fuse_reply_open(req, fi);
@@ -323,24 +637,34 @@ out:
 
 static void zfsfuse_opendir_helper(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
+	hrtime_t start = gethrtime();
+
 	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
 
 	int error = zfsfuse_opendir(req, real_ino, fi);
 	if(error)
 		fuse_reply_err(req, error);
+
+	op_latency_record(LAT_FUSE_OPENDIR, start);
 }
 
 static int zfsfuse_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
-	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
-	zfsvfs_t *zfsvfs = vfs->vfs_data;
+	file_info_t *info = (file_info_t *)(uintptr_t) fi->fh;
 
-	ZFS_ENTER(zfsvfs);
+	if(info->vp == NULL) {
+		ASSERT(ZFSFUSE_CTLDIR(ino));
+		kmem_cache_free(file_info_cache, info);
+		return 0;
+	}
 
-	file_info_t *info = (file_info_t *)(uintptr_t) fi->fh;
-	ASSERT(info->vp != NULL);
 	ASSERT(VTOZ(info->vp) != NULL);
-	ASSERT(VTOZ(info->vp)->z_id == ino);
+	ASSERT(VTOZ(info->vp)->z_id == ZFSCTL_INO_OBJ(ino));
+
+	/* The vnode keeps its filesystem mounted, even a snapshot */
+	zfsvfs_t *zfsvfs = VTOZ(info->vp)->z_zfsvfs;
+
+	ZFS_ENTER(zfsvfs);
 
 	cred_t cred;
 	zfsfuse_getcred(req, &cred);
@@ -359,40 +683,52 @@ static int zfsfuse_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info
 
 static void zfsfuse_release_helper(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
+	hrtime_t start = gethrtime();
+
 	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
 
 	int error = zfsfuse_release(req, real_ino, fi);
 	/* Release events always reply_err */
 	fuse_reply_err(req, error);
+
+	op_latency_record(LAT_FUSE_RELEASE, start);
 }
 
 static int zfsfuse_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
 {
 	vnode_t *vp = ((file_info_t *)(uintptr_t) fi->fh)->vp;
-	ASSERT(vp != NULL);
+	if(vp == NULL)
+		return zfsfuse_ctldir_readdir(req, ino, size, off);
+
 	ASSERT(VTOZ(vp) != NULL);
-	ASSERT(VTOZ(vp)->z_id == ino);
+	ASSERT(VTOZ(vp)->z_id == ZFSCTL_INO_OBJ(ino));
 
 	if(vp->v_type != VDIR)
 		return ENOTDIR;
 
-	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
-	zfsvfs_t *zfsvfs = vfs->vfs_data;
+	zfsvfs_t *zfsvfs = VTOZ(vp)->z_zfsvfs;
 
 	char *outbuf = kmem_alloc(size, KM_NOSLEEP);
 	if(outbuf == NULL)
 		return ENOMEM;
 
+	/*
+	 * Read the entries in batches rather than one at a time, so that
+	 * zfs_readdir() only has to position its cursor once per batch and
+	 * can prefetch the znodes of the whole batch.
+	 */
+	size_t bufsize = MAX(size, DIRENT64_RECLEN(MAXNAMELEN));
+	char *dirbuf = kmem_alloc(bufsize, KM_NOSLEEP);
+	if(dirbuf == NULL) {
+		kmem_free(outbuf, size);
+		return ENOMEM;
+	}
+
 	ZFS_ENTER(zfsvfs);
 
 	cred_t cred;
 	zfsfuse_getcred(req, &cred);
 
-	union {
-		char buf[DIRENT64_RECLEN(MAXNAMELEN)];
-		struct dirent64 dirent;
-	} entry;
-
 	struct stat fstat = { 0 };
 
 	iovec_t iovec;
@@ -412,9 +748,9 @@ static int zfsfuse_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t of
 
 	int error;
 
-	for(;;) {
-		iovec.iov_base = entry.buf;
-		iovec.iov_len = sizeof(entry.buf);
+	while(!eofp) {
+		iovec.iov_base = dirbuf;
+		iovec.iov_len = bufsize;
 		uio.uio_resid = iovec.iov_len;
 		uio.uio_loffset = next;
 
@@ -423,21 +759,31 @@ static int zfsfuse_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t of
 			goto out;
 
 		/* No more directory entries */
-		if(iovec.iov_base == entry.buf)
+		if(iovec.iov_base == dirbuf)
 			break;
 
-		fstat.st_ino = entry.dirent.d_ino;
-		fstat.st_mode = 0;
+		/*
+		 * Entries that don't fit in the reply are simply read again
+		 * by the next call, starting from the offset of the last
+		 * entry that did.
+		 */
+		char *dp;
+		for(dp = dirbuf; dp < (char *) iovec.iov_base; dp += ((struct dirent64 *) dp)->d_reclen) {
+			struct dirent64 *dirent = (struct dirent64 *) dp;
 
-		int dsize = fuse_dirent_size(strlen(entry.dirent.d_name));
-		if(dsize > outbuf_resid)
-			break;
+			fstat.st_ino = dirent->d_ino;
+			fstat.st_mode = 0;
 
-		fuse_add_dirent(outbuf + outbuf_off, entry.dirent.d_name, &fstat, entry.dirent.d_off);
+			int dsize = fuse_dirent_size(strlen(dirent->d_name));
+			if(dsize > outbuf_resid)
+				goto out;
 
-		outbuf_off += dsize;
-		outbuf_resid -= dsize;
-		next = entry.dirent.d_off;
+			fuse_add_dirent(outbuf + outbuf_off, dirent->d_name, &fstat, dirent->d_off);
+
+			outbuf_off += dsize;
+			outbuf_resid -= dsize;
+			next = dirent->d_off;
+		}
 	}
 
 out:
@@ -446,6 +792,7 @@ out:
 	if(!error)
 		fuse_reply_buf(req, outbuf, outbuf_off);
 
+	kmem_free(dirbuf, bufsize);
 	kmem_free(outbuf, size);
 
 	return error;
@@ -453,11 +800,15 @@ out:
 
 static void zfsfuse_readdir_helper(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
 {
+	hrtime_t start = gethrtime();
+
 	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
 
 	int error = zfsfuse_readdir(req, real_ino, size, off, fi);
 	if(error)
 		fuse_reply_err(req, error);
+
+	op_latency_record(LAT_FUSE_READDIR, start);
 }
 
 static int zfsfuse_opencreate(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi, int fflags, mode_t createmode, const char *name)
@@ -465,8 +816,17 @@ static int zfsfuse_opencreate(fuse_req_t req, fuse_ino_t ino, struct fuse_file_i
 	if(name && strlen(name) >= MAXNAMELEN)
 		return ENAMETOOLONG;
 
-	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
-	zfsvfs_t *zfsvfs = vfs->vfs_data;
+	if(ZFSFUSE_READONLY(ino) && (fflags & (O_WRONLY | O_RDWR | O_CREAT | O_TRUNC)))
+		return EROFS;
+	if(ZFSFUSE_CTLDIR(ino))
+		return EISDIR;
+
+	zfsvfs_t *zfsvfs;
+	uint64_t obj;
+
+	int error = zfsfuse_getfs(req, ino, &zfsvfs, &obj);
+	if(error)
+		return error;
 
 	ZFS_ENTER(zfsvfs);
 
@@ -508,9 +868,10 @@ static int zfsfuse_opencreate(fuse_req_t req, fuse_ino_t ino, struct fuse_file_i
 
 	znode_t *znode;
 
-	int error = zfs_zget(zfsvfs, ino, &znode, B_FALSE);
+	error = zfs_zget(zfsvfs, obj, &znode, B_FALSE);
 	if(error) {
 		ZFS_EXIT(zfsvfs);
+		zfsfuse_putfs(req, zfsvfs);
 		/* If the inode we are trying to get was recently deleted
 		   dnode_hold_impl will return EEXIST instead of ENOENT */
 		return error == EEXIST ? ENOENT : error;
@@ -614,9 +975,7 @@ static int zfsfuse_opencreate(fuse_req_t req, fuse_ino_t ino, struct fuse_file_i
 	if(flags & FCREAT) {
 		e.attr_timeout = 0.0;
 		e.entry_timeout = 0.0;
-		e.ino = VTOZ(vp)->z_id;
-		if(e.ino == 3)
-			e.ino = 1;
+		e.ino = zfsfuse_ino(VTOZ(vp));
 		e.generation = VTOZ(vp)->z_phys->zp_gen;
 	}
 
@@ -627,6 +986,7 @@ out:
 	}
 
 	ZFS_EXIT(zfsvfs);
+	zfsfuse_putfs(req, zfsvfs);
 
 	if(!error) {
 		if(!(flags & FCREAT))
@@ -639,34 +999,50 @@ out:
 
 static void zfsfuse_open_helper(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
+	hrtime_t start = gethrtime();
+
 	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
 
 	int error = zfsfuse_opencreate(req, real_ino, fi, fi->flags, 0, NULL);
 	if(error)
 		fuse_reply_err(req, error);
+
+	op_latency_record(LAT_FUSE_OPEN, start);
 }
 
 static void zfsfuse_create_helper(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_file_info *fi)
 {
+	hrtime_t start = gethrtime();
+
 	fuse_ino_t real_parent = parent == 1 ? 3 : parent;
 
 	int error = zfsfuse_opencreate(req, real_parent, fi, fi->flags | O_CREAT, mode, name);
 	if(error)
 		fuse_reply_err(req, error);
+
+	op_latency_record(LAT_FUSE_CREATE, start);
 }
 
 static int zfsfuse_readlink(fuse_req_t req, fuse_ino_t ino)
 {
-	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
-	zfsvfs_t *zfsvfs = vfs->vfs_data;
+	if(ZFSFUSE_CTLDIR(ino))
+		return EINVAL;
+
+	zfsvfs_t *zfsvfs;
+	uint64_t obj;
+
+	int error = zfsfuse_getfs(req, ino, &zfsvfs, &obj);
+	if(error)
+		return error;
 
 	ZFS_ENTER(zfsvfs);
 
 	znode_t *znode;
 
-	int error = zfs_zget(zfsvfs, ino, &znode, B_FALSE);
+	error = zfs_zget(zfsvfs, obj, &znode, B_FALSE);
 	if(error) {
 		ZFS_EXIT(zfsvfs);
+		zfsfuse_putfs(req, zfsvfs);
 		/* If the inode we are trying to get was recently deleted
 		   dnode_hold_impl will return EEXIST instead of ENOENT */
 		return error == EEXIST ? ENOENT : error;
@@ -697,6 +1073,7 @@ static int zfsfuse_readlink(fuse_req_t req, fuse_ino_t ino)
 
 	VN_RELE(vp);
 	ZFS_EXIT(zfsvfs);
+	zfsfuse_putfs(req, zfsvfs);
 
 	if(!error) {
 		VERIFY(uio.uio_loffset < sizeof(buffer));
@@ -709,11 +1086,15 @@ static int zfsfuse_readlink(fuse_req_t req, fuse_ino_t ino)
 
 static void zfsfuse_readlink_helper(fuse_req_t req, fuse_ino_t ino)
 {
+	hrtime_t start = gethrtime();
+
 	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
 
 	int error = zfsfuse_readlink(req, real_ino);
 	if(error)
 		fuse_reply_err(req, error);
+
+	op_latency_record(LAT_FUSE_READLINK, start);
 }
 
 static int zfsfuse_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
@@ -723,10 +1104,9 @@ static int zfsfuse_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
 	vnode_t *vp = info->vp;
 	ASSERT(vp != NULL);
 	ASSERT(VTOZ(vp) != NULL);
-	ASSERT(VTOZ(vp)->z_id == ino);
+	ASSERT(VTOZ(vp)->z_id == ZFSCTL_INO_OBJ(ino));
 
-	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
-	zfsvfs_t *zfsvfs = vfs->vfs_data;
+	zfsvfs_t *zfsvfs = VTOZ(vp)->z_zfsvfs;
 
 	char *outbuf = kmem_alloc(size, KM_NOSLEEP);
 	if(outbuf == NULL)
@@ -764,17 +1144,23 @@ static int zfsfuse_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
 
 static void zfsfuse_read_helper(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
 {
+	hrtime_t start = gethrtime();
+
 	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
 
 	int error = zfsfuse_read(req, real_ino, size, off, fi);
 	if(error)
 		fuse_reply_err(req, error);
+
+	op_latency_record(LAT_FUSE_READ, start);
 }
 
 static int zfsfuse_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
 {
 	if(strlen(name) >= MAXNAMELEN)
 		return ENAMETOOLONG;
+	if(ZFSFUSE_READONLY(parent))
+		return EROFS;
 
 	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
 	zfsvfs_t *zfsvfs = vfs->vfs_data;
@@ -816,9 +1202,7 @@ static int zfsfuse_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mo
 	e.attr_timeout = 0.0;
 	e.entry_timeout = 0.0;
 
-	e.ino = VTOZ(vp)->z_id;
-	if(e.ino == 3)
-		e.ino = 1;
+	e.ino = zfsfuse_ino(VTOZ(vp));
 
 	e.generation = VTOZ(vp)->z_phys->zp_gen;
 
@@ -838,17 +1222,23 @@ out:
 
 static void zfsfuse_mkdir_helper(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
 {
+	hrtime_t start = gethrtime();
+
 	fuse_ino_t real_parent = parent == 1 ? 3 : parent;
 
 	int error = zfsfuse_mkdir(req, real_parent, name, mode);
 	if(error)
 		fuse_reply_err(req, error);
+
+	op_latency_record(LAT_FUSE_MKDIR, start);
 }
 
 static int zfsfuse_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
 {
 	if(strlen(name) >= MAXNAMELEN)
 		return ENAMETOOLONG;
+	if(ZFSFUSE_READONLY(parent))
+		return EROFS;
 
 	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
 	zfsvfs_t *zfsvfs = vfs->vfs_data;
@@ -888,15 +1278,22 @@ static int zfsfuse_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
 
 static void zfsfuse_rmdir_helper(fuse_req_t req, fuse_ino_t parent, const char *name)
 {
+	hrtime_t start = gethrtime();
+
 	fuse_ino_t real_parent = parent == 1 ? 3 : parent;
 
 	int error = zfsfuse_rmdir(req, real_parent, name);
 	/* rmdir events always reply_err */
 	fuse_reply_err(req, error);
+
+	op_latency_record(LAT_FUSE_RMDIR, start);
 }
 
 static int zfsfuse_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *fi)
 {
+	if(ZFSFUSE_READONLY(ino))
+		return EROFS;
+
 	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
 	zfsvfs_t *zfsvfs = vfs->vfs_data;
 
@@ -1017,17 +1414,23 @@ out: ;
 
 static void zfsfuse_setattr_helper(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *fi)
 {
+	hrtime_t start = gethrtime();
+
 	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
 
 	int error = zfsfuse_setattr(req, real_ino, attr, to_set, fi);
 	if(error)
 		fuse_reply_err(req, error);
+
+	op_latency_record(LAT_FUSE_SETATTR, start);
 }
 
 static int zfsfuse_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
 {
 	if(strlen(name) >= MAXNAMELEN)
 		return ENAMETOOLONG;
+	if(ZFSFUSE_READONLY(parent))
+		return EROFS;
 
 	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
 	zfsvfs_t *zfsvfs = vfs->vfs_data;
@@ -1061,11 +1464,15 @@ static int zfsfuse_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
 
 static void zfsfuse_unlink_helper(fuse_req_t req, fuse_ino_t parent, const char *name)
 {
+	hrtime_t start = gethrtime();
+
 	fuse_ino_t real_parent = parent == 1 ? 3 : parent;
 
 	int error = zfsfuse_unlink(req, real_parent, name);
 	/* unlink events always reply_err */
 	fuse_reply_err(req, error);
+
+	op_latency_record(LAT_FUSE_UNLINK, start);
 }
 
 static int zfsfuse_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off, struct fuse_file_info *fi)
@@ -1113,17 +1520,23 @@ static int zfsfuse_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t
 
 static void zfsfuse_write_helper(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off, struct fuse_file_info *fi)
 {
+	hrtime_t start = gethrtime();
+
 	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
 
 	int error = zfsfuse_write(req, real_ino, buf, size, off, fi);
 	if(error)
 		fuse_reply_err(req, error);
+
+	op_latency_record(LAT_FUSE_WRITE, start);
 }
 
 static int zfsfuse_mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, dev_t rdev)
 {
 	if(strlen(name) >= MAXNAMELEN)
 		return ENAMETOOLONG;
+	if(ZFSFUSE_READONLY(parent))
+		return EROFS;
 
 	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
 	zfsvfs_t *zfsvfs = vfs->vfs_data;
@@ -1174,9 +1587,7 @@ static int zfsfuse_mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mo
 	e.attr_timeout = 0.0;
 	e.entry_timeout = 0.0;
 
-	e.ino = VTOZ(vp)->z_id;
-	if(e.ino == 3)
-		e.ino = 1;
+	e.ino = zfsfuse_ino(VTOZ(vp));
 
 	e.generation = VTOZ(vp)->z_phys->zp_gen;
 
@@ -1195,17 +1606,23 @@ out:
 
 static void zfsfuse_mknod_helper(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, dev_t rdev)
 {
+	hrtime_t start = gethrtime();
+
 	fuse_ino_t real_parent = parent == 1 ? 3 : parent;
 
 	int error = zfsfuse_mknod(req, real_parent, name, mode, rdev);
 	if(error)
 		fuse_reply_err(req, error);
+
+	op_latency_record(LAT_FUSE_MKNOD, start);
 }
 
 static int zfsfuse_symlink(fuse_req_t req, const char *link, fuse_ino_t parent, const char *name)
 {
 	if(strlen(name) >= MAXNAMELEN)
 		return ENAMETOOLONG;
+	if(ZFSFUSE_READONLY(parent))
+		return EROFS;
 
 	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
 	zfsvfs_t *zfsvfs = vfs->vfs_data;
@@ -1252,9 +1669,7 @@ static int zfsfuse_symlink(fuse_req_t req, const char *link, fuse_ino_t parent,
 	e.attr_timeout = 0.0;
 	e.entry_timeout = 0.0;
 
-	e.ino = VTOZ(vp)->z_id;
-	if(e.ino == 3)
-		e.ino = 1;
+	e.ino = zfsfuse_ino(VTOZ(vp));
 
 	e.generation = VTOZ(vp)->z_phys->zp_gen;
 
@@ -1275,11 +1690,15 @@ out:
 
 static void zfsfuse_symlink_helper(fuse_req_t req, const char *link, fuse_ino_t parent, const char *name)
 {
+	hrtime_t start = gethrtime();
+
 	fuse_ino_t real_parent = parent == 1 ? 3 : parent;
 
 	int error = zfsfuse_symlink(req, link, real_parent, name);
 	if(error)
 		fuse_reply_err(req, error);
+
+	op_latency_record(LAT_FUSE_SYMLINK, start);
 }
 
 static int zfsfuse_rename(fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent, const char *newname)
@@ -1288,6 +1707,8 @@ static int zfsfuse_rename(fuse_req_t req, fuse_ino_t parent, const char *name, f
 		return ENAMETOOLONG;
 	if(strlen(newname) >= MAXNAMELEN)
 		return ENAMETOOLONG;
+	if(ZFSFUSE_READONLY(parent) || ZFSFUSE_READONLY(newparent))
+		return EROFS;
 
 	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
 	zfsvfs_t *zfsvfs = vfs->vfs_data;
@@ -1337,6 +1758,8 @@ static int zfsfuse_rename(fuse_req_t req, fuse_ino_t parent, const char *name, f
 
 static void zfsfuse_rename_helper(fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent, const char *newname)
 {
+	hrtime_t start = gethrtime();
+
 	fuse_ino_t real_parent = parent == 1 ? 3 : parent;
 	fuse_ino_t real_newparent = newparent == 1 ? 3 : newparent;
 
@@ -1344,10 +1767,16 @@ static void zfsfuse_rename_helper(fuse_req_t req, fuse_ino_t parent, const char
 
 	/* rename events always reply_err */
 	fuse_reply_err(req, error);
+
+	op_latency_record(LAT_FUSE_RENAME, start);
 }
 
 static int zfsfuse_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
 {
+	/* Nothing to write out */
+	if(ZFSFUSE_READONLY(ino))
+		return 0;
+
 	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
 	zfsvfs_t *zfsvfs = vfs->vfs_data;
 
@@ -1372,18 +1801,24 @@ static int zfsfuse_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fu
 
 static void zfsfuse_fsync_helper(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
 {
+	hrtime_t start = gethrtime();
+
 	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
 
 	int error = zfsfuse_fsync(req, real_ino, datasync, fi);
 
 	/* fsync events always reply_err */
 	fuse_reply_err(req, error);
+
+	op_latency_record(LAT_FUSE_FSYNC, start);
 }
 
 static int zfsfuse_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent, const char *newname)
 {
 	if(strlen(newname) >= MAXNAMELEN)
 		return ENAMETOOLONG;
+	if(ZFSFUSE_READONLY(ino) || ZFSFUSE_READONLY(newparent))
+		return EROFS;
 
 	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
 	zfsvfs_t *zfsvfs = vfs->vfs_data;
@@ -1437,9 +1872,7 @@ static int zfsfuse_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent, co
 	e.attr_timeout = 0.0;
 	e.entry_timeout = 0.0;
 
-	e.ino = VTOZ(vp)->z_id;
-	if(e.ino == 3)
-		e.ino = 1;
+	e.ino = zfsfuse_ino(VTOZ(vp));
 
 	e.generation = VTOZ(vp)->z_phys->zp_gen;
 
@@ -1461,26 +1894,38 @@ out:
 
 static void zfsfuse_link_helper(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent, const char *newname)
 {
+	hrtime_t start = gethrtime();
+
 	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
 	fuse_ino_t real_newparent = newparent == 1 ? 3 : newparent;
 
 	int error = zfsfuse_link(req, real_ino, real_newparent, newname);
 	if(error)
 		fuse_reply_err(req, error);
+
+	op_latency_record(LAT_FUSE_LINK, start);
 }
 
 static int zfsfuse_access(fuse_req_t req, fuse_ino_t ino, int mask)
 {
-	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
-	zfsvfs_t *zfsvfs = vfs->vfs_data;
+	if(ZFSFUSE_CTLDIR(ino))
+		return (mask & W_OK) ? EROFS : 0;
+
+	zfsvfs_t *zfsvfs;
+	uint64_t obj;
+
+	int error = zfsfuse_getfs(req, ino, &zfsvfs, &obj);
+	if(error)
+		return error;
 
 	ZFS_ENTER(zfsvfs);
 
 	znode_t *znode;
 
-	int error = zfs_zget(zfsvfs, ino, &znode, B_TRUE);
+	error = zfs_zget(zfsvfs, obj, &znode, B_TRUE);
 	if(error) {
 		ZFS_EXIT(zfsvfs);
+		zfsfuse_putfs(req, zfsvfs);
 		/* If the inode we are trying to get was recently deleted
 		   dnode_hold_impl will return EEXIST instead of ENOENT */
 		return error == EEXIST ? ENOENT : error;
@@ -1506,18 +1951,23 @@ static int zfsfuse_access(fuse_req_t req, fuse_ino_t ino, int mask)
 	VN_RELE(vp);
 
 	ZFS_EXIT(zfsvfs);
+	zfsfuse_putfs(req, zfsvfs);
 
 	return error;
 }
 
 static void zfsfuse_access_helper(fuse_req_t req, fuse_ino_t ino, int mask)
 {
+	hrtime_t start = gethrtime();
+
 	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
 
 	int error = zfsfuse_access(req, real_ino, mask);
 
 	/* access events always reply_err */
 	fuse_reply_err(req, error);
+
+	op_latency_record(LAT_FUSE_ACCESS, start);
 }
 
 struct fuse_lowlevel_ops zfs_operations =
@@ -1544,6 +1994,6 @@ struct fuse_lowlevel_ops zfs_operations =
 	.fsync      = zfsfuse_fsync_helper,
 	.fsyncdir   = zfsfuse_fsync_helper,
 	.access     = zfsfuse_access_helper,
-	.statfs     = zfsfuse_statfs,
+	.statfs     = zfsfuse_statfs_helper,
 	.destroy    = zfsfuse_destroy,
 };
@@ -62,6 +62,7 @@
 #include <sys/dnlc.h>
 #include <sys/dmu_objset.h>
 #include <sys/spa_boot.h>
+#include "zfs_namecheck.h"
 
 #include "util.h"
 
@@ -768,9 +769,8 @@ zfs_domount(vfs_t *vfsp, char *osname, cred_t *cr)
 		error = zfsvfs_setup(zfsvfs, B_TRUE);
 	}
 
-	/* ZFSFUSE: FIXME
 	if (!zfsvfs->z_issnap)
-		zfsctl_create(zfsvfs);*/
+		zfsctl_create(zfsvfs);
 out:
 	if (error) {
 		if (zfsvfs->z_os)
@@ -1300,13 +1300,10 @@ zfs_umount(vfs_t *vfsp, int fflag, cred_t *cr)
 	 * Unmount any snapshots mounted under .zfs before unmounting the
 	 * dataset itself.
 	 */
-	/* ZFSFUSE: FIXME */
-#if 0
-	if (zfsvfs->z_ctldir != NULL &&
+	if (!zfsvfs->z_issnap &&
 	    (ret = zfsctl_umount_snapshots(vfsp, fflag, cr)) != 0) {
 		return (ret);
 	}
-#endif
 
 	if (!(fflag & MS_FORCE)) {
 		/*
@@ -1355,10 +1352,8 @@ zfs_umount(vfs_t *vfsp, int fflag, cred_t *cr)
 	/*
 	 * We can now safely destroy the '.zfs' directory node.
 	 */
-#if 0
-	if (zfsvfs->z_ctldir != NULL)
+	if (!zfsvfs->z_issnap)
 		zfsctl_destroy(zfsvfs);
-#endif
 
 	return (0);
 }
@@ -1579,14 +1574,459 @@ zfs_vfsinit(int fstype, char *name)
 	return (0);
 }
 
+/*
+ * ZFSFUSE: .zfs/snapshot
+ *
+ * zfs_operations.c implements the .zfs and .zfs/snapshot directories.
+ * Every snapshot looked up under .zfs/snapshot gets an entry in the
+ * z_snapshots list of its filesystem, with a slot number that goes into
+ * the inode numbers of its files.  The snapshot is mounted read-only when
+ * one of its files is accessed, and zfsctl_reaper() unmounts it again once
+ * it has been idle for zfsctl_snapshot_timeout seconds.
+ *
+ * When the snapshot is destroyed or renamed its entry goes stale: the inode
+ * numbers the kernel has cached for it get ESTALE, and the name can be looked
+ * up again into a new slot.  Stale slots are only given out again once all
+ * the others have been used, oldest first.  Entries are freed when the
+ * filesystem is unmounted.
+ */
+typedef struct zfsctl_snap {
+	list_node_t	zs_node;
+	char		zs_name[MAXNAMELEN];
+	uint64_t	zs_slot;
+	uint64_t	zs_objsetid;	/* which snapshot zs_name was */
+	boolean_t	zs_stale;	/* destroyed or renamed */
+	boolean_t	zs_mounting;	/* zfsctl_snapshot_hold() is mounting */
+	vfs_t		*zs_vfs;	/* NULL while unmounted */
+	int		zs_holds;	/* requests using zs_vfs */
+	clock_t		zs_last;	/* lbolt of the last rele, or going stale */
+} zfsctl_snap_t;
+
+int zfsctl_snapshot_timeout = 300;	/* seconds */
+
+static kmutex_t zfsctl_lock;		/* protects zfsctl_fs_list */
+static kcondvar_t zfsctl_cv;
+static list_t zfsctl_fs_list;		/* filesystems with a .zfs */
+static uint8_t zfsctl_thread_exit;
+
+void
+zfsctl_create(zfsvfs_t *zfsvfs)
+{
+	mutex_init(&zfsvfs->z_snap_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&zfsvfs->z_snap_cv, NULL, CV_DEFAULT, NULL);
+	list_create(&zfsvfs->z_snapshots, sizeof (zfsctl_snap_t),
+	    offsetof(zfsctl_snap_t, zs_node));
+	zfsvfs->z_snap_next = 1;
+
+	mutex_enter(&zfsctl_lock);
+	list_insert_tail(&zfsctl_fs_list, zfsvfs);
+	mutex_exit(&zfsctl_lock);
+}
+
+/*
+ * Called once zfsctl_umount_snapshots() has unmounted all the snapshots.
+ */
+void
+zfsctl_destroy(zfsvfs_t *zfsvfs)
+{
+	zfsctl_snap_t *zs;
+
+	mutex_enter(&zfsctl_lock);
+	list_remove(&zfsctl_fs_list, zfsvfs);
+	mutex_exit(&zfsctl_lock);
+
+	while ((zs = list_head(&zfsvfs->z_snapshots)) != NULL) {
+		ASSERT(zs->zs_vfs == NULL);
+		list_remove(&zfsvfs->z_snapshots, zs);
+		kmem_free(zs, sizeof (zfsctl_snap_t));
+	}
+	list_destroy(&zfsvfs->z_snapshots);
+	cv_destroy(&zfsvfs->z_snap_cv);
+	mutex_destroy(&zfsvfs->z_snap_lock);
+}
+
+static int
+zfsctl_snapshot_name(zfsvfs_t *zfsvfs, const char *name, char *buf)
+{
+	dmu_objset_name(zfsvfs->z_os, buf);
+	if (strlen(buf) + 1 + strlen(name) >= MAXNAMELEN)
+		return (ENAMETOOLONG);
+	(void) strcat(buf, "@");
+	(void) strcat(buf, name);
+	return (0);
+}
+
+static zfsctl_snap_t *
+zfsctl_snapshot_find(zfsvfs_t *zfsvfs, uint64_t slot)
+{
+	zfsctl_snap_t *zs;
+
+	ASSERT(MUTEX_HELD(&zfsvfs->z_snap_lock));
+
+	for (zs = list_head(&zfsvfs->z_snapshots); zs != NULL;
+	    zs = list_next(&zfsvfs->z_snapshots, zs)) {
+		if (zs->zs_slot == slot)
+			return (zs);
+	}
+	return (NULL);
+}
+
+static void
+zfsctl_snapshot_stale(zfsctl_snap_t *zs)
+{
+	ASSERT(zs->zs_vfs == NULL && zs->zs_holds == 0);
+
+	zs->zs_stale = B_TRUE;
+	zs->zs_last = lbolt;
+}
+
+/*
+ * Find the slot of the snapshot called 'name', giving it one if this is
+ * the first time it is looked up.
+ */
+int
+zfsctl_snapshot_lookup(zfsvfs_t *zfsvfs, const char *name, uint64_t *slotp)
+{
+	char snapname[MAXNAMELEN];
+	zfsctl_snap_t *zs, *reuse = NULL;
+	objset_t *os;
+	int error;
+
+	if ((error = zfsctl_snapshot_name(zfsvfs, name, snapname)) != 0)
+		return (error);
+	if (snapshot_namecheck(name, NULL, NULL) != 0)
+		return (ENOENT);
+
+	mutex_enter(&zfsvfs->z_snap_lock);
+	for (zs = list_head(&zfsvfs->z_snapshots); zs != NULL;
+	    zs = list_next(&zfsvfs->z_snapshots, zs)) {
+		if (!zs->zs_stale && strcmp(zs->zs_name, name) == 0) {
+			*slotp = zs->zs_slot;
+			mutex_exit(&zfsvfs->z_snap_lock);
+			return (0);
+		}
+		if (zs->zs_stale && zs->zs_holds == 0 && !zs->zs_mounting &&
+		    (reuse == NULL || zs->zs_last - reuse->zs_last < 0))
+			reuse = zs;
+	}
+
+	if (zfsvfs->z_snap_next > ZFSCTL_MAX_SLOT && reuse == NULL) {
+		mutex_exit(&zfsvfs->z_snap_lock);
+		return (ENFILE);
+	}
+
+	/* Don't keep entries for names that don't exist */
+	error = dmu_objset_open(snapname, DMU_OST_ZFS,
+	    DS_MODE_STANDARD | DS_MODE_READONLY, &os);
+	if (error) {
+		mutex_exit(&zfsvfs->z_snap_lock);
+		return (error);
+	}
+
+	if (zfsvfs->z_snap_next <= ZFSCTL_MAX_SLOT) {
+		zs = kmem_zalloc(sizeof (zfsctl_snap_t), KM_SLEEP);
+		zs->zs_slot = zfsvfs->z_snap_next++;
+		list_insert_tail(&zfsvfs->z_snapshots, zs);
+	} else {
+		zs = reuse;
+		ASSERT(zs->zs_vfs == NULL);
+		zs->zs_stale = B_FALSE;
+	}
+	(void) strcpy(zs->zs_name, name);
+	zs->zs_objsetid = dmu_objset_id(os);
+	dmu_objset_close(os);
+
+	*slotp = zs->zs_slot;
+	mutex_exit(&zfsvfs->z_snap_lock);
+
+	return (0);
+}
+
+/*
+ * Mount the snapshot 'name' of zfsvfs, provided that it still is the
+ * snapshot with the given objset id.
+ */
+static int
+zfsctl_snapshot_mount(zfsvfs_t *zfsvfs, const char *name, uint64_t objsetid,
+    vfs_t **vfspp)
+{
+	char snapname[MAXNAMELEN];
+	vfs_t *vfsp;
+	int error;
+
+	ASSERT(!MUTEX_HELD(&zfsvfs->z_snap_lock));
+
+	vfsp = kmem_zalloc(sizeof (vfs_t), KM_SLEEP);
+	VFS_INIT(vfsp, zfs_vfsops, NULL);
+	VFS_HOLD(vfsp);
+
+	if ((error = zfsctl_snapshot_name(zfsvfs, name, snapname)) ||
+	    (error = zfs_domount(vfsp, snapname, kcred))) {
+		kmem_free(vfsp, sizeof (vfs_t));
+		return (error == ENOENT ? ESTALE : error);
+	}
+
+	if (dmu_objset_id(((zfsvfs_t *)vfsp->vfs_data)->z_os) != objsetid) {
+		(void) VFS_UNMOUNT(vfsp, MS_FORCE, kcred);
+		VFS_RELE(vfsp);
+		return (ESTALE);
+	}
+
+	*vfspp = vfsp;
+	return (0);
+}
+
+static int
+zfsctl_snapshot_umount(zfsctl_snap_t *zs, int fflag)
+{
+	int error;
+
+	if (zs->zs_mounting)
+		return (EBUSY);
+	if (zs->zs_vfs == NULL)
+		return (0);
+	if (zs->zs_holds != 0)
+		return (EBUSY);
+
+	if ((error = VFS_UNMOUNT(zs->zs_vfs, fflag, kcred)) != 0)
+		return (error);
+
+	VFS_RELE(zs->zs_vfs);
+	zs->zs_vfs = NULL;
+
+	return (0);
+}
+
+/*
+ * Get the snapshot in 'slot', mounting it if needed.  It stays mounted
+ * until zfsctl_snapshot_rele().  The mount is done without z_snap_lock,
+ * so that lookups in the other snapshots don't wait for it; zs_mounting
+ * keeps anyone else from mounting or unmounting the snapshot meanwhile.
+ */
+int
+zfsctl_snapshot_hold(zfsvfs_t *zfsvfs, uint64_t slot, zfsvfs_t **snapp)
+{
+	char name[MAXNAMELEN];
+	zfsctl_snap_t *zs;
+	uint64_t objsetid;
+	vfs_t *vfsp;
+	int error = 0;
+
+	mutex_enter(&zfsvfs->z_snap_lock);
+	for (;;) {
+		zs = zfsctl_snapshot_find(zfsvfs, slot);
+		if (zs == NULL || zs->zs_stale) {
+			error = ESTALE;
+			break;
+		}
+		if (zs->zs_vfs != NULL)
+			break;
+		if (zs->zs_mounting) {
+			cv_wait(&zfsvfs->z_snap_cv, &zfsvfs->z_snap_lock);
+			continue;
+		}
+
+		zs->zs_mounting = B_TRUE;
+		(void) strcpy(name, zs->zs_name);
+		objsetid = zs->zs_objsetid;
+		mutex_exit(&zfsvfs->z_snap_lock);
+
+		error = zfsctl_snapshot_mount(zfsvfs, name, objsetid, &vfsp);
+
+		mutex_enter(&zfsvfs->z_snap_lock);
+		zs->zs_mounting = B_FALSE;
+		cv_broadcast(&zfsvfs->z_snap_cv);
+		if (error == ESTALE)
+			zfsctl_snapshot_stale(zs);
+		if (error)
+			break;
+
+		((zfsvfs_t *)vfsp->vfs_data)->z_snap_slot = zs->zs_slot;
+		zs->zs_vfs = vfsp;
+		break;
+	}
+
+	if (!error) {
+		zs->zs_holds++;
+		*snapp = zs->zs_vfs->vfs_data;
+	}
+	mutex_exit(&zfsvfs->z_snap_lock);
+
+	return (error);
+}
+
+void
+zfsctl_snapshot_rele(zfsvfs_t *zfsvfs, zfsvfs_t *snap)
+{
+	zfsctl_snap_t *zs;
+
+	mutex_enter(&zfsvfs->z_snap_lock);
+	zs = zfsctl_snapshot_find(zfsvfs, snap->z_snap_slot);
+	ASSERT(zs != NULL && zs->zs_vfs == snap->z_vfs);
+	ASSERT(zs->zs_holds > 0);
+	zs->zs_holds--;
+	zs->zs_last = lbolt;
+	mutex_exit(&zfsvfs->z_snap_lock);
+}
+
+int
+zfsctl_umount_snapshots(vfs_t *vfsp, int fflag, cred_t *cr)
+{
+	zfsvfs_t *zfsvfs = vfsp->vfs_data;
+	zfsctl_snap_t *zs;
+	int error = 0;
+
+	mutex_enter(&zfsvfs->z_snap_lock);
+	for (zs = list_head(&zfsvfs->z_snapshots); zs != NULL && error == 0;
+	    zs = list_next(&zfsvfs->z_snapshots, zs))
+		error = zfsctl_snapshot_umount(zs, fflag);
+	mutex_exit(&zfsvfs->z_snap_lock);
+
+	return (error);
+}
+
+/*
+ * Unmount the snapshot 'snapname' before it is destroyed or renamed, and
+ * make its entries stale.  Unlike on Solaris this is never forced: files
+ * that are open in the snapshot hold its vnodes, so it is busy until they
+ * are closed.  Only the filesystem the snapshot is of can have it under
+ * .zfs/snapshot; objset ids are only unique within a pool.
+ */
+/* ARGSUSED */
+int
+zfsctl_destroy_snapshot(const char *snapname, int force)
+{
+	char fsname[MAXNAMELEN], osname[MAXNAMELEN];
+	zfsvfs_t *zfsvfs;
+	zfsctl_snap_t *zs;
+	objset_t *os;
+	uint64_t objsetid;
+	char *cp;
+	int error = 0;
+
+	(void) strlcpy(fsname, snapname, sizeof (fsname));
+	if ((cp = strchr(fsname, '@')) == NULL)
+		return (0);
+	*cp = '\0';
+
+	if (dmu_objset_open(snapname, DMU_OST_ANY,
+	    DS_MODE_STANDARD | DS_MODE_READONLY, &os) != 0)
+		return (0);
+	objsetid = dmu_objset_id(os);
+	dmu_objset_close(os);
+
+	mutex_enter(&zfsctl_lock);
+	for (zfsvfs = list_head(&zfsctl_fs_list); zfsvfs != NULL;
+	    zfsvfs = list_next(&zfsctl_fs_list, zfsvfs)) {
+		dmu_objset_name(zfsvfs->z_os, osname);
+		if (strcmp(osname, fsname) != 0)
+			continue;
+
+		mutex_enter(&zfsvfs->z_snap_lock);
+		zs = list_head(&zfsvfs->z_snapshots);
+		while (zs != NULL) {
+			/*
+			 * The wait drops z_snap_lock, and the list may
+			 * change under us; start over once it's done.
+			 */
+			if (zs->zs_mounting) {
+				cv_wait(&zfsvfs->z_snap_cv,
+				    &zfsvfs->z_snap_lock);
+				zs = list_head(&zfsvfs->z_snapshots);
+				continue;
+			}
+			if (!zs->zs_stale && zs->zs_objsetid == objsetid) {
+				error = zfsctl_snapshot_umount(zs, 0);
+				if (error != 0)
+					break;
+				zfsctl_snapshot_stale(zs);
+			}
+			zs = list_next(&zfsvfs->z_snapshots, zs);
+		}
+		mutex_exit(&zfsvfs->z_snap_lock);
+		if (error)
+			break;
+	}
+	mutex_exit(&zfsctl_lock);
+
+	return (error);
+}
+
+/*
+ * Unmount the snapshots that haven't been used for a while.  Ones that
+ * still have open files are busy and are tried again later.
+ */
+static void
+zfsctl_reaper(void)
+{
+	zfsvfs_t *zfsvfs;
+	zfsctl_snap_t *zs;
+
+	mutex_enter(&zfsctl_lock);
+	while (zfsctl_thread_exit == 0) {
+		clock_t now = lbolt;
+
+		for (zfsvfs = list_head(&zfsctl_fs_list); zfsvfs != NULL;
+		    zfsvfs = list_next(&zfsctl_fs_list, zfsvfs)) {
+			mutex_enter(&zfsvfs->z_snap_lock);
+			for (zs = list_head(&zfsvfs->z_snapshots); zs != NULL;
+			    zs = list_next(&zfsvfs->z_snapshots, zs)) {
+				if (zs->zs_vfs == NULL || zs->zs_holds != 0 ||
+				    now - zs->zs_last <
+				    (clock_t)zfsctl_snapshot_timeout * hz)
+					continue;
+				if (zfsctl_snapshot_umount(zs, 0) != 0)
+					zs->zs_last = now;
+			}
+			mutex_exit(&zfsvfs->z_snap_lock);
+		}
+
+		(void) cv_timedwait(&zfsctl_cv, &zfsctl_lock,
+		    lbolt + MAX(zfsctl_snapshot_timeout / 4, 1) * hz);
+	}
+
+	zfsctl_thread_exit = 0;
+	cv_broadcast(&zfsctl_cv);
+	mutex_exit(&zfsctl_lock);
+	thread_exit();
+}
+
+void
+zfsctl_init(void)
+{
+	mutex_init(&zfsctl_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&zfsctl_cv, NULL, CV_DEFAULT, NULL);
+	list_create(&zfsctl_fs_list, sizeof (zfsvfs_t),
+	    offsetof(zfsvfs_t, z_ctl_node));
+
+	zfsctl_thread_exit = 0;
+	(void) thread_create(NULL, 0, zfsctl_reaper, NULL, 0, &p0,
+	    TS_RUN, minclsyspri);
+}
+
+void
+zfsctl_fini(void)
+{
+	mutex_enter(&zfsctl_lock);
+	zfsctl_thread_exit = 1;
+	cv_broadcast(&zfsctl_cv);
+	while (zfsctl_thread_exit != 0)
+		cv_wait(&zfsctl_cv, &zfsctl_lock);
+	mutex_exit(&zfsctl_lock);
+
+	ASSERT(list_is_empty(&zfsctl_fs_list));
+	list_destroy(&zfsctl_fs_list);
+	cv_destroy(&zfsctl_cv);
+	mutex_destroy(&zfsctl_lock);
+}
+
 void
 zfs_init(void)
 {
 	/*
 	 * Initialize .zfs directory structures
 	 */
-	/* ZFSFUSE: TODO */
-	/* zfsctl_init(); */
+	zfsctl_init();
 
 	/*
 	 * Initialize znode cache, vnode ops, etc...
@@ -1597,8 +2037,7 @@ zfs_init(void)
 void
 zfs_fini(void)
 {
-	/* ZFSFUSE: TODO */
-	/* zfsctl_fini(); */
+	zfsctl_fini();
 	zfs_znode_fini();
 }
 
@@ -57,9 +57,11 @@
 #include <sys/zfs_ioctl.h>
 #include <sys/fs/zfs.h>
 #include <sys/dmu.h>
+#include <sys/dmu_objset.h>
 #include <sys/spa.h>
 #include <sys/txg.h>
 #include <sys/dbuf.h>
+#include <sys/dnode.h>
 #include <sys/zap.h>
 #include <sys/dirent.h>
 #include <sys/policy.h>
@@ -118,7 +120,8 @@
  *	forever, because the previous txg can't quiesce until B's tx commits.
  *
  *	If dmu_tx_assign() returns ERESTART and zfsvfs->z_assign is TXG_NOWAIT,
- *	then drop all locks, call dmu_tx_wait(), and try again.
+ *	then drop all locks, call dmu_tx_wait(), and try again with
+ *	TXG_WAITED, so that the write throttle doesn't delay the retry again.
  *
  *  (5)	If the operation succeeded, generate the intent log entry for it
  *	before dropping locks.  This ensures that the ordering of events
@@ -133,12 +136,14 @@
  * In general, this is how things should be ordered in each vnode op:
  *
  *	ZFS_ENTER(zfsvfs);		// exit if unmounted
+ *	waited = B_FALSE;		// not delayed yet
  * top:
  *	zfs_dirent_lock(&dl, ...)	// lock directory entry (may VN_HOLD())
  *	rw_enter(...);			// grab any other locks you need
  *	tx = dmu_tx_create(...);	// get DMU tx
  *	dmu_tx_hold_*();		// hold each object you might modify
- *	error = dmu_tx_assign(tx, zfsvfs->z_assign);	// try to assign
+ *	error = dmu_tx_assign(tx,	// try to assign
+ *	    waited ? TXG_WAITED : zfsvfs->z_assign);
  *	if (error) {
  *		rw_exit(...);		// drop locks
  *		zfs_dirent_unlock(dl);	// unlock directory entry
@@ -146,6 +151,7 @@
  *		if (error == ERESTART && zfsvfs->z_assign == TXG_NOWAIT) {
  *			dmu_tx_wait(tx);
  *			dmu_tx_abort(tx);
+ *			waited = B_TRUE;
  *			goto top;
  *		}
  *		dmu_tx_abort(tx);	// abort DMU tx
@@ -164,6 +170,18 @@
  *	return (error);			// done, report error
  */
 
+/*
+ * Commit the ZIL at the end of an operation that changed the namespace or
+ * metadata, if the dataset has sync=always.  Such an operation may have
+ * logged records for more than one object, so commit them all.
+ */
+static void
+zfs_sync_always(zfsvfs_t *zfsvfs)
+{
+	if (zfsvfs->z_os->os->os_sync == ZFS_SYNC_ALWAYS)
+		zil_commit(zfsvfs->z_log, UINT64_MAX, 0);
+}
+
 /* ARGSUSED */
 static int
 zfs_open(vnode_t **vpp, int flag, cred_t *cr, caller_context_t *ct)
@@ -630,6 +648,7 @@ zfs_write(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 	ssize_t		tx_bytes;
 	uint64_t	end_size;
 	dmu_tx_t	*tx;
+	boolean_t	waited = B_FALSE;
 	zfsvfs_t	*zfsvfs = zp->z_zfsvfs;
 	zilog_t		*zilog;
 	offset_t	woff;
@@ -738,17 +757,20 @@ zfs_write(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 		tx = dmu_tx_create(zfsvfs->z_os);
 		dmu_tx_hold_bonus(tx, zp->z_id);
 		dmu_tx_hold_write(tx, zp->z_id, woff, MIN(n, max_blksz));
-		error = dmu_tx_assign(tx, zfsvfs->z_assign);
+		error = dmu_tx_assign(tx,
+		    waited ? TXG_WAITED : zfsvfs->z_assign);
 		if (error) {
 			if (error == ERESTART &&
 			    zfsvfs->z_assign == TXG_NOWAIT) {
 				dmu_tx_wait(tx);
 				dmu_tx_abort(tx);
+				waited = B_TRUE;
 				continue;
 			}
 			dmu_tx_abort(tx);
 			break;
 		}
+		waited = B_FALSE;	/* each chunk is throttled anew */
 
 		/*
 		 * If zfs_range_lock() over-locked we grow the blocksize
@@ -852,7 +874,8 @@ zfs_write(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 		return (error);
 	}
 
-	if (ioflag & (FSYNC | FDSYNC))
+	if (ioflag & (FSYNC | FDSYNC) ||
+	    zfsvfs->z_os->os->os_sync == ZFS_SYNC_ALWAYS)
 		zil_commit(zilog, zp->z_last_itx, zp->z_id);
 
 	ZFS_EXIT(zfsvfs);
@@ -1153,6 +1176,7 @@ zfs_create(vnode_t *dvp, char *name, vattr_t *vap, vcexcl_t excl,
 	objset_t	*os;
 	zfs_dirlock_t	*dl;
 	dmu_tx_t	*tx;
+	boolean_t	waited = B_FALSE;
 	int		error;
 	zfs_acl_t	*aclp = NULL;
 	zfs_fuid_info_t *fuidp = NULL;
@@ -1270,13 +1294,15 @@ top:
 			dmu_tx_hold_write(tx, DMU_NEW_OBJECT,
 			    0, SPA_MAXBLOCKSIZE);
 		}
-		error = dmu_tx_assign(tx, zfsvfs->z_assign);
+		error = dmu_tx_assign(tx,
+		    waited ? TXG_WAITED : zfsvfs->z_assign);
 		if (error) {
 			zfs_dirent_unlock(dl);
 			if (error == ERESTART &&
 			    zfsvfs->z_assign == TXG_NOWAIT) {
 				dmu_tx_wait(tx);
 				dmu_tx_abort(tx);
+				waited = B_TRUE;
 				goto top;
 			}
 			dmu_tx_abort(tx);
@@ -1331,12 +1357,13 @@ top:
 		 */
 		if ((ZTOV(zp)->v_type == VREG) &&
 		    (vap->va_mask & AT_SIZE) && (vap->va_size == 0)) {
-			error = zfs_freesp(zp, 0, 0, mode, TRUE);
+			error = zfs_freesp(zp, 0, 0, mode, TRUE, waited);
 			if (error == ERESTART &&
 			    zfsvfs->z_assign == TXG_NOWAIT) {
 				/* NB: we already did dmu_tx_wait() */
 				zfs_dirent_unlock(dl);
 				VN_RELE(ZTOV(zp));
+				waited = B_TRUE;
 				goto top;
 			}
 
@@ -1375,6 +1402,8 @@ out:
 	if (aclp)
 		zfs_acl_free(aclp);
 
+	zfs_sync_always(zfsvfs);
+
 	ZFS_EXIT(zfsvfs);
 	return (error);
 }
@@ -1408,6 +1437,7 @@ zfs_remove(vnode_t *dvp, char *name, cred_t *cr, caller_context_t *ct,
 	uint64_t	acl_obj, xattr_obj;
 	zfs_dirlock_t	*dl;
 	dmu_tx_t	*tx;
+	boolean_t	waited = B_FALSE;
 	boolean_t	may_delete_now, delete_now = FALSE;
 	boolean_t	unlinked;
 	uint64_t	txtype;
@@ -1489,13 +1519,14 @@ top:
 	/* charge as an update -- would be nice not to charge at all */
 	dmu_tx_hold_zap(tx, zfsvfs->z_unlinkedobj, FALSE, NULL);
 
-	error = dmu_tx_assign(tx, zfsvfs->z_assign);
+	error = dmu_tx_assign(tx, waited ? TXG_WAITED : zfsvfs->z_assign);
 	if (error) {
 		zfs_dirent_unlock(dl);
 		VN_RELE(vp);
 		if (error == ERESTART && zfsvfs->z_assign == TXG_NOWAIT) {
 			dmu_tx_wait(tx);
 			dmu_tx_abort(tx);
+			waited = B_TRUE;
 			goto top;
 		}
 		if (realnmp)
@@ -1567,6 +1598,8 @@ out:
 		VN_RELE(ZTOV(xzp));
 	}
 
+	zfs_sync_always(zfsvfs);
+
 	ZFS_EXIT(zfsvfs);
 	return (error);
 }
@@ -1602,6 +1635,7 @@ zfs_mkdir(vnode_t *dvp, char *dirname, vattr_t *vap, vnode_t **vpp, cred_t *cr,
 	zfs_dirlock_t	*dl;
 	uint64_t	txtype;
 	dmu_tx_t	*tx;
+	boolean_t	waited = B_FALSE;
 	int		error;
 	zfs_acl_t	*aclp = NULL;
 	zfs_fuid_info_t	*fuidp = NULL;
@@ -1691,12 +1725,13 @@ top:
 	if ((dzp->z_phys->zp_flags & ZFS_INHERIT_ACE) || aclp)
 		dmu_tx_hold_write(tx, DMU_NEW_OBJECT,
 		    0, SPA_MAXBLOCKSIZE);
-	error = dmu_tx_assign(tx, zfsvfs->z_assign);
+	error = dmu_tx_assign(tx, waited ? TXG_WAITED : zfsvfs->z_assign);
 	if (error) {
 		zfs_dirent_unlock(dl);
 		if (error == ERESTART && zfsvfs->z_assign == TXG_NOWAIT) {
 			dmu_tx_wait(tx);
 			dmu_tx_abort(tx);
+			waited = B_TRUE;
 			goto top;
 		}
 		dmu_tx_abort(tx);
@@ -1732,6 +1767,8 @@ top:
 
 	zfs_dirent_unlock(dl);
 
+	zfs_sync_always(zfsvfs);
+
 	ZFS_EXIT(zfsvfs);
 	return (0);
 }
@@ -1766,6 +1803,7 @@ zfs_rmdir(vnode_t *dvp, char *name, vnode_t *cwd, cred_t *cr,
 	zilog_t		*zilog;
 	zfs_dirlock_t	*dl;
 	dmu_tx_t	*tx;
+	boolean_t	waited = B_FALSE;
 	int		error;
 	int		zflg = ZEXISTS;
 
@@ -1821,7 +1859,7 @@ top:
 	dmu_tx_hold_zap(tx, dzp->z_id, FALSE, name);
 	dmu_tx_hold_bonus(tx, zp->z_id);
 	dmu_tx_hold_zap(tx, zfsvfs->z_unlinkedobj, FALSE, NULL);
-	error = dmu_tx_assign(tx, zfsvfs->z_assign);
+	error = dmu_tx_assign(tx, waited ? TXG_WAITED : zfsvfs->z_assign);
 	if (error) {
 		rw_exit(&zp->z_parent_lock);
 		rw_exit(&zp->z_name_lock);
@@ -1830,6 +1868,7 @@ top:
 		if (error == ERESTART && zfsvfs->z_assign == TXG_NOWAIT) {
 			dmu_tx_wait(tx);
 			dmu_tx_abort(tx);
+			waited = B_TRUE;
 			goto top;
 		}
 		dmu_tx_abort(tx);
@@ -1855,6 +1894,8 @@ out:
 
 	VN_RELE(vp);
 
+	zfs_sync_always(zfsvfs);
+
 	ZFS_EXIT(zfsvfs);
 	return (error);
 }
@@ -1906,6 +1947,7 @@ zfs_readdir(vnode_t *vp, uio_t *uio, cred_t *cr, int *eofp,
 	int		outcount;
 	int		error;
 	uint8_t		prefetch;
+	uint64_t	prefetch_blk;
 	boolean_t	check_sysattrs;
 
 	ZFS_ENTER(zfsvfs);
@@ -1938,6 +1980,7 @@ zfs_readdir(vnode_t *vp, uio_t *uio, cred_t *cr, int *eofp,
 	os = zfsvfs->z_os;
 	offset = uio->uio_loffset;
 	prefetch = zp->z_zn_prefetch;
+	prefetch_blk = -1ULL;
 
 	/*
 	 * Initialize the iterator cursor.
@@ -2085,9 +2128,17 @@ zfs_readdir(vnode_t *vp, uio_t *uio, cred_t *cr, int *eofp,
 
 		ASSERT(outcount <= bufsize);
 
-		/* Prefetch znode */
-		if (prefetch)
+		/*
+		 * Prefetch the znode, so that the lookups and getattrs that
+		 * usually follow a readdir find it cached.  Entries are
+		 * often allocated next to each other, so only ask once for
+		 * each block of dnodes.
+		 */
+		if (prefetch && offset > 2 &&
+		    (objnum >> DNODES_PER_BLOCK_SHIFT) != prefetch_blk) {
+			prefetch_blk = objnum >> DNODES_PER_BLOCK_SHIFT;
 			dmu_prefetch(os, objnum, 0, 0);
+		}
 
 		/*
 		 * Move to the next entry, fill in the previous offset.
@@ -2100,7 +2151,13 @@ zfs_readdir(vnode_t *vp, uio_t *uio, cred_t *cr, int *eofp,
 		}
 		*next = offset;
 	}
-	zp->z_zn_prefetch = B_FALSE; /* a lookup will re-enable pre-fetching */
+	/*
+	 * A lookup will re-enable pre-fetching.  Keep it on until the end
+	 * of the directory though, since a directory is normally read by
+	 * several calls.
+	 */
+	if (*eofp)
+		zp->z_zn_prefetch = B_FALSE;
 
 	if (uio->uio_segflg == UIO_SYSSPACE && uio->uio_iovcnt == 1) {
 		iovp->iov_base = ((char *) iovp->iov_base) + outcount;
@@ -2375,6 +2432,7 @@ zfs_setattr(vnode_t *vp, vattr_t *vap, int flags, cred_t *cr,
 	zfsvfs_t	*zfsvfs = zp->z_zfsvfs;
 	zilog_t		*zilog;
 	dmu_tx_t	*tx;
+	boolean_t	waited = B_FALSE;
 	vattr_t		oldva;
 	uint_t		mask = vap->va_mask;
 	uint_t		saved_mask;
@@ -2483,10 +2541,11 @@ top:
 		 * block if there are locks present... this
 		 * should be addressed in openat().
 		 */
-		do {
-			err = zfs_freesp(zp, vap->va_size, 0, 0, FALSE);
-			/* NB: we already did dmu_tx_wait() if necessary */
-		} while (err == ERESTART && zfsvfs->z_assign == TXG_NOWAIT);
+		while ((err = zfs_freesp(zp, vap->va_size, 0, 0, FALSE,
+		    waited)) == ERESTART && zfsvfs->z_assign == TXG_NOWAIT) {
+			/* NB: we already did dmu_tx_wait() */
+			waited = B_TRUE;
+		}
 		if (err) {
 			ZFS_EXIT(zfsvfs);
 			return (err);
@@ -2685,7 +2744,7 @@ top:
 		dmu_tx_hold_bonus(tx, attrzp->z_id);
 	}
 
-	err = dmu_tx_assign(tx, zfsvfs->z_assign);
+	err = dmu_tx_assign(tx, waited ? TXG_WAITED : zfsvfs->z_assign);
 	if (err) {
 		if (attrzp)
 			VN_RELE(ZTOV(attrzp));
@@ -2698,6 +2757,7 @@ top:
 		if (err == ERESTART && zfsvfs->z_assign == TXG_NOWAIT) {
 			dmu_tx_wait(tx);
 			dmu_tx_abort(tx);
+			waited = B_TRUE;
 			goto top;
 		}
 		dmu_tx_abort(tx);
@@ -2795,6 +2855,8 @@ top:
 
 	dmu_tx_commit(tx);
 
+	zfs_sync_always(zfsvfs);
+
 	ZFS_EXIT(zfsvfs);
 	return (err);
 }
@@ -2925,6 +2987,7 @@ zfs_rename(vnode_t *sdvp, char *snm, vnode_t *tdvp, char *tnm, cred_t *cr,
 	vnode_t		*realvp;
 	zfs_dirlock_t	*sdl, *tdl;
 	dmu_tx_t	*tx;
+	boolean_t	waited = B_FALSE;
 	zfs_zlock_t	*zl;
 	int		cmp, serr, terr;
 	int		error = 0;
@@ -3139,7 +3202,7 @@ top:
 	if (tzp)
 		dmu_tx_hold_bonus(tx, tzp->z_id);	/* parent changes */
 	dmu_tx_hold_zap(tx, zfsvfs->z_unlinkedobj, FALSE, NULL);
-	error = dmu_tx_assign(tx, zfsvfs->z_assign);
+	error = dmu_tx_assign(tx, waited ? TXG_WAITED : zfsvfs->z_assign);
 	if (error) {
 		if (zl != NULL)
 			zfs_rename_unlock(&zl);
@@ -3151,6 +3214,7 @@ top:
 		if (error == ERESTART && zfsvfs->z_assign == TXG_NOWAIT) {
 			dmu_tx_wait(tx);
 			dmu_tx_abort(tx);
+			waited = B_TRUE;
 			goto top;
 		}
 		dmu_tx_abort(tx);
@@ -3187,6 +3251,8 @@ out:
 	if (tzp)
 		VN_RELE(ZTOV(tzp));
 
+	zfs_sync_always(zfsvfs);
+
 	ZFS_EXIT(zfsvfs);
 	return (error);
 }
@@ -3216,6 +3282,7 @@ zfs_symlink(vnode_t *dvp, char *name, vattr_t *vap, char *link, cred_t *cr,
 	znode_t		*zp, *dzp = VTOZ(dvp);
 	zfs_dirlock_t	*dl;
 	dmu_tx_t	*tx;
+	boolean_t	waited = B_FALSE;
 	zfsvfs_t	*zfsvfs = dzp->z_zfsvfs;
 	zilog_t		*zilog;
 	int		len = strlen(link);
@@ -3274,12 +3341,13 @@ top:
 			    FUID_SIZE_ESTIMATE(zfsvfs));
 		}
 	}
-	error = dmu_tx_assign(tx, zfsvfs->z_assign);
+	error = dmu_tx_assign(tx, waited ? TXG_WAITED : zfsvfs->z_assign);
 	if (error) {
 		zfs_dirent_unlock(dl);
 		if (error == ERESTART && zfsvfs->z_assign == TXG_NOWAIT) {
 			dmu_tx_wait(tx);
 			dmu_tx_abort(tx);
+			waited = B_TRUE;
 			goto top;
 		}
 		dmu_tx_abort(tx);
@@ -3338,6 +3406,8 @@ top:
 
 	VN_RELE(ZTOV(zp));
 
+	zfs_sync_always(zfsvfs);
+
 	ZFS_EXIT(zfsvfs);
 	return (error);
 }
@@ -3419,6 +3489,7 @@ zfs_link(vnode_t *tdvp, vnode_t *svp, char *name, cred_t *cr,
 	zilog_t		*zilog;
 	zfs_dirlock_t	*dl;
 	dmu_tx_t	*tx;
+	boolean_t	waited = B_FALSE;
 	vnode_t		*realvp;
 	int		error;
 	int		zf = ZNEW;
@@ -3494,12 +3565,13 @@ top:
 	tx = dmu_tx_create(zfsvfs->z_os);
 	dmu_tx_hold_bonus(tx, szp->z_id);
 	dmu_tx_hold_zap(tx, dzp->z_id, TRUE, name);
-	error = dmu_tx_assign(tx, zfsvfs->z_assign);
+	error = dmu_tx_assign(tx, waited ? TXG_WAITED : zfsvfs->z_assign);
 	if (error) {
 		zfs_dirent_unlock(dl);
 		if (error == ERESTART && zfsvfs->z_assign == TXG_NOWAIT) {
 			dmu_tx_wait(tx);
 			dmu_tx_abort(tx);
+			waited = B_TRUE;
 			goto top;
 		}
 		dmu_tx_abort(tx);
@@ -3524,6 +3596,8 @@ top:
 		vnevent_link(svp, ct);
 	}
 
+	zfs_sync_always(zfsvfs);
+
 	ZFS_EXIT(zfsvfs);
 	return (error);
 }
@@ -3573,6 +3647,7 @@ zfs_putapage(vnode_t *vp, page_t *pp, u_offset_t *offp,
 	zfsvfs_t	*zfsvfs = zp->z_zfsvfs;
 	zilog_t		*zilog = zfsvfs->z_log;
 	dmu_tx_t	*tx;
+	boolean_t	waited = B_FALSE;
 	rl_t		*rl;
 	u_offset_t	off, koff;
 	size_t		len, klen;
@@ -3626,12 +3701,13 @@ top:
 	tx = dmu_tx_create(zfsvfs->z_os);
 	dmu_tx_hold_write(tx, zp->z_id, off, len);
 	dmu_tx_hold_bonus(tx, zp->z_id);
-	err = dmu_tx_assign(tx, zfsvfs->z_assign);
+	err = dmu_tx_assign(tx, waited ? TXG_WAITED : zfsvfs->z_assign);
 	if (err != 0) {
 		if (err == ERESTART && zfsvfs->z_assign == TXG_NOWAIT) {
 			zfs_range_unlock(rl);
 			dmu_tx_wait(tx);
 			dmu_tx_abort(tx);
+			waited = B_TRUE;
 			err = 0;
 			goto top;
 		}
@@ -4293,6 +4369,7 @@ zfs_space(vnode_t *vp, int cmd, flock64_t *bfp, int flag,
 	znode_t		*zp = VTOZ(vp);
 	zfsvfs_t	*zfsvfs = zp->z_zfsvfs;
 	uint64_t	off, len;
+	boolean_t	waited = B_FALSE;
 	int		error;
 
 	ZFS_ENTER(zfsvfs);
@@ -4316,10 +4393,13 @@ zfs_space(vnode_t *vp, int cmd, flock64_t *bfp, int flag,
 	off = bfp->l_start;
 	len = bfp->l_len; /* 0 means from off to end of file */
 
-	do {
-		error = zfs_freesp(zp, off, len, flag, TRUE);
-		/* NB: we already did dmu_tx_wait() if necessary */
-	} while (error == ERESTART && zfsvfs->z_assign == TXG_NOWAIT);
+	while ((error = zfs_freesp(zp, off, len, flag, TRUE, waited)) ==
+	    ERESTART && zfsvfs->z_assign == TXG_NOWAIT) {
+		/* NB: we already did dmu_tx_wait() */
+		waited = B_TRUE;
+	}
+
+	zfs_sync_always(zfsvfs);
 
 	ZFS_EXIT(zfsvfs);
 	return (error);
@@ -4473,6 +4553,8 @@ zfs_setsecattr(vnode_t *vp, vsecattr_t *vsecp, int flag, cred_t *cr,
 	ZFS_ENTER(zfsvfs);
 	ZFS_VERIFY_ZP(zp);
 	error = zfs_setacl(zp, vsecp, skipaclchk, cr);
+	zfs_sync_always(zfsvfs);
+
 	ZFS_EXIT(zfsvfs);
 	return (error);
 }
@@ -46,7 +46,26 @@
 #define LOCKDIR "/var/lock/zfs"
 #define LOCKFILE LOCKDIR "/zfs_lock"
 
-int cur_fd = -1;
+/*
+ * The client socket of the ioctl being processed by the calling thread,
+ * used by xcopyin(), xcopyout(), getf() and friends.
+ */
+__thread int cur_fd = -1;
+
+/*
+ * Client memory shipped along with the IOCTL_BULK_REQ being processed by
+ * the calling thread: the zfs_cmd_t and up to two nvlists.
+ */
+#define MAX_PRELOAD 3
+
+typedef struct preload {
+	uint64_t ptr;
+	uint64_t size;
+	char *buf;
+} preload_t;
+
+static __thread preload_t preload[MAX_PRELOAD];
+static __thread int npreload = 0;
 
 avl_tree_t fd_avl;
 pthread_mutex_t fd_avl_mtx = PTHREAD_MUTEX_INITIALIZER;
@@ -169,6 +188,71 @@ int zfsfuse_socket_read_loop(int fd, void *buf, int bytes)
 	return 0;
 }
 
+static int preload_read(int fd, uint64_t ptr, uint64_t size)
+{
+	ASSERT(npreload < MAX_PRELOAD);
+
+	char *buf = kmem_alloc(size, KM_SLEEP);
+
+	if(zfsfuse_socket_read_loop(fd, buf, size) != 0) {
+		kmem_free(buf, size);
+		return -1;
+	}
+
+	preload[npreload].ptr = ptr;
+	preload[npreload].size = size;
+	preload[npreload].buf = buf;
+	npreload++;
+
+	return 0;
+}
+
+/*
+ * Read the client memory that follows an IOCTL_BULK_REQ for the zfs_cmd_t
+ * at 'arg'. See ZFSFUSE_PRELOAD() in sys/zfs_ioctl.h.
+ * The caller must call zfsfuse_socket_free_preload() in any case.
+ */
+int zfsfuse_socket_read_preload(int fd, uint64_t arg)
+{
+	ASSERT(npreload == 0);
+
+	if(preload_read(fd, arg, sizeof(zfs_cmd_t)) != 0)
+		return -1;
+
+	zfs_cmd_t *zc = (zfs_cmd_t *) preload[0].buf;
+
+	if(ZFSFUSE_PRELOAD(zc->zc_nvlist_conf, zc->zc_nvlist_conf_size) &&
+	   preload_read(fd, zc->zc_nvlist_conf, zc->zc_nvlist_conf_size) != 0)
+		return -1;
+
+	if(ZFSFUSE_PRELOAD(zc->zc_nvlist_src, zc->zc_nvlist_src_size) &&
+	   preload_read(fd, zc->zc_nvlist_src, zc->zc_nvlist_src_size) != 0)
+		return -1;
+
+	return 0;
+}
+
+void zfsfuse_socket_free_preload()
+{
+	for(int i = 0; i < npreload; i++)
+		kmem_free(preload[i].buf, preload[i].size);
+	npreload = 0;
+}
+
+/*
+ * Returns our copy of the client range [ptr, ptr + size) if it was
+ * shipped with the request, NULL otherwise
+ */
+static char *preload_find(uint64_t ptr, size_t size)
+{
+	for(int i = 0; i < npreload; i++) {
+		preload_t *p = &preload[i];
+		if(ptr >= p->ptr && size <= p->size && ptr - p->ptr <= p->size - size)
+			return p->buf + (ptr - p->ptr);
+	}
+	return NULL;
+}
+
 int zfsfuse_socket_ioctl_write(int fd, int ret)
 {
 #ifdef DEBUG
@@ -199,6 +283,12 @@ int xcopyin(const void *src, void *dest, size_t size)
 	/* This should catch stray xcopyin()s in the code.. */
 	VERIFY(cur_fd >= 0);
 
+	char *buf = preload_find((uint64_t)(uintptr_t) src, size);
+	if(buf != NULL) {
+		memcpy(dest, buf, size);
+		return 0;
+	}
+
 	cmd.cmd_type = COPYIN_REQ;
 	cmd.cmd_u.copy_req.ptr = (uint64_t)(uintptr_t) src;
 	cmd.cmd_u.copy_req.size = size;
@@ -267,6 +357,11 @@ int xcopyout(const void *src, void *dest, size_t size)
 	/* This should catch stray xcopyout()s in the code.. */
 	VERIFY(cur_fd >= 0);
 
+	/* Keep our copy in sync, in case it is copied in again */
+	char *buf = preload_find((uint64_t)(uintptr_t) dest, size);
+	if(buf != NULL)
+		memcpy(buf, src, size);
+
 	cmd.cmd_type = COPYOUT_REQ;
 	cmd.cmd_u.copy_req.ptr = (uint64_t)(uintptr_t) dest;
 	cmd.cmd_u.copy_req.size = size;
@@ -30,7 +30,7 @@
 #include <sys/zfs_ioctl.h>
 #include <sys/types.h>
 
-extern int cur_fd;
+extern __thread int cur_fd;
 
 extern int zfsfuse_socket_create();
 extern void zfsfuse_socket_close(int fd);
@@ -38,4 +38,7 @@ extern void zfsfuse_socket_close(int fd);
 extern int zfsfuse_socket_read_loop(int fd, void *buf, int bytes);
 extern int zfsfuse_socket_ioctl_write(int fd, int ret);
 
+extern int zfsfuse_socket_read_preload(int fd, uint64_t arg);
+extern void zfsfuse_socket_free_preload();
+
 #endif
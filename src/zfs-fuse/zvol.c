@@ -37,6 +37,9 @@
  * These links are created by the ZFS-specific devfsadm link generator.
  * Volumes are persistent through reboot.  No user command needs to be
  * run before opening and using a device.
+ *
+ * ZFSFUSE: there are no device nodes.  Volumes are exported by the NBD
+ * server in nbd_listener.c instead, under their dataset names.
  */
 
 #include <sys/types.h>
@@ -54,6 +57,7 @@
 #include <sys/spa.h>
 #include <sys/zio.h>
 #include <sys/dmu_traverse.h>
+#include <sys/dmu_objset.h>
 #include <sys/dnode.h>
 #include <sys/dsl_dataset.h>
 #include <sys/dsl_prop.h>
@@ -84,6 +88,7 @@
 static void *zvol_state;
 
 #define	ZVOL_DUMPSIZE		"dumpsize"
+#endif
 
 /*
  * This lock protects the zvol_state structure from being modified
@@ -94,6 +99,14 @@ static void *zvol_state;
 static kmutex_t zvol_state_lock;
 static uint32_t zvol_minors;
 
+/*
+ * ZFSFUSE: there are no minor nodes.  A volume is opened when the first
+ * client of the NBD server (nbd_listener.c) asks for it by name, and its
+ * state is kept on this list until the last client goes away.
+ */
+static zvol_state_t *zvol_list;
+
+#if 0
 #define	NUM_EXTENTS	((SPA_MAXBLOCKSIZE) / sizeof (zvol_extent_t))
 
 typedef struct zvol_extent {
@@ -109,26 +122,25 @@ typedef struct zvol_ext_list {
 	zvol_extent_t		zl_extents[NUM_EXTENTS];
 	struct zvol_ext_list	*zl_next;
 } zvol_ext_list_t;
+#endif
 
 /*
  * The in-core state of each volume.
  */
-typedef struct zvol_state {
+struct zvol_state {
 	char		zv_name[MAXPATHLEN]; /* pool/dd name */
 	uint64_t	zv_volsize;	/* amount of space we advertise */
 	uint64_t	zv_volblocksize; /* volume block size */
-	minor_t		zv_minor;	/* minor number */
 	uint8_t		zv_min_bs;	/* minimum addressable block shift */
 	uint8_t		zv_flags;	/* readonly; dumpified */
 	objset_t	*zv_objset;	/* objset handle */
 	uint32_t	zv_mode;	/* DS_MODE_* flags at open time */
-	uint32_t	zv_open_count[OTYPCNT];	/* open counts */
 	uint32_t	zv_total_opens;	/* total open count */
 	zilog_t		*zv_zilog;	/* ZIL handle */
-	zvol_ext_list_t	*zv_list;	/* List of extents for dump */
 	uint64_t	zv_txg_assign;	/* txg to assign during ZIL replay */
 	znode_t		zv_znode;	/* for range locking */
-} zvol_state_t;
+	zvol_state_t	*zv_next;	/* next on zvol_list */
+};
 
 /*
  * zvol specific flags
@@ -141,8 +153,9 @@ typedef struct zvol_state {
  */
 int zvol_maxphys = DMU_MAX_ACCESS/2;
 
-extern int zfs_set_prop_nvlist(const char *, nvlist_t *);
 static int zvol_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio);
+#if 0
+extern int zfs_set_prop_nvlist(const char *, nvlist_t *);
 static int zvol_dumpify(zvol_state_t *zv);
 static int zvol_dump_fini(zvol_state_t *zv);
 static int zvol_dump_init(zvol_state_t *zv, boolean_t resize);
@@ -161,6 +174,7 @@ zvol_size_changed(zvol_state_t *zv, major_t maj)
 	spec_size_invalidate(dev, VBLK);
 	spec_size_invalidate(dev, VCHR);
 }
+#endif
 
 int
 zvol_check_volsize(uint64_t volsize, uint64_t blocksize)
@@ -171,9 +185,12 @@ zvol_check_volsize(uint64_t volsize, uint64_t blocksize)
 	if (volsize % blocksize != 0)
 		return (EINVAL);
 
+	/* ZFSFUSE: offsets are 64-bit on 32-bit platforms too */
+#if 0
 #ifdef _ILP32
 	if (volsize - 1 > SPEC_MAXOFFSET_T)
 		return (EOVERFLOW);
+#endif
 #endif
 	return (0);
 }
@@ -199,7 +216,6 @@ zvol_readonly_changed_cb(void *arg, uint64_t newval)
 	else
 		zv->zv_flags &= ~ZVOL_RDONLY;
 }
-#endif
 
 int
 zvol_get_stats(objset_t *os, nvlist_t *nv)
@@ -243,25 +259,23 @@ zvol_minor_alloc(void)
 	return (0);
 }
 
+#endif
+
 static zvol_state_t *
 zvol_minor_lookup(const char *name)
 {
-	minor_t minor;
 	zvol_state_t *zv;
 
 	ASSERT(MUTEX_HELD(&zvol_state_lock));
 
-	for (minor = 1; minor <= ZVOL_MAX_MINOR; minor++) {
-		zv = ddi_get_soft_state(zvol_state, minor);
-		if (zv == NULL)
-			continue;
+	for (zv = zvol_list; zv != NULL; zv = zv->zv_next)
 		if (strcmp(zv->zv_name, name) == 0)
 			break;
-	}
 
 	return (zv);
 }
 
+#if 0
 void
 zvol_init_extent(zvol_extent_t *ze, blkptr_t *bp)
 {
@@ -386,6 +400,7 @@ zvol_map_block(traverse_blk_cache_t *bc, spa_t *spa, void *arg)
 	zvol_init_extent(ma->ma_extent, bp);
 	return (0);
 }
+#endif
 
 /* ARGSUSED */
 void
@@ -453,6 +468,34 @@ zvol_replay_write(zvol_state_t *zv, lr_write_t *lr, boolean_t byteswap)
 	return (error);
 }
 
+/*
+ * Replay a TX_TRUNCATE ZIL transaction, logged when a range of the volume
+ * was discarded.
+ */
+static int
+zvol_replay_truncate(zvol_state_t *zv, lr_truncate_t *lr, boolean_t byteswap)
+{
+	objset_t *os = zv->zv_objset;
+	dmu_tx_t *tx;
+	int error;
+
+	if (byteswap)
+		byteswap_uint64_array(lr, sizeof (*lr));
+
+	tx = dmu_tx_create(os);
+	dmu_tx_hold_free(tx, ZVOL_OBJ, lr->lr_offset, lr->lr_length);
+	error = dmu_tx_assign(tx, zv->zv_txg_assign);
+	if (error) {
+		dmu_tx_abort(tx);
+	} else {
+		error = dmu_free_range(os, ZVOL_OBJ, lr->lr_offset,
+		    lr->lr_length, tx);
+		dmu_tx_commit(tx);
+	}
+
+	return (error);
+}
+
 /* ARGSUSED */
 static int
 zvol_replay_err(zvol_state_t *zv, lr_t *lr, boolean_t byteswap)
@@ -462,7 +505,7 @@ zvol_replay_err(zvol_state_t *zv, lr_t *lr, boolean_t byteswap)
 
 /*
  * Callback vectors for replaying records.
- * Only TX_WRITE is needed for zvol.
+ * Only TX_WRITE and TX_TRUNCATE are needed for zvol.
  */
 zil_replay_func_t *zvol_replay_vector[TX_MAX_TYPE] = {
 	zvol_replay_err,	/* 0 no such transaction type */
@@ -475,11 +518,12 @@ zil_replay_func_t *zvol_replay_vector[TX_MAX_TYPE] = {
 	zvol_replay_err,	/* TX_LINK */
 	zvol_replay_err,	/* TX_RENAME */
 	zvol_replay_write,	/* TX_WRITE */
-	zvol_replay_err,	/* TX_TRUNCATE */
+	zvol_replay_truncate,	/* TX_TRUNCATE */
 	zvol_replay_err,	/* TX_SETATTR */
 	zvol_replay_err,	/* TX_ACL */
 };
 
+#if 0
 /*
  * reconstruct dva that gets us to the desired offset (offset
  * is in bytes)
@@ -776,6 +820,125 @@ zvol_remove_minor(const char *name)
 
 	return (0);
 }
+#endif
+
+/*
+ * ZFSFUSE: take a hold on the specified volume, opening it if this is the
+ * first one.  This does for the NBD server what zvol_create_minor() and
+ * zvol_open() did for the device nodes.
+ */
+int
+zvol_hold(const char *name, zvol_state_t **zvp)
+{
+	zvol_state_t *zv;
+	objset_t *os;
+	dmu_object_info_t doi;
+	uint64_t volsize;
+	int ds_mode = DS_MODE_PRIMARY;
+	int error;
+
+	mutex_enter(&zvol_state_lock);
+
+	if ((zv = zvol_minor_lookup(name)) != NULL) {
+		zv->zv_total_opens++;
+		mutex_exit(&zvol_state_lock);
+		*zvp = zv;
+		return (0);
+	}
+
+	if (dataset_namecheck(name, NULL, NULL) != 0) {
+		mutex_exit(&zvol_state_lock);
+		return (EINVAL);
+	}
+
+	if (strchr(name, '@') != 0)
+		ds_mode |= DS_MODE_READONLY;
+
+	error = dmu_objset_open(name, DMU_OST_ZVOL, ds_mode, &os);
+
+	if (error) {
+		mutex_exit(&zvol_state_lock);
+		return (error);
+	}
+
+	error = zap_lookup(os, ZVOL_ZAP_OBJ, "size", 8, 1, &volsize);
+
+	if (error) {
+		dmu_objset_close(os);
+		mutex_exit(&zvol_state_lock);
+		return (error);
+	}
+
+	zv = kmem_zalloc(sizeof (zvol_state_t), KM_SLEEP);
+
+	(void) strcpy(zv->zv_name, name);
+	zv->zv_min_bs = DEV_BSHIFT;
+	zv->zv_volsize = volsize;
+	zv->zv_objset = os;
+	zv->zv_mode = ds_mode;
+	zv->zv_zilog = zil_open(os, zvol_get_data);
+	mutex_init(&zv->zv_znode.z_range_lock, NULL, MUTEX_DEFAULT, NULL);
+	avl_create(&zv->zv_znode.z_range_avl, zfs_range_compare,
+	    sizeof (rl_t), offsetof(rl_t, r_node));
+	/* get and cache the blocksize */
+	error = dmu_object_info(os, ZVOL_OBJ, &doi);
+	ASSERT(error == 0);
+	zv->zv_volblocksize = doi.doi_data_block_size;
+
+	zil_replay(os, zv, &zv->zv_txg_assign, zvol_replay_vector);
+
+	/* XXX this should handle the possible i/o error */
+	VERIFY(dsl_prop_register(dmu_objset_ds(zv->zv_objset),
+	    "readonly", zvol_readonly_changed_cb, zv) == 0);
+
+	zv->zv_total_opens = 1;
+	zv->zv_next = zvol_list;
+	zvol_list = zv;
+	zvol_minors++;
+
+	mutex_exit(&zvol_state_lock);
+
+	*zvp = zv;
+	return (0);
+}
+
+/*
+ * ZFSFUSE: release a hold taken by zvol_hold(), closing the volume when
+ * the last one goes away.
+ */
+void
+zvol_rele(zvol_state_t *zv)
+{
+	zvol_state_t **zvpp;
+
+	mutex_enter(&zvol_state_lock);
+
+	ASSERT(zv->zv_total_opens != 0);
+	if (--zv->zv_total_opens != 0) {
+		mutex_exit(&zvol_state_lock);
+		return;
+	}
+
+	for (zvpp = &zvol_list; *zvpp != zv; zvpp = &(*zvpp)->zv_next)
+		ASSERT(*zvpp != NULL);
+	*zvpp = zv->zv_next;
+
+	VERIFY(dsl_prop_unregister(dmu_objset_ds(zv->zv_objset),
+	    "readonly", zvol_readonly_changed_cb, zv) == 0);
+
+	zil_close(zv->zv_zilog);
+	zv->zv_zilog = NULL;
+	dmu_objset_close(zv->zv_objset);
+	zv->zv_objset = NULL;
+	avl_destroy(&zv->zv_znode.z_range_avl);
+	mutex_destroy(&zv->zv_znode.z_range_lock);
+
+	kmem_free(zv, sizeof (zvol_state_t));
+
+	zvol_minors--;
+
+	mutex_exit(&zvol_state_lock);
+}
 
 static int
 zvol_truncate(zvol_state_t *zv, uint64_t offset, uint64_t size)
@@ -795,6 +958,7 @@ zvol_truncate(zvol_state_t *zv, uint64_t offset, uint64_t size)
 	return (0);
 }
 
+#if 0
 int
 zvol_prealloc(zvol_state_t *zv)
 {
@@ -839,7 +1003,9 @@ zvol_prealloc(zvol_state_t *zv)
 
 	return (0);
 }
+#endif
 
+/* ARGSUSED */
 int
 zvol_update_volsize(zvol_state_t *zv, major_t maj, uint64_t volsize)
 {
@@ -866,7 +1032,9 @@ zvol_update_volsize(zvol_state_t *zv, major_t maj, uint64_t volsize)
 
 	if (error == 0) {
 		zv->zv_volsize = volsize;
+#if 0
 		zvol_size_changed(zv, maj);
+#endif
 	}
 	return (error);
 }
@@ -877,48 +1045,37 @@ zvol_set_volsize(const char *name, major_t maj, uint64_t volsize)
 	zvol_state_t *zv;
 	int error;
 	dmu_object_info_t doi;
-	uint64_t old_volsize = 0ULL;
 
-	mutex_enter(&zvol_state_lock);
+	/* ZFSFUSE: the volume doesn't have to be in use */
+	if ((error = zvol_hold(name, &zv)) != 0)
+		return (error);
 
-	if ((zv = zvol_minor_lookup(name)) == NULL) {
-		mutex_exit(&zvol_state_lock);
-		return (ENXIO);
-	}
-	old_volsize = zv->zv_volsize;
+	mutex_enter(&zvol_state_lock);
 
 	if ((error = dmu_object_info(zv->zv_objset, ZVOL_OBJ, &doi)) != 0 ||
 	    (error = zvol_check_volsize(volsize,
 	    doi.doi_data_block_size)) != 0) {
 		mutex_exit(&zvol_state_lock);
+		zvol_rele(zv);
 		return (error);
 	}
 
 	if (zv->zv_flags & ZVOL_RDONLY || (zv->zv_mode & DS_MODE_READONLY)) {
 		mutex_exit(&zvol_state_lock);
+		zvol_rele(zv);
 		return (EROFS);
 	}
 
 	error = zvol_update_volsize(zv, maj, volsize);
 
-	/*
-	 * Reinitialize the dump area to the new size. If we
-	 * failed to resize the dump area then restore the it back to
-	 * it's original size.
-	 */
-	if (error == 0 && zv->zv_flags & ZVOL_DUMPIFIED) {
-		if ((error = zvol_dumpify(zv)) != 0 ||
-		    (error = dumpvp_resize()) != 0) {
-			(void) zvol_update_volsize(zv, maj, old_volsize);
-			error = zvol_dumpify(zv);
-		}
-	}
-
 	mutex_exit(&zvol_state_lock);
 
+	zvol_rele(zv);
+
 	return (error);
 }
 
+#if 0
 int
 zvol_set_volblocksize(const char *name, uint64_t volblocksize)
 {
@@ -1035,6 +1192,7 @@ zvol_close(dev_t dev, int flag, int otyp, cred_t *cr)
 
 	return (0);
 }
+#endif
 
 static void
 zvol_get_done(dmu_buf_t *db, void *vzgd)
@@ -1129,6 +1287,9 @@ zvol_log_write(zvol_state_t *zv, dmu_tx_t *tx, offset_t off, ssize_t len)
 
 		itx->itx_wr_state =
 		    len > zvol_immediate_write_sz ?  WR_INDIRECT : WR_NEED_COPY;
+		if (itx->itx_wr_state == WR_NEED_COPY)
+			itx->itx_sod += nbytes;
+		itx->itx_sync = B_FALSE;
 		itx->itx_private = zv;
 		lr = (lr_write_t *)&itx->itx_lr;
 		lr->lr_foid = ZVOL_OBJ;
@@ -1143,6 +1304,27 @@ zvol_log_write(zvol_state_t *zv, dmu_tx_t *tx, offset_t off, ssize_t len)
 	}
 }
 
+/*
+ * ZFSFUSE: zvol_log_truncate() logs a discarded range as a TX_TRUNCATE
+ * transaction.
+ */
+static void
+zvol_log_truncate(zvol_state_t *zv, dmu_tx_t *tx, uint64_t off, uint64_t len)
+{
+	itx_t *itx;
+	lr_truncate_t *lr;
+
+	itx = zil_itx_create(TX_TRUNCATE, sizeof (*lr));
+	lr = (lr_truncate_t *)&itx->itx_lr;
+	lr->lr_foid = ZVOL_OBJ;
+	lr->lr_offset = off;
+	lr->lr_length = len;
+
+	itx->itx_sync = B_FALSE;
+	(void) zil_itx_assign(zv->zv_zilog, itx, tx);
+}
+
+#if 0
 int
 zvol_dumpio(vdev_t *vd, uint64_t size, uint64_t offset, void *addr,
     int bflags, int isdump)
@@ -1299,7 +1481,9 @@ zvol_strategy(buf_t *bp)
 	if ((bp->b_resid = resid) == bp->b_bcount)
 		bioerror(bp, off > volsize ? EINVAL : error);
 
-	if (!(bp->b_flags & B_ASYNC) && !reading && !zil_disable && !is_dump)
+	if ((!(bp->b_flags & B_ASYNC) ||
+	    zv->zv_objset->os->os_sync == ZFS_SYNC_ALWAYS) &&
+	    !reading && !zil_disable && !is_dump)
 		zil_commit(zv->zv_zilog, UINT64_MAX, ZVOL_OBJ);
 	biodone(bp);
 
@@ -1435,7 +1619,156 @@ zvol_write(dev_t dev, uio_t *uio, cred_t *cr)
 	zfs_range_unlock(rl);
 	return (error);
 }
+#endif
+
+/*
+ * ZFSFUSE: the NBD server reads and writes volumes with these instead of
+ * zvol_read(), zvol_write() and zvol_strategy().
+ */
+static int
+zvol_check_range(zvol_state_t *zv, uint64_t off, uint64_t len)
+{
+	if (off > zv->zv_volsize || len > zv->zv_volsize - off)
+		return (EINVAL);
+
+	return (0);
+}
+
+int
+zvol_read_buf(zvol_state_t *zv, uint64_t off, uint64_t len, void *buf)
+{
+	rl_t *rl;
+	int error;
+
+	if ((error = zvol_check_range(zv, off, len)) != 0)
+		return (error);
+
+	rl = zfs_range_lock(&zv->zv_znode, off, len, RL_READER);
+	while (len > 0) {
+		uint64_t bytes = MIN(len, zvol_maxphys);
+
+		error = dmu_read(zv->zv_objset, ZVOL_OBJ, off, bytes, buf);
+		if (error)
+			break;
+		off += bytes;
+		len -= bytes;
+		buf = (char *)buf + bytes;
+	}
+	zfs_range_unlock(rl);
+	return (error);
+}
 
+/*
+ * Write len bytes from buf at off.  If sync is set, or the dataset's sync
+ * property is "always", the data is on stable storage when this returns.
+ */
+int
+zvol_write_buf(zvol_state_t *zv, uint64_t off, uint64_t len, const void *buf,
+    boolean_t sync)
+{
+	objset_t *os = zv->zv_objset;
+	rl_t *rl;
+	int error;
+
+	if (zv->zv_flags & ZVOL_RDONLY || (zv->zv_mode & DS_MODE_READONLY))
+		return (EROFS);
+
+	if ((error = zvol_check_range(zv, off, len)) != 0)
+		return (error);
+
+	rl = zfs_range_lock(&zv->zv_znode, off, len, RL_WRITER);
+	while (len > 0) {
+		uint64_t bytes = MIN(len, zvol_maxphys);
+
+		dmu_tx_t *tx = dmu_tx_create(os);
+		dmu_tx_hold_write(tx, ZVOL_OBJ, off, bytes);
+		error = dmu_tx_assign(tx, TXG_WAIT);
+		if (error) {
+			dmu_tx_abort(tx);
+			break;
+		}
+		dmu_write(os, ZVOL_OBJ, off, bytes, buf, tx);
+		zvol_log_write(zv, tx, off, bytes);
+		dmu_tx_commit(tx);
+
+		off += bytes;
+		len -= bytes;
+		buf = (const char *)buf + bytes;
+	}
+	zfs_range_unlock(rl);
+
+	if (error == 0 && (sync || os->os->os_sync == ZFS_SYNC_ALWAYS))
+		zil_commit(zv->zv_zilog, UINT64_MAX, ZVOL_OBJ);
+
+	return (error);
+}
+
+/*
+ * Discard len bytes at off.  The range reads back as zeroes afterwards.
+ */
+int
+zvol_free_buf(zvol_state_t *zv, uint64_t off, uint64_t len, boolean_t sync)
+{
+	objset_t *os = zv->zv_objset;
+	dmu_tx_t *tx;
+	rl_t *rl;
+	int error;
+
+	if (zv->zv_flags & ZVOL_RDONLY || (zv->zv_mode & DS_MODE_READONLY))
+		return (EROFS);
+
+	if ((error = zvol_check_range(zv, off, len)) != 0 || len == 0)
+		return (error);
+
+	rl = zfs_range_lock(&zv->zv_znode, off, len, RL_WRITER);
+	tx = dmu_tx_create(os);
+	dmu_tx_hold_free(tx, ZVOL_OBJ, off, len);
+	error = dmu_tx_assign(tx, TXG_WAIT);
+	if (error) {
+		dmu_tx_abort(tx);
+	} else {
+		error = dmu_free_range(os, ZVOL_OBJ, off, len, tx);
+		if (error == 0)
+			zvol_log_truncate(zv, tx, off, len);
+		dmu_tx_commit(tx);
+	}
+	zfs_range_unlock(rl);
+
+	if (error == 0 && (sync || os->os->os_sync == ZFS_SYNC_ALWAYS))
+		zil_commit(zv->zv_zilog, UINT64_MAX, ZVOL_OBJ);
+
+	return (error);
+}
+
+/*
+ * Make everything written to the volume so far stable.
+ */
+void
+zvol_flush(zvol_state_t *zv)
+{
+	zil_commit(zv->zv_zilog, UINT64_MAX, ZVOL_OBJ);
+}
+
+uint64_t
+zvol_get_volsize(zvol_state_t *zv)
+{
+	return (zv->zv_volsize);
+}
+
+uint64_t
+zvol_get_volblocksize(zvol_state_t *zv)
+{
+	return (zv->zv_volblocksize);
+}
+
+boolean_t
+zvol_is_readonly(zvol_state_t *zv)
+{
+	return ((zv->zv_flags & ZVOL_RDONLY) ||
+	    (zv->zv_mode & DS_MODE_READONLY));
+}
+
+#if 0
 /*
  * Dirtbag ioctls to support mkfs(1M) for UFS filesystems.  See dkio(7I).
  */
@@ -1598,6 +1931,7 @@ zvol_ioctl(dev_t dev, int cmd, intptr_t arg, int flag, cred_t *cr, int *rvalp)
 	mutex_exit(&zvol_state_lock);
 	return (error);
 }
+#endif
 
 int
 zvol_busy(void)
@@ -1608,7 +1942,9 @@ zvol_busy(void)
 void
 zvol_init(void)
 {
+#if 0
 	VERIFY(ddi_soft_state_init(&zvol_state, sizeof (zvol_state_t), 1) == 0);
+#endif
 	mutex_init(&zvol_state_lock, NULL, MUTEX_DEFAULT, NULL);
 }
 
@@ -1616,9 +1952,12 @@ void
 zvol_fini(void)
 {
 	mutex_destroy(&zvol_state_lock);
+#if 0
 	ddi_soft_state_fini(&zvol_state);
+#endif
 }
 
+#if 0
 static boolean_t
 zvol_is_swap(zvol_state_t *zv)
 {